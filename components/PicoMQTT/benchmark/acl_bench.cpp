@@ -0,0 +1,202 @@
+/*
+ * Host benchmark of the per-publish ACL check with 100 rules: a straightforward implementation, which substitutes
+ * %c/%u and matches each rule in order on every message, vs. Acl::Policy, which is compiled once per client.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../src -o acl_bench acl_bench.cpp ../src/PicoMQTT/acl.cpp ../src/PicoMQTT/topic_matcher.cpp
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "PicoMQTT/acl.h"
+
+namespace {
+
+// Copy of Subscriber::topic_matches(), which can't be included here without the Arduino core.
+bool topic_matches(const char * p, const char * t) {
+    while (true) {
+        switch (*p) {
+            case '\0':
+                return (*t == '\0');
+            case '#':
+                if (*t == '\0') {
+                    return false;
+                }
+                return true;
+            case '+':
+                while (*t && *t != '/') {
+                    ++t;
+                }
+                ++p;
+                break;
+            default:
+                if (*p != *t) {
+                    return false;
+                }
+                ++p;
+                ++t;
+        }
+    }
+}
+
+struct Rule {
+    bool allow;
+    const char * username;
+    std::string topic_filter;
+};
+
+const char * const CLIENT_ID = "sensor7";
+const char * const USERNAME = "user3";
+
+const char * const METRICS[] = {
+    "socofpack", "voltageofpack", "currentofpack", "cellvmax", "cellvmin",
+    "celltmax", "celltmin", "bmschstate", "bmsdschstate", "power",
+};
+
+std::vector<Rule> make_rules() {
+    std::vector<Rule> rules;
+    rules.push_back({false, nullptr, "$SYS/#"});
+    rules.push_back({true, nullptr, "devices/%c/#"});
+    rules.push_back({true, nullptr, "users/%u/%c/status"});
+    for (unsigned int i = 0; rules.size() < 100; ++i) {
+        const std::string device = std::to_string(i % 40);
+        const std::string metric = METRICS[i % 10];
+        switch (i % 5) {
+            case 0:
+                rules.push_back({false, nullptr, "emkit/" + device + "/pack/" + metric});
+                break;
+            case 1:
+                rules.push_back({true, nullptr, "emkit/" + device + "/+/" + metric});
+                break;
+            case 2:
+                rules.push_back({true, "user3", "emkit/" + device + "/#"});
+                break;
+            case 3:
+                rules.push_back({i % 2 == 0, nullptr, "emkit/+/" + device + "/" + metric});
+                break;
+            default:
+                rules.push_back({true, nullptr, "%u/" + device + "/" + metric});
+                break;
+        }
+    }
+    return rules;
+}
+
+std::string make_topic(unsigned int i) {
+    switch (i % 4) {
+        case 0:
+            return "emkit/" + std::to_string(i % 50) + "/pack/" + METRICS[(i / 7) % 10];
+        case 1:
+            return "devices/sensor" + std::to_string(i % 10) + "/temperature";
+        case 2:
+            return std::string("user3/") + std::to_string(i % 45) + "/" + METRICS[(i / 3) % 10];
+        default:
+            return "emkit/" + std::to_string(i % 60) + "/" + std::to_string(i % 40) + "/" + METRICS[i % 10];
+    }
+}
+
+std::string substitute(const std::string & topic_filter) {
+    std::string ret;
+    for (size_t i = 0; i < topic_filter.size(); ++i) {
+        if (topic_filter[i] == '%' && i + 1 < topic_filter.size() && topic_filter[i + 1] == 'c') {
+            ret += CLIENT_ID;
+            ++i;
+        } else if (topic_filter[i] == '%' && i + 1 < topic_filter.size() && topic_filter[i + 1] == 'u') {
+            ret += USERNAME;
+            ++i;
+        } else {
+            ret += topic_filter[i];
+        }
+    }
+    return ret;
+}
+
+bool naive_can_publish(const std::vector<Rule> & rules, const char * topic) {
+    for (const auto & rule : rules) {
+        if (rule.username && strcmp(rule.username, USERNAME)) {
+            continue;
+        }
+        if (topic_matches(substitute(rule.topic_filter).c_str(), topic)) {
+            return rule.allow;
+        }
+    }
+    return false;
+}
+
+template <typename Function>
+double measure(unsigned int iterations, Function function) {
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; ++i) {
+        function(i);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const unsigned int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    const std::vector<Rule> rules = make_rules();
+    PicoMQTT::Acl acl;
+    for (const auto & rule : rules) {
+        if (rule.allow) {
+            acl.allow(PicoMQTT::Acl::PUBLISH_AND_SUBSCRIBE, rule.topic_filter.c_str(), rule.username);
+        } else {
+            acl.deny(PicoMQTT::Acl::PUBLISH_AND_SUBSCRIBE, rule.topic_filter.c_str(), rule.username);
+        }
+    }
+
+    const auto compile_start = std::chrono::steady_clock::now();
+    const PicoMQTT::Acl::Policy policy(acl, CLIENT_ID, USERNAME);
+    const double compile_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()
+                              - compile_start).count();
+
+    std::vector<std::string> topics;
+    for (unsigned int i = 0; i < 1024; ++i) {
+        topics.push_back(make_topic(i));
+    }
+
+    // verify both implementations agree
+    size_t allowed = 0;
+    for (const auto & topic : topics) {
+        const bool expected = naive_can_publish(rules, topic.c_str());
+        if (expected != policy.can_publish(topic.c_str())) {
+            fprintf(stderr, "Mismatch: topic '%s'\n", topic.c_str());
+            return 1;
+        }
+        allowed += expected;
+    }
+
+    volatile size_t sink = 0;
+
+    const double tokenize = measure(iterations, [&](unsigned int i) {
+        PicoMQTT::TopicTokens tokens(topics[i % topics.size()].c_str());
+        sink = sink + tokens.get_level_count();
+    });
+
+    const double naive = measure(iterations, [&](unsigned int i) {
+        sink = sink + naive_can_publish(rules, topics[i % topics.size()].c_str());
+    });
+
+    const double compiled = measure(iterations, [&](unsigned int i) {
+        PicoMQTT::TopicTokens tokens(topics[i % topics.size()].c_str());
+        sink = sink + policy.can_publish(tokens);
+    });
+
+    printf("rules:                   %u\n", (unsigned int) rules.size());
+    printf("allowed topics:          %u / %u\n", (unsigned int) allowed, (unsigned int) topics.size());
+    printf("policy compile time:     %.1f us, %u bytes\n", compile_us, (unsigned int) policy.get_memory_usage());
+    printf("tokenize only:           %.1f ns/publish\n", tokenize);
+    printf("substitute and match:    %.1f ns/publish\n", naive);
+    printf("compiled policy:         %.1f ns/publish (including tokenizing), %.1fx faster\n", compiled,
+           naive / compiled);
+
+    return 0;
+}
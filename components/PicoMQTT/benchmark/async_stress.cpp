@@ -0,0 +1,136 @@
+/*
+ * Host stress test of AsyncQueue, the lock-free queue behind Server::publish_async().
+ *
+ * Several producer threads push numbered messages of varying size while a consumer thread drains the queue, like
+ * the broker loop does.  The consumer checks that every message arrives intact and that messages of each producer
+ * arrive in order, and that the number of messages received plus the number of drops equals the number sent.
+ * Messages are 17 to 147 bytes long including the record overhead, so with a queue of 256 bytes or less some are
+ * dropped as too big.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -pthread -I../src -o async_stress async_stress.cpp ../src/PicoMQTT/async_queue.cpp
+ *
+ * Usage:
+ *   ./async_stress [producers] [messages per producer] [queue size] [retry|drop]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PicoMQTT/async_queue.h"
+
+namespace {
+
+// payload: producer, sequence number and a fill pattern depending on both
+size_t make_payload(unsigned int producer, unsigned int sequence, char * buffer) {
+    const size_t size = 8 + (sequence * 7 + producer * 13) % 120;
+    memcpy(buffer, &producer, 4);
+    memcpy(buffer + 4, &sequence, 4);
+    for (size_t i = 8; i < size; ++i) {
+        buffer[i] = (char)(producer + sequence + i);
+    }
+    return size;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const unsigned int producers = argc > 1 ? atoi(argv[1]) : 4;
+    const unsigned int messages = argc > 2 ? atoi(argv[2]) : 500000;
+    const size_t queue_size = argc > 3 ? atoi(argv[3]) : 4096;
+    const bool retry = argc > 4 ? strcmp(argv[4], "drop") : true;
+
+    PicoMQTT::AsyncQueue queue;
+    queue.begin(queue_size);
+
+    std::atomic<unsigned int> running_producers(producers);
+    std::atomic<unsigned long> retries(0);
+    std::vector<unsigned int> next_sequence(producers, 0);
+    unsigned long received = 0;
+    unsigned long errors = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::thread consumer([&] {
+        auto handle = [&](const char * topic, const void * payload, size_t size) {
+            char expected[128];
+            unsigned int producer, sequence;
+            memcpy(&producer, payload, 4);
+            memcpy(&sequence, (const char *) payload + 4, 4);
+            const std::string expected_topic = "stress/" + std::to_string(producer);
+            if ((producer >= producers) || (expected_topic != topic)
+                    || (make_payload(producer, sequence, expected) != size) || memcmp(expected, payload, size)
+                    || ((const char *) payload)[size] != '\0') {
+                ++errors;
+                return;
+            }
+            // with drops, sequence numbers may skip, but never go back; when retrying only messages too big for the
+            // queue may be skipped
+            unsigned int & next = next_sequence[producer];
+            while (retry && (next < sequence)
+                    && !queue.fits(expected_topic.size(), make_payload(producer, next, expected))) {
+                ++next;
+            }
+            if (sequence < next || (retry && sequence != next)) {
+                ++errors;
+            }
+            next = sequence + 1;
+            ++received;
+        };
+
+        while (running_producers.load() || !queue.empty()) {
+            if (!queue.pop(handle)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (unsigned int producer = 0; producer < producers; ++producer) {
+        threads.emplace_back([&, producer] {
+            const std::string topic = "stress/" + std::to_string(producer);
+            char payload[128];
+            for (unsigned int sequence = 0; sequence < messages; ++sequence) {
+                const size_t size = make_payload(producer, sequence, payload);
+                while (!queue.push(topic.c_str(), payload, size, !retry)) {
+                    // give the consumer a chance to run, even with fewer cores than threads
+                    std::this_thread::yield();
+                    if (!retry || !queue.fits(topic.size(), size)) {
+                        break;
+                    }
+                    ++retries;
+                }
+            }
+            --running_producers;
+        });
+    }
+
+    for (auto & thread : threads) {
+        thread.join();
+    }
+    consumer.join();
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const PicoMQTT::AsyncQueue::Stats stats = queue.get_stats();
+    const unsigned long sent = (unsigned long) producers * messages;
+
+    printf("producers:       %u x %u messages, queue %u bytes, %s when full\n", producers, messages,
+           (unsigned int) queue.get_size(), retry ? "retry" : "drop");
+    printf("received:        %lu (%.0f msg/s)\n", received, received / elapsed);
+    printf("enqueued:        %lu, dequeued %lu\n", stats.enqueued, stats.dequeued);
+    printf("dropped:         %lu full, %lu too big, %lu retries\n", stats.dropped_full, stats.dropped_too_big,
+           retries.load());
+    printf("high water:      %u bytes\n", (unsigned int) stats.high_water);
+    printf("errors:          %lu\n", errors);
+
+    const bool ok = !errors && (received == stats.dequeued)
+                    && (received + stats.dropped_full + stats.dropped_too_big == sent);
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
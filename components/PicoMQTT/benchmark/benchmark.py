@@ -2,84 +2,164 @@
 import argparse
 import time
 import multiprocessing
+import struct
 
 import paho.mqtt.client as mqtt
 
+# Payload header used in latency mode: publish time in nanoseconds (time.time_ns()).
+TIMESTAMP = struct.Struct("!Q")
 
-def consumer(barrier, conn, host, expected_messages, timeout):
+
+def get_topic(index):
+    return f"benchmark/{index}"
+
+
+def get_filters(producers, wildcard):
+    if wildcard:
+        return ["benchmark/+"]
+    return [get_topic(index) for index in range(producers)]
+
+
+def percentile(samples, p):
+    if not samples:
+        return float("nan")
+    samples = sorted(samples)
+    rank = (len(samples) - 1) * p / 100.0
+    lower = int(rank)
+    upper = min(lower + 1, len(samples) - 1)
+    return samples[lower] + (samples[upper] - samples[lower]) * (rank - lower)
+
+
+def consumer(barrier, conn, args):
     pid = multiprocessing.current_process().pid
     client = mqtt.Client(f"consumer_{pid}")
     # client.username_pw_set("username", "password")
 
+    filters = get_filters(args.producers, args.wildcard)
+    pending_subscriptions = len(filters)
+
     total_messages = 0
     first_message_time = None
     last_message_time = None
+    latencies = []
 
     def on_message(client, userdata, msg):
         nonlocal total_messages, first_message_time, last_message_time
         total_messages += 1
         last_message_time = time.time()
         first_message_time = first_message_time or last_message_time
+        if args.mode == "latency" and len(msg.payload) >= TIMESTAMP.size:
+            (sent_ns,) = TIMESTAMP.unpack_from(msg.payload)
+            latencies.append((time.time_ns() - sent_ns) / 1e6)
 
     def on_subscribe(client, userdata, mid, granted_qos):
-        barrier.wait()
+        nonlocal pending_subscriptions
+        pending_subscriptions -= 1
+        if not pending_subscriptions:
+            barrier.wait()
 
     client.on_message = on_message
     client.on_subscribe = on_subscribe
 
-    client.connect(host)
+    client.connect(args.host, args.port)
     client.loop_start()
-    client.subscribe("benchmark")
-    while total_messages < expected_messages:
+    for topic_filter in filters:
+        client.subscribe(topic_filter, args.qos)
+    while total_messages < args.messages:
         if first_message_time and total_messages >= 2:
             elapsed_time = time.time() - first_message_time
-            if elapsed_time >= timeout:
+            if elapsed_time >= args.timeout:
                 break
-        time.sleep(1)
+        time.sleep(0.1 if args.mode == "latency" else 1)
     client.loop_stop()
 
     elapsed_time = last_message_time - first_message_time
-    rate = (total_messages - 1) / elapsed_time
-    conn.send(rate)
+    rate = (total_messages - 1) / elapsed_time if elapsed_time else 0.0
+    conn.send((rate, latencies))
+
+
+def producer(index, barrier, stop, args):
+    client = mqtt.Client(f"producer_{index}")
+    client.connect(args.host, args.port)
+    client.loop_start()
+
+    topic = get_topic(index)
+    padding = b"0" * max(args.size - TIMESTAMP.size, 0)
+    message = b"0" * args.size
+    interval = 1.0 / args.rate if args.rate else 0
+    next_publish = time.time()
+
+    barrier.wait()
+
+    # fire messages
+    while not stop.is_set():
+        if args.mode == "latency":
+            message = TIMESTAMP.pack(time.time_ns()) + padding
+        info = client.publish(topic, message, args.qos)
+        if args.qos:
+            # QoS 1 publishes are confirmed before the next one is sent, just like PicoMQTT clients do
+            info.wait_for_publish()
+        if interval:
+            next_publish += interval
+            delay = next_publish - time.time()
+            if delay > 0:
+                time.sleep(delay)
+
+    client.loop_stop()
+    client.disconnect()
 
 
 parser = argparse.ArgumentParser()
-parser.add_argument("host")
+parser.add_argument("host", nargs="?", default="localhost")
+parser.add_argument("--port", type=int, default=1883)
+parser.add_argument("--mode", choices=["rate", "latency"], default="rate",
+                    help="report delivery rate per consumer [1/s] or end-to-end latency percentile [ms]")
 parser.add_argument("--consumers", type=int, default=1)
+parser.add_argument("--producers", type=int, default=1)
 parser.add_argument("--messages", type=int, default=1000)
 parser.add_argument("--size", type=int, default=1)
 parser.add_argument("--timeout", type=int, default=10)
+parser.add_argument("--qos", type=int, choices=[0, 1], default=0)
+parser.add_argument("--wildcard", action="store_true",
+                    help="subscribe using a single-level wildcard filter instead of exact topics")
+parser.add_argument("--rate", type=float, default=0,
+                    help="limit the publish rate of each producer [1/s], 0 means unlimited")
+parser.add_argument("--percentile", type=float, default=50,
+                    help="latency percentile to report in latency mode")
 
 args = parser.parse_args()
 
-client = mqtt.Client("producer")
-client.connect(args.host)
+if args.mode == "latency" and args.size < TIMESTAMP.size:
+    args.size = TIMESTAMP.size
 
-barrier = multiprocessing.Barrier(args.consumers + 1)
+barrier = multiprocessing.Barrier(args.consumers + args.producers)
+stop = multiprocessing.Event()
 pipe = multiprocessing.Pipe(False)
 consumers = [
-    multiprocessing.Process(
-        target=consumer, args=(barrier, pipe[1], args.host, args.messages, args.timeout)
-    )
+    multiprocessing.Process(target=consumer, args=(barrier, pipe[1], args))
     for _ in range(args.consumers)
 ]
+producers = [
+    multiprocessing.Process(target=producer, args=(index, barrier, stop, args))
+    for index in range(args.producers)
+]
 
-message = "0" * args.size
-
-for consumer in consumers:
-    consumer.start()
-
-# wait for all processes to connect
-barrier.wait()
-
-# fire messages
-while any(p.is_alive() for p in consumers):
-    client.publish("benchmark", message)
+for process in consumers + producers:
+    process.start()
 
 # wait for consumers
-for consumer in consumers:
-    consumer.join()
+for process in consumers:
+    process.join()
+
+stop.set()
+for process in producers:
+    process.join()
 
 # collect results
-rate = sum(pipe[0].recv() for _ in consumers) / len(consumers)
-print(f"{rate:.1f}")
+results = [pipe[0].recv() for _ in consumers]
+if args.mode == "latency":
+    latencies = [sample for _, samples in results for sample in samples]
+    print(f"{percentile(latencies, args.percentile):.2f}")
+else:
+    rate = sum(rate for rate, _ in results) / len(results)
+    print(f"{rate:.1f}")
@@ -1,37 +1,69 @@
 #!/usr/bin/env bash
 
 # Usage:
-#   ./benchmark.sh <ESP IP>
+#   ./benchmark.sh [<ESP IP>]
+#
+# The broker defaults to localhost, so a host build can be benchmarked too.  Further options are read from the
+# environment:
+#   MODE=rate|latency        delivery rate per consumer [1/s] or latency percentile [ms] (default: rate)
+#   QOS=0|1                  QoS level used for publishing and subscribing (default: 0)
+#   PRODUCERS=<n>            number of concurrent publishers (default: 1)
+#   FILTERS="exact wildcard" subscription filter kinds to compare (default: exact)
+#   PERCENTILE=<p>           latency percentile reported in latency mode (default: 50)
 
 export LC_NUMERIC=C
 
-HOST="$1"
+HOST="${1:-localhost}"
 REPEAT=5
 CONSUMER_COUNTS="12 10 5 1"
 SIZES="10000 5000 1000 500 100 50 10 5 1"
+MODE="${MODE:-rate}"
+QOS="${QOS:-0}"
+PRODUCERS="${PRODUCERS:-1}"
+FILTERS="${FILTERS:-exact}"
+PERCENTILE="${PERCENTILE:-50}"
 
 printf "message size\t"
-for CONSUMERS in $CONSUMER_COUNTS
+for FILTER in $FILTERS
 do
-    printf "%i consumers\t" $CONSUMERS
+    for CONSUMERS in $CONSUMER_COUNTS
+    do
+        if [ "$FILTERS" = "exact" ]
+        then
+            printf "%i consumers\t" $CONSUMERS
+        else
+            printf "%i consumers (%s)\t" $CONSUMERS $FILTER
+        fi
+    done
 done
 printf "\n"
 
 for SIZE in $SIZES
 do
     printf "%i\t" $SIZE
-    for CONSUMERS in $CONSUMER_COUNTS
+    for FILTER in $FILTERS
     do
-        RESULT=$({
-            for ITERATION in $(seq $REPEAT)
-            do
-                ./benchmark.py --size=$SIZE --consumers=$CONSUMERS "$HOST"
-                # potential interference may go away by itself if we wait
-                sleep 1
-            done
-        } | awk '{ sum += $1; count += 1 } END { print sum / count }')
+        if [ "$FILTER" = "wildcard" ]
+        then
+            FILTER_ARGS="--wildcard"
+        else
+            FILTER_ARGS=""
+        fi
+
+        for CONSUMERS in $CONSUMER_COUNTS
+        do
+            RESULT=$({
+                for ITERATION in $(seq $REPEAT)
+                do
+                    ./benchmark.py --size=$SIZE --consumers=$CONSUMERS --producers=$PRODUCERS --qos=$QOS \
+                        --mode=$MODE --percentile=$PERCENTILE $FILTER_ARGS "$HOST"
+                    # potential interference may go away by itself if we wait
+                    sleep 1
+                done
+            } | awk '{ sum += $1; count += 1 } END { print sum / count }')
 
-        printf "%.1f\t" $RESULT
+            printf "%.1f\t" $RESULT
+        done
     done
     printf "\n"
 done
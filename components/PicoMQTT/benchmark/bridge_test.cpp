@@ -0,0 +1,261 @@
+/*
+ * Loopback test of MqttBridge, the store-and-forward bridge of the application (main/) to an upstream broker.
+ *
+ * A local PicoMQTT::Server hands the messages matching the filters of the bridge to it, like MqttBroker does.  The
+ * upstream broker is a PicoMQTT::Server in a child process (this program started with --upstream), which prints each
+ * message it receives with its DUP flag and acknowledges it with PUBACK.  The test checks that:
+ *
+ *  - messages published while the upstream broker is down wait in the ring of the bridge,
+ *  - when the upstream broker goes away in the middle of the backlog (it exits on its 21st message, without the
+ *    PUBACK), the messages in flight are resent with DUP set after the reconnect, before the rest of the backlog,
+ *  - every message reaches the upstream broker in order and is acknowledged, only the resent ones more than once.
+ *
+ * Build:
+ *   g++ -O2 -std=gnu++17 -pthread -DPICOMQTT_TLS=0 -Ihost -I../src -I../../../main -o bridge_test bridge_test.cpp \
+ *       ../../../main/MqttBridge.cpp ../src/PicoMQTT/[a-z]*.cpp
+ *
+ * Usage:
+ *   ./bridge_test [port]
+ *
+ * The upstream broker listens on the given port (18840 by default).  The bridge retries the connection every 5
+ * seconds, so the test takes 10 to 15 seconds.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <PicoMQTT.h>
+
+#include "MqttBridge.h"
+
+namespace {
+
+// Exits on message number stop_at (counting from 1) before acknowledging it, 0 runs until killed
+class Upstream: public PicoMQTT::Server {
+    public:
+        Upstream(uint16_t port, unsigned int stop_at): PicoMQTT::Server(port), stop_at(stop_at), received(0) {}
+
+    protected:
+        virtual void on_message(const char * topic, PicoMQTT::IncomingPacket & packet) override {
+            const bool dup = (packet.get_flags() >> 3) & 0b1;
+            std::string payload(packet.get_remaining_size(), '\0');
+            const uint8_t * buffered = packet.get_buffered_data();
+            if (buffered) {
+                payload.assign((const char *) buffered, payload.size());
+            } else if (packet.read((uint8_t *) &payload[0], payload.size()) != (int) payload.size()) {
+                return;
+            }
+
+            printf("%s %d\n", payload.c_str(), dup);
+            fflush(stdout);
+            if (++received == stop_at) {
+                _exit(0);
+            }
+        }
+
+        const unsigned int stop_at;
+        unsigned int received;
+};
+
+[[noreturn]] void run_upstream(uint16_t port, unsigned int stop_at) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    Upstream upstream(port, stop_at);
+    upstream.begin();
+    while (true) {
+        upstream.loop();
+        usleep(100);
+    }
+}
+
+// Hands the messages matching the filters of the bridge to it, like MqttBroker
+class LocalBroker: public PicoMQTT::Server {
+    public:
+        LocalBroker(MqttBridge & bridge): bridge(bridge) {}
+
+    protected:
+        virtual PicoMQTT::PrintMux get_subscribed(const char * topic) override {
+            PicoMQTT::PrintMux ret = PicoMQTT::Server::get_subscribed(topic);
+            if (bridge.Matches(PicoMQTT::TopicTokens(topic))) {
+                bridge.BeginMessage();
+                ret.add(bridge);
+            }
+            return ret;
+        }
+
+        MqttBridge & bridge;
+};
+
+// Starts this program as the upstream broker, its output is read from the returned pipe
+pid_t start_upstream(uint16_t port, unsigned int stop_at, int & output) {
+    char port_arg[16];
+    char stop_at_arg[16];
+    snprintf(port_arg, sizeof(port_arg), "%u", port);
+    snprintf(stop_at_arg, sizeof(stop_at_arg), "%u", stop_at);
+
+    int fds[2];
+    if (pipe(fds)) {
+        perror("pipe");
+        exit(1);
+    }
+
+    const pid_t pid = fork();
+    if (!pid) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl("/proc/self/exe", "bridge_test", "--upstream", port_arg, stop_at_arg, (char *) nullptr);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    output = fds[0];
+    return pid;
+}
+
+struct Delivery {
+    unsigned int message;
+    bool dup;
+};
+
+// Reads the messages printed by the upstream broker until it exits
+std::vector<Delivery> read_deliveries(int fd) {
+    std::string text;
+    char buffer[1024];
+    ssize_t size;
+    while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, size);
+    }
+    close(fd);
+
+    std::vector<Delivery> ret;
+    unsigned int message;
+    int dup;
+    int consumed;
+    for (const char * line = text.c_str(); sscanf(line, "%u %d\n%n", &message, &dup, &consumed) == 2;
+            line += consumed) {
+        ret.push_back({message, dup != 0});
+    }
+    return ret;
+}
+
+bool wait_for_exit(pid_t pid, unsigned long timeout_millis) {
+    const unsigned long start = millis();
+    while (millis() - start < timeout_millis) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) {
+            return true;
+        }
+        delay(10);
+    }
+    return false;
+}
+
+template <typename Condition>
+bool wait_for(Condition condition, unsigned long timeout_millis) {
+    const unsigned long start = millis();
+    while (!condition() && millis() - start < timeout_millis) {
+        delay(10);
+    }
+    return condition();
+}
+
+bool check(bool condition, const char * what) {
+    printf("%-70s %s\n", what, condition ? "OK" : "FAILED");
+    return condition;
+}
+
+MqttBridge bridge;
+
+}
+
+int main(int argc, char ** argv) {
+    if (argc == 4 && !strcmp(argv[1], "--upstream")) {
+        run_upstream(atoi(argv[2]), atoi(argv[3]));
+    }
+
+    const uint16_t port = argc > 1 ? atoi(argv[1]) : 18840;
+    const unsigned int count = 100;
+    const unsigned int stop_at = 21;
+
+    char settings[64];
+    snprintf(settings, sizeof(settings), "127.0.0.1:%u;test/#", port);
+    bridge.Configure(settings);
+    LocalBroker local(bridge);
+    bridge.Start();
+
+    // the upstream broker is down
+    for (unsigned int n = 0; n < count; ++n) {
+        local.publish("test/bridge", String(n));
+        local.publish("other/topic", String(n));
+    }
+    delay(200);
+
+    MqttBridge::Stats stats = bridge.GetStats();
+    printf("queued %u messages, %u bytes\n", stats.Enqueued, (unsigned) bridge.GetQueuedBytes());
+    bool ok = check(stats.Enqueued == count && !stats.Sent && bridge.GetQueuedBytes(),
+                    "messages queued while the upstream broker is down");
+
+    // first run, ends in the middle of the backlog
+    int output;
+    pid_t upstream = start_upstream(port, stop_at, output);
+    const bool stopped = wait_for_exit(upstream, 15000);
+    const std::vector<Delivery> first = read_deliveries(output);
+    ok = check(stopped && first.size() == stop_at, "upstream broker stopped in the middle of the backlog") && ok;
+
+    // second run, gets the rest
+    upstream = start_upstream(port, 0, output);
+    const bool delivered = wait_for([] {
+        return bridge.GetStats().Acked == count && !bridge.GetQueuedBytes();
+    }, 15000);
+    delay(100);
+    kill(upstream, SIGTERM);
+    waitpid(upstream, nullptr, 0);
+    const std::vector<Delivery> second = read_deliveries(output);
+
+    stats = bridge.GetStats();
+    printf("sent %u, resent %u, acked %u, reconnects %u; upstream received %u + %u messages\n", stats.Sent,
+           stats.Resent, stats.Acked, stats.Reconnects, (unsigned) first.size(), (unsigned) second.size());
+
+    std::map<unsigned int, unsigned int> received;
+    for (const auto & delivery : first) {
+        ++received[delivery.message];
+    }
+
+    unsigned int resent = 0;
+    bool resent_first = true;
+    bool in_order = true;
+    bool only_resent_twice = true;
+    for (size_t i = 0; i < second.size(); ++i) {
+        const Delivery & delivery = second[i];
+        if (delivery.dup) {
+            ++resent;
+            resent_first = resent_first && (resent == i + 1);
+        } else if (received.count(delivery.message)) {
+            only_resent_twice = false;
+        }
+        in_order = in_order && (!i || delivery.message > second[i - 1].message);
+        ++received[delivery.message];
+    }
+
+    bool all_received = received.size() == count;
+    for (unsigned int n = 0; n < count; ++n) {
+        all_received = all_received && received.count(n);
+    }
+
+    ok = check(resent && resent == stats.Resent && resent <= MQTT_BRIDGE_WINDOW && resent_first,
+               "messages in flight resent with DUP first after the reconnect") && ok;
+    ok = check(all_received && in_order, "every message delivered to the upstream broker, in order") && ok;
+    ok = check(only_resent_twice, "only resent messages delivered more than once") && ok;
+    ok = check(delivered && stats.Acked == count && stats.Reconnects == 2, "whole backlog acknowledged") && ok;
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+/*
+ * Host benchmark of the message callback dispatch in SubscribedMessageListener: the previous implementation, where
+ * each subscribe() overload wrapped the callback in another std::function (three levels for the common
+ * (const char * topic, const char * payload) form), vs. the current one, where the callback is wrapped once in a
+ * Delegate, which stores small callables inline.
+ *
+ * Both variants are copies of the respective subscriber code, which can't be included here without the Arduino
+ * core.  The packet is a stand-in for IncomingPacket with the payload already buffered, so only the dispatch and the
+ * callback itself are measured.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../src -o callback_bench callback_bench.cpp
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <vector>
+
+#include "PicoMQTT/delegate.h"
+
+namespace {
+
+size_t allocations = 0;
+
+struct Packet {
+    virtual ~Packet() {}
+
+    size_t get_remaining_size() const { return size; }
+    virtual const uint8_t * get_buffered_data() const { return (const uint8_t *) data; }
+    virtual int read(uint8_t * buffer, size_t length) {
+        memcpy(buffer, data, length);
+        return length;
+    }
+
+    char data[16];
+    size_t size;
+};
+
+struct Listener {
+    virtual ~Listener() {}
+    virtual void on_message_too_big(const char *, Packet &) {}
+};
+
+// The previous implementation
+
+typedef std::function<void(char * topic, Packet & packet)> OldMessageCallback;
+
+OldMessageCallback old_subscribe(Listener & listener, std::function<void(char *, void *, size_t)> callback,
+                                 size_t max_size) {
+    return [&listener, callback, max_size](char * topic, Packet & packet) {
+        const size_t payload_size = packet.get_remaining_size();
+        if (payload_size >= max_size) {
+            listener.on_message_too_big(topic, packet);
+            return;
+        }
+
+        const uint8_t * buffered_payload = packet.get_buffered_data();
+        if (buffered_payload) {
+            callback(topic, (void *) buffered_payload, payload_size);
+            return;
+        }
+
+        char payload[payload_size + 1];
+        if (packet.read((uint8_t *) payload, payload_size) != (int) payload_size) {
+            return;
+        }
+        payload[payload_size] = '\0';
+        callback(topic, payload, payload_size);
+    };
+}
+
+OldMessageCallback old_subscribe(Listener & listener, std::function<void(char *, char *)> callback, size_t max_size) {
+    return old_subscribe(listener, [callback](char * topic, void * payload, size_t) {
+        callback(topic, (char *) payload);
+    }, max_size);
+}
+
+// The current implementation
+
+typedef PicoMQTT::Delegate<void(char * topic, Packet & packet)> MessageCallback;
+
+template <typename Callback>
+class PayloadCallback {
+    public:
+        PayloadCallback(Listener & listener, Callback && callback, size_t max_size)
+            : listener(listener), max_size(max_size), callback(std::move(callback)) {}
+
+        void operator()(char * topic, Packet & packet) {
+            const size_t payload_size = packet.get_remaining_size();
+            if (payload_size >= max_size) {
+                listener.on_message_too_big(topic, packet);
+                return;
+            }
+
+            const uint8_t * buffered_payload = packet.get_buffered_data();
+            if (buffered_payload) {
+                callback(topic, (void *) buffered_payload, payload_size);
+                return;
+            }
+
+            char payload[payload_size + 1];
+            if (packet.read((uint8_t *) payload, payload_size) != (int) payload_size) {
+                return;
+            }
+            payload[payload_size] = '\0';
+            callback(topic, payload, payload_size);
+        }
+
+    protected:
+        Listener & listener;
+        size_t max_size;
+        Callback callback;
+};
+
+template <typename Callback>
+MessageCallback new_subscribe(Listener & listener, Callback callback, size_t max_size) {
+    auto adapter = [callback](char * topic, void * payload, size_t) mutable {
+        callback(topic, (char *) payload);
+    };
+    return PayloadCallback<decltype(adapter)>(listener, std::move(adapter), max_size);
+}
+
+template <typename Callbacks>
+double measure(const Callbacks & callbacks, Packet & packet, unsigned int iterations) {
+    char topic[] = "emkit/1/pack/socofpack";
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; ++i) {
+        (*callbacks[i % callbacks.size()])(topic, packet);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+}
+
+void * operator new(size_t size) {
+    ++allocations;
+    void * ret = malloc(size);
+    if (!ret) {
+        throw std::bad_alloc();
+    }
+    return ret;
+}
+
+void operator delete(void * ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void * ptr, size_t) noexcept {
+    free(ptr);
+}
+
+int main(int argc, char ** argv) {
+    const unsigned int iterations = argc > 1 ? atoi(argv[1]) : 10000000;
+    const unsigned int subscriptions = 9;
+
+    Listener listener;
+    volatile size_t sink = 0;
+    // like the callbacks in main.cpp: parse the payload and store it
+    auto callback = [&sink](const char * topic, const char * payload) {
+        sink = sink + payload[0] + topic[0];
+    };
+
+    std::vector<OldMessageCallback> old_callbacks;
+    std::vector<MessageCallback> new_callbacks;
+    old_callbacks.reserve(subscriptions);
+    new_callbacks.reserve(subscriptions);
+
+    size_t start = allocations;
+    for (unsigned int i = 0; i < subscriptions; ++i) {
+        old_callbacks.push_back(old_subscribe(listener, callback, 1024));
+    }
+    const size_t old_allocations = allocations - start;
+
+    start = allocations;
+    for (unsigned int i = 0; i < subscriptions; ++i) {
+        new_callbacks.push_back(new_subscribe(listener, callback, 1024));
+    }
+    const size_t new_allocations = allocations - start;
+
+    std::vector<const OldMessageCallback *> old_pointers;
+    std::vector<const MessageCallback *> new_pointers;
+    for (unsigned int i = 0; i < subscriptions; ++i) {
+        old_pointers.push_back(&old_callbacks[i]);
+        new_pointers.push_back(&new_callbacks[i]);
+    }
+
+    Packet packet;
+    strcpy(packet.data, "97.5");
+    packet.size = 4;
+
+    start = allocations;
+    const double old_ns = measure(old_pointers, packet, iterations);
+    const double new_ns = measure(new_pointers, packet, iterations);
+    const size_t dispatch_allocations = allocations - start;
+
+    printf("callback object size:    std::function %u bytes, Delegate %u bytes\n",
+           (unsigned int) sizeof(OldMessageCallback), (unsigned int) sizeof(MessageCallback));
+    printf("allocations per subscribe: std::function layers %.1f, Delegate %.1f\n",
+           (double) old_allocations / subscriptions, (double) new_allocations / subscriptions);
+    printf("allocations while dispatching: %u\n", (unsigned int) dispatch_allocations);
+    printf("dispatch, std::function layers: %.2f ns/message\n", old_ns);
+    printf("dispatch, Delegate:             %.2f ns/message, %.1fx faster\n", new_ns, old_ns / new_ns);
+
+    return 0;
+}
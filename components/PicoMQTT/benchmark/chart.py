@@ -4,6 +4,9 @@ import sys
 
 import pygal
 
+# Usage:
+#   ./chart.py [<y axis title>] < results.csv > chart.svg
+
 data = list(csv.DictReader(sys.stdin, dialect="excel-tab"))
 X = "message size"
 SERIES = [e for e in data[0].keys() if e and e != X]
@@ -12,7 +15,7 @@ chart = pygal.XY(
     legend_at_bottom=True,
     logarithmic=True,
     x_title="payload size [B]",
-    y_title="messages delivery rate [1/s]",
+    y_title=sys.argv[1] if len(sys.argv) > 1 else "messages delivery rate [1/s]",
     pretty_print=True,
     stroke_style={"width": 50},
     x_label_rotation=-90,
@@ -0,0 +1,169 @@
+/*
+ * Host benchmark of idle connection compaction (Server::idle_compaction_millis): heap held by the subscription
+ * state and buffers of 50 idle clients, before and after Server::Client::compact().
+ *
+ * Each client is modeled by the parts compaction touches: the node-based set of subscriptions (an Arduino String
+ * per subscription, which always allocates), the compiled TopicFilterSet used for matching and the payload buffer,
+ * which route() leaves at the size of the largest message the client has published.  Like the displays in
+ * main.cpp, every client subscribes to the battery pack topics and one topic of its own.  The heap is measured by
+ * counting the usable size of allocations plus 8 bytes of allocator overhead per block, like heap_block_size().
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../src -o compaction_bench compaction_bench.cpp ../src/PicoMQTT/topic_matcher.cpp
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "PicoMQTT/topic_matcher.h"
+
+namespace {
+
+size_t allocated = 0;
+size_t blocks = 0;
+
+// stand-in for Arduino's String, which stores even short strings on the heap
+class HeapString {
+    public:
+        HeapString(const char * str): buffer(new char[strlen(str) + 1]) { strcpy(buffer, str); }
+        HeapString(const HeapString & other): HeapString(other.buffer) {}
+        ~HeapString() { delete[] buffer; }
+        const char * c_str() const { return buffer; }
+        bool operator<(const HeapString & other) const { return strcmp(buffer, other.buffer) < 0; }
+
+    protected:
+        // same layout as String
+        char * buffer;
+        unsigned int capacity = 0;
+        unsigned int length = 0;
+};
+
+struct Subscription: public HeapString {
+    Subscription(const char * str): HeapString(str), id(++next_id) {}
+    unsigned int id;
+    static unsigned int next_id;
+};
+
+unsigned int Subscription::next_id = 0;
+
+// the parts of Server::Client which compaction touches
+struct ClientState {
+    std::set<Subscription> subscriptions;
+    PicoMQTT::TopicFilterSet subscription_filters;
+    std::vector<uint8_t> payload_buffer;
+    bool compacted = false;
+
+    void subscribe(const char * topic_filter) {
+        subscriptions.insert(Subscription(topic_filter));
+        subscription_filters.clear();
+        for (const auto & subscription : subscriptions) {
+            subscription_filters.add(subscription.c_str(), subscription.id);
+        }
+    }
+
+    void compact() {
+        std::vector<uint8_t>().swap(payload_buffer);
+        subscriptions.clear();
+        subscription_filters.shrink_to_fit();
+        compacted = true;
+    }
+
+    void rehydrate() {
+        for (size_t i = 0; i < subscription_filters.size(); ++i) {
+            subscriptions.insert(Subscription(subscription_filters.get_filter(i)));
+        }
+        compacted = false;
+    }
+};
+
+}
+
+void * operator new(size_t size) {
+    void * ret = malloc(size);
+    if (!ret) {
+        throw std::bad_alloc();
+    }
+    allocated += malloc_usable_size(ret) + 8;
+    ++blocks;
+    return ret;
+}
+
+void operator delete(void * ptr) noexcept {
+    if (ptr) {
+        allocated -= malloc_usable_size(ptr) + 8;
+        --blocks;
+    }
+    free(ptr);
+}
+
+void operator delete(void * ptr, size_t) noexcept {
+    operator delete(ptr);
+}
+
+int main(int argc, char ** argv) {
+    const unsigned int client_count = argc > 1 ? atoi(argv[1]) : 50;
+    const size_t payload_size = argc > 2 ? atoi(argv[2]) : 200;
+
+    const char * pack_filters[] = {
+        "emkit/+/+/socofpack", "emkit/+/+/voltageofpack", "emkit/+/+/currentofpack", "emkit/+/+/cellvmax",
+        "emkit/+/+/celltmax", "emkit/+/+/cellvmin", "emkit/+/+/celltmin", "emkit/+/+/bmschstate",
+        "emkit/+/+/bmsdschstate",
+    };
+
+    std::vector<ClientState> clients(client_count);
+    const size_t start_allocated = allocated;
+    const size_t start_blocks = blocks;
+
+    for (unsigned int i = 0; i < client_count; ++i) {
+        for (const char * filter : pack_filters) {
+            clients[i].subscribe(filter);
+        }
+        clients[i].subscribe(("display/" + std::to_string(i) + "/#").c_str());
+        // a status message published after connecting
+        clients[i].payload_buffer.resize(payload_size + 1);
+    }
+
+    const size_t active_allocated = allocated - start_allocated;
+    const size_t active_blocks = blocks - start_blocks;
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto & client : clients) {
+        client.compact();
+    }
+    const double compact_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()
+                              - start).count();
+
+    const size_t idle_allocated = allocated - start_allocated;
+    const size_t idle_blocks = blocks - start_blocks;
+
+    // matching keeps working on the packed filters
+    const PicoMQTT::TopicTokens topic("emkit/1/pack/socofpack");
+    unsigned int matching = 0;
+    for (const auto & client : clients) {
+        matching += client.subscription_filters.find_first(topic) >= 0 ? 1 : 0;
+    }
+
+    start = std::chrono::steady_clock::now();
+    clients[0].rehydrate();
+    const double rehydrate_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()
+                                - start).count();
+
+    printf("%u clients, %u subscriptions each, %u byte payload buffer\n", client_count,
+           (unsigned int)(sizeof(pack_filters) / sizeof(pack_filters[0]) + 1), (unsigned int) payload_size);
+    printf("active:    %7u bytes in %5u blocks, %5u bytes per client\n", (unsigned int) active_allocated,
+           (unsigned int) active_blocks, (unsigned int)(active_allocated / client_count));
+    printf("compacted: %7u bytes in %5u blocks, %5u bytes per client\n", (unsigned int) idle_allocated,
+           (unsigned int) idle_blocks, (unsigned int)(idle_allocated / client_count));
+    printf("recovered: %7u bytes (%.0f%%)\n", (unsigned int)(active_allocated - idle_allocated),
+           100.0 * (active_allocated - idle_allocated) / active_allocated);
+    printf("compacting all clients: %.1f us, rehydrating one: %.2f us, still matching: %u/%u\n", compact_us,
+           rehydrate_us, matching, client_count);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * Loopback test of FederatedServer.
+ *
+ * Runs three brokers (nodes A, B and C, each peering with the other two) in child processes on the PC, using the
+ * Arduino and WiFi shims from host/, and connects PicoMQTT clients to them to check that:
+ *
+ *  - messages published on any node reach the subscribers of every node exactly once, i.e. nothing is forwarded
+ *    again by the receiving node (split horizon) and nothing loops in the full mesh,
+ *  - a message is sent only to the peers which have subscribers for it, and unsubscribing withdraws the interest,
+ *  - shared subscription groups are served by each node with members,
+ *  - clients can't pose as peer links by using a peer client id without the peer password.
+ *
+ * Build:
+ *   g++ -O2 -std=gnu++17 -DPICOMQTT_TLS=0 -Ihost -I../src -o federation_test federation_test.cpp \
+ *       ../src/PicoMQTT/[a-z]*.cpp
+ *
+ * Usage:
+ *   ./federation_test [first port]
+ *
+ * The nodes listen on the given port (18830 by default) and the two following ones.  Each node publishes its
+ * counters on "stats/<node>" every 100 ms.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <PicoMQTT.h>
+
+namespace {
+
+const char * const node_names[] = { "A", "B", "C" };
+const size_t node_count = 3;
+const char * const peer_password = "secret";
+
+[[noreturn]] void run_node(size_t index, uint16_t first_port) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    PicoMQTT::FederatedServer mqtt(first_port + index);
+    mqtt.node_id = node_names[index];
+    mqtt.peer_password = peer_password;
+    mqtt.peer_reconnect_interval_millis = 200;
+    mqtt.peer_socket_timeout_millis = 500;
+    for (size_t peer = 0; peer < node_count; ++peer) {
+        if (peer != index) {
+            mqtt.add_peer("127.0.0.1", first_port + peer);
+        }
+    }
+    mqtt.begin();
+
+    const String stats_topic = String("stats/") + node_names[index];
+    unsigned long last_stats = millis();
+    while (true) {
+        mqtt.loop();
+        if (millis() - last_stats >= 100) {
+            last_stats = millis();
+            char stats[64];
+            snprintf(stats, sizeof(stats), "%u %lu", (unsigned) mqtt.get_connected_peer_count(), mqtt.peer_messages);
+            mqtt.publish(stats_topic, stats);
+        }
+        usleep(100);
+    }
+}
+
+struct NodeStats {
+    unsigned int connected_peers = 0;
+    unsigned long peer_messages = 0;
+    bool valid = false;
+};
+
+// A test client, counts the messages it receives by topic and payload, or passes them to handler if set.  Messages
+// are taken in on_message(), because the filters of shared subscriptions ($share/...) don't match the topics of the
+// messages on the client side.
+class TestClient: public PicoMQTT::Client {
+    public:
+        TestClient(uint16_t port, const char * id, const char * user = nullptr, const char * password = nullptr)
+            : PicoMQTT::Client("127.0.0.1", port, id, user, password) {
+            begin();
+        }
+
+        bool wait_for_connection(unsigned long timeout_millis) {
+            const unsigned long start = millis();
+            while (!connected() && millis() - start < timeout_millis) {
+                loop();
+                delay(10);
+            }
+            return connected();
+        }
+
+        void subscribe(const char * filter) {
+            PicoMQTT::Client::subscribe(filter, [](const char *, const char *) {});
+        }
+
+        std::function<void(const char * payload)> handler;
+        std::map<std::string, unsigned int> received;
+        unsigned long total = 0;
+
+    protected:
+        virtual void on_message(const char * topic, PicoMQTT::IncomingPacket & packet) override {
+            std::string payload(packet.get_remaining_size(), '\0');
+            if (packet.read((uint8_t *) &payload[0], payload.size()) != (int) payload.size()) {
+                return;
+            }
+            if (handler) {
+                handler(payload.c_str());
+                return;
+            }
+            ++received[std::string(topic) + " " + payload];
+            ++total;
+        }
+};
+
+std::vector<std::unique_ptr<TestClient>> clients;
+
+void run_clients(unsigned long millis_to_run) {
+    const unsigned long start = millis();
+    do {
+        for (auto & client : clients) {
+            client->loop();
+        }
+        delay(1);
+    } while (millis() - start < millis_to_run);
+}
+
+TestClient & add_client(uint16_t port, const char * id) {
+    clients.push_back(std::unique_ptr<TestClient>(new TestClient(port, id)));
+    clients.back()->wait_for_connection(5000);
+    return *clients.back();
+}
+
+bool check(bool condition, const char * what) {
+    printf("%-70s %s\n", what, condition ? "OK" : "FAILED");
+    return condition;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const uint16_t first_port = argc > 1 ? atoi(argv[1]) : 18830;
+
+    pid_t nodes[node_count];
+    for (size_t i = 0; i < node_count; ++i) {
+        nodes[i] = fork();
+        if (!nodes[i]) {
+            run_node(i, first_port);
+        }
+    }
+    delay(200);
+
+    // wait for the full mesh, each node reports its connected peers
+    NodeStats stats[node_count];
+    for (size_t i = 0; i < node_count; ++i) {
+        TestClient & client = add_client(first_port + i, (String("stats-") + node_names[i]).c_str());
+        client.handler = [&stats, i](const char * payload) {
+            stats[i].valid = sscanf(payload, "%u %lu", &stats[i].connected_peers, &stats[i].peer_messages) == 2;
+        };
+        client.subscribe((String("stats/") + node_names[i]).c_str());
+    }
+
+    auto mesh_ready = [&stats] {
+        for (size_t i = 0; i < node_count; ++i) {
+            if (!stats[i].valid || stats[i].connected_peers != node_count - 1) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    const unsigned long start = millis();
+    while (!mesh_ready() && millis() - start < 20000) {
+        run_clients(100);
+    }
+
+    bool ok = check(mesh_ready(), "all nodes connected to their peers");
+
+    // one subscriber and one publisher on each node
+    TestClient * subscribers[node_count];
+    TestClient * publishers[node_count];
+    for (size_t i = 0; i < node_count; ++i) {
+        subscribers[i] = &add_client(first_port + i, (String("sub-") + node_names[i]).c_str());
+        subscribers[i]->subscribe("test/#");
+        subscribers[i]->subscribe("sync/#");
+        publishers[i] = &add_client(first_port + i, (String("pub-") + node_names[i]).c_str());
+    }
+
+    // wait until the interest has reached all peers, i.e. every subscriber gets the probes of every node
+    auto synced = [&subscribers] {
+        for (size_t i = 0; i < node_count; ++i) {
+            for (size_t j = 0; j < node_count; ++j) {
+                if (!subscribers[i]->received.count(std::string("sync/") + node_names[j] + " x")) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    const unsigned long sync_start = millis();
+    while (!synced() && millis() - sync_start < 10000) {
+        for (size_t i = 0; i < node_count; ++i) {
+            publishers[i]->publish(String("sync/") + node_names[i], "x");
+        }
+        run_clients(100);
+    }
+    ok = check(synced(), "interest propagated to all peers") && ok;
+
+    // full mesh: every message exactly once on every node
+    const unsigned int count = 100;
+    for (size_t i = 0; i < node_count; ++i) {
+        subscribers[i]->received.clear();
+        subscribers[i]->total = 0;
+    }
+    for (unsigned int n = 0; n < count; ++n) {
+        for (size_t i = 0; i < node_count; ++i) {
+            publishers[i]->publish(String("test/") + node_names[i], String(n));
+        }
+        run_clients(0);
+    }
+    run_clients(500);
+
+    bool exactly_once = true;
+    for (size_t i = 0; i < node_count; ++i) {
+        exactly_once = exactly_once && (subscribers[i]->total == count * node_count)
+                       && (subscribers[i]->received.size() == count * node_count);
+        printf("subscriber on node %s: %lu messages, %u distinct\n", node_names[i], subscribers[i]->total,
+               (unsigned) subscribers[i]->received.size());
+    }
+    ok = check(exactly_once, "each message delivered exactly once on each node") && ok;
+
+    // interest: only B subscribes to "only/b", C must not receive any of these from A
+    TestClient & only_b = add_client(first_port + 1, "only-b");
+    only_b.subscribe("only/b");
+    run_clients(300);
+
+    NodeStats before[node_count];
+    std::copy(stats, stats + node_count, before);
+    for (unsigned int n = 0; n < count; ++n) {
+        publishers[0]->publish("only/b", String(n));
+        publishers[0]->publish("nobody/x", String(n));
+        run_clients(0);
+    }
+    run_clients(500);
+
+    printf("peer messages during the run: B %lu, C %lu\n", stats[1].peer_messages - before[1].peer_messages,
+           stats[2].peer_messages - before[2].peer_messages);
+    ok = check(only_b.total == count, "subscriber on B received all messages") && ok;
+    ok = check(stats[1].peer_messages - before[1].peer_messages == count, "B received only its messages from A") && ok;
+    ok = check(stats[2].peer_messages == before[2].peer_messages, "C received nothing from A") && ok;
+
+    // unsubscribing withdraws the interest
+    only_b.unsubscribe("only/b");
+    run_clients(300);
+    std::copy(stats, stats + node_count, before);
+    for (unsigned int n = 0; n < count; ++n) {
+        publishers[0]->publish("only/b", String(n));
+        run_clients(0);
+    }
+    run_clients(500);
+    ok = check(stats[1].peer_messages == before[1].peer_messages, "B received nothing from A after unsubscribing")
+         && ok;
+
+    // shared subscriptions: two members on B and one on C
+    TestClient * shared_members[] = {
+        &add_client(first_port + 1, "shared-b1"),
+        &add_client(first_port + 1, "shared-b2"),
+        &add_client(first_port + 2, "shared-c"),
+    };
+    for (auto member : shared_members) {
+        member->subscribe("$share/group/shared/#");
+    }
+    run_clients(300);
+
+    std::copy(stats, stats + node_count, before);
+    for (unsigned int n = 0; n < count; ++n) {
+        publishers[0]->publish("shared/a", String(n));
+        run_clients(0);
+    }
+    run_clients(500);
+
+    printf("shared subscription: B %lu + %lu, C %lu messages; peer messages B %lu, C %lu\n",
+           shared_members[0]->total, shared_members[1]->total, shared_members[2]->total,
+           stats[1].peer_messages - before[1].peer_messages, stats[2].peer_messages - before[2].peer_messages);
+    ok = check(shared_members[0]->received.size() + shared_members[1]->received.size() == count
+               && shared_members[0]->total + shared_members[1]->total == count
+               && shared_members[0]->total && shared_members[1]->total, "group on B received each message once") && ok;
+    ok = check(shared_members[2]->received.size() == count && shared_members[2]->total == count,
+               "group on C received each message once") && ok;
+    ok = check(stats[1].peer_messages - before[1].peer_messages == count
+               && stats[2].peer_messages - before[2].peer_messages == count, "A sent each message once to B and C")
+         && ok;
+
+    // spoofed peer links: a peer client id without the peer password or with a wrong one is refused
+    TestClient no_password(first_port + 1, PICOMQTT_PEER_CLIENT_ID_PREFIX "spoof");
+    TestClient wrong_password(first_port + 1, PICOMQTT_PEER_CLIENT_ID_PREFIX "spoof", "spoof", "guess");
+    TestClient right_password(first_port + 1, PICOMQTT_PEER_CLIENT_ID_PREFIX "spoof", "spoof", peer_password);
+    ok = check(!no_password.wait_for_connection(500) && !wrong_password.wait_for_connection(500),
+               "peer client id refused without the peer password") && ok;
+    ok = check(right_password.wait_for_connection(500), "peer client id accepted with the peer password") && ok;
+
+    clients.clear();
+    for (size_t i = 0; i < node_count; ++i) {
+        kill(nodes[i], SIGTERM);
+        waitpid(nodes[i], nullptr, 0);
+    }
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
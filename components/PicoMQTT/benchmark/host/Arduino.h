@@ -0,0 +1,198 @@
+#pragma once
+
+/*
+ * Minimal Arduino core for building PicoMQTT on a Linux PC, see federation_test.cpp.
+ *
+ * Only what the library uses is provided.  ESP32 is defined so that the library takes its ESP32 code paths (WiFi.h,
+ * ESP.getMinFreeHeap()); build with -DPICOMQTT_TLS=0 unless mbedTLS is available.
+ */
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#define ESP32 1
+#define ESP_ARDUINO_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+#define ESP_ARDUINO_VERSION ESP_ARDUINO_VERSION_VAL(3, 0, 0)
+
+#define PROGMEM
+#define PGM_P const char *
+#define HEX 16
+#define DEC 10
+
+class __FlashStringHelper;
+#define F(string) ((const __FlashStringHelper *)(string))
+
+inline void * memcpy_P(void * destination, const void * source, size_t size) { return memcpy(destination, source, size); }
+inline size_t strlen_P(const char * string) { return strlen(string); }
+
+inline unsigned long millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned long micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void yield() {}
+
+inline long random(long max) { return ::random() % max; }
+
+class String {
+    public:
+        String() {}
+        String(const char * value): value(value ? value : "") {}
+        String(int value): value(std::to_string(value)) {}
+        String(long value): value(std::to_string(value)) {}
+        String(unsigned long value): value(std::to_string(value)) {}
+        String(unsigned int value, int base = DEC) {
+            char buffer[16];
+            snprintf(buffer, sizeof(buffer), base == HEX ? "%x" : "%u", value);
+            this->value = buffer;
+        }
+        String(float value, unsigned int decimals = 2) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+            this->value = buffer;
+        }
+
+        const char * c_str() const { return value.c_str(); }
+        size_t length() const { return value.size(); }
+        bool isEmpty() const { return value.empty(); }
+        void reserve(size_t size) { value.reserve(size); }
+
+        bool concat(const char * string) { value.append(string); return true; }
+        bool concat(const char * string, unsigned int size) { value.append(string, size); return true; }
+
+        bool startsWith(const char * prefix) const { return value.compare(0, strlen(prefix), prefix) == 0; }
+        bool startsWith(const String & prefix) const { return startsWith(prefix.c_str()); }
+        int indexOf(char c, unsigned int from = 0) const {
+            const size_t pos = value.find(c, from);
+            return pos == std::string::npos ? -1 : (int) pos;
+        }
+        String substring(unsigned int begin) const { return value.substr(begin).c_str(); }
+        String substring(unsigned int begin, unsigned int end) const { return value.substr(begin, end - begin).c_str(); }
+        long toInt() const { return atol(value.c_str()); }
+        float toFloat() const { return atof(value.c_str()); }
+
+        char operator[](size_t index) const { return value[index]; }
+        String & operator+=(const String & other) { value += other.value; return *this; }
+        String & operator+=(const char * other) { value += other; return *this; }
+        String & operator+=(char other) { value += other; return *this; }
+        friend String operator+(String a, const String & b) { return a += b; }
+        friend String operator+(String a, const char * b) { return a += b; }
+
+        bool operator<(const String & other) const { return value < other.value; }
+        bool operator==(const String & other) const { return value == other.value; }
+        bool operator!=(const String & other) const { return value != other.value; }
+        bool operator==(const char * other) const { return value == other; }
+
+    protected:
+        std::string value;
+};
+
+class Print {
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t value) = 0;
+        virtual size_t write(const uint8_t * buffer, size_t size) {
+            size_t ret = 0;
+            while (size--) {
+                ret += write(*buffer++);
+            }
+            return ret;
+        }
+        size_t write(const char * string) { return write((const uint8_t *) string, strlen(string)); }
+
+        virtual int availableForWrite() { return 0; }
+        virtual void flush() {}
+
+        size_t print(const char * string) { return write(string); }
+        size_t print(const String & string) { return write(string.c_str()); }
+        size_t print(const __FlashStringHelper * string) { return write((const char *) string); }
+        size_t print(unsigned long value, int base = DEC) { return print(String(value)); }
+        size_t println(const char * string = "") { return print(string) + write("\n"); }
+        size_t println(const String & string) { return println(string.c_str()); }
+        size_t println(const __FlashStringHelper * string) { return println((const char *) string); }
+        size_t println(unsigned long value, int base = DEC) { return print(value, base) + write("\n"); }
+
+        size_t printf(const char * format, ...) {
+            char buffer[256];
+            va_list args;
+            va_start(args, format);
+            const int size = vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            return size > 0 ? write((const uint8_t *) buffer, strnlen(buffer, sizeof(buffer))) : 0;
+        }
+};
+
+class Stream: public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        virtual size_t readBytes(char * buffer, size_t size) {
+            size_t ret = 0;
+            for (; ret < size; ++ret) {
+                const int c = read();
+                if (c < 0) {
+                    break;
+                }
+                buffer[ret] = c;
+            }
+            return ret;
+        }
+};
+
+class IPAddress {
+    public:
+        IPAddress() {}
+        IPAddress(uint8_t, uint8_t, uint8_t, uint8_t) {}
+        String toString() const { return "127.0.0.1"; }
+};
+
+class Client: public Stream {
+    public:
+        virtual int connect(IPAddress ip, uint16_t port) = 0;
+        virtual int connect(const char * host, uint16_t port) = 0;
+        virtual size_t write(uint8_t value) = 0;
+        virtual size_t write(const uint8_t * buffer, size_t size) = 0;
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int read(uint8_t * buffer, size_t size) = 0;
+        virtual int peek() = 0;
+        virtual void flush() = 0;
+        virtual void stop() = 0;
+        virtual uint8_t connected() = 0;
+        virtual operator bool() = 0;
+};
+
+// Heap figures are made up, the $SYS topics and heap limits only need some values
+class EspClass {
+    public:
+        uint32_t getFreeHeap() { return 200 * 1024; }
+        uint32_t getMinFreeHeap() { return 150 * 1024; }
+        uint32_t getMaxAllocHeap() { return 100 * 1024; }
+        uint64_t getEfuseMac() { return 0; }
+};
+
+inline EspClass ESP;
+
+class HardwareSerial: public Print {
+    public:
+        void begin(unsigned long baud) {}
+        virtual size_t write(uint8_t value) override { return fwrite(&value, 1, 1, stderr); }
+        virtual size_t write(const uint8_t * buffer, size_t size) override { return fwrite(buffer, 1, size, stderr); }
+};
+
+inline HardwareSerial Serial;
@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * WiFiServer listening on the loopback interface.
+ */
+
+#include <arpa/inet.h>
+
+#include "WiFiClient.h"
+
+class WiFiServer {
+    public:
+        WiFiServer(uint16_t port = 80): port(port) {}
+
+        void begin() {
+            fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            const int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (bind(fd, (sockaddr *) &address, sizeof(address)) || listen(fd, 128)) {
+                perror("WiFiServer");
+                exit(1);
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+
+        WiFiClient accept() {
+            const int client = ::accept(fd, nullptr, nullptr);
+            return client >= 0 ? WiFiClient(client) : WiFiClient();
+        }
+
+        WiFiClient available() { return accept(); }
+
+    protected:
+        const uint16_t port;
+        int fd = -1;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+/*
+ * WiFiClient on top of a non-blocking TCP socket.  Copies share the socket, like on ESP32.
+ */
+
+#include <cerrno>
+#include <memory>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+
+class WiFiClient: public Client {
+    public:
+        WiFiClient() {}
+        explicit WiFiClient(int fd): socket(std::make_shared<Socket>(fd)) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            const int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        virtual int connect(IPAddress ip, uint16_t port) override { return connect(ip.toString().c_str(), port); }
+        virtual int connect(const char * host, uint16_t port) override {
+            stop();
+
+            addrinfo hints = {};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo * result = nullptr;
+            if (getaddrinfo(host, nullptr, &hints, &result) || !result) {
+                return 0;
+            }
+            sockaddr_in address = *(sockaddr_in *) result->ai_addr;
+            address.sin_port = htons(port);
+            freeaddrinfo(result);
+
+            const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (::connect(fd, (sockaddr *) &address, sizeof(address)) < 0) {
+                ::close(fd);
+                return 0;
+            }
+            *this = WiFiClient(fd);
+            return 1;
+        }
+
+        virtual size_t write(uint8_t value) override { return write(&value, 1); }
+        virtual size_t write(const uint8_t * buffer, size_t size) override {
+            size_t done = 0;
+            while (fd() >= 0 && done < size) {
+                const ssize_t ret = ::send(fd(), buffer + done, size - done, MSG_NOSIGNAL);
+                if (ret >= 0) {
+                    done += ret;
+                } else if (errno == EAGAIN) {
+                    usleep(100);
+                } else {
+                    closed = true;
+                    break;
+                }
+            }
+            return done;
+        }
+
+        virtual int availableForWrite() override {
+            int queued = 0;
+            int size = 0;
+            socklen_t length = sizeof(size);
+            if (fd() < 0 || ioctl(fd(), TIOCOUTQ, &queued) || getsockopt(fd(), SOL_SOCKET, SO_SNDBUF, &size, &length)) {
+                return 0;
+            }
+            return size > queued ? size - queued : 0;
+        }
+
+        virtual int available() override {
+            uint8_t value;
+            if (fd() < 0 || !check(::recv(fd(), &value, 1, MSG_PEEK))) {
+                return 0;
+            }
+            int size = 0;
+            ioctl(fd(), FIONREAD, &size);
+            return size > 0 ? size : 1;
+        }
+
+        virtual int read() override {
+            uint8_t value;
+            return read(&value, 1) == 1 ? value : -1;
+        }
+
+        virtual int read(uint8_t * buffer, size_t size) override {
+            if (fd() < 0 || !size) {
+                return 0;
+            }
+            const ssize_t ret = ::recv(fd(), buffer, size, 0);
+            return check(ret) ? ret : (ret ? -1 : 0);
+        }
+
+        virtual int peek() override { return -1; }
+        virtual void flush() override {}
+
+        virtual void stop() override {
+            socket.reset();
+            closed = false;
+        }
+
+        virtual uint8_t connected() override {
+            available();
+            return fd() >= 0 && !closed;
+        }
+
+        virtual operator bool() override { return fd() >= 0; }
+
+    protected:
+        struct Socket {
+            Socket(int fd): fd(fd) {}
+            ~Socket() { ::close(fd); }
+            const int fd;
+        };
+
+        int fd() const { return socket ? socket->fd : -1; }
+
+        // result of recv(), false if there's nothing to read, notes if the peer has closed the connection
+        bool check(ssize_t ret) {
+            if (ret == 0 || (ret < 0 && errno != EAGAIN)) {
+                closed = true;
+            }
+            return ret > 0;
+        }
+
+        std::shared_ptr<Socket> socket;
+        bool closed = false;
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+/*
+ * ESP-IDF logging to stderr.  Debug and verbose messages are dropped.
+ */
+
+#include <cstdio>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do { (void) tag; } while (0)
+#define ESP_LOGV(tag, format, ...) do { (void) tag; } while (0)
@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+ * Minimal FreeRTOS for building application code which uses PicoMQTT on a PC, see bridge_test.cpp.  A tick is a
+ * millisecond.
+ */
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef unsigned int UBaseType_t;
+typedef int BaseType_t;
+typedef void * TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdPASS                  1
+#define portMAX_DELAY           ((TickType_t) 0xffffffff)
+#define pdMS_TO_TICKS(ms)       ((TickType_t) (ms))
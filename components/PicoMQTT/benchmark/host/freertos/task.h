@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+ * Tasks are detached threads, priority and stack size are ignored.
+ */
+
+#include <chrono>
+#include <thread>
+
+#include "FreeRTOS.h"
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char *, uint32_t, void * parameter, UBaseType_t,
+                              TaskHandle_t * handle) {
+    std::thread(function, parameter).detach();
+    if (handle) {
+        *handle = nullptr;
+    }
+    return pdPASS;
+}
+
+inline void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
@@ -0,0 +1,361 @@
+/*
+ * Host test of Journal, the append-only log which keeps queued messages and persistent sessions across restarts,
+ * with a file standing in for the flash partition.
+ *
+ * The file behaves like NOR flash: writes can only clear bits, erasing sets a sector to 0xff.  A workload like the
+ * one of main.cpp appends records (queued messages, acknowledgements and sessions), commits them in groups and calls
+ * loop(), which writes checkpoints and erases obsolete sectors.  After a random number of bytes written, the power is
+ * cut: the write in progress is torn (a prefix is written, the next byte only partially) or the erase in progress
+ * is left half done.  The journal is then opened again, replaying the log, and the recovered state must be the state
+ * after the last commit plus, possibly, some of the records appended after it, in order.  Every run continues on
+ * the file left by the previous one.
+ *
+ * Finally, the time to replay a log filled up to the checkpoint threshold is measured.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../src -o journal_recovery journal_recovery.cpp ../src/PicoMQTT/journal.cpp
+ *
+ * Usage:
+ *   ./journal_recovery [power cuts] [partition file]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "PicoMQTT/journal.h"
+
+namespace {
+
+struct PowerLoss {};
+
+class FileStorage: public PicoMQTT::Journal::Storage {
+    public:
+        FileStorage(const char * path, size_t size, size_t sector_size)
+            : size(size), sector_size(sector_size), budget(SIZE_MAX), violations(0),
+              erase_counts(size / sector_size, 0) {
+            file = fopen(path, "w+b");
+            std::vector<uint8_t> erased(size, 0xff);
+            fwrite(erased.data(), 1, size, file);
+            fflush(file);
+        }
+
+        ~FileStorage() { fclose(file); }
+
+        virtual size_t get_size() const override { return size; }
+        virtual size_t get_sector_size() const override { return sector_size; }
+
+        virtual bool read(size_t offset, void * buffer, size_t length) override {
+            fseek(file, offset, SEEK_SET);
+            return fread(buffer, 1, length, file) == length;
+        }
+
+        virtual bool write(size_t offset, const void * data, size_t length) override {
+            std::vector<uint8_t> current(length);
+            read(offset, current.data(), length);
+            const uint8_t * bytes = (const uint8_t *) data;
+
+            size_t written = length;
+            bool torn = false;
+            if (length > budget) {
+                written = budget;
+                torn = true;
+            }
+            budget -= written;
+
+            for (size_t i = 0; i < written; ++i) {
+                if (~current[i] & bytes[i]) {
+                    // the journal wrote over programmed bits
+                    ++violations;
+                }
+                current[i] &= bytes[i];
+            }
+            if (torn) {
+                // the byte being programmed when the power was cut has only some of its bits cleared
+                current[written] &= bytes[written] | (uint8_t) random();
+            }
+
+            fseek(file, offset, SEEK_SET);
+            fwrite(current.data(), 1, length, file);
+            if (torn) {
+                fflush(file);
+                throw PowerLoss();
+            }
+            return true;
+        }
+
+        virtual bool erase_sector(size_t offset) override {
+            ++erase_counts[offset / sector_size];
+            std::vector<uint8_t> erased(sector_size, 0xff);
+            if (sector_size > budget) {
+                // interrupted erase: only a part of the sector is erased
+                budget = 0;
+                fseek(file, offset, SEEK_SET);
+                fwrite(erased.data(), 1, random() % sector_size, file);
+                fflush(file);
+                throw PowerLoss();
+            }
+            budget -= sector_size;
+            fseek(file, offset, SEEK_SET);
+            fwrite(erased.data(), 1, sector_size, file);
+            return true;
+        }
+
+        const size_t size;
+        const size_t sector_size;
+        size_t budget;              // bytes until the power is cut, erasing counts as a sector
+        unsigned long violations;
+        std::vector<unsigned long> erase_counts;
+
+    protected:
+        FILE * file;
+};
+
+enum RecordType: uint8_t { MESSAGE = 1, ACK = 2, SESSION_SET = 3, SESSION_REMOVE = 4 };
+
+// The state kept in the journal, like MqttJournal: queued messages by queue offset, the acknowledged queue offset
+// and sessions by client
+struct State {
+    std::map<uint32_t, std::string> messages;
+    uint32_t acked = 0;
+    std::map<uint8_t, std::string> sessions;
+
+    bool operator==(const State & other) const {
+        return messages == other.messages && acked == other.acked && sessions == other.sessions;
+    }
+
+    void apply(uint8_t type, const uint8_t * data, size_t size) {
+        uint32_t value = 0;
+        switch (type) {
+            case MESSAGE:
+                memcpy(&value, data, 4);
+                if (value >= acked) {
+                    messages[value] = std::string((const char *) data + 4, size - 4);
+                }
+                break;
+            case ACK:
+                memcpy(&value, data, 4);
+                acked = std::max(acked, value);
+                messages.erase(messages.begin(), messages.lower_bound(acked));
+                break;
+            case SESSION_SET:
+                sessions[data[0]] = std::string((const char *) data + 1, size - 1);
+                break;
+            case SESSION_REMOVE:
+                sessions.erase(data[0]);
+                break;
+        }
+    }
+};
+
+struct Record {
+    uint8_t type;
+    std::string data;
+};
+
+void append(PicoMQTT::Journal & journal, State & state, std::vector<Record> * pending, uint8_t type,
+            const std::string & data) {
+    // records dropped for lack of space are not in the state either
+    if (journal.append(type, data.data(), data.size())) {
+        state.apply(type, (const uint8_t *) data.data(), data.size());
+        if (pending) {
+            pending->push_back(Record{type, data});
+        }
+    }
+}
+
+std::string encode(uint32_t value, const std::string & tail = std::string()) {
+    return std::string((const char *) &value, 4) + tail;
+}
+
+void write_checkpoint(PicoMQTT::Journal & journal, State & state) {
+    State copy = state;
+    for (const auto & kv : copy.sessions) {
+        append(journal, state, nullptr, SESSION_SET, std::string(1, (char) kv.first) + kv.second);
+    }
+    for (const auto & kv : copy.messages) {
+        append(journal, state, nullptr, MESSAGE, encode(kv.first, kv.second));
+    }
+    append(journal, state, nullptr, ACK, encode(copy.acked));
+}
+
+// queue offset of the next message
+uint32_t next_offset(const State & state) {
+    if (state.messages.empty()) {
+        return state.acked;
+    }
+    return state.messages.rbegin()->first + 2 + state.messages.rbegin()->second.size();
+}
+
+void workload(PicoMQTT::Journal & journal, State & state, State & committed, std::vector<Record> & pending,
+              std::mt19937 & random, unsigned long operations) {
+    for (unsigned long i = 0; i < operations; ++i) {
+        const unsigned int choice = random() % 100;
+        if (choice < 55) {
+            // mostly telemetry sized, sometimes bigger than the commit buffer
+            const size_t size = (random() % 20) ? 10 + random() % 300 : 600 + random() % 1400;
+            std::string payload(size, 'a' + random() % 26);
+            payload[0] = (char) random();
+            append(journal, state, &pending, MESSAGE, encode(next_offset(state), payload));
+        } else if (choice < 90) {
+            if (!state.messages.empty()) {
+                auto it = state.messages.begin();
+                for (unsigned int n = random() % 3; n && std::next(it) != state.messages.end(); --n) {
+                    ++it;
+                }
+                append(journal, state, &pending, ACK, encode(it->first + 2 + it->second.size()));
+            }
+        } else if (choice < 97) {
+            const uint8_t client = random() % 16;
+            append(journal, state, &pending, SESSION_SET, std::string(1, (char) client) + "filters/"
+                   + std::to_string(random()));
+        } else {
+            const uint8_t client = random() % 16;
+            append(journal, state, &pending, SESSION_REMOVE, std::string(1, (char) client));
+        }
+
+        // group commit every few records, like the commit interval of MqttJournal
+        if (random() % 8 == 0) {
+            if (journal.commit()) {
+                committed = state;
+                pending.clear();
+            }
+        }
+        journal.loop();
+    }
+}
+
+bool recovered_ok(const State & recovered, const State & committed, const std::vector<Record> & pending) {
+    State candidate = committed;
+    if (recovered == candidate) {
+        return true;
+    }
+    for (const auto & record : pending) {
+        candidate.apply(record.type, (const uint8_t *) record.data.data(), record.data.size());
+        if (recovered == candidate) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const unsigned int power_cuts = argc > 1 ? atoi(argv[1]) : 2000;
+    const char * path = argc > 2 ? argv[2] : "journal_recovery.bin";
+
+    // a quarter of the espflash partition, so that the log wraps around often
+    FileStorage storage(path, 256 * 1024, 4096);
+    std::mt19937 random(1);
+
+    State state;
+    State committed;
+    std::vector<Record> pending;
+    unsigned long failures = 0;
+    unsigned long replayed = 0;
+    unsigned long corrupted = 0;
+    unsigned long appended = 0;
+    unsigned long commits = 0;
+    unsigned long checkpoints = 0;
+    unsigned long bytes_written = 0;
+
+    for (unsigned int run = 0; run <= power_cuts; ++run) {
+        storage.budget = (run < power_cuts) ? random() % (96 * 1024) : SIZE_MAX;
+
+        PicoMQTT::Journal journal(storage, 512);
+        State recovered;
+        if (!journal.begin([&recovered](uint8_t type, const uint8_t * data, size_t size) {
+            recovered.apply(type, data, size);
+        })) {
+            printf("begin() failed\n");
+            return 1;
+        }
+
+        if (!recovered_ok(recovered, committed, pending)) {
+            ++failures;
+            printf("run %u: recovered %u messages, acked %u, %u sessions; committed %u messages, acked %u, "
+                   "%u sessions, %u pending\n", run, (unsigned int) recovered.messages.size(), recovered.acked,
+                   (unsigned int) recovered.sessions.size(), (unsigned int) committed.messages.size(),
+                   committed.acked, (unsigned int) committed.sessions.size(), (unsigned int) pending.size());
+        }
+
+        state = recovered;
+        committed = recovered;
+        pending.clear();
+
+        try {
+            journal.checkpoint_callback = [&] {
+                // checkpoint() committed everything appended before
+                committed = state;
+                pending.clear();
+                write_checkpoint(journal, state);
+            };
+            // like MqttJournal::Begin(), drop the records which don't apply anymore right away
+            journal.checkpoint();
+            workload(journal, state, committed, pending, random, run < power_cuts ? 1000000 : 20000);
+            if (journal.commit()) {
+                committed = state;
+                pending.clear();
+            }
+        } catch (const PowerLoss &) {
+        }
+
+        replayed += journal.get_stats().replayed;
+        corrupted += journal.get_stats().corrupted;
+        appended += journal.get_stats().appended;
+        commits += journal.get_stats().commits;
+        checkpoints += journal.get_stats().checkpoints;
+        bytes_written += journal.get_stats().bytes_written;
+    }
+
+    // replay of a log grown up to the checkpoint threshold
+    double replay_ms = 0;
+    unsigned long replay_records = 0;
+    {
+        PicoMQTT::Journal journal(storage, 512);
+        journal.begin([](uint8_t, const uint8_t *, size_t) {});
+        journal.checkpoint_callback = [&] { write_checkpoint(journal, state); };
+        journal.checkpoint();
+        while (journal.get_used_sectors() + 1 < journal.get_sector_count() / 2) {
+            workload(journal, state, committed, pending, random, 100);
+        }
+        journal.commit();
+
+        PicoMQTT::Journal reopened(storage, 512);
+        State recovered;
+        const auto start = std::chrono::steady_clock::now();
+        reopened.begin([&recovered](uint8_t type, const uint8_t * data, size_t size) {
+            recovered.apply(type, data, size);
+        });
+        replay_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        replay_records = reopened.get_stats().replayed;
+        if (!(recovered == state)) {
+            ++failures;
+            printf("full replay: state mismatch\n");
+        }
+    }
+
+    const auto wear = std::minmax_element(storage.erase_counts.begin(), storage.erase_counts.end());
+    printf("power cuts:      %u, %lu records replayed, %lu corrupted records skipped\n", power_cuts, replayed,
+           corrupted);
+    printf("appended:        %lu records in %lu commits (%.1f records per flash write)\n", appended, commits,
+           (double) appended / commits);
+    printf("written:         %lu bytes, %lu checkpoints\n", bytes_written, checkpoints);
+    printf("sector erases:   min %lu, max %lu\n", *wear.first, *wear.second);
+    printf("full replay:     %lu records, %u sectors in %.2f ms\n", replay_records,
+           (unsigned int)(storage.get_size() / storage.get_sector_size() / 2), replay_ms);
+    printf("flash semantics: %lu writes over programmed bits\n", storage.violations);
+    printf("failures:        %lu\n", failures);
+
+    const bool ok = !failures && !storage.violations;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    remove(path);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,693 @@
+/*
+ * In-process MQTT load generator.
+ *
+ * Drives thousands of simulated MQTT 3.1.1 clients from a single thread using non-blocking sockets and epoll, so
+ * that the broker -- not the benchmark -- is the bottleneck.  Linux only.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -o loadgen loadgen.cpp
+ *
+ * Usage examples:
+ *   ./loadgen --profile=connect-storm --clients=2000
+ *   ./loadgen --profile=telemetry --publishers=200 --rate=10 --subscribers=5
+ *   ./loadgen --profile=wildcard --publishers=100 --rate=20 --subscribers=20
+ *   ./loadgen --profile=slow --publishers=50 --rate=50 --subscribers=10 --slow=2 --slow-rate=512
+ *   ./loadgen --profile=telemetry --port=1883 --subscriber-port=1884
+ *   ./loadgen --profile=wildcard --publishers=20 --rate=100 --subscribers=4 --share=workers
+ *
+ * Publishers embed a monotonic timestamp in each payload, subscribers use it to compute end-to-end latency.  All
+ * clients live in the same process, so the clocks are the same.  When simulating many clients, raise the open file
+ * limit first (ulimit -n).
+ *
+ * With --subscriber-port, subscribers connect to a different broker on the same host than publishers, e.g. to
+ * measure delivery between two FederatedServer peers.  With --share, subscribers join a shared subscription group
+ * ($share/<group>/<filter>) and the number of messages delivered to each of them is reported.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 1883;
+    uint16_t subscriber_port = 0;       // same as port if zero
+    std::string profile = "telemetry";
+    unsigned int clients = 1000;        // connect-storm only
+    unsigned int publishers = 100;
+    unsigned int subscribers = 5;
+    unsigned int slow = 0;              // number of subscribers which read slowly
+    double rate = 10;                   // messages per second per publisher
+    double slow_rate = 1024;            // bytes per second read by slow subscribers
+    unsigned int size = 16;             // payload size, at least 8 bytes for the timestamp
+    double duration = 10;               // seconds
+    bool wildcard = false;
+    std::string share;                  // shared subscription group name
+    bool csv = false;
+};
+
+class Histogram {
+    public:
+        void add(uint64_t value) { samples.push_back(value); }
+        size_t count() const { return samples.size(); }
+
+        double percentile(double p) {
+            if (samples.empty()) {
+                return 0;
+            }
+            if (!sorted) {
+                std::sort(samples.begin(), samples.end());
+                sorted = true;
+            }
+            const size_t index = std::min(samples.size() - 1, (size_t)((samples.size() - 1) * p / 100.0 + 0.5));
+            return samples[index];
+        }
+
+    protected:
+        std::vector<uint64_t> samples;
+        bool sorted = false;
+};
+
+struct Stats {
+    uint64_t connects_started = 0;
+    uint64_t connects_accepted = 0;
+    uint64_t connects_failed = 0;
+    uint64_t connects_refused = 0;      // CONNACK with a non-zero return code, also counted as failed
+    uint64_t published = 0;
+    uint64_t delivered = 0;
+    uint64_t delivered_bytes = 0;
+    Histogram connect_latency;
+    Histogram delivery_latency;
+};
+
+class Connection {
+    public:
+        enum class Role { storm, publisher, subscriber };
+        enum class State { connecting, wait_connack, wait_suback, ready, closed };
+
+        Connection(Role role, unsigned int index): role(role), index(index) {}
+
+        Role role;
+        unsigned int index;
+        State state = State::connecting;
+        int fd = -1;
+        bool want_write = false;
+        bool slow = false;
+
+        uint64_t connect_started_ns = 0;
+        uint64_t delivered = 0;
+        uint64_t next_publish_ns = 0;
+
+        // read throttling for slow consumers
+        double read_budget = 0;
+        uint64_t last_budget_update_ns = 0;
+
+        std::vector<uint8_t> inbox;
+        std::vector<uint8_t> outbox;
+        size_t outbox_pos = 0;
+};
+
+// packet encoding
+
+void write_u16(std::vector<uint8_t> & out, uint16_t value) {
+    out.push_back(value >> 8);
+    out.push_back(value & 0xff);
+}
+
+void write_string(std::vector<uint8_t> & out, const std::string & str) {
+    write_u16(out, str.size());
+    out.insert(out.end(), str.begin(), str.end());
+}
+
+void write_packet(std::vector<uint8_t> & out, uint8_t head, const std::vector<uint8_t> & body) {
+    out.push_back(head);
+    size_t length = body.size();
+    do {
+        const uint8_t digit = length & 127;
+        length >>= 7;
+        out.push_back(digit | (length ? 0x80 : 0));
+    } while (length);
+    out.insert(out.end(), body.begin(), body.end());
+}
+
+void encode_connect(std::vector<uint8_t> & out, const std::string & client_id) {
+    std::vector<uint8_t> body;
+    write_string(body, "MQTT");
+    body.push_back(4);          // protocol level
+    body.push_back(0b10);       // clean session
+    write_u16(body, 0);         // no keep alive
+    write_string(body, client_id);
+    write_packet(out, 0x10, body);
+}
+
+void encode_subscribe(std::vector<uint8_t> & out, const std::string & topic_filter) {
+    std::vector<uint8_t> body;
+    write_u16(body, 1);
+    write_string(body, topic_filter);
+    body.push_back(0);
+    write_packet(out, 0x82, body);
+}
+
+void encode_publish(std::vector<uint8_t> & out, const std::string & topic, unsigned int size) {
+    std::vector<uint8_t> body;
+    write_string(body, topic);
+    const uint64_t timestamp = now_ns();
+    for (int i = 7; i >= 0; --i) {
+        body.push_back((timestamp >> (8 * i)) & 0xff);
+    }
+    body.resize(body.size() + (size > 8 ? size - 8 : 0), '0');
+    write_packet(out, 0x30, body);
+}
+
+class LoadGenerator {
+    public:
+        LoadGenerator(const Options & options): options(options) {
+            epoll_fd = epoll_create1(0);
+        }
+
+        ~LoadGenerator() {
+            for (auto & connection : connections) {
+                if (connection.fd >= 0) {
+                    close(connection.fd);
+                }
+            }
+            close(epoll_fd);
+        }
+
+        bool run();
+        void report();
+
+    protected:
+        bool resolve();
+        void open(Connection & connection);
+        void close_connection(Connection & connection, bool failed);
+        void update_events(Connection & connection);
+        void send(Connection & connection);
+        void flush(Connection & connection);
+        void receive(Connection & connection);
+        void handle_packet(Connection & connection, uint8_t head, const uint8_t * body, size_t size);
+        void tick(uint64_t now);
+
+        std::string publish_topic(unsigned int index) const {
+            return "loadgen/" + std::to_string(index) + "/telemetry";
+        }
+
+        const Options & options;
+        int epoll_fd;
+        sockaddr_in address;
+        sockaddr_in subscriber_address;
+        std::vector<Connection> connections;
+        Stats stats;
+        uint64_t started_ns = 0;
+        uint64_t measure_from_ns = 0;
+        uint64_t finished_ns = 0;
+};
+
+bool LoadGenerator::resolve() {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo * result = nullptr;
+    if (getaddrinfo(options.host.c_str(), nullptr, &hints, &result) != 0 || !result) {
+        fprintf(stderr, "Unable to resolve %s\n", options.host.c_str());
+        return false;
+    }
+    address = *(sockaddr_in *) result->ai_addr;
+    address.sin_port = htons(options.port);
+    subscriber_address = address;
+    if (options.subscriber_port) {
+        subscriber_address.sin_port = htons(options.subscriber_port);
+    }
+    freeaddrinfo(result);
+    return true;
+}
+
+void LoadGenerator::open(Connection & connection) {
+    connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (connection.fd < 0) {
+        ++stats.connects_failed;
+        connection.state = Connection::State::closed;
+        return;
+    }
+
+    const int one = 1;
+    setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connection.slow) {
+        // keep the kernel receive buffer small, so that slow reading actually creates backpressure on the broker
+        const int size = 4096;
+        setsockopt(connection.fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    connection.connect_started_ns = now_ns();
+    ++stats.connects_started;
+
+    const sockaddr_in & target = connection.role == Connection::Role::subscriber ? subscriber_address : address;
+    if ((connect(connection.fd, (sockaddr *) &target, sizeof(target)) < 0) && (errno != EINPROGRESS)) {
+        close_connection(connection, true);
+        return;
+    }
+
+    // slow consumers are not woken up by epoll, they get polled in tick() instead
+    epoll_event event = {};
+    event.events = (connection.slow ? 0u : (uint32_t) EPOLLIN) | EPOLLOUT;
+    event.data.u32 = &connection - connections.data();
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection.fd, &event);
+    connection.want_write = true;
+}
+
+void LoadGenerator::close_connection(Connection & connection, bool failed) {
+    if (connection.state == Connection::State::closed) {
+        return;
+    }
+    if (failed && connection.state != Connection::State::ready) {
+        ++stats.connects_failed;
+    }
+    if (connection.fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+        close(connection.fd);
+        connection.fd = -1;
+    }
+    connection.state = Connection::State::closed;
+}
+
+void LoadGenerator::update_events(Connection & connection) {
+    const bool want_write = connection.outbox_pos < connection.outbox.size()
+                            || connection.state == Connection::State::connecting;
+    if (want_write == connection.want_write) {
+        return;
+    }
+    epoll_event event = {};
+    event.events = (connection.slow ? 0u : (uint32_t) EPOLLIN) | (want_write ? (uint32_t) EPOLLOUT : 0u);
+    event.data.u32 = &connection - connections.data();
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.want_write = want_write;
+}
+
+void LoadGenerator::flush(Connection & connection) {
+    while (connection.outbox_pos < connection.outbox.size()) {
+        const ssize_t ret = ::send(connection.fd, connection.outbox.data() + connection.outbox_pos,
+                                   connection.outbox.size() - connection.outbox_pos, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_connection(connection, true);
+                return;
+            }
+            break;
+        }
+        connection.outbox_pos += ret;
+    }
+
+    if (connection.outbox_pos >= connection.outbox.size()) {
+        connection.outbox.clear();
+        connection.outbox_pos = 0;
+    }
+
+    update_events(connection);
+}
+
+void LoadGenerator::send(Connection & connection) {
+    if (connection.state == Connection::State::connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error) {
+            close_connection(connection, true);
+            return;
+        }
+        connection.state = Connection::State::wait_connack;
+        encode_connect(connection.outbox, "loadgen-" + std::to_string(&connection - connections.data()));
+    }
+    flush(connection);
+}
+
+void LoadGenerator::receive(Connection & connection) {
+    uint8_t buffer[16 * 1024];
+    size_t budget = sizeof(buffer);
+
+    if (connection.slow) {
+        const uint64_t now = now_ns();
+        connection.read_budget += (now - connection.last_budget_update_ns) * 1e-9 * options.slow_rate;
+        connection.read_budget = std::min(connection.read_budget, (double) sizeof(buffer));
+        connection.last_budget_update_ns = now;
+        budget = (size_t) connection.read_budget;
+        if (!budget) {
+            return;
+        }
+    }
+
+    const ssize_t ret = recv(connection.fd, buffer, budget, 0);
+    if (ret == 0) {
+        close_connection(connection, true);
+        return;
+    }
+    if (ret < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            close_connection(connection, true);
+        }
+        return;
+    }
+
+    if (connection.slow) {
+        connection.read_budget -= ret;
+    }
+
+    auto & inbox = connection.inbox;
+    inbox.insert(inbox.end(), buffer, buffer + ret);
+
+    size_t pos = 0;
+    while (connection.state != Connection::State::closed) {
+        // decode fixed header
+        if (inbox.size() - pos < 2) {
+            break;
+        }
+        size_t length = 0;
+        size_t header_size = 1;
+        bool complete = false;
+        for (unsigned int shift = 0; header_size < inbox.size() - pos && shift < 28; shift += 7) {
+            const uint8_t digit = inbox[pos + header_size++];
+            length |= (size_t)(digit & 0x7f) << shift;
+            if (!(digit & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete || inbox.size() - pos < header_size + length) {
+            break;
+        }
+        handle_packet(connection, inbox[pos], inbox.data() + pos + header_size, length);
+        pos += header_size + length;
+    }
+    inbox.erase(inbox.begin(), inbox.begin() + pos);
+}
+
+void LoadGenerator::handle_packet(Connection & connection, uint8_t head, const uint8_t * body, size_t size) {
+    const uint64_t now = now_ns();
+    switch (head & 0xf0) {
+        case 0x20:  // CONNACK
+            if (size != 2 || body[1] != 0) {
+                if (size == 2) {
+                    ++stats.connects_refused;
+                }
+                close_connection(connection, true);
+                return;
+            }
+            ++stats.connects_accepted;
+            stats.connect_latency.add(now - connection.connect_started_ns);
+            if (connection.role == Connection::Role::subscriber) {
+                connection.state = Connection::State::wait_suback;
+                const std::string prefix = options.share.empty() ? "" : "$share/" + options.share + "/";
+                if (options.wildcard) {
+                    encode_subscribe(connection.outbox, prefix + "loadgen/#");
+                } else {
+                    for (unsigned int i = 0; i < options.publishers; ++i) {
+                        encode_subscribe(connection.outbox, prefix + publish_topic(i));
+                    }
+                }
+                flush(connection);
+            } else {
+                connection.state = Connection::State::ready;
+                connection.next_publish_ns = now;
+            }
+            break;
+
+        case 0x90:  // SUBACK
+            connection.state = Connection::State::ready;
+            break;
+
+        case 0x30: {  // PUBLISH
+            if (size < 2) {
+                return;
+            }
+            const size_t topic_size = (body[0] << 8) | body[1];
+            const size_t payload_offset = 2 + topic_size + ((head & 0b0110) ? 2 : 0);
+            if (payload_offset + 8 > size) {
+                return;
+            }
+            uint64_t timestamp = 0;
+            for (int i = 0; i < 8; ++i) {
+                timestamp = (timestamp << 8) | body[payload_offset + i];
+            }
+            if (timestamp >= measure_from_ns) {
+                ++stats.delivered;
+                ++connection.delivered;
+                stats.delivered_bytes += size;
+                stats.delivery_latency.add(now - timestamp);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void LoadGenerator::tick(uint64_t now) {
+    for (auto & connection : connections) {
+        if (connection.slow && connection.state != Connection::State::closed
+                && connection.state != Connection::State::connecting) {
+            receive(connection);
+        }
+    }
+
+    if (options.rate <= 0) {
+        return;
+    }
+    const uint64_t interval = 1e9 / options.rate;
+    for (auto & connection : connections) {
+        if (connection.role != Connection::Role::publisher || connection.state != Connection::State::ready) {
+            continue;
+        }
+        if (connection.outbox.size() - connection.outbox_pos > 64 * 1024) {
+            // the broker does not keep up, don't queue infinitely
+            continue;
+        }
+        bool published = false;
+        while (connection.next_publish_ns <= now) {
+            encode_publish(connection.outbox, publish_topic(connection.index), options.size);
+            connection.next_publish_ns += interval;
+            if (connection.next_publish_ns >= measure_from_ns) {
+                ++stats.published;
+            }
+            published = true;
+        }
+        if (published) {
+            flush(connection);
+        }
+    }
+}
+
+bool LoadGenerator::run() {
+    if (!resolve()) {
+        return false;
+    }
+
+    if (options.profile == "connect-storm") {
+        for (unsigned int i = 0; i < options.clients; ++i) {
+            connections.emplace_back(Connection::Role::storm, i);
+        }
+    } else {
+        // subscribers first, so that they are ready when publishing starts
+        for (unsigned int i = 0; i < options.subscribers; ++i) {
+            connections.emplace_back(Connection::Role::subscriber, i);
+            connections.back().slow = i < options.slow;
+        }
+        for (unsigned int i = 0; i < options.publishers; ++i) {
+            connections.emplace_back(Connection::Role::publisher, i);
+        }
+    }
+
+    started_ns = now_ns();
+    for (auto & connection : connections) {
+        connection.last_budget_update_ns = started_ns;
+        open(connection);
+    }
+
+    // give subscribers one second to connect and subscribe before measuring
+    measure_from_ns = options.profile == "connect-storm" ? started_ns : started_ns + 1000000000ull;
+    const uint64_t deadline = measure_from_ns + (uint64_t)(options.duration * 1e9);
+
+    std::vector<epoll_event> events(1024);
+    while (true) {
+        const uint64_t now = now_ns();
+        if (now >= deadline) {
+            break;
+        }
+
+        if (options.profile == "connect-storm" &&
+                stats.connects_accepted + stats.connects_failed >= connections.size()) {
+            break;
+        }
+
+        const int count = epoll_wait(epoll_fd, events.data(), events.size(), 1);
+        for (int i = 0; i < count; ++i) {
+            Connection & connection = connections[events[i].data.u32];
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_connection(connection, true);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                send(connection);
+            }
+            if ((events[i].events & EPOLLIN) && connection.state != Connection::State::closed) {
+                receive(connection);
+            }
+        }
+
+        tick(now_ns());
+    }
+    finished_ns = now_ns();
+
+    return true;
+}
+
+void LoadGenerator::report() {
+    const double elapsed = (finished_ns - measure_from_ns) * 1e-9;
+    const double ms = 1e-6;
+
+    if (options.csv) {
+        printf("profile\tclients\tpublishers\tsubscribers\tconnects/s\tpublished/s\tdelivered/s\t"
+               "connect p50 [ms]\tconnect p99 [ms]\tlatency p50 [ms]\tlatency p90 [ms]\tlatency p99 [ms]\t"
+               "latency max [ms]\n");
+        printf("%s\t%u\t%u\t%u\t%.1f\t%.1f\t%.1f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n",
+               options.profile.c_str(), (unsigned int) connections.size(), options.publishers, options.subscribers,
+               stats.connects_accepted / elapsed, stats.published / elapsed, stats.delivered / elapsed,
+               stats.connect_latency.percentile(50) * ms, stats.connect_latency.percentile(99) * ms,
+               stats.delivery_latency.percentile(50) * ms, stats.delivery_latency.percentile(90) * ms,
+               stats.delivery_latency.percentile(99) * ms, stats.delivery_latency.percentile(100) * ms);
+        return;
+    }
+
+    printf("profile:            %s\n", options.profile.c_str());
+    printf("elapsed:            %.2f s\n", elapsed);
+    printf("connections:        %llu accepted, %llu failed (%llu refused by the broker), %.1f/s\n",
+           (unsigned long long) stats.connects_accepted, (unsigned long long) stats.connects_failed,
+           (unsigned long long) stats.connects_refused, stats.connects_accepted / elapsed);
+    printf("connect latency:    p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           stats.connect_latency.percentile(50) * ms, stats.connect_latency.percentile(90) * ms,
+           stats.connect_latency.percentile(99) * ms, stats.connect_latency.percentile(100) * ms);
+
+    if (options.profile == "connect-storm") {
+        return;
+    }
+
+    printf("published:          %llu msg, %.1f msg/s\n",
+           (unsigned long long) stats.published, stats.published / elapsed);
+    printf("delivered:          %llu msg, %.1f msg/s, %.1f kB/s\n",
+           (unsigned long long) stats.delivered, stats.delivered / elapsed,
+           stats.delivered_bytes / elapsed / 1024);
+    printf("delivery latency:   p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           stats.delivery_latency.percentile(50) * ms, stats.delivery_latency.percentile(90) * ms,
+           stats.delivery_latency.percentile(99) * ms, stats.delivery_latency.percentile(100) * ms);
+
+    if (!options.share.empty()) {
+        printf("per subscriber:    ");
+        for (const auto & connection : connections) {
+            if (connection.role == Connection::Role::subscriber) {
+                printf(" %llu", (unsigned long long) connection.delivered);
+            }
+        }
+        printf("\n");
+    }
+}
+
+bool parse_options(int argc, char ** argv, Options & options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string name = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--host") {
+            options.host = value;
+        } else if (name == "--port") {
+            options.port = atoi(value.c_str());
+        } else if (name == "--subscriber-port") {
+            options.subscriber_port = atoi(value.c_str());
+        } else if (name == "--profile") {
+            options.profile = value;
+        } else if (name == "--clients") {
+            options.clients = atoi(value.c_str());
+        } else if (name == "--publishers") {
+            options.publishers = atoi(value.c_str());
+        } else if (name == "--subscribers") {
+            options.subscribers = atoi(value.c_str());
+        } else if (name == "--slow") {
+            options.slow = atoi(value.c_str());
+        } else if (name == "--rate") {
+            options.rate = atof(value.c_str());
+        } else if (name == "--slow-rate") {
+            options.slow_rate = atof(value.c_str());
+        } else if (name == "--size") {
+            options.size = atoi(value.c_str());
+        } else if (name == "--duration") {
+            options.duration = atof(value.c_str());
+        } else if (name == "--wildcard") {
+            options.wildcard = true;
+        } else if (name == "--share") {
+            options.share = value;
+        } else if (name == "--csv") {
+            options.csv = true;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (options.profile == "wildcard") {
+        options.wildcard = true;
+    } else if (options.profile == "slow") {
+        if (!options.slow) {
+            options.slow = 1;
+        }
+    } else if (options.profile != "telemetry" && options.profile != "connect-storm") {
+        fprintf(stderr, "Unknown profile: %s\n", options.profile.c_str());
+        return false;
+    }
+
+    options.slow = std::min(options.slow, options.subscribers);
+    return true;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        fprintf(stderr, "Usage: %s [--host=127.0.0.1] [--port=1883] [--subscriber-port=PORT] "
+                "[--profile=connect-storm|telemetry|wildcard|slow] [--clients=N] [--publishers=N] [--subscribers=N] "
+                "[--slow=N] [--rate=MSG_PER_S] [--slow-rate=BYTES_PER_S] [--size=BYTES] [--duration=S] "
+                "[--wildcard] [--share=GROUP] [--csv]\n", argv[0]);
+        return 1;
+    }
+
+    LoadGenerator generator(options);
+    if (!generator.run()) {
+        return 1;
+    }
+    generator.report();
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Host benchmark of RuleEngine, which evaluates alarm conditions on incoming messages.
+ *
+ * First, a few rules are checked against expected alarm and clear events: plain thresholds, compound conditions,
+ * hold times expiring with and without new messages, keys kept apart by the wildcards and invalid conditions.
+ *
+ * Then the cost per message is measured with 100 rules: 5 rules (a mix of plain thresholds, ranges and hold times)
+ * on each of 20 BMS metrics, fed with messages of 4 packs with random values.  For comparison, the cost of only
+ * finding the matching rules by checking every filter, as an engine without the index would, is measured too.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../src -o rule_engine_bench rule_engine_bench.cpp ../src/PicoMQTT/rule_engine.cpp \
+ *       ../src/PicoMQTT/topic_matcher.cpp
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "PicoMQTT/rule_engine.h"
+
+namespace {
+
+std::string events;
+
+void record(const char * name, const char * topic, bool active, float value) {
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%s%s:%s=%g;", active ? "+" : "-", name, topic, value);
+    events += buffer;
+}
+
+bool expect(const char * what, const std::string & expected) {
+    const bool ok = events == expected;
+    if (!ok) {
+        printf("FAILED %s:\n  expected %s\n  got      %s\n", what, expected.c_str(), events.c_str());
+    }
+    events.clear();
+    return ok;
+}
+
+bool check() {
+    bool ok = true;
+
+    PicoMQTT::RuleEngine engine(2);
+    engine.event_callback = record;
+
+    for (const char * condition : {"", "value >", "value = 6", "values > 1", "(value > 1", "value > 1 for",
+                                   "value > 1 for 5", "value > 1 2", "1 + + 2"}) {
+        if (engine.add("bad", "x", condition)) {
+            printf("FAILED: accepted invalid condition '%s'\n", condition);
+            ok = false;
+        }
+    }
+
+    ok = engine.add("high", "bms/+/cellvmax", "value > 3.65") && ok;
+    ok = engine.add("range", "bms/+/temp", "value < -(10 + 10) or not (value <= 45)") && ok;
+    ok = engine.add("state", "bms/+/chstate", "value == 6 for 5s") && ok;
+    ok = engine.add("scaled", "bms/#", "value * 2 / 4 - 1 >= 100 and value != 300") && ok;
+    if (!ok) {
+        printf("FAILED: valid condition rejected\n");
+        return false;
+    }
+
+    engine.ingest("bms/1/cellvmax", "3.6", 0);
+    engine.ingest("bms/1/cellvmax", "3.7", 1);
+    engine.ingest("bms/1/cellvmax", "3.8", 2);
+    engine.ingest("bms/2/cellvmax", "3.9", 3);
+    engine.ingest("bms/1/cellvmax", "3.65", 4);
+    ok = expect("threshold", "+high:bms/1/cellvmax=3.7;+high:bms/2/cellvmax=3.9;-high:bms/1/cellvmax=3.65;") && ok;
+
+    engine.ingest("bms/1/temp", "-25", 0);
+    engine.ingest("bms/1/temp", "20", 1);
+    engine.ingest("bms/1/temp", "46", 2);
+    engine.ingest("bms/1/temp", "45", 3);
+    engine.ingest("bms/1/temp", "abc", 4);
+    ok = expect("compound", "+range:bms/1/temp=-25;-range:bms/1/temp=20;+range:bms/1/temp=46;-range:bms/1/temp=45;")
+         && ok;
+
+    // held by messages
+    engine.ingest("bms/1/chstate", "6", 1000);
+    engine.ingest("bms/1/chstate", "6", 5999);
+    ok = expect("hold pending", "") && ok;
+    engine.ingest("bms/1/chstate", "6", 6000);
+    ok = expect("hold expired", "+state:bms/1/chstate=6;") && ok;
+    // interrupted before the hold time
+    engine.ingest("bms/1/chstate", "2", 7000);
+    engine.ingest("bms/1/chstate", "6", 8000);
+    engine.ingest("bms/1/chstate", "1", 12000);
+    engine.ingest("bms/1/chstate", "6", 13000);
+    engine.loop(17999);
+    ok = expect("hold interrupted", "-state:bms/1/chstate=2;") && ok;
+    // expired in loop() without a message
+    engine.loop(18000);
+    engine.loop(19000);
+    ok = expect("hold in loop", "+state:bms/1/chstate=6;") && ok;
+
+    // the '#' rule matched all of the above, only the first two keys were kept, rules fire in the order of adding
+    engine.ingest("bms/3/x", "250", 0);
+    engine.ingest("bms/1/cellvmax", "202", 0);
+    engine.ingest("bms/1/cellvmax", "300", 0);
+    ok = expect("multi level", "+high:bms/1/cellvmax=202;+scaled:bms/1/cellvmax=202;-scaled:bms/1/cellvmax=300;") && ok;
+
+    const auto & stats = engine.get_stats();
+    if (stats.not_numeric != 1 || stats.dropped_keys == 0) {
+        printf("FAILED: stats not_numeric %lu, dropped keys %lu\n", stats.not_numeric, stats.dropped_keys);
+        ok = false;
+    }
+    return ok;
+}
+
+void measure(unsigned long messages) {
+    static const char * const metrics[] = {
+        "socofpack", "voltageofpack", "currentofpack", "cellvmax", "cellvmin", "celltmax", "celltmin", "bmschstate",
+        "bmsdschstate", "cellvdiff", "powerofpack", "capacity", "cycles", "soh", "balancing", "fet", "heater",
+        "fan", "alarms", "uptime",
+    };
+    static const char * const conditions[] = {
+        "value > 80", "value < 10", "value < 5 or value > 95", "value == 50 for 5s", "not (value >= 20 and value <= 60)",
+    };
+
+    PicoMQTT::RuleEngine engine(8);
+    PicoMQTT::TopicFilterSet filters;
+    unsigned long events_count = 0;
+    engine.event_callback = [&events_count](const char *, const char *, bool, float) { ++events_count; };
+
+    for (const char * metric : metrics) {
+        const std::string filter = std::string("emkit/+/+/") + metric;
+        for (const char * condition : conditions) {
+            engine.add(metric, filter.c_str(), condition);
+            filters.add(filter.c_str());
+        }
+    }
+
+    std::mt19937 random(1);
+    std::vector<std::string> topics;
+    std::vector<std::string> payloads;
+    for (size_t i = 0; i < 4096; ++i) {
+        topics.push_back(std::string("emkit/bms/") + std::to_string(random() % 4) + "/"
+                         + metrics[random() % (sizeof(metrics) / sizeof(metrics[0]))]);
+        payloads.push_back(std::to_string(random() % 100));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < messages; ++i) {
+        engine.ingest(topics[i % topics.size()].c_str(), payloads[i % payloads.size()].c_str(), i);
+        engine.loop(i);
+    }
+    const double engine_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+                             / messages;
+
+    unsigned long matched = 0;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < messages; ++i) {
+        const PicoMQTT::TopicTokens tokens(topics[i % topics.size()].c_str());
+        for (size_t rule = 0; rule < filters.size(); ++rule) {
+            matched += filters.matches(rule, tokens);
+        }
+    }
+    const double scan_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+                           / messages;
+
+    const auto & stats = engine.get_stats();
+    printf("%u rules, %.1f evaluated per message\n", (unsigned) engine.get_rule_count(),
+           (double) stats.evaluated / stats.messages);
+    printf("engine:             %8.1f ns/message, %lu events, %u bytes\n", engine_ns, events_count,
+           (unsigned) engine.get_memory_usage());
+    printf("filter scan only:   %8.1f ns/message, %lu matches\n", scan_ns, matched);
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const unsigned long messages = argc > 1 ? atol(argv[1]) : 1000000;
+
+    if (!check()) {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    measure(messages);
+    printf("OK\n");
+    return 0;
+}
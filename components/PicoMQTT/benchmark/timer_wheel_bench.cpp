@@ -0,0 +1,192 @@
+/*
+ * Host benchmark of TimerWheel, which tracks the keep-alive and CONNECT deadlines of broker connections.
+ *
+ * First, the wheel is cross-checked against a sorted reference: timers with random deadlines (up to beyond the
+ * range of the wheel) are scheduled, rescheduled from their callbacks and cancelled while the time advances in
+ * random steps, and every timer must fire in the first advance() whose time reaches its deadline.
+ *
+ * Then the cost of one broker loop iteration is measured for idle connections: the previous implementation, which
+ * compared the time since the last read with the keep-alive of every connection on every iteration, vs. the wheel,
+ * where each connection has a timer and the loop only advances the wheel.  The simulated loop runs every
+ * millisecond, connections use a 60 s keep-alive and send a PINGREQ every 45 s.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../src -o timer_wheel_bench timer_wheel_bench.cpp ../src/PicoMQTT/timer_wheel.cpp
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "PicoMQTT/timer_wheel.h"
+
+namespace {
+
+bool check(unsigned int timers, unsigned long steps, unsigned int seed) {
+    std::mt19937 random(seed);
+    unsigned long now = 0xfffff000ul - random() % 100000;  // cross the 32-bit wrap-around on the way
+    PicoMQTT::TimerWheel wheel(now);
+
+    std::vector<std::unique_ptr<PicoMQTT::TimerWheel::Timer>> pool;
+    std::map<const PicoMQTT::TimerWheel::Timer *, unsigned long> expected;
+    unsigned long errors = 0;
+    unsigned long fired = 0;
+
+    auto random_delay = [&random]() -> unsigned long {
+        switch (random() % 4) {
+            case 0: return random() % 70;
+            case 1: return random() % 5000;
+            case 2: return random() % 400000;
+            default: return random() % 30000000;  // beyond the range of the wheel
+        }
+    };
+
+    for (unsigned int i = 0; i < timers; ++i) {
+        pool.emplace_back(new PicoMQTT::TimerWheel::Timer());
+        PicoMQTT::TimerWheel::Timer * timer = pool.back().get();
+        timer->callback = [&, timer] {
+            auto it = expected.find(timer);
+            if ((it == expected.end()) || ((long)(now - it->second) < 0)) {
+                ++errors;
+            }
+            expected.erase(timer);
+            ++fired;
+            if (random() % 2) {
+                // a deadline of now or earlier would only fire on the next advance()
+                const unsigned long deadline = now + 1 + random_delay();
+                wheel.schedule(*timer, deadline);
+                expected[timer] = deadline;
+            }
+        };
+        const unsigned long deadline = now + random_delay();
+        wheel.schedule(*timer, deadline);
+        expected[timer] = deadline;
+    }
+    wheel.advance(now);
+
+    for (unsigned long step = 0; step < steps; ++step) {
+        const unsigned long previous = now;
+        now += (random() % 8 == 0) ? random() % 100000 : random() % 20;
+
+        // timers due up to previous must have fired in an earlier step
+        for (const auto & kv : expected) {
+            if ((long)(previous - kv.second) >= 0) {
+                ++errors;
+            }
+        }
+
+        switch (random() % 4) {
+            case 0: {
+                PicoMQTT::TimerWheel::Timer & timer = *pool[random() % pool.size()];
+                timer.cancel();
+                expected.erase(&timer);
+                break;
+            }
+            case 1: {
+                PicoMQTT::TimerWheel::Timer & timer = *pool[random() % pool.size()];
+                const unsigned long deadline = previous + random_delay() - 10;
+                wheel.schedule(timer, deadline);
+                expected[&timer] = deadline;
+                break;
+            }
+            default:
+                break;
+        }
+
+        wheel.advance(now);
+
+        if (wheel.get_count() != expected.size()) {
+            ++errors;
+        }
+    }
+
+    printf("cross-check: %u timers, %lu steps, %lu fired, %lu errors\n", timers, steps, fired, errors);
+    return !errors;
+}
+
+struct Connection {
+    unsigned long last_read;
+    unsigned long keep_alive_millis;
+    PicoMQTT::TimerWheel::Timer timer;
+};
+
+void measure(unsigned int connections, unsigned long iterations) {
+    std::vector<std::unique_ptr<Connection>> pool;
+    unsigned long now = 0;
+    unsigned long timeouts = 0;
+    PicoMQTT::TimerWheel wheel(now);
+
+    for (unsigned int i = 0; i < connections; ++i) {
+        pool.emplace_back(new Connection());
+        Connection & connection = *pool.back();
+        connection.last_read = now;
+        connection.keep_alive_millis = 60 * 1000;
+        // same as Server::Client::check_timeout()
+        connection.timer.callback = [&connection, &wheel, &now, &timeouts] {
+            const unsigned long idle = now - connection.last_read;
+            if (idle > connection.keep_alive_millis) {
+                ++timeouts;
+                return;
+            }
+            wheel.schedule(connection.timer, connection.last_read + connection.keep_alive_millis + 1);
+        };
+        wheel.schedule(connection.timer, now + connection.keep_alive_millis + 1);
+    }
+
+    // spread the pings over the 45 s period
+    auto ping = [&pool, &now](unsigned long iteration) {
+        for (size_t i = iteration % 45000; i < pool.size(); i += 45000) {
+            pool[i]->last_read = now;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; ++i) {
+        ++now;
+        ping(i);
+        for (const auto & connection : pool) {
+            if (connection->keep_alive_millis && (now - connection->last_read > connection->keep_alive_millis)) {
+                ++timeouts;
+            }
+        }
+    }
+    const double scan_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+                           / iterations;
+
+    now = 0;
+    for (auto & connection : pool) {
+        connection->last_read = now;
+    }
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; ++i) {
+        ++now;
+        ping(i);
+        wheel.advance(now);
+    }
+    const double wheel_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+                            / iterations;
+
+    printf("%8u connections: scan %10.1f ns/loop, wheel %8.1f ns/loop, %6.1fx, %lu timeouts\n", connections, scan_ns,
+           wheel_ns, scan_ns / wheel_ns, timeouts);
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const unsigned long iterations = argc > 1 ? atol(argv[1]) : 200000;
+
+    if (!check(2000, 200000, 1)) {
+        return 1;
+    }
+
+    printf("timer size: %u bytes, wheel size: %u bytes\n", (unsigned int) sizeof(PicoMQTT::TimerWheel::Timer),
+           (unsigned int) sizeof(PicoMQTT::TimerWheel));
+    for (unsigned int connections : {10, 100, 1000, 10000}) {
+        measure(connections, iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Reconnect test of a TLS broker (e.g. TlsServer) using the mbedTLS client.
+ *
+ * Connects to the broker repeatedly, each time completing the TLS handshake, an MQTT CONNECT/CONNACK exchange and a
+ * clean disconnect.  After the first connection, the client offers the saved session (session ticket or session id)
+ * so the broker can resume it, unless the mode is "full".  Handshake times are reported separately for the first and
+ * the following connections; the broker's TlsServer::get_stats() tells how many handshakes were actually resumed.
+ *
+ * Build (Linux, requires the mbedTLS development package, 2.28 or 3.x):
+ *   g++ -O2 -std=c++17 -o tls_reconnect tls_reconnect.cpp -lmbedtls -lmbedx509 -lmbedcrypto
+ *
+ * Usage:
+ *   ./tls_reconnect [host] [port] [count] [resume|full]
+ *   ./tls_reconnect 192.168.1.10 8883 20
+ *
+ * The server certificate is not verified.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Connection {
+    Connection() {
+        mbedtls_net_init(&net);
+        mbedtls_ssl_init(&ssl);
+    }
+
+    ~Connection() {
+        mbedtls_ssl_free(&ssl);
+        mbedtls_net_free(&net);
+    }
+
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+};
+
+bool write_all(mbedtls_ssl_context & ssl, const unsigned char * data, size_t size) {
+    while (size) {
+        const int ret = mbedtls_ssl_write(&ssl, data, size);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+bool read_all(mbedtls_ssl_context & ssl, unsigned char * data, size_t size) {
+    while (size) {
+        const int ret = mbedtls_ssl_read(&ssl, data, size);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+// MQTT 3.1.1 CONNECT with a clean session and the given client id
+std::vector<unsigned char> build_connect(const std::string & client_id) {
+    std::vector<unsigned char> ret = {0x10, 0, 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60};
+    ret.push_back(client_id.size() >> 8);
+    ret.push_back(client_id.size() & 0xff);
+    ret.insert(ret.end(), client_id.begin(), client_id.end());
+    ret[1] = ret.size() - 2;
+    return ret;
+}
+
+void print_times(const char * label, std::vector<double> & times) {
+    if (times.empty()) {
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (double time : times) {
+        total += time;
+    }
+    printf("%-10s %4u handshakes, avg %8.2f ms, median %8.2f ms, max %8.2f ms\n", label, (unsigned int) times.size(),
+           total / times.size(), times[times.size() / 2], times.back());
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const char * host = argc > 1 ? argv[1] : "127.0.0.1";
+    const char * port = argc > 2 ? argv[2] : "8883";
+    const unsigned int count = argc > 3 ? atoi(argv[3]) : 10;
+    const bool resume = argc > 4 ? strcmp(argv[4], "full") : true;
+
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_ssl_config config;
+    mbedtls_ssl_session session;
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&ctr_drbg);
+    mbedtls_ssl_config_init(&config);
+    mbedtls_ssl_session_init(&session);
+
+    if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, nullptr, 0)
+            || mbedtls_ssl_config_defaults(&config, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                           MBEDTLS_SSL_PRESET_DEFAULT)) {
+        fprintf(stderr, "mbedTLS setup failed\n");
+        return 1;
+    }
+    mbedtls_ssl_conf_authmode(&config, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(&config, mbedtls_ctr_drbg_random, &ctr_drbg);
+    mbedtls_ssl_conf_session_tickets(&config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+    std::vector<double> first_times, next_times;
+    bool have_session = false;
+    int ret = 0;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        Connection connection;
+
+        if (mbedtls_net_connect(&connection.net, host, port, MBEDTLS_NET_PROTO_TCP)) {
+            fprintf(stderr, "Connection to %s:%s failed\n", host, port);
+            ret = 1;
+            break;
+        }
+
+        mbedtls_ssl_setup(&connection.ssl, &config);
+        mbedtls_ssl_set_bio(&connection.ssl, &connection.net, mbedtls_net_send, mbedtls_net_recv, nullptr);
+        if (resume && have_session) {
+            mbedtls_ssl_set_session(&connection.ssl, &session);
+        }
+
+        const auto start = Clock::now();
+        int result;
+        do {
+            result = mbedtls_ssl_handshake(&connection.ssl);
+        } while (result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE);
+        const double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        if (result) {
+            fprintf(stderr, "Handshake %u failed: -0x%04x\n", i, (unsigned int) -result);
+            ret = 1;
+            break;
+        }
+
+        (i ? next_times : first_times).push_back(elapsed_ms);
+
+        if (resume) {
+            mbedtls_ssl_session_free(&session);
+            mbedtls_ssl_session_init(&session);
+            have_session = (mbedtls_ssl_get_session(&connection.ssl, &session) == 0);
+        }
+
+        const std::vector<unsigned char> connect = build_connect("tls-reconnect-" + std::to_string(i));
+        unsigned char connack[4];
+        if (!write_all(connection.ssl, connect.data(), connect.size()) || !read_all(connection.ssl, connack, 4)
+                || connack[0] != 0x20 || connack[3] != 0) {
+            fprintf(stderr, "MQTT connect %u failed\n", i);
+            ret = 1;
+            break;
+        }
+
+        const unsigned char disconnect[] = {0xe0, 0x00};
+        write_all(connection.ssl, disconnect, sizeof(disconnect));
+        mbedtls_ssl_close_notify(&connection.ssl);
+    }
+
+    print_times("first:", first_times);
+    print_times(resume ? "resuming:" : "full:", next_times);
+
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_config_free(&config);
+    mbedtls_ctr_drbg_free(&ctr_drbg);
+    mbedtls_entropy_free(&entropy);
+
+    return ret;
+}
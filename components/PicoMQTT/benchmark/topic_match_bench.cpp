@@ -0,0 +1,162 @@
+/*
+ * Host benchmark of topic matching: the scalar Subscriber::topic_matches() loop called once per filter vs.
+ * TopicFilterSet, which tokenizes the topic once and evaluates all filters in a single pass, vs. TopicFilterIndex,
+ * a trie which only visits the filters sharing levels with the topic.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../src -o topic_match_bench topic_match_bench.cpp ../src/PicoMQTT/topic_matcher.cpp
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "PicoMQTT/topic_matcher.h"
+
+namespace {
+
+// Copy of Subscriber::topic_matches(), which can't be included here without the Arduino core.
+bool topic_matches(const char * p, const char * t) {
+    while (true) {
+        switch (*p) {
+            case '\0':
+                return (*t == '\0');
+            case '#':
+                if (*t == '\0') {
+                    return false;
+                }
+                return true;
+            case '+':
+                while (*t && *t != '/') {
+                    ++t;
+                }
+                ++p;
+                break;
+            default:
+                if (*p != *t) {
+                    return false;
+                }
+                ++p;
+                ++t;
+        }
+    }
+}
+
+const char * const METRICS[] = {
+    "socofpack", "voltageofpack", "currentofpack", "cellvmax", "cellvmin",
+    "celltmax", "celltmin", "bmschstate", "bmsdschstate", "power",
+};
+
+std::string make_filter(unsigned int i) {
+    const std::string metric = METRICS[i % 10];
+    const std::string device = std::to_string(i / 10);
+    switch (i % 4) {
+        case 0:
+            return "emkit/" + device + "/pack/" + metric;
+        case 1:
+            return "emkit/+/+/" + metric;
+        case 2:
+            return "emkit/" + device + "/#";
+        default:
+            return "emkit/" + device + "/+/" + metric;
+    }
+}
+
+std::string make_topic(unsigned int i) {
+    return "emkit/" + std::to_string(i % 300) + "/pack/" + METRICS[(i / 7) % 10];
+}
+
+template <typename Function>
+double measure(unsigned int iterations, Function function) {
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; ++i) {
+        function(i);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const unsigned int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+
+    std::vector<std::string> topics;
+    for (unsigned int i = 0; i < 1024; ++i) {
+        topics.push_back(make_topic(i));
+    }
+
+    printf("filters\tscalar [ns/topic]\tbatch [ns/topic]\tindex [ns/topic]\tspeedup\tmatches/topic\n");
+
+    for (unsigned int filter_count : {64u, 256u, 1024u}) {
+        std::vector<std::string> filters;
+        PicoMQTT::TopicFilterSet filter_set;
+        for (unsigned int i = 0; i < filter_count; ++i) {
+            filters.push_back(make_filter(i));
+            filter_set.add(filters.back().c_str(), i);
+        }
+        PicoMQTT::TopicFilterIndex index;
+        index.build(filter_set);
+        std::vector<uint32_t> indices;
+
+        // verify both implementations agree
+        PicoMQTT::TopicFilterSet::Bitmap bitmap;
+        for (const auto & topic : topics) {
+            PicoMQTT::TopicTokens tokens(topic.c_str());
+            filter_set.match(tokens, bitmap);
+            for (unsigned int i = 0; i < filter_count; ++i) {
+                const bool expected = topic_matches(filters[i].c_str(), topic.c_str());
+                const bool actual = bitmap[i / 32] & (1u << (i % 32));
+                if (expected != actual) {
+                    fprintf(stderr, "Mismatch: filter '%s', topic '%s'\n", filters[i].c_str(), topic.c_str());
+                    return 1;
+                }
+            }
+
+            indices.clear();
+            index.match(tokens, indices);
+            std::vector<uint32_t> expected;
+            for (unsigned int i = 0; i < filter_count; ++i) {
+                if (bitmap[i / 32] & (1u << (i % 32))) {
+                    expected.push_back(i);
+                }
+            }
+            if (indices != expected) {
+                fprintf(stderr, "Index mismatch: topic '%s'\n", topic.c_str());
+                return 1;
+            }
+        }
+
+        size_t total_matches = 0;
+        volatile size_t sink = 0;
+
+        const double scalar = measure(iterations, [&](unsigned int i) {
+            const char * topic = topics[i % topics.size()].c_str();
+            size_t matches = 0;
+            for (const auto & filter : filters) {
+                matches += topic_matches(filter.c_str(), topic);
+            }
+            sink = sink + matches;
+        });
+
+        const double batch = measure(iterations, [&](unsigned int i) {
+            PicoMQTT::TopicTokens tokens(topics[i % topics.size()].c_str());
+            const size_t matches = filter_set.match(tokens, bitmap);
+            total_matches += matches;
+            sink = sink + matches;
+        });
+
+        const double indexed = measure(iterations, [&](unsigned int i) {
+            PicoMQTT::TopicTokens tokens(topics[i % topics.size()].c_str());
+            indices.clear();
+            sink = sink + index.match(tokens, indices);
+        });
+
+        printf("%u\t%.1f\t%.1f\t%.1f\t%.2fx\t%.2f\n", filter_count, scalar, batch, indexed, scalar / indexed,
+               (double) total_matches / iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <PicoMQTT.h>
+
+#if __has_include("config.h")
+#include "config.h"
+#endif
+
+#ifndef WIFI_SSID
+#define WIFI_SSID "WiFi SSID"
+#endif
+
+#ifndef WIFI_PASSWORD
+#define WIFI_PASSWORD "password"
+#endif
+
+#ifndef NODE_ID
+#define NODE_ID "node1"
+#endif
+
+#ifndef PEER_PASSWORD
+#define PEER_PASSWORD "peer password"
+#endif
+
+// Addresses of the other brokers.  Every broker should list all the other brokers (full mesh).
+const char * const PEERS[] = {"192.168.1.11", "192.168.1.12"};
+
+PicoMQTT::FederatedServer mqtt;
+
+void setup() {
+    // Setup serial
+    Serial.begin(115200);
+
+    // Connect to WiFi
+    Serial.printf("Connecting to WiFi %s\n", WIFI_SSID);
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    while (WiFi.status() != WL_CONNECTED) { delay(1000); }
+    Serial.printf("WiFi connected, IP: %s\n", WiFi.localIP().toString().c_str());
+
+    mqtt.node_id = NODE_ID;
+    // Peer links are only accepted with this password, it must be the same on all brokers.
+    mqtt.peer_password = PEER_PASSWORD;
+    for (const char * peer : PEERS) {
+        mqtt.add_peer(peer);
+    }
+
+    // Messages published on any broker are delivered to subscribers of all brokers, but a message is only sent to
+    // the peers which have subscribers for it.
+    mqtt.begin();
+}
+
+void loop() {
+    mqtt.loop();
+}
@@ -18,3 +18,5 @@
 
 #include "PicoMQTT/client.h"
 #include "PicoMQTT/server.h"
+#include "PicoMQTT/federation.h"
+#include "PicoMQTT/tls_server.h"
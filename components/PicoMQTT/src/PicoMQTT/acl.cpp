@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+
+#include "acl.h"
+
+namespace {
+
+// Replaces %c and %u in the topic filter.  Fails if a value is missing or it would change the structure of the
+// filter (e.g. a client id containing '/' or a wildcard).
+bool substitute(const std::string & topic_filter, const char * client_id, const char * username, std::string & out) {
+    out.clear();
+    for (size_t i = 0; i < topic_filter.size(); ++i) {
+        if ((topic_filter[i] != '%') || (i + 1 == topic_filter.size())
+                || ((topic_filter[i + 1] != 'c') && (topic_filter[i + 1] != 'u'))) {
+            out.push_back(topic_filter[i]);
+            continue;
+        }
+
+        const char * value = topic_filter[++i] == 'c' ? client_id : username;
+        if (!value || !value[0] || strpbrk(value, "/+#")) {
+            return false;
+        }
+        out.append(value);
+    }
+    return true;
+}
+
+struct BuildNode {
+    BuildNode() : single_level_wildcard(0), exact{INT32_MAX, INT32_MAX}, multi_level{INT32_MAX, INT32_MAX} {}
+
+    std::map<std::string, size_t> children;
+    size_t single_level_wildcard;   // 0 if there's none, the root is never a child
+    int32_t exact[2];
+    int32_t multi_level[2];
+};
+
+void set_decision(int32_t (&decision)[2], uint8_t access, int32_t value) {
+    for (unsigned int i = 0; i < 2; ++i) {
+        // rules are inserted in order, so the first one wins
+        if ((access & (1 << i)) && (decision[i] == INT32_MAX)) {
+            decision[i] = value;
+        }
+    }
+}
+
+bool is_level(const PicoMQTT::TopicTokens & tokens, size_t level, char c) {
+    return (tokens.get_level(level).size == 1) && (tokens.get_level_data(level)[0] == c);
+}
+
+}
+
+namespace PicoMQTT {
+
+void Acl::allow(uint8_t access, const char * topic_filter, const char * username) {
+    add(access, true, topic_filter, username);
+}
+
+void Acl::deny(uint8_t access, const char * topic_filter, const char * username) {
+    add(access, false, topic_filter, username);
+}
+
+void Acl::add(uint8_t access, bool allow, const char * topic_filter, const char * username) {
+    Rule rule;
+    rule.access = access;
+    rule.allow = allow;
+    rule.any_user = !username;
+    rule.username = username ? username : "";
+    rule.topic_filter = topic_filter;
+    rules.push_back(rule);
+}
+
+Acl::Policy::Policy(): allow_all(true), default_allow(true) {
+}
+
+Acl::Policy::Policy(const Acl & acl, const char * client_id, const char * username)
+    : allow_all(acl.empty()), default_allow(acl.default_allow) {
+
+    if (allow_all) {
+        return;
+    }
+
+    // build a pointer based trie of the rules which apply to this client
+    std::vector<BuildNode> tree(1);
+    std::string topic_filter;
+
+    for (size_t index = 0; index < acl.rules.size(); ++index) {
+        const Rule & rule = acl.rules[index];
+        if (!rule.any_user && (!username || (rule.username != username))) {
+            continue;
+        }
+        if (!substitute(rule.topic_filter, client_id, username, topic_filter)) {
+            continue;
+        }
+
+        const int32_t decision = index * 2 + (rule.allow ? 1 : 0);
+        size_t node = 0;
+        size_t begin = 0;
+        while (true) {
+            const size_t end = std::min(topic_filter.find('/', begin), topic_filter.size());
+            const std::string level = topic_filter.substr(begin, end - begin);
+
+            if ((level == "#") && (end == topic_filter.size())) {
+                set_decision(tree[node].multi_level, rule.access, decision);
+                break;
+            }
+
+            size_t child;
+            if (level == "+") {
+                child = tree[node].single_level_wildcard;
+                if (!child) {
+                    child = tree.size();
+                    tree.emplace_back();
+                    tree[node].single_level_wildcard = child;
+                }
+            } else {
+                auto it = tree[node].children.find(level);
+                if (it == tree[node].children.end()) {
+                    child = tree.size();
+                    tree.emplace_back();
+                    tree[node].children[level] = child;
+                } else {
+                    child = it->second;
+                }
+            }
+            node = child;
+
+            if (end == topic_filter.size()) {
+                set_decision(tree[node].exact, rule.access, decision);
+                break;
+            }
+            begin = end + 1;
+        }
+    }
+
+    // flatten it breadth first, so that the edges of each node are contiguous and sorted
+    std::vector<uint32_t> flat_index(tree.size());
+    std::deque<size_t> queue = {0};
+    nodes.resize(tree.size());
+    uint32_t next_index = 1;
+
+    while (!queue.empty()) {
+        const BuildNode & source = tree[queue.front()];
+        Node & target = nodes[flat_index[queue.front()]];
+        queue.pop_front();
+
+        memcpy(target.exact, source.exact, sizeof(target.exact));
+        memcpy(target.multi_level, source.multi_level, sizeof(target.multi_level));
+
+        target.single_level_wildcard = -1;
+        if (source.single_level_wildcard) {
+            flat_index[source.single_level_wildcard] = next_index;
+            target.single_level_wildcard = next_index++;
+            queue.push_back(source.single_level_wildcard);
+        }
+
+        target.first_edge = edges.size();
+        target.edge_count = source.children.size();
+        for (const auto & kv : source.children) {
+            flat_index[kv.second] = next_index;
+            Edge edge;
+            edge.size = kv.first.size();
+            edge.head = TopicTokens::get_head_key(kv.first.data(), kv.first.size());
+            edge.tail = TopicTokens::get_tail_key(kv.first.data(), kv.first.size());
+            edge.offset = pool.size();
+            edge.node = next_index++;
+            pool.append(kv.first);
+            edges.push_back(edge);
+            queue.push_back(kv.second);
+        }
+
+        std::sort(edges.begin() + target.first_edge, edges.end(), [](const Edge & a, const Edge & b) {
+            if (a.size != b.size) {
+                return a.size < b.size;
+            }
+            if (a.head != b.head) {
+                return a.head < b.head;
+            }
+            return a.tail < b.tail;
+        });
+    }
+}
+
+size_t Acl::Policy::get_memory_usage() const {
+    return nodes.capacity() * sizeof(nodes[0]) + edges.capacity() * sizeof(edges[0]) + pool.capacity();
+}
+
+int32_t Acl::Policy::find_edge(const Node & node, const TopicTokens & topic, size_t level) const {
+    const TopicTokens::Level & key = topic.get_level(level);
+    const Edge * begin = edges.data() + node.first_edge;
+    const Edge * end = begin + node.edge_count;
+
+    const Edge * edge = std::lower_bound(begin, end, key, [](const Edge & edge, const TopicTokens::Level & key) {
+        if (edge.size != key.size) {
+            return edge.size < key.size;
+        }
+        if (edge.head != key.head) {
+            return edge.head < key.head;
+        }
+        return edge.tail < key.tail;
+    });
+
+    // levels longer than 8 bytes may have equal keys
+    for (; (edge != end) && (edge->size == key.size) && (edge->head == key.head) && (edge->tail == key.tail); ++edge) {
+        if ((key.size <= 2 * sizeof(key.head))
+                || !memcmp(pool.data() + edge->offset + sizeof(key.head),
+                           topic.get_level_data(level) + sizeof(key.head),
+                           key.size - 2 * sizeof(key.head))) {
+            return edge->node;
+        }
+    }
+
+    return -1;
+}
+
+int32_t Acl::Policy::match_topic(uint32_t index, const TopicTokens & topic, size_t level, int32_t best) const {
+    const Node & node = nodes[index];
+    const size_t count = topic.get_level_count();
+
+    // '#' needs a non-empty remainder of the topic, like in TopicFilterSet
+    if ((node.multi_level[0] < best) && (level < count)
+            && ((level + 1 < count) || topic.get_level(level).size)) {
+        best = node.multi_level[0];
+    }
+
+    if (level == count) {
+        return node.exact[0] < best ? node.exact[0] : best;
+    }
+
+    const int32_t child = find_edge(node, topic, level);
+    if (child >= 0) {
+        best = match_topic(child, topic, level + 1, best);
+    }
+
+    if (node.single_level_wildcard >= 0) {
+        best = match_topic(node.single_level_wildcard, topic, level + 1, best);
+    }
+
+    return best;
+}
+
+int32_t Acl::Policy::match_filter(uint32_t index, const TopicTokens & filter, size_t level, int32_t best) const {
+    const Node & node = nodes[index];
+    const size_t count = filter.get_level_count();
+
+    // a rule ending with '#' covers all the remaining levels of the filter, including wildcards
+    if ((node.multi_level[1] < best) && (level < count)
+            && ((level + 1 < count) || filter.get_level(level).size)) {
+        best = node.multi_level[1];
+    }
+
+    if (level == count) {
+        return node.exact[1] < best ? node.exact[1] : best;
+    }
+
+    if (is_level(filter, level, '#')) {
+        // only covered by rules ending with '#' at this level
+        return best;
+    }
+
+    if (!is_level(filter, level, '+')) {
+        const int32_t child = find_edge(node, filter, level);
+        if (child >= 0) {
+            best = match_filter(child, filter, level + 1, best);
+        }
+    }
+
+    if (node.single_level_wildcard >= 0) {
+        best = match_filter(node.single_level_wildcard, filter, level + 1, best);
+    }
+
+    return best;
+}
+
+bool Acl::Policy::decide(int32_t best) const {
+    return best == NONE ? default_allow : (best & 1);
+}
+
+bool Acl::Policy::can_publish(const TopicTokens & topic) const {
+    if (allow_all) {
+        return true;
+    }
+    return decide(match_topic(0, topic, 0, NONE));
+}
+
+bool Acl::Policy::can_subscribe(const char * topic_filter) const {
+    if (allow_all) {
+        return true;
+    }
+    return decide(match_filter(0, TopicTokens(topic_filter), 0, NONE));
+}
+
+}
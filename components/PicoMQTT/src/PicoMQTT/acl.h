@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "topic_matcher.h"
+
+namespace PicoMQTT {
+
+/*
+ * Access control list of a broker.
+ *
+ * Each rule allows or denies publishing and/or subscribing to a topic filter, either for all users or for a single
+ * user name.  In topic filters, %c is replaced with the client id and %u with the user name of the client.  Rules are
+ * evaluated in the order they were added and the first matching rule wins.  If no rule matches, default_allow
+ * decides.  An empty list allows everything.
+ *
+ * Substitution happens only once, when a client connects: the rules which apply to the client are compiled into a
+ * Policy, a trie of topic levels, so checking a message costs O(levels) and doesn't format any strings.
+ */
+class Acl {
+    public:
+        enum Access : uint8_t {
+            PUBLISH = 1,
+            SUBSCRIBE = 2,
+            PUBLISH_AND_SUBSCRIBE = PUBLISH | SUBSCRIBE,
+        };
+
+        class Policy {
+            public:
+                // Allows everything
+                Policy();
+                Policy(const Acl & acl, const char * client_id, const char * username);
+
+                bool can_publish(const TopicTokens & topic) const;
+                bool can_publish(const char * topic) const { return can_publish(TopicTokens(topic)); }
+
+                // A subscription is allowed if the rule with the lowest index which covers the whole topic filter
+                // allows it.  Note that denying a part of a topic tree (e.g. a/secret) doesn't stop anyone from
+                // subscribing to a wider filter (e.g. a/#) that is allowed by a later rule.
+                bool can_subscribe(const char * topic_filter) const;
+
+                size_t get_memory_usage() const;
+
+            protected:
+                static const int32_t NONE = INT32_MAX;
+
+                struct Node {
+                    uint32_t first_edge;
+                    uint32_t edge_count;
+                    int32_t single_level_wildcard;     // index of the '+' child node or -1
+
+                    // Lowest matching rule for each access type, encoded as rule index * 2 + allow or NONE.
+                    int32_t exact[2];               // rules ending at this node
+                    int32_t multi_level[2];         // rules ending with '#' after this node
+                };
+
+                // literal child, edges of a node are sorted by (size, head, tail)
+                struct Edge {
+                    uint16_t size;
+                    uint32_t head;
+                    uint32_t tail;
+                    uint32_t offset;
+                    uint32_t node;
+                };
+
+                int32_t match_topic(uint32_t node, const TopicTokens & topic, size_t level, int32_t best) const;
+                int32_t match_filter(uint32_t node, const TopicTokens & filter, size_t level, int32_t best) const;
+                int32_t find_edge(const Node & node, const TopicTokens & topic, size_t level) const;
+                bool decide(int32_t best) const;
+
+                bool allow_all;
+                bool default_allow;
+                std::vector<Node> nodes;
+                std::vector<Edge> edges;
+                std::string pool;
+        };
+
+        Acl(): default_allow(false) {}
+
+        // username == nullptr makes the rule apply to all users
+        void allow(uint8_t access, const char * topic_filter, const char * username = nullptr);
+        void deny(uint8_t access, const char * topic_filter, const char * username = nullptr);
+        void clear() { rules.clear(); }
+
+        bool empty() const { return rules.empty(); }
+        size_t size() const { return rules.size(); }
+
+        bool default_allow;
+
+    protected:
+        struct Rule {
+            uint8_t access;
+            bool allow;
+            bool any_user;
+            std::string username;
+            std::string topic_filter;
+        };
+
+        void add(uint8_t access, bool allow, const char * topic_filter, const char * username);
+
+        std::vector<Rule> rules;
+};
+
+}
@@ -0,0 +1,249 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "aggregator.h"
+
+namespace {
+
+const char * const FUNCTION_NAMES[] = {"avg", "min", "max", "sum", "count"};
+
+const char * skip_spaces(const char * text) {
+    while (*text == ' ') {
+        ++text;
+    }
+    return text;
+}
+
+// Trimmed text between begin and the first of the given characters
+std::string read_token(const char * & begin, const char * delimiters) {
+    begin = skip_spaces(begin);
+    const char * end = begin + strcspn(begin, delimiters);
+    const char * last = end;
+    while ((last > begin) && (last[-1] == ' ')) {
+        --last;
+    }
+    std::string ret(begin, last);
+    begin = end;
+    return ret;
+}
+
+bool parse_window(const std::string & text, uint32_t & window) {
+    char * unit;
+    const unsigned long value = strtoul(text.c_str(), &unit, 10);
+    unsigned long scale;
+    if (!strcmp(unit, "ms")) {
+        scale = 1;
+    } else if (!strcmp(unit, "s")) {
+        scale = 1000;
+    } else if (!strcmp(unit, "m")) {
+        scale = 60 * 1000;
+    } else if (!strcmp(unit, "h")) {
+        scale = 60 * 60 * 1000;
+    } else {
+        return false;
+    }
+    // windows are compared with signed differences of millis()
+    if ((unit == text.c_str()) || !value || (value > 0x7fffffffUL / scale)) {
+        return false;
+    }
+    window = value * scale;
+    return true;
+}
+
+}
+
+namespace PicoMQTT {
+
+Aggregator::Aggregator(size_t max_keys): max_keys(max_keys) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+bool Aggregator::add(const char * expression) {
+    Rule rule;
+
+    // <function>(<topic filter>, <window>)
+    const char * cursor = expression;
+    const std::string function = read_token(cursor, "(");
+    if (*cursor++ != '(') {
+        return false;
+    }
+    const std::string filter = read_token(cursor, ",");
+    if (*cursor++ != ',') {
+        return false;
+    }
+    const std::string window = read_token(cursor, ")");
+    if ((*cursor++ != ')') || *skip_spaces(cursor)) {
+        return false;
+    }
+
+    size_t function_index = 0;
+    while ((function_index < sizeof(FUNCTION_NAMES) / sizeof(FUNCTION_NAMES[0]))
+            && (function != FUNCTION_NAMES[function_index])) {
+        ++function_index;
+    }
+    if ((function_index == sizeof(FUNCTION_NAMES) / sizeof(FUNCTION_NAMES[0])) || filter.empty()
+            || !parse_window(window, rule.window)) {
+        return false;
+    }
+
+    rule.function = (Function) function_index;
+    rule.suffix = "/" + function + "/" + window;
+    rule.multi_level = -1;
+
+    size_t level = 0;
+    for (const char * begin = filter.c_str(); ; ++level) {
+        const size_t size = strcspn(begin, "/");
+        if ((size == 1) && (*begin == '+')) {
+            rule.captures.push_back(level);
+        } else if ((size == 1) && (*begin == '#')) {
+            if (begin[1]) {
+                return false;
+            }
+            rule.multi_level = level;
+        }
+        if (!begin[size]) {
+            break;
+        }
+        begin += size + 1;
+    }
+
+    rule.started = false;
+    rule.window_end = 0;
+    rules.push_back(std::move(rule));
+
+    filters.add(filter.c_str());
+    index.build(filters);
+    return true;
+}
+
+void Aggregator::build_key(const Rule & rule, const TopicTokens & topic) {
+    key.clear();
+    for (const uint16_t level : rule.captures) {
+        key.append(topic.get_level_data(level), topic.get_level(level).size);
+        key.push_back('/');
+    }
+    if (rule.multi_level >= 0) {
+        key.append(topic.get_level_data(rule.multi_level));
+    }
+}
+
+bool Aggregator::ingest(const char * topic, const char * payload, uint32_t now) {
+    char * end;
+    const float value = strtof(payload, &end);
+    if ((end == payload) || (*end && *end != ' ')) {
+        ++stats.not_numeric;
+        return false;
+    }
+    return ingest(topic, value, now);
+}
+
+bool Aggregator::ingest(const char * topic, float value, uint32_t now) {
+    if (rules.empty()) {
+        return false;
+    }
+
+    const TopicTokens tokens(topic);
+    matches.clear();
+    index.match(tokens, matches);
+
+    bool ingested = false;
+    for (const uint32_t rule_index : matches) {
+        Rule & rule = rules[rule_index];
+
+        if (!rule.started) {
+            rule.started = true;
+            rule.window_end = now - now % rule.window + rule.window;
+        } else if ((int32_t)(now - rule.window_end) >= 0) {
+            // loop() wasn't called since the window ended, don't mix the sample into it
+            flush(rule, now);
+        }
+
+        build_key(rule, tokens);
+        auto it = rule.keys.find(key);
+        if (it == rule.keys.end()) {
+            if (rule.keys.size() >= max_keys) {
+                ++stats.dropped_keys;
+                continue;
+            }
+            it = rule.keys.emplace(key, Key()).first;
+            it->second.topic = topic + rule.suffix;
+            it->second.accumulator.count = 0;
+        }
+
+        Accumulator & accumulator = it->second.accumulator;
+        if (!accumulator.count) {
+            accumulator.min = accumulator.max = accumulator.sum = value;
+        } else {
+            accumulator.min = value < accumulator.min ? value : accumulator.min;
+            accumulator.max = value > accumulator.max ? value : accumulator.max;
+            accumulator.sum += value;
+        }
+        ++accumulator.count;
+        ingested = true;
+    }
+
+    if (ingested) {
+        ++stats.ingested;
+    }
+    return ingested;
+}
+
+void Aggregator::flush(Rule & rule, uint32_t now) {
+    for (auto & kv : rule.keys) {
+        Accumulator & accumulator = kv.second.accumulator;
+        if (!accumulator.count) {
+            continue;
+        }
+
+        float value = 0;
+        switch (rule.function) {
+            case AVG:
+                value = accumulator.sum / accumulator.count;
+                break;
+            case MIN:
+                value = accumulator.min;
+                break;
+            case MAX:
+                value = accumulator.max;
+                break;
+            case SUM:
+                value = accumulator.sum;
+                break;
+            case COUNT:
+                value = accumulator.count;
+                break;
+        }
+        accumulator.count = 0;
+
+        if (publish_callback) {
+            publish_callback(kv.second.topic.c_str(), value);
+        }
+        ++stats.published;
+    }
+
+    rule.window_end = now - now % rule.window + rule.window;
+}
+
+void Aggregator::loop(uint32_t now) {
+    for (auto & rule : rules) {
+        if (rule.started && ((int32_t)(now - rule.window_end) >= 0)) {
+            flush(rule, now);
+        }
+    }
+}
+
+size_t Aggregator::get_memory_usage() const {
+    size_t ret = rules.capacity() * sizeof(Rule) + filters.get_memory_usage() + index.get_memory_usage()
+                 + matches.capacity() * sizeof(uint32_t) + key.capacity();
+    for (const auto & rule : rules) {
+        ret += rule.suffix.capacity() + rule.captures.capacity() * sizeof(uint16_t)
+               + rule.keys.bucket_count() * sizeof(void *);
+        for (const auto & kv : rule.keys) {
+            // node with the key, value and next pointer
+            ret += sizeof(kv) + sizeof(void *) + kv.first.capacity() + kv.second.topic.capacity();
+        }
+    }
+    return ret;
+}
+
+}
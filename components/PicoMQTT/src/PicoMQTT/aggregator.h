@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "delegate.h"
+#include "topic_matcher.h"
+
+namespace PicoMQTT {
+
+/*
+ * Windowed aggregates of numeric topics, e.g. the average of each pack's current over 10 s.
+ *
+ * Rules are added as "<function>(<topic filter>, <window>)", where the function is avg, min, max, sum or count and
+ * the window is a number followed by ms, s, m or h, e.g. "avg(emkit/+/+/currentofpack, 10s)".  A rule keeps an
+ * accumulator per key, the levels matched by the wildcards of its filter, so each pack is aggregated separately.
+ * A sample updates the accumulators of the matching rules in O(1); the rules are found with a TopicFilterIndex.
+ *
+ * Windows are aligned to multiples of their length.  When a window ends, loop() (or the first sample after it)
+ * passes the result of every key which got samples to publish_callback, with the topic of the sample followed by
+ * "/<function>/<window>", e.g. "emkit/bms/1/currentofpack/avg/10s", and starts the next window.
+ *
+ * Keys are allocated when they're first seen, up to max_keys per rule.  Not thread safe.
+ */
+class Aggregator {
+    public:
+        enum Function {
+            AVG,
+            MIN,
+            MAX,
+            SUM,
+            COUNT,
+        };
+
+        typedef Delegate<void(const char * topic, float value), 2 * sizeof(void *)> PublishCallback;
+
+        struct Stats {
+            unsigned long ingested;         // samples added to at least one accumulator
+            unsigned long not_numeric;
+            unsigned long published;
+            unsigned long dropped_keys;     // samples of new keys beyond max_keys
+        };
+
+        Aggregator(size_t max_keys = 16);
+
+        Aggregator(const Aggregator &) = delete;
+        const Aggregator & operator=(const Aggregator &) = delete;
+
+        // Parses and adds a rule, returns false if the expression is not valid
+        bool add(const char * expression);
+
+        // Parses the payload as a number, once, and adds it to all rules matching the topic
+        bool ingest(const char * topic, const char * payload, uint32_t now);
+        bool ingest(const char * topic, float value, uint32_t now);
+
+        // Publishes the windows which ended
+        void loop(uint32_t now);
+
+        size_t get_rule_count() const { return rules.size(); }
+        const Stats & get_stats() const { return stats; }
+        size_t get_memory_usage() const;
+
+        PublishCallback publish_callback;
+        const size_t max_keys;
+
+    protected:
+        struct Accumulator {
+            uint32_t count;
+            float min;
+            float max;
+            float sum;
+        };
+
+        struct Key {
+            std::string topic;      // of the result
+            Accumulator accumulator;
+        };
+
+        struct Rule {
+            Function function;
+            uint32_t window;
+            std::string suffix;                 // "/<function>/<window>"
+            std::vector<uint16_t> captures;     // levels matched by '+'
+            int multi_level;                    // level of '#' or -1
+
+            bool started;
+            uint32_t window_end;
+            std::unordered_map<std::string, Key> keys;
+        };
+
+        void flush(Rule & rule, uint32_t now);
+        void build_key(const Rule & rule, const TopicTokens & topic);
+
+        std::vector<Rule> rules;
+        TopicFilterSet filters;
+        TopicFilterIndex index;
+
+        // reused by every sample to avoid allocations
+        std::vector<uint32_t> matches;
+        std::string key;
+
+        Stats stats;
+};
+
+}
@@ -0,0 +1,145 @@
+#include "async_queue.h"
+
+namespace {
+
+// record header, payload size
+const uint32_t RECORD_OVERHEAD = 2 * sizeof(uint32_t);
+
+uint32_t round_up(uint32_t size) {
+    return (size + 3) & ~uint32_t(3);
+}
+
+}
+
+namespace PicoMQTT {
+
+AsyncQueue::AsyncQueue()
+    : capacity(0), reserve_position(0), head_position(0), enqueued(0), dequeued(0), dropped_full(0),
+      dropped_too_big(0), high_water(0) {
+}
+
+void AsyncQueue::begin(size_t size) {
+    capacity = 0;
+    ring.reset();
+    reserve_position = 0;
+    head_position = 0;
+
+    if (!size) {
+        return;
+    }
+
+    uint32_t rounded = 16;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+
+    ring.reset(new uint32_t[rounded / sizeof(uint32_t)]());
+    capacity = rounded;
+}
+
+uint32_t AsyncQueue::get_record_size(size_t topic_size, size_t payload_size) {
+    return round_up(RECORD_OVERHEAD + topic_size + 1 + payload_size + 1);
+}
+
+bool AsyncQueue::fits(size_t topic_size, size_t payload_size) const {
+    // A record of up to half of the ring always fits into an empty ring, either before its end or after padding.
+    // Bigger ones might never fit without the consumer moving, which it doesn't do when the ring is empty.
+    return (topic_size + payload_size < capacity) && (get_record_size(topic_size, payload_size) <= capacity / 2);
+}
+
+bool AsyncQueue::push(const char * topic, const void * payload, size_t payload_size, bool last_attempt) {
+    const size_t topic_size = strlen(topic);
+
+    if (!fits(topic_size, payload_size)) {
+        ++dropped_too_big;
+        return false;
+    }
+
+    const uint32_t record_size = get_record_size(topic_size, payload_size);
+
+    // reserve space, plus padding if the record would wrap around the end of the ring
+    uint32_t position = reserve_position.load(std::memory_order_relaxed);
+    uint32_t padding;
+    while (true) {
+        const uint32_t offset = position & (capacity - 1);
+        padding = (offset + record_size > capacity) ? capacity - offset : 0;
+        const uint32_t used = position - head_position.load(std::memory_order_acquire);
+        if (used + padding + record_size > capacity) {
+            if (last_attempt) {
+                ++dropped_full;
+            }
+            return false;
+        }
+        if (reserve_position.compare_exchange_weak(position, position + padding + record_size,
+                std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            uint32_t peak = high_water.load(std::memory_order_relaxed);
+            const uint32_t now_used = used + padding + record_size;
+            while ((now_used > peak) && !high_water.compare_exchange_weak(peak, now_used, std::memory_order_relaxed)) {
+            }
+            break;
+        }
+    }
+
+    if (padding) {
+        __atomic_store_n(&ring[(position & (capacity - 1)) / sizeof(uint32_t)], PADDING | padding, __ATOMIC_RELEASE);
+        position += padding;
+    }
+
+    uint32_t * header = &ring[(position & (capacity - 1)) / sizeof(uint32_t)];
+    header[1] = payload_size;
+    char * data = (char *)(header + 2);
+    memcpy(data, topic, topic_size + 1);
+    data += topic_size + 1;
+    memcpy(data, payload, payload_size);
+    data[payload_size] = '\0';
+
+    // commit
+    __atomic_store_n(header, (uint32_t) record_size, __ATOMIC_RELEASE);
+    ++enqueued;
+    return true;
+}
+
+uint32_t * AsyncQueue::peek() {
+    while (true) {
+        const uint32_t head = head_position.load(std::memory_order_relaxed);
+        if (head == reserve_position.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        uint32_t * header = &ring[(head & (capacity - 1)) / sizeof(uint32_t)];
+        const uint32_t value = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+        if (!value) {
+            // reserved, but still being written
+            return nullptr;
+        }
+
+        if (!(value & PADDING)) {
+            return header;
+        }
+
+        memset(header, 0, value & ~PADDING);
+        head_position.store(head + (value & ~PADDING), std::memory_order_release);
+    }
+}
+
+void AsyncQueue::release() {
+    const uint32_t head = head_position.load(std::memory_order_relaxed);
+    uint32_t * header = &ring[(head & (capacity - 1)) / sizeof(uint32_t)];
+    const uint32_t record_size = *header;
+    // header slots of future records must read 0 until they are committed
+    memset(header, 0, record_size);
+    head_position.store(head + record_size, std::memory_order_release);
+    ++dequeued;
+}
+
+AsyncQueue::Stats AsyncQueue::get_stats() const {
+    Stats stats;
+    stats.enqueued = enqueued.load();
+    stats.dequeued = dequeued.load();
+    stats.dropped_full = dropped_full.load();
+    stats.dropped_too_big = dropped_too_big.load();
+    stats.high_water = high_water.load();
+    return stats;
+}
+
+}
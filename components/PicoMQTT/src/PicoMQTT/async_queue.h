@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace PicoMQTT {
+
+/*
+ * Bounded multi-producer, single-consumer queue of messages (topic and payload), used to publish from other tasks
+ * than the one running the broker loop.
+ *
+ * Messages are stored back to back in a byte ring as [header][payload size][topic]\0[payload]\0, padded to 4 bytes.
+ * A producer reserves space by advancing the reserve position with a compare-and-swap, copies the message and
+ * commits it by writing the (non-zero) header last.  The consumer processes committed records in reservation order,
+ * stopping at the first one still being written, and zeroes the consumed bytes before releasing them, so a header
+ * slot always reads 0 until its record is committed.  No locks are taken and push() never blocks.
+ *
+ * All methods except begin() and pop() may be called from any task.  begin() must be called before producers
+ * start, pop() only from the consumer.
+ */
+class AsyncQueue {
+    public:
+        struct Stats {
+            unsigned long enqueued;
+            unsigned long dequeued;
+            unsigned long dropped_full;
+            unsigned long dropped_too_big;
+            size_t high_water;          // max bytes in use
+        };
+
+        AsyncQueue();
+
+        AsyncQueue(const AsyncQueue &) = delete;
+        const AsyncQueue & operator=(const AsyncQueue &) = delete;
+
+        // Allocates the ring, the size is rounded up to a power of two.  A size of 0 frees it.
+        void begin(size_t size);
+
+        // Returns false if the queue is full, not allocated or the message doesn't fit at all.  A full queue is
+        // counted as a dropped message only if the caller isn't going to retry (last_attempt).
+        bool push(const char * topic, const void * payload, size_t payload_size, bool last_attempt = true);
+
+        // True if the message is small enough for the queue (the record must not exceed half of the size)
+        bool fits(size_t topic_size, size_t payload_size) const;
+
+        // Passes the oldest committed message to callback(const char * topic, const void * payload, size_t size)
+        // and removes it.  Returns false if there's none.  The pointers are valid only during the call.
+        template <typename Callback>
+        bool pop(Callback callback) {
+            uint32_t * header = peek();
+            if (!header) {
+                return false;
+            }
+            const uint32_t payload_size = header[1];
+            const char * topic = (const char *)(header + 2);
+            callback(topic, topic + strlen(topic) + 1, (size_t) payload_size);
+            release();
+            return true;
+        }
+
+        bool empty() const { return reserve_position.load() == head_position.load(); }
+        size_t get_size() const { return capacity; }
+        size_t get_used() const { return reserve_position.load() - head_position.load(); }
+
+        Stats get_stats() const;
+        size_t get_memory_usage() const { return capacity; }
+
+    protected:
+        // set in the header of records which only fill the end of the ring
+        static const uint32_t PADDING = 0x80000000;
+
+        static uint32_t get_record_size(size_t topic_size, size_t payload_size);
+
+        // Returns the header of the next committed message, skipping padding, or nullptr.
+        uint32_t * peek();
+        // Frees the record returned by peek().
+        void release();
+
+        std::unique_ptr<uint32_t[]> ring;
+        uint32_t capacity;          // bytes, power of two
+        std::atomic<uint32_t> reserve_position;
+        std::atomic<uint32_t> head_position;
+
+        std::atomic<unsigned long> enqueued;
+        std::atomic<unsigned long> dequeued;
+        std::atomic<unsigned long> dropped_full;
+        std::atomic<unsigned long> dropped_too_big;
+        std::atomic<uint32_t> high_water;
+};
+
+}
@@ -217,7 +217,7 @@ last_reconnect_attempt(millis() - reconnect_interval_millis) {
 
 Client::SubscriptionId Client::subscribe(const String & topic_filter, MessageCallback callback) {
     TRACE_FUNCTION
-    const auto ret = SubscribedMessageListener::subscribe(topic_filter, callback);
+    const auto ret = SubscribedMessageListener::subscribe(topic_filter, std::move(callback));
     BasicClient::subscribe(topic_filter);
     return ret;
 }
@@ -141,6 +141,11 @@ int ClientWrapper::available() {
     return client.available();
 }
 
+int ClientWrapper::availableForWrite() {
+    TRACE_FUNCTION
+    return client.availableForWrite();
+}
+
 void ClientWrapper::flush() {
     TRACE_FUNCTION
     client.flush();
@@ -25,6 +25,7 @@ class ClientWrapper: public ::Client {
         virtual int connect(const char * host, uint16_t port, int32_t timeout) override;
 #endif
         virtual int available() override;
+        virtual int availableForWrite() override;
         virtual void flush() override;
         virtual void stop() override;
         virtual uint8_t connected() override;
@@ -22,10 +22,80 @@
 #define PICOMQTT_MAX_USERPASS_SIZE 256
 #endif
 
+#ifndef PICOMQTT_PEER_CLIENT_ID_PREFIX
+// Client id prefix of links between FederatedServer instances
+#define PICOMQTT_PEER_CLIENT_ID_PREFIX "$peer-"
+#endif
+
+#ifndef PICOMQTT_MAX_BUFFERED_PAYLOAD_SIZE
+// Default of Server::max_buffered_payload_size
+#define PICOMQTT_MAX_BUFFERED_PAYLOAD_SIZE PICOMQTT_MAX_MESSAGE_SIZE
+#endif
+
+#ifndef PICOMQTT_CALLBACK_INLINE_SIZE
+// Message callbacks up to this size (including the payload adapter of the const char * and void * overloads, which
+// adds two words) are stored without allocating
+#define PICOMQTT_CALLBACK_INLINE_SIZE (4 * sizeof(void *))
+#endif
+
 #ifndef PICOMQTT_OUTGOING_BUFFER_SIZE
 #define PICOMQTT_OUTGOING_BUFFER_SIZE 128
 #endif
 
+#ifndef PICOMQTT_MAX_CLIENTS
+// Default of Server::max_clients, 0 means no limit
+#define PICOMQTT_MAX_CLIENTS 0
+#endif
+
+#ifndef PICOMQTT_MIN_FREE_HEAP
+// Default of Server::min_free_heap
+#define PICOMQTT_MIN_FREE_HEAP (8 * 1024)
+#endif
+
+#ifndef PICOMQTT_MAX_REJECTED_CLIENTS
+// Refused connections which wait for their CONNACK at the same time, the rest is closed right away
+#define PICOMQTT_MAX_REJECTED_CLIENTS 4
+#endif
+
+#ifndef PICOMQTT_SOCKET_MEMORY_ESTIMATE
+// Default of Server::socket_memory_estimate
+#define PICOMQTT_SOCKET_MEMORY_ESTIMATE 512
+#endif
+
+#ifndef PICOMQTT_IDLE_COMPACTION_MILLIS
+// Default of Server::idle_compaction_millis, 0 disables compaction
+#define PICOMQTT_IDLE_COMPACTION_MILLIS (60 * 1000)
+#endif
+
+#ifndef PICOMQTT_MAX_SESSIONS
+// Default of Server::max_sessions, 0 disables persistent sessions
+#define PICOMQTT_MAX_SESSIONS 16
+#endif
+
+#ifndef PICOMQTT_ASYNC_QUEUE_SIZE
+// Default of Server::async_queue_size, 0 disables Server::publish_async()
+#define PICOMQTT_ASYNC_QUEUE_SIZE 0
+#endif
+
+#ifndef PICOMQTT_ASYNC_WAIT_MILLIS
+// Default of Server::async_wait_millis
+#define PICOMQTT_ASYNC_WAIT_MILLIS 0
+#endif
+
+#ifndef PICOMQTT_TLS
+// TlsServer, needs mbedTLS (shipped with ESP-IDF and the ESP32 Arduino core).  Define as 0 to build without it.
+#if defined(ESP32) || defined(ESP_PLATFORM)
+#define PICOMQTT_TLS 1
+#else
+#define PICOMQTT_TLS 0
+#endif
+#endif
+
+#ifndef PICOMQTT_TLS_RECORD_SIZE
+// Default size of the plaintext buffer of each TLS connection, see TlsServer::record_size
+#define PICOMQTT_TLS_RECORD_SIZE 512
+#endif
+
 #ifdef ESP32
 // Uncomment this define to make PicoMQTT compatible with framework variants
 // which have extra Client::connect methods which accept a timeout parameter.
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace PicoMQTT {
+
+template <typename Signature, size_t InlineSize = 4 * sizeof(void *)>
+class Delegate;
+
+/*
+ * Function wrapper similar to std::function, but with a configurable small buffer: callables of up to InlineSize
+ * bytes (e.g. lambdas capturing a few pointers or values) are stored inside the object, only bigger ones are
+ * allocated on the heap.  Calling a delegate is a single indirect call.  Trivially copyable callables stored inline
+ * (which includes most lambdas) are copied with memcpy and need no destructor call.
+ *
+ * Calling an empty delegate is undefined.
+ */
+template <typename R, typename... Args, size_t InlineSize>
+class Delegate<R(Args...), InlineSize> {
+    public:
+        // enough for pointers and all scalar types commonly captured by lambdas
+        static constexpr size_t storage_alignment = alignof(double) > alignof(long long) ? alignof(double)
+                                                    : alignof(long long);
+
+        template <typename Callable>
+        static constexpr bool fits_inline() {
+            return (sizeof(Callable) <= InlineSize) && (alignof(Callable) <= storage_alignment)
+                   && std::is_nothrow_move_constructible<Callable>::value;
+        }
+
+        Delegate(): invoker(nullptr), manager(nullptr) {}
+        Delegate(std::nullptr_t): Delegate() {}
+
+        template <typename Function, typename Callable = typename std::decay<Function>::type,
+                  typename = typename std::enable_if<!std::is_same<Callable, Delegate>::value
+                          && std::is_invocable_r<R, Callable &, Args...>::value>::type>
+        Delegate(Function && function) {
+            if constexpr (fits_inline<Callable>()) {
+                new (storage) Callable(std::forward<Function>(function));
+                invoker = &invoke_inline<Callable>;
+                manager = (std::is_trivially_copyable<Callable>::value
+                           && std::is_trivially_destructible<Callable>::value) ? nullptr : &manage_inline<Callable>;
+            } else {
+                *reinterpret_cast<Callable **>(storage) = new Callable(std::forward<Function>(function));
+                invoker = &invoke_heap<Callable>;
+                manager = &manage_heap<Callable>;
+            }
+        }
+
+        Delegate(const Delegate & other) { copy_from(other); }
+        Delegate(Delegate && other) noexcept { move_from(other); }
+
+        Delegate & operator=(const Delegate & other) {
+            if (this != &other) {
+                reset();
+                copy_from(other);
+            }
+            return *this;
+        }
+
+        Delegate & operator=(Delegate && other) noexcept {
+            if (this != &other) {
+                reset();
+                move_from(other);
+            }
+            return *this;
+        }
+
+        Delegate & operator=(std::nullptr_t) {
+            reset();
+            return *this;
+        }
+
+        ~Delegate() { reset(); }
+
+        explicit operator bool() const { return invoker != nullptr; }
+
+        R operator()(Args... args) const {
+            return invoker(const_cast<unsigned char *>(storage), std::forward<Args>(args)...);
+        }
+
+    protected:
+        enum class Operation { COPY, MOVE, DESTROY };
+
+        typedef R (*Invoker)(void * storage, Args... args);
+        typedef void (*Manager)(Operation operation, void * target, void * source);
+
+        template <typename Callable>
+        static R invoke_inline(void * storage, Args... args) {
+            return (*static_cast<Callable *>(storage))(std::forward<Args>(args)...);
+        }
+
+        template <typename Callable>
+        static R invoke_heap(void * storage, Args... args) {
+            return (**static_cast<Callable **>(storage))(std::forward<Args>(args)...);
+        }
+
+        template <typename Callable>
+        static void manage_inline(Operation operation, void * target, void * source) {
+            switch (operation) {
+                case Operation::COPY:
+                    new (target) Callable(*static_cast<const Callable *>(source));
+                    break;
+                case Operation::MOVE:
+                    new (target) Callable(std::move(*static_cast<Callable *>(source)));
+                    static_cast<Callable *>(source)->~Callable();
+                    break;
+                case Operation::DESTROY:
+                    static_cast<Callable *>(target)->~Callable();
+                    break;
+            }
+        }
+
+        template <typename Callable>
+        static void manage_heap(Operation operation, void * target, void * source) {
+            switch (operation) {
+                case Operation::COPY:
+                    *static_cast<Callable **>(target) = new Callable(**static_cast<Callable **>(source));
+                    break;
+                case Operation::MOVE:
+                    *static_cast<Callable **>(target) = *static_cast<Callable **>(source);
+                    break;
+                case Operation::DESTROY:
+                    delete *static_cast<Callable **>(target);
+                    break;
+            }
+        }
+
+        void copy_from(const Delegate & other) {
+            invoker = other.invoker;
+            manager = other.manager;
+            if (manager) {
+                manager(Operation::COPY, storage, const_cast<unsigned char *>(other.storage));
+            } else if (invoker) {
+                memcpy(storage, other.storage, InlineSize);
+            }
+        }
+
+        void move_from(Delegate & other) {
+            invoker = other.invoker;
+            manager = other.manager;
+            if (manager) {
+                manager(Operation::MOVE, storage, other.storage);
+            } else if (invoker) {
+                memcpy(storage, other.storage, InlineSize);
+            }
+            other.invoker = nullptr;
+            other.manager = nullptr;
+        }
+
+        void reset() {
+            if (manager) {
+                manager(Operation::DESTROY, storage, nullptr);
+            }
+            invoker = nullptr;
+            manager = nullptr;
+        }
+
+        static_assert(InlineSize >= sizeof(void *), "The inline storage must be able to hold a pointer");
+
+        alignas(storage_alignment) unsigned char storage[InlineSize];
+        Invoker invoker;
+        Manager manager;
+};
+
+}
@@ -0,0 +1,273 @@
+#include "debug.h"
+#include "federation.h"
+
+namespace PicoMQTT {
+
+FederatedServer::Peer::Peer(FederatedServer & server, const char * host, uint16_t port, const char * id)
+    : ::PicoMQTT::Client(host, port, id, server.node_id.c_str(), server.peer_password.c_str(),
+                         server.peer_reconnect_interval_millis, 60 * 1000, server.peer_socket_timeout_millis),
+      server(server) {
+    TRACE_FUNCTION
+}
+
+void FederatedServer::Peer::set_interest(const std::set<String> & interest) {
+    TRACE_FUNCTION
+    const bool online = connected();
+
+    for (auto it = topic_filters.begin(); it != topic_filters.end();) {
+        if (interest.count(*it)) {
+            ++it;
+            continue;
+        }
+        if (online) {
+            send_unsubscribe(*it);
+        }
+        topic_filters.erase(it++);
+    }
+
+    for (const auto & topic_filter : interest) {
+        if (topic_filters.insert(topic_filter).second && online) {
+            send_subscribe(topic_filter);
+        }
+    }
+}
+
+size_t FederatedServer::Peer::get_memory_usage() const {
+    TRACE_FUNCTION
+    size_t ret = tree_heap_usage(topic_filters) + heap_usage(payload_buffer);
+    for (const auto & topic_filter : topic_filters) {
+        ret += heap_block_size(topic_filter.length() + 1);
+    }
+    return ret;
+}
+
+void FederatedServer::Peer::on_connect() {
+    TRACE_FUNCTION
+    ::PicoMQTT::Client::on_connect();
+    for (const auto & topic_filter : topic_filters) {
+        send_subscribe(topic_filter);
+    }
+}
+
+// Unlike BasicClient::subscribe() and unsubscribe(), these don't wait for the acknowledgement.  Two brokers waiting
+// for each other's SUBACK would block both until the socket timeout.
+
+void FederatedServer::Peer::send_subscribe(const String & topic_filter) {
+    TRACE_FUNCTION
+    const size_t topic_size = topic_filter.length();
+    auto packet = build_packet(Packet::SUBSCRIBE, 0b0010, 2 + 2 + topic_size + 1);
+    packet.write_u16(message_id_generator.generate());
+    packet.write_string(topic_filter.c_str(), topic_size);
+    packet.write_u8(0);
+    packet.send();
+}
+
+void FederatedServer::Peer::send_unsubscribe(const String & topic_filter) {
+    TRACE_FUNCTION
+    const size_t topic_size = topic_filter.length();
+    auto packet = build_packet(Packet::UNSUBSCRIBE, 0b0010, 2 + 2 + topic_size);
+    packet.write_u16(message_id_generator.generate());
+    packet.write_string(topic_filter.c_str(), topic_size);
+    packet.send();
+}
+
+void FederatedServer::Peer::on_message(const char * topic, IncomingPacket & packet) {
+    TRACE_FUNCTION
+    server.on_peer_message(topic, packet, payload_buffer);
+}
+
+void FederatedServer::Peer::handle_packet(IncomingPacket & packet) {
+    TRACE_FUNCTION
+    switch (packet.get_type()) {
+        case Packet::SUBACK:
+        case Packet::UNSUBACK:
+            // remaining data is ignored by the packet destructor
+            return;
+
+        default:
+            ::PicoMQTT::Client::handle_packet(packet);
+            return;
+    }
+}
+
+void FederatedServer::add_peer(const char * host, uint16_t port) {
+    TRACE_FUNCTION
+    if (node_id.isEmpty()) {
+        node_id = String((unsigned long) random(0x7fffffff), HEX);
+    }
+    const String client_id = PICOMQTT_PEER_CLIENT_ID_PREFIX + node_id;
+    peers.push_back(std::unique_ptr<Peer>(new Peer(*this, host, port, client_id.c_str())));
+    peers.back()->set_interest(interest);
+}
+
+void FederatedServer::begin() {
+    TRACE_FUNCTION
+    if (!memory.find("federation")) {
+        memory.add("federation", [this] { return get_federation_memory_usage(); });
+    }
+    for (auto & peer : peers) {
+        peer->username = node_id;
+        peer->password = peer_password;
+    }
+    Server::begin();
+    update_interest();
+}
+
+size_t FederatedServer::get_federation_memory_usage() const {
+    TRACE_FUNCTION
+    size_t ret = 0;
+    for (const auto & peer : peers) {
+        // the peer's socket is counted like the sockets of local clients
+        ret += heap_block_size(sizeof(Peer)) + socket_memory_estimate + peer->get_memory_usage();
+    }
+
+    ret += tree_heap_usage(interest);
+    for (const auto & topic_filter : interest) {
+        ret += heap_block_size(topic_filter.length() + 1);
+    }
+
+    ret += tree_heap_usage(client_interest);
+    for (const auto & kv : client_interest) {
+        ret += heap_block_size(kv.first.length() + 1) + tree_heap_usage(kv.second);
+        for (const auto & topic_filter : kv.second) {
+            ret += heap_block_size(topic_filter.length() + 1);
+        }
+    }
+    return ret;
+}
+
+void FederatedServer::loop() {
+    TRACE_FUNCTION
+    Server::loop();
+
+    if (interest_changed) {
+        update_interest();
+    }
+
+    for (auto & peer : peers) {
+        peer->loop();
+    }
+}
+
+SubscribedMessageListener::SubscriptionId FederatedServer::subscribe(const String & topic_filter,
+        MessageCallback callback) {
+    TRACE_FUNCTION
+    interest_changed = true;
+    return Server::subscribe(topic_filter, std::move(callback));
+}
+
+void FederatedServer::unsubscribe(const String & topic_filter) {
+    TRACE_FUNCTION
+    interest_changed = true;
+    Server::unsubscribe(topic_filter);
+}
+
+bool FederatedServer::is_peer(const char * client_id) {
+    TRACE_FUNCTION
+    static const size_t prefix_size = strlen(PICOMQTT_PEER_CLIENT_ID_PREFIX);
+    return strncmp(client_id, PICOMQTT_PEER_CLIENT_ID_PREFIX, prefix_size) == 0;
+}
+
+ConnectReturnCode FederatedServer::auth(const char * client_id, const char * username, const char * password) {
+    TRACE_FUNCTION
+    if (!is_peer(client_id)) {
+        return Server::auth(client_id, username, password);
+    }
+
+    // only peer links may use peer client ids, they get the split horizon and are left out of shared groups
+    if (peer_password.isEmpty() || !password || (peer_password != password)) {
+        return CRC_NOT_AUTHORIZED;
+    }
+    return CRC_ACCEPTED;
+}
+
+size_t FederatedServer::get_connected_peer_count() const {
+    TRACE_FUNCTION
+    size_t ret = 0;
+    for (const auto & peer : peers) {
+        if (peer->connected()) {
+            ++ret;
+        }
+    }
+    return ret;
+}
+
+void FederatedServer::on_disconnected(const char * client_id) {
+    TRACE_FUNCTION
+    if (client_interest.erase(client_id)) {
+        interest_changed = true;
+    }
+}
+
+void FederatedServer::on_subscribe(const char * client_id, const char * topic) {
+    TRACE_FUNCTION
+    if (!is_peer(client_id) && client_interest[client_id].insert(topic).second) {
+        interest_changed = true;
+    }
+}
+
+void FederatedServer::on_unsubscribe(const char * client_id, const char * topic) {
+    TRACE_FUNCTION
+    auto it = client_interest.find(client_id);
+    if ((it != client_interest.end()) && it->second.erase(topic)) {
+        interest_changed = true;
+    }
+}
+
+void FederatedServer::update_interest() {
+    TRACE_FUNCTION
+    interest_changed = false;
+
+    std::set<String> new_interest;
+    for (const auto & kv : client_interest) {
+        for (const auto & topic_filter : kv.second) {
+            // peers forward all messages matching the filter, this node picks the member of the group
+            String group;
+            const char * filter = SharedSubscription::parse(topic_filter.c_str(), group);
+            new_interest.insert(filter ? String(filter) : topic_filter);
+        }
+    }
+    for (const auto & kv : subscriptions) {
+        new_interest.insert(kv.first);
+    }
+
+    if (new_interest == interest) {
+        return;
+    }
+
+    interest = std::move(new_interest);
+    for (auto & peer : peers) {
+        peer->set_interest(interest);
+    }
+}
+
+PrintMux FederatedServer::get_subscribed(const char * topic) {
+    TRACE_FUNCTION
+    if (!routing_peer_message) {
+        return Server::get_subscribed(topic);
+    }
+
+    // split horizon: messages from peers are not sent back to any peer
+    const TopicTokens tokens(topic);
+    PrintMux ret;
+    for (auto & client_ptr : clients) {
+        if (!is_peer(client_ptr->get_client_id()) && client_ptr->get_subscription(tokens)) {
+            ret.add(client_ptr->get_print());
+        }
+    }
+    add_shared_subscribers(tokens, ret, is_peer);
+    return ret;
+}
+
+void FederatedServer::on_peer_message(const char * topic, IncomingPacket & packet, std::vector<uint8_t> & buffer) {
+    TRACE_FUNCTION
+    ++peer_messages;
+
+    routing_peer_message = true;
+    auto publish = begin_publish(topic, packet.get_remaining_size());
+    routing_peer_message = false;
+
+    route(topic, packet, publish, buffer);
+}
+
+}
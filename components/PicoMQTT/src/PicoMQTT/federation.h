@@ -0,0 +1,112 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "client.h"
+#include "config.h"
+#include "server.h"
+
+namespace PicoMQTT {
+
+/*
+ * A broker which shares messages with other brokers (peers).
+ *
+ * The server opens a link to every peer, which is a regular client connection with a client id starting with
+ * PICOMQTT_PEER_CLIENT_ID_PREFIX.  Over this link it subscribes to the topic filters which local clients and local
+ * callbacks are subscribed to (the interest of this node) and keeps the subscriptions up to date as local clients
+ * come and go.  The peer then forwards only the messages that have subscribers here, like to any other subscriber.
+ *
+ * Messages received from a peer are delivered to local clients and callbacks, but never to other peers (split
+ * horizon) and subscriptions of peer links don't count as interest.  This prevents loops, but it also means that a
+ * message travels at most one hop, so every node should list all other nodes as its peers (full mesh).
+ *
+ * Shared subscription groups are local to each node: a node subscribes to the plain topic filter on its peers, so
+ * each node with members in a group delivers a message to one of them.
+ *
+ * Peer links authenticate with peer_password, which must be the same on all nodes.  Connections using a client id
+ * with the peer prefix are refused unless they send it, so local clients can't pose as peers.  Subclasses overriding
+ * auth() must call FederatedServer::auth() first.
+ */
+class FederatedServer: public Server {
+    public:
+        class Peer: public ::PicoMQTT::Client {
+            public:
+                Peer(FederatedServer & server, const char * host, uint16_t port, const char * id);
+
+                void set_interest(const std::set<String> & interest);
+                virtual void on_connect() override;
+
+                // heap used by the subscriptions and the payload buffer of the link, not including the object itself
+                size_t get_memory_usage() const;
+
+            protected:
+                FederatedServer & server;
+                std::set<String> topic_filters;
+                std::vector<uint8_t> payload_buffer;
+
+                void send_subscribe(const String & topic_filter);
+                void send_unsubscribe(const String & topic_filter);
+
+                virtual void on_message(const char * topic, IncomingPacket & packet) override;
+                virtual void handle_packet(IncomingPacket & packet) override;
+        };
+
+        using Server::Server;
+
+        void add_peer(const char * host, uint16_t port = 1883);
+
+        virtual void begin() override;
+        virtual void loop() override;
+
+        using SubscribedMessageListener::subscribe;
+        virtual SubscriptionId subscribe(const String & topic_filter, MessageCallback callback) override;
+        virtual void unsubscribe(const String & topic_filter) override;
+
+        static bool is_peer(const char * client_id);
+
+        size_t get_peer_count() const { return peers.size(); }
+        size_t get_connected_peer_count() const;
+        const std::set<String> & get_interest() const { return interest; }
+
+        // Unique name of this node, used in the client id of peer links.  A random one is generated if left empty.
+        String node_id;
+
+        // Shared secret of the peer links.  While it's empty, no node accepts peer links.  Set it before begin().
+        String peer_password;
+
+        unsigned long peer_reconnect_interval_millis = 5 * 1000;
+        unsigned long peer_socket_timeout_millis = 2 * 1000;
+
+        // number of messages received from peers
+        unsigned long peer_messages = 0;
+
+    protected:
+        virtual ConnectReturnCode auth(const char * client_id, const char * username, const char * password) override;
+        virtual void on_disconnected(const char * client_id) override;
+        virtual void on_subscribe(const char * client_id, const char * topic) override;
+        virtual void on_unsubscribe(const char * client_id, const char * topic) override;
+
+        virtual PrintMux get_subscribed(const char * topic) override;
+
+        void on_peer_message(const char * topic, IncomingPacket & packet, std::vector<uint8_t> & buffer);
+        void update_interest();
+        size_t get_federation_memory_usage() const;
+
+        std::list<std::unique_ptr<Peer>> peers;
+
+        // topic filters of local (non-peer) clients, by client id
+        std::map<String, std::set<String>> client_interest;
+        std::set<String> interest;
+        bool interest_changed = false;
+
+        // set while a message received from a peer is routed
+        bool routing_peer_message = false;
+};
+
+}
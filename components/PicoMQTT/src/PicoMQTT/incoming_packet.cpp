@@ -19,6 +19,19 @@ IncomingPacket::IncomingPacket(const Type type, const uint8_t flags, const size_
     TRACE_FUNCTION
 }
 
+BufferedIncomingPacket::BufferedIncomingPacket(const Type type, const uint8_t flags, const uint8_t * data,
+        const size_t size)
+    // the base only stores the reference to buffer, which is constructed later
+    : IncomingPacket(type, flags, size, buffer), data(data), buffer(data) {
+    TRACE_FUNCTION
+}
+
+BufferedIncomingPacket::~BufferedIncomingPacket() {
+    TRACE_FUNCTION
+    // unread data doesn't have to be drained from a socket
+    pos = size;
+}
+
 IncomingPacket::~IncomingPacket() {
     TRACE_FUNCTION
 #ifdef PICOMQTT_DEBUG
@@ -3,6 +3,7 @@
 #include <Arduino.h>
 #include <Client.h>
 
+#include "buffer_client.h"
 #include "config.h"
 #include "packet.h"
 
@@ -43,10 +44,27 @@ class IncomingPacket: public Packet, public Client {
         bool read_string(char * buffer, size_t len);
         void ignore(size_t len);
 
+        // If the rest of the packet is already in memory, returns a pointer to it (get_remaining_size() bytes followed
+        // by a zero byte), otherwise nullptr.  The data is owned by the packet's source and must not be modified.
+        virtual const uint8_t * get_buffered_data() const { return nullptr; }
+
     protected:
         static Packet read_header(Client & client);
 
         Client & client;
 };
 
+// An incoming packet, which has been read into memory already.  The data must be followed by a zero byte.
+class BufferedIncomingPacket: public IncomingPacket {
+    public:
+        BufferedIncomingPacket(const Type type, const uint8_t flags, const uint8_t * data, const size_t size);
+        ~BufferedIncomingPacket();
+
+        virtual const uint8_t * get_buffered_data() const override { return data + pos; }
+
+    protected:
+        const uint8_t * data;
+        BufferClient buffer;
+};
+
 }
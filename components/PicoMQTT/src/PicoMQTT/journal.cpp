@@ -0,0 +1,369 @@
+#include <cstring>
+
+#include "journal.h"
+
+namespace {
+
+const uint32_t SECTOR_MAGIC = 0x4c4e524a;  // "JRNL"
+
+// magic, sequence, base, crc32
+const size_t SECTOR_HEADER_SIZE = 4 * sizeof(uint32_t);
+// size, type, 0, crc32
+const size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+size_t round_up(size_t size) {
+    return (size + 3) & ~size_t(3);
+}
+
+void write_u32(uint8_t * buffer, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i) {
+        buffer[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+uint32_t read_u32(const uint8_t * buffer) {
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t) buffer[3] << 24);
+}
+
+// CRC-32 (IEEE), a nibble at a time, which keeps the table small
+uint32_t crc32_update(uint32_t crc, const void * data, size_t size) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    const uint8_t * bytes = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0x0f] ^ (crc >> 4);
+        crc = table[(crc ^ (bytes[i] >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return crc;
+}
+
+uint32_t record_crc(const uint8_t * header, const void * data, size_t size) {
+    return ~crc32_update(crc32_update(~0u, header, 4), data, size);
+}
+
+bool is_erased(const uint8_t * data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+namespace PicoMQTT {
+
+Journal::Journal(Storage & storage, size_t buffer_size)
+    : checkpoint_sectors(0), storage(storage), sector_count(0), sector_size(0), opened(false), head(0),
+      head_sequence(0), write_offset(0), base_sequence(1), buffer(buffer_size), buffer_used(0), checkpointing(false) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+size_t Journal::get_max_record_size() const {
+    const size_t max_size = sector_size - SECTOR_HEADER_SIZE - RECORD_HEADER_SIZE;
+    return max_size < 0xffff ? max_size : 0xfffe;
+}
+
+size_t Journal::get_used_sectors() const {
+    return opened ? head_sequence - base_sequence + 1 : 0;
+}
+
+size_t Journal::sector_at(uint32_t sequence) const {
+    return (head + sector_count - (head_sequence - sequence) % sector_count) % sector_count;
+}
+
+bool Journal::begin(ReplayCallback callback) {
+    sector_size = storage.get_sector_size();
+    sector_count = sector_size ? storage.get_size() / sector_size : 0;
+    if ((sector_count < 4) || (sector_size < 256)) {
+        return false;
+    }
+
+    if (!checkpoint_sectors) {
+        checkpoint_sectors = sector_count / 2;
+    }
+
+    opened = false;
+    head_sequence = 0;
+    buffer_used = 0;
+    dirty.assign(sector_count, false);
+
+    // find the sector written last
+    std::vector<uint32_t> sequences(sector_count, 0);
+    size_t newest = 0;
+    uint32_t newest_base = 0;
+    for (size_t sector = 0; sector < sector_count; ++sector) {
+        uint8_t header[SECTOR_HEADER_SIZE];
+        if (!storage.read(sector_offset(sector), header, sizeof(header))) {
+            return false;
+        }
+        if (is_erased(header, sizeof(header))) {
+            continue;
+        }
+        dirty[sector] = true;
+        if ((read_u32(header) != SECTOR_MAGIC)
+                || (read_u32(header + 12) != ~crc32_update(~0u, header, 12))) {
+            continue;
+        }
+        sequences[sector] = read_u32(header + 4);
+        if (sequences[sector] > head_sequence || !opened) {
+            opened = true;
+            newest = sector;
+            head_sequence = sequences[sector];
+            newest_base = read_u32(header + 8);
+        }
+    }
+
+    if (!opened) {
+        // empty or unformatted, start at the first sector
+        head = sector_count - 1;
+        head_sequence = 0;
+        base_sequence = 1;
+        return true;
+    }
+
+    head = newest;
+
+    // The sectors since the base must directly precede the newest one, but a checkpoint which completed in the
+    // newest sector may have obsoleted and erased some of them.
+    uint32_t first = head_sequence;
+    while ((first > newest_base) && (first > 1) && (head_sequence - first + 1 < sector_count)
+            && (sequences[sector_at(first - 1)] == first - 1)) {
+        --first;
+    }
+
+    std::vector<uint8_t> data(sector_size);
+
+    // the last complete checkpoint
+    uint32_t checkpoint = 0;
+    for (uint32_t sequence = first; sequence != head_sequence + 1; ++sequence) {
+        scan_sector(sector_at(sequence), data, nullptr, &checkpoint, sequence == head_sequence);
+    }
+    base_sequence = ((checkpoint >= first) && (checkpoint <= head_sequence)) ? checkpoint : first;
+
+    for (uint32_t sequence = base_sequence; sequence != head_sequence + 1; ++sequence) {
+        write_offset = scan_sector(sector_at(sequence), data, &callback, nullptr, sequence == head_sequence);
+    }
+
+    // Continue in the last sector only if the rest of it is erased, a record torn by a reset may have left
+    // programmed bits behind the last valid record.
+    if (!is_erased(data.data() + write_offset, sector_size - write_offset)) {
+        write_offset = sector_size;
+    }
+
+    return true;
+}
+
+size_t Journal::scan_sector(size_t sector, std::vector<uint8_t> & data, ReplayCallback * callback,
+                            uint32_t * checkpoint, bool last) {
+    if (!storage.read(sector_offset(sector), data.data(), sector_size)) {
+        return sector_size;
+    }
+
+    size_t offset = SECTOR_HEADER_SIZE;
+    while (offset + RECORD_HEADER_SIZE <= sector_size) {
+        const uint8_t * header = data.data() + offset;
+        if (is_erased(header, RECORD_HEADER_SIZE)) {
+            break;
+        }
+
+        const size_t size = header[0] | (header[1] << 8);
+        const uint8_t type = header[2];
+        const size_t record_size = RECORD_HEADER_SIZE + round_up(size);
+        if ((offset + record_size > sector_size)
+                || (read_u32(header + 4) != record_crc(header, header + RECORD_HEADER_SIZE, size))) {
+            // The rest of the sector can't be parsed.  In the last sector, that's a record torn by a reset.
+            if (callback && !last) {
+                ++stats.corrupted;
+            }
+            break;
+        }
+
+        const uint8_t * record = header + RECORD_HEADER_SIZE;
+        if (type == CHECKPOINT_END) {
+            if (checkpoint && (size == 4)) {
+                *checkpoint = read_u32(record);
+            }
+        } else if (callback && (type <= MAX_RECORD_TYPE)) {
+            (*callback)(type, record, size);
+            ++stats.replayed;
+        }
+
+        offset += record_size;
+    }
+
+    return offset;
+}
+
+bool Journal::erase(size_t sector) {
+    if (!storage.erase_sector(sector_offset(sector))) {
+        return false;
+    }
+    dirty[sector] = false;
+    ++stats.sectors_erased;
+    return true;
+}
+
+bool Journal::open_sector() {
+    if (get_used_sectors() >= sector_count) {
+        // the next sector is still needed, no checkpoint freed any
+        return false;
+    }
+
+    const size_t sector = (head + 1) % sector_count;
+    if (!dirty[sector]) {
+        // an erase interrupted by a reset may have left an erased header on a sector which is not erased
+        uint8_t data[64];
+        for (size_t offset = 0; (offset < sector_size) && !dirty[sector]; offset += sizeof(data)) {
+            dirty[sector] = !storage.read(sector_offset(sector) + offset, data, sizeof(data))
+                            || !is_erased(data, sizeof(data));
+        }
+    }
+    if (dirty[sector] && !erase(sector)) {
+        return false;
+    }
+
+    uint8_t header[SECTOR_HEADER_SIZE];
+    write_u32(header, SECTOR_MAGIC);
+    write_u32(header + 4, head_sequence + 1);
+    write_u32(header + 8, base_sequence);
+    write_u32(header + 12, ~crc32_update(~0u, header, 12));
+
+    dirty[sector] = true;
+    if (!storage.write(sector_offset(sector), header, sizeof(header))) {
+        return false;
+    }
+
+    opened = true;
+    head = sector;
+    ++head_sequence;
+    write_offset = SECTOR_HEADER_SIZE;
+    stats.bytes_written += sizeof(header);
+    return true;
+}
+
+bool Journal::append(uint8_t type, const void * data, size_t size) {
+    if (type > MAX_RECORD_TYPE) {
+        return false;
+    }
+    return write_record(type, data, size);
+}
+
+bool Journal::write_record(uint8_t type, const void * data, size_t size) {
+    if (!sector_count || (size > get_max_record_size())) {
+        ++stats.dropped;
+        return false;
+    }
+
+    const size_t record_size = RECORD_HEADER_SIZE + round_up(size);
+
+    if (!opened || (write_offset + buffer_used + record_size > sector_size)) {
+        if (!commit() || !open_sector()) {
+            ++stats.dropped;
+            return false;
+        }
+    }
+
+    if ((buffer_used + record_size > buffer.size()) && !commit()) {
+        ++stats.dropped;
+        return false;
+    }
+
+    uint8_t header[RECORD_HEADER_SIZE];
+    header[0] = (uint8_t) size;
+    header[1] = (uint8_t)(size >> 8);
+    header[2] = type;
+    header[3] = 0;
+    write_u32(header + 4, record_crc(header, data, size));
+
+    if (record_size > buffer.size()) {
+        // too big for the buffer, which is empty now: write it directly, the padding stays erased
+        const size_t offset = sector_offset(head) + write_offset;
+        const bool ok = storage.write(offset, header, sizeof(header))
+                        && storage.write(offset + sizeof(header), data, size);
+        write_offset += record_size;
+        stats.bytes_written += sizeof(header) + size;
+        ++stats.commits;
+        if (!ok) {
+            ++stats.dropped;
+            return false;
+        }
+    } else {
+        uint8_t * target = buffer.data() + buffer_used;
+        memcpy(target, header, sizeof(header));
+        memcpy(target + sizeof(header), data, size);
+        memset(target + sizeof(header) + size, 0, record_size - sizeof(header) - size);
+        buffer_used += record_size;
+    }
+
+    ++stats.appended;
+    return true;
+}
+
+bool Journal::commit() {
+    if (!buffer_used) {
+        return true;
+    }
+
+    const bool ok = storage.write(sector_offset(head) + write_offset, buffer.data(), buffer_used);
+    stats.bytes_written += buffer_used;
+    ++stats.commits;
+
+    // Space written to is used, even if the write failed.  After a failure, don't write to the sector again.
+    write_offset = ok ? write_offset + buffer_used : sector_size;
+    buffer_used = 0;
+    return ok;
+}
+
+bool Journal::checkpoint() {
+    if (!sector_count || checkpointing) {
+        return false;
+    }
+
+    // The checkpoint starts a new sector, so the base of the log is always the start of a sector
+    checkpointing = true;
+    bool ok = commit() && open_sector();
+    const uint32_t begin_sequence = head_sequence;
+
+    if (ok && checkpoint_callback) {
+        checkpoint_callback();
+    }
+
+    uint8_t marker[4];
+    write_u32(marker, begin_sequence);
+    ok = ok && write_record(CHECKPOINT_END, marker, sizeof(marker)) && commit();
+    if (ok) {
+        // all sectors before are obsolete now
+        base_sequence = begin_sequence;
+        ++stats.checkpoints;
+    }
+    checkpointing = false;
+    return ok;
+}
+
+void Journal::loop() {
+    if (!opened) {
+        return;
+    }
+
+    if (checkpoint_callback && (get_used_sectors() >= checkpoint_sectors)) {
+        checkpoint();
+        return;
+    }
+
+    // Erase obsolete sectors just ahead of the log, one per call, so that opening a sector rarely waits for an
+    // erase.  The ones further ahead are erased when the log gets close.
+    const size_t free_sectors = sector_count - get_used_sectors();
+    for (size_t distance = 1; (distance <= 2) && (distance <= free_sectors); ++distance) {
+        const size_t sector = (head + distance) % sector_count;
+        if (dirty[sector]) {
+            erase(sector);
+            return;
+        }
+    }
+}
+
+}
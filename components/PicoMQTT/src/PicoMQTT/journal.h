@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "delegate.h"
+
+namespace PicoMQTT {
+
+/*
+ * Append-only log of small records on a flash partition, used to keep state across restarts.
+ *
+ * The partition is used as a ring of erase sectors.  Each sector starts with a header holding its sequence number
+ * and the sequence number of the oldest sector still needed (the base), followed by records of
+ * [size u16][type u8][0][crc32][data], padded to 4 bytes.  Records never span sectors, erased space (0xff) ends the
+ * records of a sector.  The CRC covers the record header and data, so records torn by a reset while they were written
+ * are detected and dropped on replay.
+ *
+ * Records are collected in a RAM buffer by append() and written by commit() in one go (group commit), so the
+ * application decides how much it may lose on a reset and how often the flash is written.
+ *
+ * The log is compacted by checkpoints: once it spans checkpoint_sectors, loop() starts a new sector and calls
+ * checkpoint_callback, which appends records describing the complete live state, and ends it with a marker.  The
+ * sectors before the checkpoint are then obsolete and loop() erases them one at a time, ahead of the sector being
+ * written, so erasing rarely delays append().  begin() replays the records from the last complete checkpoint on.
+ *
+ * Replay may pass the records of an interrupted checkpoint on top of the state they copy, so records must be
+ * idempotent (e.g. "set key to value", "remove everything up to n").  Not thread safe.
+ */
+class Journal {
+    public:
+        class Storage {
+            public:
+                virtual ~Storage() {}
+
+                virtual size_t get_size() const = 0;
+                virtual size_t get_sector_size() const = 0;
+
+                virtual bool read(size_t offset, void * buffer, size_t size) = 0;
+                // Like NOR flash, written bits may only change from 1 to 0 until the sector is erased
+                virtual bool write(size_t offset, const void * data, size_t size) = 0;
+                virtual bool erase_sector(size_t offset) = 0;
+        };
+
+        // types above this are used by the journal itself
+        static const uint8_t MAX_RECORD_TYPE = 0xef;
+
+        typedef Delegate<void(uint8_t type, const uint8_t * data, size_t size), 2 * sizeof(void *)> ReplayCallback;
+        typedef Delegate<void(), 2 * sizeof(void *)> CheckpointCallback;
+
+        struct Stats {
+            unsigned long appended;
+            unsigned long dropped;          // too big or no space left
+            unsigned long commits;          // writes of buffered records
+            unsigned long bytes_written;
+            unsigned long sectors_erased;
+            unsigned long checkpoints;
+            unsigned long replayed;
+            unsigned long corrupted;        // records skipped by replay, other than the last one written
+        };
+
+        Journal(Storage & storage, size_t buffer_size = 1024);
+
+        Journal(const Journal &) = delete;
+        const Journal & operator=(const Journal &) = delete;
+
+        // Reads the log, passes all records since the last complete checkpoint to callback and prepares appending.
+        // Returns false if the storage can't be used, e.g. because it's smaller than 4 sectors.
+        bool begin(ReplayCallback callback);
+
+        // Adds a record to the buffer, commits first if it doesn't fit.  Records bigger than get_max_record_size()
+        // are dropped.
+        bool append(uint8_t type, const void * data, size_t size);
+
+        // Writes the buffered records
+        bool commit();
+
+        // Starts a checkpoint when needed and erases an obsolete sector, if there's one ahead of the log
+        void loop();
+
+        // Writes a checkpoint right away, e.g. after replay, to drop records which don't apply anymore
+        bool checkpoint();
+
+        size_t get_max_record_size() const;
+        size_t get_pending_size() const { return buffer_used; }
+        // sectors from the last checkpoint up to the one being written
+        size_t get_used_sectors() const;
+        size_t get_sector_count() const { return sector_count; }
+        const Stats & get_stats() const { return stats; }
+
+        // Sectors spanned by the log which trigger a checkpoint, half of the storage by default
+        size_t checkpoint_sectors;
+        CheckpointCallback checkpoint_callback;
+
+    protected:
+        static const uint8_t CHECKPOINT_END = 0xf0;
+
+        size_t sector_offset(size_t sector) const { return sector * sector_size; }
+        size_t sector_at(uint32_t sequence) const;
+
+        bool open_sector();
+        bool erase(size_t sector);
+        bool write_record(uint8_t type, const void * data, size_t size);
+        // Passes the records of a sector to callback and/or the start of the last checkpoint ending in it to
+        // checkpoint.  Returns the offset after the last valid record.
+        size_t scan_sector(size_t sector, std::vector<uint8_t> & data, ReplayCallback * callback,
+                           uint32_t * checkpoint, bool last);
+
+        Storage & storage;
+        size_t sector_count;
+        size_t sector_size;
+
+        // sector being written, valid once a sector was opened
+        bool opened;
+        size_t head;
+        uint32_t head_sequence;
+        size_t write_offset;
+
+        // oldest sector needed to replay the log
+        uint32_t base_sequence;
+
+        // sectors which need to be erased before they can be written
+        std::vector<bool> dirty;
+
+        std::vector<uint8_t> buffer;
+        size_t buffer_used;
+        bool checkpointing;
+
+        Stats stats;
+};
+
+}
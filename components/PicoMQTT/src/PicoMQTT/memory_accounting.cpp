@@ -0,0 +1,34 @@
+#include <cstring>
+
+#include "memory_accounting.h"
+
+namespace PicoMQTT {
+
+void MemoryAccounting::add(const char * name, Probe probe) {
+    accounts.emplace_back(name, probe);
+}
+
+void MemoryAccounting::update() {
+    total = 0;
+    for (auto & account : accounts) {
+        account.current = account.probe();
+        if (account.current > account.high_water) {
+            account.high_water = account.current;
+        }
+        total += account.current;
+    }
+    if (total > total_high_water) {
+        total_high_water = total;
+    }
+}
+
+const MemoryAccounting::Account * MemoryAccounting::find(const char * name) const {
+    for (const auto & account : accounts) {
+        if (strcmp(account.name, name) == 0) {
+            return &account;
+        }
+    }
+    return nullptr;
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace PicoMQTT {
+
+// Estimated heap usage of a single allocation of the given size, including the allocator's header and alignment.
+inline size_t heap_block_size(size_t size) {
+    return size ? ((size + 7) & ~(size_t) 7) + 8 : 0;
+}
+
+template <typename T>
+size_t heap_usage(const std::vector<T> & vector) {
+    return heap_block_size(vector.capacity() * sizeof(T));
+}
+
+// std::set and std::map allocate a red-black tree node (3 pointers and a color) for each element
+template <typename Tree>
+size_t tree_heap_usage(const Tree & tree) {
+    return tree.size() * heap_block_size(sizeof(typename Tree::value_type) + 4 * sizeof(void *));
+}
+
+/*
+ * Memory owned by the subsystems of an application.
+ *
+ * Each account has a probe, which returns the number of bytes the subsystem currently owns.  Probes are only called
+ * from update(), which also tracks the high-water mark of each account and of the total.  Sampling is cheap enough
+ * to run every few seconds, but accounts are estimates: they count the payload of allocations plus a fixed allocator
+ * overhead, not what the heap allocator actually does.
+ */
+class MemoryAccounting {
+    public:
+        typedef std::function<size_t()> Probe;
+
+        struct Account {
+            Account(const char * name, Probe probe): name(name), probe(probe), current(0), high_water(0) {}
+
+            const char * name;
+            Probe probe;
+            size_t current;
+            size_t high_water;
+        };
+
+        MemoryAccounting(): total(0), total_high_water(0) {}
+
+        // The name is not copied, it must stay valid.
+        void add(const char * name, Probe probe);
+        void update();
+
+        const std::vector<Account> & get_accounts() const { return accounts; }
+        const Account * find(const char * name) const;
+
+        // values from the last update()
+        size_t get_total() const { return total; }
+        size_t get_total_high_water() const { return total_high_water; }
+
+    protected:
+        std::vector<Account> accounts;
+        size_t total;
+        size_t total_high_water;
+};
+
+}
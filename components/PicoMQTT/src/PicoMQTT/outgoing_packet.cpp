@@ -126,6 +126,15 @@ size_t OutgoingPacket::write(const void * data, size_t remaining, void * (*memcp
 size_t OutgoingPacket::write(const uint8_t * data, size_t length) {
     TRACE_FUNCTION
 #ifndef PICOMQTT_UNBUFFERED
+    if (length >= PICOMQTT_OUTGOING_BUFFER_SIZE) {
+        // large blocks are written to the print directly instead of being copied to the buffer chunk by chunk
+        if (buffer_position) {
+            flush();
+        }
+        const size_t written = print.write(data, length);
+        pos += written;
+        return written;
+    }
     return write(data, length, memcpy);
 #else
     const size_t written = print.write(data, length);
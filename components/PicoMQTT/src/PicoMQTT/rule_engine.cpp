@@ -0,0 +1,478 @@
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "rule_engine.h"
+
+namespace {
+
+bool parse_duration(const char * text, uint32_t & duration) {
+    char * unit;
+    const unsigned long value = strtoul(text, &unit, 10);
+    unsigned long scale;
+    if (!strcmp(unit, "ms")) {
+        scale = 1;
+    } else if (!strcmp(unit, "s")) {
+        scale = 1000;
+    } else if (!strcmp(unit, "m")) {
+        scale = 60 * 1000;
+    } else if (!strcmp(unit, "h")) {
+        scale = 60 * 60 * 1000;
+    } else {
+        return false;
+    }
+    // compared with signed differences of millis()
+    if ((unit == text) || (value > 0x7fffffffUL / scale)) {
+        return false;
+    }
+    duration = value * scale;
+    return true;
+}
+
+}
+
+namespace PicoMQTT {
+
+/*
+ * Recursive descent parser emitting the bytecode in postfix order:
+ *
+ *   condition  := or [ "for" duration ]
+ *   or         := and { "or" and }
+ *   and        := not { "and" not }
+ *   not        := "not" not | comparison
+ *   comparison := sum [ ( "<" | "<=" | ">" | ">=" | "==" | "!=" ) sum ]
+ *   sum        := product { ( "+" | "-" ) product }
+ *   product    := unary { ( "*" | "/" ) unary }
+ *   unary      := "-" unary | number | "value" | "(" or ")"
+ */
+class RuleEngine::Compiler {
+    public:
+        Compiler(Rule & rule, const char * text): rule(rule), cursor(text), depth(0), max_depth(0) {}
+
+        bool compile() {
+            rule.hold = 0;
+            if (!parse_or()) {
+                return false;
+            }
+            if (accept_word("for")) {
+                skip_spaces();
+                const char * begin = cursor;
+                while (isalnum((unsigned char) *cursor)) {
+                    ++cursor;
+                }
+                if (!parse_duration(std::string(begin, cursor).c_str(), rule.hold)) {
+                    return false;
+                }
+            }
+            skip_spaces();
+            return !*cursor && (depth == 1) && (max_depth <= MAX_STACK);
+        }
+
+    protected:
+        void skip_spaces() {
+            while (isspace((unsigned char) *cursor)) {
+                ++cursor;
+            }
+        }
+
+        bool accept(const char * symbol) {
+            skip_spaces();
+            const size_t size = strlen(symbol);
+            if (strncmp(cursor, symbol, size)) {
+                return false;
+            }
+            cursor += size;
+            return true;
+        }
+
+        bool accept_word(const char * word) {
+            skip_spaces();
+            const size_t size = strlen(word);
+            if (strncmp(cursor, word, size) || isalnum((unsigned char) cursor[size]) || (cursor[size] == '_')) {
+                return false;
+            }
+            cursor += size;
+            return true;
+        }
+
+        void emit(OpCode op) {
+            rule.code.push_back(op);
+            if ((op == PUSH_VALUE) || (op == PUSH_CONSTANT)) {
+                ++depth;
+                max_depth = depth > max_depth ? depth : max_depth;
+            } else if ((op != NEGATE) && (op != NOT)) {
+                --depth;
+            }
+        }
+
+        bool parse_or() {
+            if (!parse_and()) {
+                return false;
+            }
+            while (accept_word("or")) {
+                if (!parse_and()) {
+                    return false;
+                }
+                emit(OR);
+            }
+            return true;
+        }
+
+        bool parse_and() {
+            if (!parse_not()) {
+                return false;
+            }
+            while (accept_word("and")) {
+                if (!parse_not()) {
+                    return false;
+                }
+                emit(AND);
+            }
+            return true;
+        }
+
+        bool parse_not() {
+            if (accept_word("not")) {
+                if (!parse_not()) {
+                    return false;
+                }
+                emit(NOT);
+                return true;
+            }
+            return parse_comparison();
+        }
+
+        bool parse_comparison() {
+            if (!parse_sum()) {
+                return false;
+            }
+            // longer symbols first
+            static const struct {
+                const char * symbol;
+                OpCode op;
+            } comparisons[] = {
+                {"<=", LESS_EQUAL}, {">=", GREATER_EQUAL}, {"==", EQUAL}, {"!=", NOT_EQUAL}, {"<", LESS}, {">", GREATER},
+            };
+            for (const auto & comparison : comparisons) {
+                if (accept(comparison.symbol)) {
+                    if (!parse_sum()) {
+                        return false;
+                    }
+                    emit(comparison.op);
+                    return true;
+                }
+            }
+            return true;
+        }
+
+        bool parse_sum() {
+            if (!parse_product()) {
+                return false;
+            }
+            while (true) {
+                const OpCode op = accept("+") ? ADD : accept("-") ? SUBTRACT : NOT;
+                if (op == NOT) {
+                    return true;
+                }
+                if (!parse_product()) {
+                    return false;
+                }
+                emit(op);
+            }
+        }
+
+        bool parse_product() {
+            if (!parse_unary()) {
+                return false;
+            }
+            while (true) {
+                const OpCode op = accept("*") ? MULTIPLY : accept("/") ? DIVIDE : NOT;
+                if (op == NOT) {
+                    return true;
+                }
+                if (!parse_unary()) {
+                    return false;
+                }
+                emit(op);
+            }
+        }
+
+        bool parse_unary() {
+            if (accept("-")) {
+                if (!parse_unary()) {
+                    return false;
+                }
+                emit(NEGATE);
+                return true;
+            }
+
+            if (accept("(")) {
+                return parse_or() && accept(")");
+            }
+
+            if (accept_word("value")) {
+                emit(PUSH_VALUE);
+                return true;
+            }
+
+            skip_spaces();
+            if (!isdigit((unsigned char) *cursor) && (*cursor != '.')) {
+                return false;
+            }
+            char * end;
+            const float constant = strtof(cursor, &end);
+            if ((end == cursor) || (rule.constants.size() > 0xff)) {
+                return false;
+            }
+            cursor = end;
+            emit(PUSH_CONSTANT);
+            rule.code.push_back(rule.constants.size());
+            rule.constants.push_back(constant);
+            return true;
+        }
+
+        Rule & rule;
+        const char * cursor;
+        size_t depth;
+        size_t max_depth;
+};
+
+RuleEngine::RuleEngine(size_t max_keys): max_keys(max_keys), pending(0), next_expiry(0) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+bool RuleEngine::add(const char * name, const char * topic_filter, const char * condition) {
+    Rule rule;
+    rule.name = name;
+    if (!*topic_filter || !Compiler(rule, condition).compile()) {
+        return false;
+    }
+    rule.code.shrink_to_fit();
+    rule.constants.shrink_to_fit();
+
+    size_t filter_index = 0;
+    while ((filter_index < filters.size()) && strcmp(filter_set.get_filter(filter_index), topic_filter)) {
+        ++filter_index;
+    }
+
+    if (filter_index == filters.size()) {
+        Filter filter;
+        filter.multi_level = -1;
+        size_t level = 0;
+        for (const char * begin = topic_filter; ; ++level) {
+            const size_t size = strcspn(begin, "/");
+            if ((size == 1) && (*begin == '+')) {
+                filter.captures.push_back(level);
+            } else if ((size == 1) && (*begin == '#')) {
+                if (begin[1]) {
+                    return false;
+                }
+                filter.multi_level = level;
+            }
+            if (!begin[size]) {
+                break;
+            }
+            begin += size + 1;
+        }
+
+        filters.push_back(std::move(filter));
+        filter_set.add(topic_filter);
+        index.build(filter_set);
+    }
+
+    filters[filter_index].rules.push_back(rules.size());
+    rules.push_back(std::move(rule));
+    return true;
+}
+
+bool RuleEngine::evaluate(const Rule & rule, float value) {
+    float stack[MAX_STACK];
+    size_t top = 0;
+
+    const uint8_t * code = rule.code.data();
+    const uint8_t * const end = code + rule.code.size();
+    while (code < end) {
+        switch (*code++) {
+            case PUSH_VALUE:
+                stack[top++] = value;
+                break;
+            case PUSH_CONSTANT:
+                stack[top++] = rule.constants[*code++];
+                break;
+            case NEGATE:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            case NOT:
+                stack[top - 1] = stack[top - 1] == 0;
+                break;
+            default: {
+                const float right = stack[--top];
+                float & left = stack[top - 1];
+                switch (code[-1]) {
+                    case ADD: left = left + right; break;
+                    case SUBTRACT: left = left - right; break;
+                    case MULTIPLY: left = left * right; break;
+                    case DIVIDE: left = left / right; break;
+                    case LESS: left = left < right; break;
+                    case LESS_EQUAL: left = left <= right; break;
+                    case GREATER: left = left > right; break;
+                    case GREATER_EQUAL: left = left >= right; break;
+                    case EQUAL: left = left == right; break;
+                    case NOT_EQUAL: left = left != right; break;
+                    case AND: left = (left != 0) && (right != 0); break;
+                    case OR: left = (left != 0) || (right != 0); break;
+                }
+            }
+        }
+    }
+    return stack[0] != 0;
+}
+
+void RuleEngine::build_key(const Filter & filter, const TopicTokens & topic) {
+    key.clear();
+    for (const uint16_t level : filter.captures) {
+        key.append(topic.get_level_data(level), topic.get_level(level).size);
+        key.push_back('/');
+    }
+    if (filter.multi_level >= 0) {
+        key.append(topic.get_level_data(filter.multi_level));
+    }
+}
+
+void RuleEngine::update(const Rule & rule, const Key & key, State & state, bool condition, uint32_t now) {
+    if (!condition) {
+        if (state.pending) {
+            state.pending = false;
+            --pending;
+        }
+        if (state.active) {
+            state.active = false;
+            ++stats.cleared;
+            if (event_callback) {
+                event_callback(rule.name.c_str(), key.topic.c_str(), false, key.value);
+            }
+        }
+        return;
+    }
+
+    if (state.active) {
+        return;
+    }
+
+    if (rule.hold) {
+        if (!state.pending) {
+            state.pending = true;
+            state.since = now;
+            if (!pending++ || ((int32_t)(now + rule.hold - next_expiry) < 0)) {
+                next_expiry = now + rule.hold;
+            }
+            return;
+        }
+        if (now - state.since < rule.hold) {
+            return;
+        }
+        state.pending = false;
+        --pending;
+    }
+
+    state.active = true;
+    ++stats.raised;
+    if (event_callback) {
+        event_callback(rule.name.c_str(), key.topic.c_str(), true, key.value);
+    }
+}
+
+bool RuleEngine::ingest(const char * topic, const char * payload, uint32_t now) {
+    char * end;
+    const float value = strtof(payload, &end);
+    if ((end == payload) || (*end && *end != ' ')) {
+        ++stats.not_numeric;
+        return false;
+    }
+    return ingest(topic, value, now);
+}
+
+bool RuleEngine::ingest(const char * topic, float value, uint32_t now) {
+    if (rules.empty()) {
+        return false;
+    }
+
+    const TopicTokens tokens(topic);
+    matches.clear();
+    if (!index.match(tokens, matches)) {
+        return false;
+    }
+
+    for (const uint32_t filter_index : matches) {
+        Filter & filter = filters[filter_index];
+
+        build_key(filter, tokens);
+        auto it = filter.keys.find(key);
+        if (it == filter.keys.end()) {
+            if (filter.keys.size() >= max_keys) {
+                ++stats.dropped_keys;
+                continue;
+            }
+            it = filter.keys.emplace(key, Key()).first;
+            it->second.topic = topic;
+            it->second.states.assign(filter.rules.size(), State{false, false, 0});
+        }
+
+        Key & state_key = it->second;
+        state_key.value = value;
+        for (size_t i = 0; i < filter.rules.size(); ++i) {
+            const Rule & rule = rules[filter.rules[i]];
+            update(rule, state_key, state_key.states[i], evaluate(rule, value), now);
+        }
+        stats.evaluated += filter.rules.size();
+    }
+
+    ++stats.messages;
+    return true;
+}
+
+void RuleEngine::loop(uint32_t now) {
+    if (!pending || ((int32_t)(now - next_expiry) < 0)) {
+        return;
+    }
+
+    // raise the expired ones and find the next expiry among the rest
+    bool found = false;
+    for (auto & filter : filters) {
+        for (auto & kv : filter.keys) {
+            for (size_t i = 0; i < filter.rules.size(); ++i) {
+                State & state = kv.second.states[i];
+                if (!state.pending) {
+                    continue;
+                }
+                const Rule & rule = rules[filter.rules[i]];
+                update(rule, kv.second, state, true, now);
+                if (state.pending && (!found || ((int32_t)(state.since + rule.hold - next_expiry) < 0))) {
+                    next_expiry = state.since + rule.hold;
+                    found = true;
+                }
+            }
+        }
+    }
+}
+
+size_t RuleEngine::get_memory_usage() const {
+    size_t ret = rules.capacity() * sizeof(Rule) + filters.capacity() * sizeof(Filter)
+                 + filter_set.get_memory_usage() + index.get_memory_usage() + matches.capacity() * sizeof(uint32_t)
+                 + key.capacity();
+    for (const auto & rule : rules) {
+        ret += rule.name.capacity() + rule.code.capacity() + rule.constants.capacity() * sizeof(float);
+    }
+    for (const auto & filter : filters) {
+        ret += filter.captures.capacity() * sizeof(uint16_t) + filter.rules.capacity() * sizeof(uint32_t)
+               + filter.keys.bucket_count() * sizeof(void *);
+        for (const auto & kv : filter.keys) {
+            // node with the key, value and next pointer
+            ret += sizeof(kv) + sizeof(void *) + kv.first.capacity() + kv.second.topic.capacity()
+                   + kv.second.states.capacity() * sizeof(State);
+        }
+    }
+    return ret;
+}
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "delegate.h"
+#include "topic_matcher.h"
+
+namespace PicoMQTT {
+
+/*
+ * Alarms on numeric topics, evaluated as messages arrive.
+ *
+ * A rule has a name, a topic filter and a condition on the value of the message, optionally followed by a hold time:
+ *
+ *     value > 3.65
+ *     value == 6 for 5s
+ *     value < 2.8 or value > 3.65
+ *     not (value >= -50 and value <= 50) for 500ms
+ *
+ * Conditions may use numbers, value, the arithmetic operators + - * /, the comparisons < <= > >= == != and
+ * and, or, not and parentheses, with the usual precedence.  add() compiles the condition into bytecode for a small
+ * stack machine, so evaluating it doesn't parse or allocate anything.  The rules are indexed by topic filter with a
+ * TopicFilterIndex, only the rules matching the topic of a message are evaluated.
+ *
+ * Like in Aggregator, each rule keeps a separate state per key, the levels matched by the wildcards of its filter.
+ * Rules with the same filter share the keys, so a message costs one index lookup, one key lookup and the evaluation
+ * of the rules of the filter.  When the condition becomes true (and stays true for the hold time), event_callback is called with active set; when
+ * it becomes false again, it's called with active cleared.  Hold times expire in loop() even if no message arrives.
+ * Keys are allocated when they're first seen, up to max_keys per filter.  Not thread safe.
+ */
+class RuleEngine {
+    public:
+        typedef Delegate<void(const char * name, const char * topic, bool active, float value),
+                         2 * sizeof(void *)> EventCallback;
+
+        struct Stats {
+            unsigned long messages;         // numeric messages matching at least one rule
+            unsigned long not_numeric;
+            unsigned long evaluated;        // conditions evaluated
+            unsigned long raised;
+            unsigned long cleared;
+            unsigned long dropped_keys;     // messages of new keys beyond max_keys
+        };
+
+        // Max depth of the stack of the bytecode, conditions needing more are rejected
+        static const size_t MAX_STACK = 16;
+
+        RuleEngine(size_t max_keys = 16);
+
+        RuleEngine(const RuleEngine &) = delete;
+        const RuleEngine & operator=(const RuleEngine &) = delete;
+
+        // Compiles and adds a rule, returns false if the condition is not valid.  Rules must be added before any
+        // messages are ingested.
+        bool add(const char * name, const char * topic_filter, const char * condition);
+
+        // Parses the payload as a number, once, and evaluates all rules matching the topic
+        bool ingest(const char * topic, const char * payload, uint32_t now);
+        bool ingest(const char * topic, float value, uint32_t now);
+
+        // Raises alarms whose hold time expired
+        void loop(uint32_t now);
+
+        size_t get_rule_count() const { return rules.size(); }
+        size_t get_filter_count() const { return filters.size(); }
+        const Stats & get_stats() const { return stats; }
+        size_t get_memory_usage() const;
+
+        EventCallback event_callback;
+        const size_t max_keys;
+
+    protected:
+        enum OpCode : uint8_t {
+            PUSH_VALUE,
+            PUSH_CONSTANT,      // followed by the index of the constant
+            NEGATE,
+            ADD,
+            SUBTRACT,
+            MULTIPLY,
+            DIVIDE,
+            LESS,
+            LESS_EQUAL,
+            GREATER,
+            GREATER_EQUAL,
+            EQUAL,
+            NOT_EQUAL,
+            AND,
+            OR,
+            NOT,
+        };
+
+        struct Rule {
+            std::string name;
+            std::vector<uint8_t> code;
+            std::vector<float> constants;
+            uint32_t hold;
+        };
+
+        struct State {
+            bool active;
+            bool pending;           // condition true, waiting for the hold time
+            uint32_t since;
+        };
+
+        // a state per rule of the filter
+        struct Key {
+            std::string topic;      // of the messages
+            float value;            // of the last message
+            std::vector<State> states;
+        };
+
+        // Rules with the same topic filter share the keys, so a message is matched and its key looked up once
+        struct Filter {
+            std::vector<uint16_t> captures;     // levels matched by '+'
+            int multi_level;                    // level of '#' or -1
+            std::vector<uint32_t> rules;
+            std::unordered_map<std::string, Key> keys;
+        };
+
+        class Compiler;
+
+        static bool evaluate(const Rule & rule, float value);
+        void update(const Rule & rule, const Key & key, State & state, bool condition, uint32_t now);
+        void build_key(const Filter & filter, const TopicTokens & topic);
+
+        std::vector<Rule> rules;
+        std::vector<Filter> filters;
+        TopicFilterSet filter_set;
+        TopicFilterIndex index;
+        size_t pending;
+        // earliest end of a hold time, valid if pending
+        uint32_t next_expiry;
+
+        // reused by every message to avoid allocations
+        std::vector<uint32_t> matches;
+        std::string key;
+
+        Stats stats;
+};
+
+}
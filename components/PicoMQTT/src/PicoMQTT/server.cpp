@@ -1,196 +1,176 @@
+#include <algorithm>
+
+#include "buffer_client.h"
 #include "config.h"
 #include "debug.h"
 #include "server.h"
 
-namespace {
-
-class BufferClient: public ::Client {
-    public:
-        BufferClient(const void * ptr): ptr((const char *) ptr) { TRACE_FUNCTION }
-
-        // these methods are nop dummies
-        virtual int connect(IPAddress ip, uint16_t port) override final { TRACE_FUNCTION return 0; }
-        virtual int connect(const char * host, uint16_t port) override final { TRACE_FUNCTION return 0; }
-#ifdef PICOMQTT_EXTRA_CONNECT_METHODS
-        virtual int connect(IPAddress ip, uint16_t port, int32_t timeout) override final { TRACE_FUNCTION return 0; }
-        virtual int connect(const char * host, uint16_t port, int32_t timeout) override final { TRACE_FUNCTION return 0; }
-#endif
-        virtual size_t write(const uint8_t * buffer, size_t size) override final { TRACE_FUNCTION return 0; }
-        virtual size_t write(uint8_t value) override final { TRACE_FUNCTION return 0; }
-        virtual void flush() override final { TRACE_FUNCTION }
-        virtual void stop() override final { TRACE_FUNCTION }
-
-        // these methods are in jasager mode
-        virtual int available() override final { TRACE_FUNCTION return std::numeric_limits<int>::max(); }
-        virtual operator bool() override final { TRACE_FUNCTION return true; }
-        virtual uint8_t connected() override final { TRACE_FUNCTION return true; }
-
-        // actual reads implemented here
-        virtual int read(uint8_t * buf, size_t size) override {
-            memcpy(buf, ptr, size);
-            ptr += size;
-            return size;
-        }
-
-        virtual int read() override final {
-            TRACE_FUNCTION
-            uint8_t ret;
-            read(&ret, 1);
-            return ret;
-        }
-
-        virtual int peek() override final {
-            TRACE_FUNCTION
-            const int ret = read();
-            --ptr;
-            return ret;
-        }
-
-    protected:
-        const char * ptr;
-};
-
-class BufferClientP: public BufferClient {
-    public:
-        using BufferClient::BufferClient;
-
-        virtual int read(uint8_t * buf, size_t size) override {
-            memcpy_P(buf, ptr, size);
-            ptr += size;
-            return size;
-        }
-};
-
-}
-
 namespace PicoMQTT {
 
 Server::Client::Client(Server & server, ::Client * client)
     :
     SocketOwner(client),
-    Connection(*socket, 0, server.socket_timeout_millis), server(server), client_id("<unknown>") {
+    Connection(*socket, 0, server.socket_timeout_millis), server(server), client_id("<unknown>"),
+    memory_high_water(0), connect_received(false), timeout_timer([this] { check_timeout(); }), accepted(false),
+    compacted(false), clean_session(true) {
     TRACE_FUNCTION
-    wait_for_reply(Packet::CONNECT, [this](IncomingPacket & packet) {
-        TRACE_FUNCTION
-
-        auto connack = [this](ConnectReturnCode crc) {
-            TRACE_FUNCTION
-            auto connack = build_packet(Packet::CONNACK, 0, 2);
-            connack.write_u8(0);  /* session present always set to zero */
-            connack.write_u8(crc);
-            connack.send();
-            if (crc != CRC_ACCEPTED) {
-                Connection::client.stop();
-            }
-        };
-
-        {
-            // MQTT protocol identifier
-            char buf[4];
-
-            if (packet.read_u16() != 4) {
-                on_protocol_violation();
-                return;
-            }
+    // the CONNECT packet is handled by loop(), it must arrive within the socket timeout
+    server.timers.schedule(timeout_timer, millis() + server.socket_timeout_millis);
+}
 
-            packet.read((uint8_t *) buf, 4);
+void Server::Client::on_connect(IncomingPacket & packet) {
+    TRACE_FUNCTION
 
-            if (memcmp(buf, "MQTT", 4) != 0) {
-                on_protocol_violation();
-                return;
-            }
+    auto connack = [this](ConnectReturnCode crc, bool session_present = false) {
+        TRACE_FUNCTION
+        auto connack = build_packet(Packet::CONNACK, 0, 2);
+        connack.write_u8(session_present ? 1 : 0);
+        connack.write_u8(crc);
+        connack.send();
+        if (crc != CRC_ACCEPTED) {
+            Connection::client.stop();
         }
+    };
 
-        const uint8_t protocol_level = packet.read_u8();
-        if (protocol_level != 4) {
+    {
+        // MQTT protocol identifier
+        char buf[4];
+
+        if (packet.read_u16() != 4) {
             on_protocol_violation();
             return;
         }
 
-        const uint8_t connect_flags = packet.read_u8();
-        const bool has_user = connect_flags & (1 << 7);
-        const bool has_pass = connect_flags & (1 << 6);
-        const bool will_retain = connect_flags & (1 << 5);
-        const uint8_t will_qos = (connect_flags >> 3) & 0b11;
-        const bool has_will = connect_flags & (1 << 2);
-        /* const bool clean_session = connect_flags & (1 << 1); */
+        packet.read((uint8_t *) buf, 4);
 
-        if ((has_pass && !has_user)
-                || (will_qos > 2)
-                || (!has_will && ((will_qos > 0) || will_retain))) {
+        if (memcmp(buf, "MQTT", 4) != 0) {
             on_protocol_violation();
             return;
         }
+    }
 
-        const unsigned long keep_alive_seconds = packet.read_u16();
-        keep_alive_millis = keep_alive_seconds ? (keep_alive_seconds * 1000 + this->server.keep_alive_tolerance_millis) : 0;
+    const uint8_t protocol_level = packet.read_u8();
+    if (protocol_level != 4) {
+        on_protocol_violation();
+        return;
+    }
 
-        {
-            const size_t client_id_size = packet.read_u16();
-            if (client_id_size > PICOMQTT_MAX_CLIENT_ID_SIZE) {
-                connack(CRC_IDENTIFIER_REJECTED);
-                return;
-            }
+    const uint8_t connect_flags = packet.read_u8();
+    const bool has_user = connect_flags & (1 << 7);
+    const bool has_pass = connect_flags & (1 << 6);
+    const bool will_retain = connect_flags & (1 << 5);
+    const uint8_t will_qos = (connect_flags >> 3) & 0b11;
+    const bool has_will = connect_flags & (1 << 2);
+    clean_session = connect_flags & (1 << 1);
+
+    if ((has_pass && !has_user)
+            || (will_qos > 2)
+            || (!has_will && ((will_qos > 0) || will_retain))) {
+        on_protocol_violation();
+        return;
+    }
 
-            char client_id_buffer[client_id_size + 1];
-            packet.read_string(client_id_buffer, client_id_size);
-            client_id = client_id_buffer;
-        }
+    const unsigned long keep_alive_seconds = packet.read_u16();
+    keep_alive_millis = keep_alive_seconds ? (keep_alive_seconds * 1000 + server.keep_alive_tolerance_millis) : 0;
 
-        if (client_id.isEmpty()) {
-            client_id = String((unsigned int)(this), HEX);
+    {
+        const size_t client_id_size = packet.read_u16();
+        if (client_id_size > PICOMQTT_MAX_CLIENT_ID_SIZE) {
+            connack(CRC_IDENTIFIER_REJECTED);
+            return;
         }
 
-        if (has_will) {
-            packet.ignore(packet.read_u16()); // will topic
-            packet.ignore(packet.read_u16()); // will payload
-        }
+        char client_id_buffer[client_id_size + 1];
+        packet.read_string(client_id_buffer, client_id_size);
+        client_id = client_id_buffer;
+    }
 
-        // read username
-        const size_t user_size = has_user ? packet.read_u16() : 0;
-        if (user_size > PICOMQTT_MAX_USERPASS_SIZE) {
-            connack(CRC_BAD_USERNAME_OR_PASSWORD);
-            return;
-        }
-        char user[user_size + 1];
-        if (user_size && !packet.read_string(user, user_size)) {
-            on_timeout();
+    if (client_id.isEmpty()) {
+        if (!clean_session) {
+            // MQTT 3.1.1 3.1.3-8, a persistent session needs a client id which identifies it on the next connect
+            connack(CRC_IDENTIFIER_REJECTED);
             return;
         }
+        client_id = String((unsigned int)(uintptr_t)(this), HEX);
+    }
 
-        // read password
-        const size_t pass_size = has_pass ? packet.read_u16() : 0;
-        if (pass_size > PICOMQTT_MAX_USERPASS_SIZE) {
-            connack(CRC_BAD_USERNAME_OR_PASSWORD);
-            return;
-        }
-        char pass[pass_size + 1];
-        if (pass_size && !packet.read_string(pass, pass_size)) {
-            on_timeout();
-            return;
-        }
+    if (has_will) {
+        packet.ignore(packet.read_u16()); // will topic
+        packet.ignore(packet.read_u16()); // will payload
+    }
 
-        const auto connect_return_code = this->server.auth(
-                                             client_id.c_str(),
-                                             has_user ? user : nullptr, has_pass ? pass : nullptr);
+    // read username
+    const size_t user_size = has_user ? packet.read_u16() : 0;
+    if (user_size > PICOMQTT_MAX_USERPASS_SIZE) {
+        connack(CRC_BAD_USERNAME_OR_PASSWORD);
+        return;
+    }
+    char user[user_size + 1];
+    if (user_size && !packet.read_string(user, user_size)) {
+        on_timeout();
+        return;
+    }
 
-        connack(connect_return_code);
-    });
+    // read password
+    const size_t pass_size = has_pass ? packet.read_u16() : 0;
+    if (pass_size > PICOMQTT_MAX_USERPASS_SIZE) {
+        connack(CRC_BAD_USERNAME_OR_PASSWORD);
+        return;
+    }
+    char pass[pass_size + 1];
+    if (pass_size && !packet.read_string(pass, pass_size)) {
+        on_timeout();
+        return;
+    }
+
+    const auto connect_return_code = server.auth(
+                                     client_id.c_str(),
+                                     has_user ? user : nullptr, has_pass ? pass : nullptr);
+
+    bool session_present = false;
+    if (connect_return_code == CRC_ACCEPTED) {
+        acl_policy = Acl::Policy(server.acl, client_id.c_str(), has_user ? user : nullptr);
+        session_present = server.open_session(*this);
+    }
+
+    connack(connect_return_code, session_present);
+    accepted = (connect_return_code == CRC_ACCEPTED);
+
+    if (accepted && keep_alive_millis) {
+        server.timers.schedule(timeout_timer, millis() + keep_alive_millis + 1);
+    }
 }
 
-void Server::Client::on_message(const char * topic, IncomingPacket & packet) {
+void Server::Client::check_timeout() {
     TRACE_FUNCTION
+    if (!connect_received) {
+        // no CONNECT packet
+        on_timeout();
+        return;
+    }
 
-    const size_t payload_size = packet.get_remaining_size();
-    auto publish = server.begin_publish(topic, payload_size);
+    const unsigned long idle_millis = get_millis_since_last_read();
+    if (idle_millis > keep_alive_millis) {
+        // ping timeout
+        on_timeout();
+        return;
+    }
 
-    // Always notify the server about the message
-    {
-        IncomingPublish incoming_publish(packet, publish);
-        server.on_message(topic, incoming_publish);
+    // The timer is not moved on every packet received, only when it fires.  Check again when the keep-alive
+    // interval since the last read runs out.
+    server.timers.schedule(timeout_timer, millis() - idle_millis + keep_alive_millis + 1);
+}
+
+void Server::Client::on_message(const char * topic, IncomingPacket & packet) {
+    TRACE_FUNCTION
+
+    if (!acl_policy.can_publish(topic)) {
+        // MQTT 3.1.1 has no way to reject a publish, just drop the message
+        return;
     }
 
-    publish.send();
+    auto publish = server.begin_publish(topic, packet.get_remaining_size());
+    server.route(topic, packet, publish, payload_buffer);
 }
 
 void Server::Client::on_subscribe(IncomingPacket & subscribe) {
@@ -221,8 +201,14 @@ void Server::Client::on_subscribe(IncomingPacket & subscribe) {
                 on_protocol_violation();
                 return;
             }
-            this->subscribe(topic);
+            String group;
+            const char * topic_filter = SharedSubscription::parse(topic, group);
+            if (!acl_policy.can_subscribe(topic_filter ? topic_filter : topic) || !this->subscribe(topic)) {
+                suback_codes.push_back(0x80);
+                continue;
+            }
             server.on_subscribe(client_id.c_str(), topic);
+            server.update_session(*this, topic, true);
             suback_codes.push_back(0);
         }
     }
@@ -256,6 +242,7 @@ void Server::Client::on_unsubscribe(IncomingPacket & unsubscribe) {
             }
             server.on_unsubscribe(client_id.c_str(), topic);
             this->unsubscribe(topic);
+            server.update_session(*this, topic, false);
         }
     }
 
@@ -265,6 +252,14 @@ void Server::Client::on_unsubscribe(IncomingPacket & unsubscribe) {
 }
 
 const char * Server::Client::get_subscription_pattern(Server::Client::SubscriptionId id) const {
+    if (compacted) {
+        for (size_t i = 0; i < subscription_filters.size(); ++i)
+            if (subscription_filters.get_id(i) == id) {
+                return subscription_filters.get_filter(i);
+            }
+        return nullptr;
+    }
+
     for (const auto & pattern : subscriptions)
         if (pattern.id == id) {
             return pattern.c_str();
@@ -274,28 +269,106 @@ const char * Server::Client::get_subscription_pattern(Server::Client::Subscripti
 
 Server::Client::SubscriptionId Server::Client::get_subscription(const char * topic) const {
     TRACE_FUNCTION
-    for (const auto & pattern : subscriptions)
-        if (topic_matches(pattern.c_str(), topic)) {
-            return pattern.id;
-        }
-    return 0;
+    return get_subscription(TopicTokens(topic));
+}
+
+Server::Client::SubscriptionId Server::Client::get_subscription(const TopicTokens & topic) const {
+    TRACE_FUNCTION
+    const int index = subscription_filters.find_first(topic);
+    return index >= 0 ? subscription_filters.get_id(index) : 0;
 }
 
 Server::Client::SubscriptionId Server::Client::subscribe(const String & topic_filter) {
     TRACE_FUNCTION
+    if (topic_filter.startsWith("$share/")) {
+        return server.subscribe_shared(*this, topic_filter.c_str());
+    }
+    rehydrate();
     const Subscription subscription(topic_filter.c_str());
-    subscriptions.insert(subscription);
-    return subscription.id;
+    const auto result = subscriptions.insert(subscription);
+    update_subscription_filters();
+    return result.first->id;
 }
 
 void Server::Client::unsubscribe(const String & topic_filter) {
     TRACE_FUNCTION
+    if (topic_filter.startsWith("$share/")) {
+        server.unsubscribe_shared(*this, topic_filter.c_str());
+        return;
+    }
+    rehydrate();
     subscriptions.erase(topic_filter.c_str());
+    update_subscription_filters();
+}
+
+void Server::Client::update_subscription_filters() {
+    TRACE_FUNCTION
+    subscription_filters.clear();
+    for (const auto & subscription : subscriptions) {
+        subscription_filters.add(subscription.c_str(), subscription.id);
+    }
+}
+
+void Server::Client::compact() {
+    TRACE_FUNCTION
+    // the buffer is allocated again by the next PUBLISH
+    std::vector<uint8_t>().swap(payload_buffer);
+
+    if (compacted) {
+        return;
+    }
+
+    subscriptions.clear();
+    subscription_filters.shrink_to_fit();
+    compacted = true;
+}
+
+void Server::Client::rehydrate() {
+    TRACE_FUNCTION
+    if (!compacted) {
+        return;
+    }
+
+    for (size_t i = 0; i < subscription_filters.size(); ++i) {
+        subscriptions.insert(Subscription(subscription_filters.get_filter(i)));
+    }
+    compacted = false;
+    // new subscription ids
+    update_subscription_filters();
+}
+
+size_t Server::Client::get_memory_usage() const {
+    TRACE_FUNCTION
+    size_t ret = heap_block_size(sizeof(*this)) + server.socket_memory_estimate;
+    ret += heap_block_size(client_id.length() + 1);
+    ret += tree_heap_usage(subscriptions);
+    for (const auto & subscription : subscriptions) {
+        ret += heap_block_size(subscription.length() + 1);
+    }
+    ret += subscription_filters.get_memory_usage();
+    ret += acl_policy.get_memory_usage();
+    ret += heap_usage(payload_buffer);
+    return ret;
 }
 
 void Server::Client::handle_packet(IncomingPacket & packet) {
     TRACE_FUNCTION
 
+    if (!connect_received) {
+        if (packet.get_type() != Packet::CONNECT) {
+            // the first packet must be CONNECT
+            on_protocol_violation();
+            return;
+        }
+        connect_received = true;
+        timeout_timer.cancel();
+        on_connect(packet);
+        if (accepted) {
+            server.on_connected(client_id.c_str());
+        }
+        return;
+    }
+
     switch (packet.get_type()) {
         case Packet::PINGREQ:
             build_packet(Packet::PINGRESP).send();
@@ -315,17 +388,6 @@ void Server::Client::handle_packet(IncomingPacket & packet) {
     }
 }
 
-void Server::Client::loop() {
-    TRACE_FUNCTION
-    if (keep_alive_millis && (get_millis_since_last_read() > keep_alive_millis)) {
-        // ping timeout
-        on_timeout();
-        return;
-    }
-
-    Connection::loop();
-}
-
 Server::IncomingPublish::IncomingPublish(IncomingPacket & packet, Publish & publish)
     : IncomingPacket(std::move(packet)), publish(publish) {
     TRACE_FUNCTION
@@ -355,48 +417,574 @@ int Server::IncomingPublish::read() {
 }
 
 Server::Server(std::unique_ptr<ServerSocketInterface> server)
-    : keep_alive_tolerance_millis(10 * 1000), socket_timeout_millis(5 * 1000), server(std::move(server)) {
+    : keep_alive_tolerance_millis(10 * 1000), socket_timeout_millis(5 * 1000),
+      max_buffered_payload_size(PICOMQTT_MAX_BUFFERED_PAYLOAD_SIZE),
+      shared_subscription_policy(SHARED_ROUND_ROBIN), max_clients(PICOMQTT_MAX_CLIENTS),
+      min_free_heap(PICOMQTT_MIN_FREE_HEAP), idle_compaction_millis(PICOMQTT_IDLE_COMPACTION_MILLIS),
+      max_sessions(PICOMQTT_MAX_SESSIONS), socket_memory_estimate(PICOMQTT_SOCKET_MEMORY_ESTIMATE),
+      async_queue_size(PICOMQTT_ASYNC_QUEUE_SIZE), async_wait_millis(PICOMQTT_ASYNC_WAIT_MILLIS),
+      sys_interval_millis(0), sys_top_clients(5), compaction_timer([this] { compact_idle_clients(); }),
+      server(std::move(server)), last_sys_millis(0), heap_low_water(SIZE_MAX) {
     TRACE_FUNCTION
+    memory.add("clients", [this] { return get_clients_memory_usage(); });
+    memory.add("routing", [this] { return get_routing_memory_usage(); });
+    memory.add("async", [this] { return async_queue.get_memory_usage(); });
 }
 
 void Server::begin() {
     TRACE_FUNCTION
+    async_queue.begin(async_queue_size);
     server->begin();
+
+    // start the wheel at the current time
+    timers.advance(millis());
+    if (idle_compaction_millis) {
+        timers.schedule(compaction_timer, millis() + idle_compaction_millis / 2);
+    }
 }
 
 void Server::loop() {
     TRACE_FUNCTION
 
+    loop_async();
+
+    // Fires only the expired deadlines.  Clients which time out are removed below.
+    timers.advance(millis());
+
     ::Client * client_ptr = server->accept_client();
     if (client_ptr) {
-        clients.push_back(std::unique_ptr<Client>(new Client(*this, client_ptr)));
-        on_connected(clients.back()->get_client_id());
+        const ConnectReturnCode crc = admit();
+        if (crc == CRC_ACCEPTED) {
+            clients.push_back(std::unique_ptr<Client>(new Client(*this, client_ptr)));
+        } else {
+            reject(client_ptr, crc);
+        }
     }
 
+    loop_rejected();
+
     for (auto it = clients.begin(); it != clients.end();) {
         Client & client = **it;
         client.loop();
 
         if (!client.connected()) {
-            on_disconnected(client.get_client_id());
+            if (client.accepted) {
+                on_disconnected(client.get_client_id());
+            }
+            unsubscribe_shared(client);
             clients.erase(it++);
         } else {
             ++it;
         }
     }
+
+    if (sys_interval_millis && (millis() - last_sys_millis >= sys_interval_millis)) {
+        last_sys_millis = millis();
+        publish_sys();
+    }
+}
+
+bool Server::publish_async(const char * topic, const void * payload, size_t payload_size) {
+    TRACE_FUNCTION
+    const unsigned long start_millis = millis();
+    while (true) {
+        const bool last_attempt = !async_wait_millis || (millis() - start_millis >= async_wait_millis);
+        if (async_queue.push(topic, payload, payload_size, last_attempt)) {
+            if (async_wakeup) {
+                async_wakeup();
+            }
+            return true;
+        }
+
+        if (last_attempt || !async_queue.fits(strlen(topic), payload_size)) {
+            return false;
+        }
+
+        // wait for loop() to make room
+        delay(1);
+    }
+}
+
+void Server::loop_async() {
+    TRACE_FUNCTION
+    // Only the messages queued so far, so that fast producers can't keep the loop here
+    const AsyncQueue::Stats stats = async_queue.get_stats();
+    for (unsigned long pending = stats.enqueued - stats.dequeued; pending; --pending) {
+        const bool popped = async_queue.pop([this](const char * topic, const void * payload, size_t payload_size) {
+            publish(topic, payload, payload_size);
+        });
+        if (!popped) {
+            break;
+        }
+    }
+}
+
+void Server::compact_idle_clients() {
+    TRACE_FUNCTION
+    // Runs every half of the threshold, so clients are compacted at most 1.5 times the threshold after their last
+    // packet.  Idle means nothing was received, messages sent to the client don't count.
+    if (!idle_compaction_millis) {
+        return;
+    }
+
+    for (auto & client_ptr : clients) {
+        if (client_ptr->connect_received && (client_ptr->get_millis_since_last_read() >= idle_compaction_millis)) {
+            client_ptr->compact();
+        }
+    }
+
+    timers.schedule(compaction_timer, millis() + idle_compaction_millis / 2);
+}
+
+bool Server::open_session(Client & client) {
+    TRACE_FUNCTION
+    auto it = sessions.find(client.client_id);
+
+    if (client.clean_session) {
+        if (it != sessions.end()) {
+            sessions.erase(it);
+            on_session_changed(client.get_client_id());
+        }
+        return false;
+    }
+
+    if (it == sessions.end()) {
+        if (sessions.size() >= max_sessions) {
+            // no room for another session
+            client.clean_session = true;
+            return false;
+        }
+        sessions[client.client_id];
+        on_session_changed(client.get_client_id());
+        return false;
+    }
+
+    // The ACL may have changed since the session was stored
+    for (const auto & topic : it->second) {
+        String group;
+        const char * topic_filter = SharedSubscription::parse(topic.c_str(), group);
+        if (client.acl_policy.can_subscribe(topic_filter ? topic_filter : topic.c_str()) && client.subscribe(topic)) {
+            on_subscribe(client.get_client_id(), topic.c_str());
+        }
+    }
+    return true;
+}
+
+void Server::update_session(Client & client, const char * topic_filter, bool subscribed) {
+    TRACE_FUNCTION
+    if (client.clean_session) {
+        return;
+    }
+
+    auto it = sessions.find(client.client_id);
+    if (it == sessions.end()) {
+        return;
+    }
+
+    const bool changed = subscribed ? it->second.insert(topic_filter).second : it->second.erase(topic_filter);
+    if (changed) {
+        on_session_changed(client.get_client_id());
+    }
+}
+
+void Server::restore_session(const char * client_id, const char * topic_filter) {
+    TRACE_FUNCTION
+    auto it = sessions.find(client_id);
+    if (it == sessions.end()) {
+        if (sessions.size() >= max_sessions) {
+            return;
+        }
+        it = sessions.insert(std::make_pair(String(client_id), std::set<String>())).first;
+    }
+    if (topic_filter) {
+        it->second.insert(topic_filter);
+    }
+}
+
+size_t Server::get_compacted_client_count() const {
+    TRACE_FUNCTION
+    size_t ret = 0;
+    for (const auto & client_ptr : clients) {
+        ret += client_ptr->is_compacted() ? 1 : 0;
+    }
+    return ret;
+}
+
+size_t Server::get_clients_memory_usage() const {
+    TRACE_FUNCTION
+    // list nodes hold a pointer and two links
+    size_t ret = clients.size() * heap_block_size(3 * sizeof(void *));
+    for (const auto & client_ptr : clients) {
+        ret += client_ptr->get_memory_usage();
+    }
+    ret += rejected_clients.size() * (heap_block_size(sizeof(RejectedClient) + 2 * sizeof(void *))
+                                      + socket_memory_estimate);
+    return ret;
+}
+
+size_t Server::get_routing_memory_usage() const {
+    TRACE_FUNCTION
+    // local subscriptions
+    size_t ret = tree_heap_usage(subscriptions);
+    for (const auto & kv : subscriptions) {
+        ret += heap_block_size(kv.first.length() + 1);
+    }
+    ret += subscription_filters.get_memory_usage() + subscription_index.get_memory_usage()
+           + heap_usage(subscription_callbacks) + heap_usage(match_buffer) + heap_usage(payload_buffer);
+
+    // shared subscriptions
+    ret += heap_usage(shared_subscriptions);
+    for (const auto & subscription : shared_subscriptions) {
+        ret += heap_block_size(subscription.group.length() + 1) + heap_block_size(subscription.topic_filter.length() + 1)
+               + heap_usage(subscription.members);
+    }
+    ret += shared_filters.get_memory_usage() + heap_usage(shared_bitmap);
+
+    // persistent sessions
+    ret += tree_heap_usage(sessions);
+    for (const auto & kv : sessions) {
+        ret += heap_block_size(kv.first.length() + 1) + tree_heap_usage(kv.second);
+        for (const auto & topic : kv.second) {
+            ret += heap_block_size(topic.length() + 1);
+        }
+    }
+    return ret;
+}
+
+void Server::update_memory_usage() {
+    TRACE_FUNCTION
+    memory.update();
+    for (auto & client_ptr : clients) {
+        const size_t usage = client_ptr->get_memory_usage();
+        if (usage > client_ptr->memory_high_water) {
+            client_ptr->memory_high_water = usage;
+        }
+    }
+
+    const size_t free_heap = ESP.getFreeHeap();
+    if (free_heap < heap_low_water) {
+        heap_low_water = free_heap;
+    }
+}
+
+std::vector<const Server::Client *> Server::get_top_memory_clients(size_t count) const {
+    TRACE_FUNCTION
+    std::vector<std::pair<size_t, const Client *>> usage;
+    usage.reserve(clients.size());
+    for (const auto & client_ptr : clients) {
+        usage.push_back({client_ptr->get_memory_usage(), client_ptr.get()});
+    }
+
+    count = std::min(count, usage.size());
+    std::partial_sort(usage.begin(), usage.begin() + count, usage.end(),
+    [](const std::pair<size_t, const Client *> & a, const std::pair<size_t, const Client *> & b) {
+        return a.first > b.first;
+    });
+
+    std::vector<const Client *> ret;
+    ret.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        ret.push_back(usage[i].second);
+    }
+    return ret;
+}
+
+size_t Server::get_heap_low_water() const {
+    TRACE_FUNCTION
+#if defined(ESP32)
+    return ESP.getMinFreeHeap();
+#else
+    return heap_low_water;
+#endif
+}
+
+void Server::publish_sys() {
+    TRACE_FUNCTION
+    update_memory_usage();
+
+    publish("$SYS/broker/clients/connected", String((unsigned long) clients.size()));
+    publish("$SYS/broker/clients/compacted", String((unsigned long) get_compacted_client_count()));
+    publish("$SYS/broker/clients/rejected/max_clients", String(rejected_max_clients));
+    publish("$SYS/broker/clients/rejected/low_memory", String(rejected_low_memory));
+
+    publish("$SYS/broker/heap/free", String((unsigned long) ESP.getFreeHeap()));
+    publish("$SYS/broker/heap/low_water", String((unsigned long) get_heap_low_water()));
+
+    for (const auto & account : memory.get_accounts()) {
+        const String topic = String("$SYS/broker/memory/") + account.name;
+        publish(topic, String((unsigned long) account.current));
+        publish(topic + "/high_water", String((unsigned long) account.high_water));
+    }
+    if (async_queue.get_size()) {
+        const AsyncQueue::Stats stats = async_queue.get_stats();
+        publish("$SYS/broker/async/enqueued", String(stats.enqueued));
+        publish("$SYS/broker/async/dropped/full", String(stats.dropped_full));
+        publish("$SYS/broker/async/dropped/too_big", String(stats.dropped_too_big));
+        publish("$SYS/broker/async/high_water", String((unsigned long) stats.high_water));
+    }
+
+    publish("$SYS/broker/memory/total", String((unsigned long) memory.get_total()));
+    publish("$SYS/broker/memory/total/high_water", String((unsigned long) memory.get_total_high_water()));
+
+    // one line per client: <client id> <bytes> <high-water mark>
+    String top;
+    for (const Client * client : get_top_memory_clients(sys_top_clients)) {
+        top += client->get_client_id();
+        top += ' ';
+        top += String((unsigned long) client->get_memory_usage());
+        top += ' ';
+        top += String((unsigned long) client->get_memory_high_water());
+        top += '\n';
+    }
+    publish("$SYS/broker/memory/top_clients", top);
+}
+
+ConnectReturnCode Server::admit() {
+    TRACE_FUNCTION
+    if (max_clients && (clients.size() >= max_clients)) {
+        ++rejected_max_clients;
+        return CRC_SERVER_UNAVAILABLE;
+    }
+
+    if (min_free_heap && (ESP.getFreeHeap() < min_free_heap)) {
+        ++rejected_low_memory;
+        return CRC_SERVER_UNAVAILABLE;
+    }
+
+    return CRC_ACCEPTED;
+}
+
+void Server::reject(::Client * client, ConnectReturnCode crc) {
+    TRACE_FUNCTION
+    std::unique_ptr<::Client> client_ptr(client);
+    if (rejected_clients.size() >= PICOMQTT_MAX_REJECTED_CLIENTS) {
+        client_ptr->stop();
+        return;
+    }
+    rejected_clients.push_back({std::move(client_ptr), crc, millis()});
+}
+
+void Server::loop_rejected() {
+    TRACE_FUNCTION
+    for (auto it = rejected_clients.begin(); it != rejected_clients.end();) {
+        ::Client & client = *it->client;
+
+        if (client.available() > 0) {
+            // discard the CONNECT packet, it doesn't matter what's in it
+            uint8_t buffer[32];
+            while (client.available() > 0) {
+                client.read(buffer, sizeof(buffer));
+            }
+
+            const uint8_t connack[] = {Packet::CONNACK, 2, 0, (uint8_t) it->crc};
+            client.write(connack, sizeof(connack));
+        } else if (client.connected() && (millis() - it->start_millis < socket_timeout_millis)) {
+            ++it;
+            continue;
+        }
+
+        client.stop();
+        rejected_clients.erase(it++);
+    }
 }
 
 PrintMux Server::get_subscribed(const char * topic) {
     TRACE_FUNCTION
+    // tokenize once, then match against the compiled subscriptions of each client
+    const TopicTokens tokens(topic);
     PrintMux ret;
     for (auto & client_ptr : clients) {
-        if (client_ptr->get_subscription(topic)) {
+        if (client_ptr->get_subscription(tokens)) {
             ret.add(client_ptr->get_print());
         }
     }
+    add_shared_subscribers(tokens, ret);
     return ret;
 }
 
+const char * Server::SharedSubscription::parse(const char * topic_filter, String & group) {
+    TRACE_FUNCTION
+    static const size_t prefix_size = 7;  // strlen("$share/")
+    if (strncmp(topic_filter, "$share/", prefix_size) != 0) {
+        return nullptr;
+    }
+
+    const char * group_begin = topic_filter + prefix_size;
+    const char * group_end = strchr(group_begin, '/');
+    if (!group_end || (group_end == group_begin) || !group_end[1]) {
+        return nullptr;
+    }
+
+    for (const char * c = group_begin; c != group_end; ++c) {
+        if ((*c == '+') || (*c == '#')) {
+            return nullptr;
+        }
+    }
+
+    group = "";
+    group.concat(group_begin, group_end - group_begin);
+    return group_end + 1;
+}
+
+Server::Client::SubscriptionId Server::subscribe_shared(Client & client, const char * topic_filter) {
+    TRACE_FUNCTION
+    String group;
+    const char * filter = SharedSubscription::parse(topic_filter, group);
+    if (!filter) {
+        return 0;
+    }
+
+    auto it = std::find_if(shared_subscriptions.begin(), shared_subscriptions.end(),
+    [&group, filter](const SharedSubscription & subscription) {
+        return (subscription.group == group) && (subscription.topic_filter == filter);
+    });
+
+    if (it == shared_subscriptions.end()) {
+        shared_subscriptions.push_back(SharedSubscription(group, filter));
+        it = shared_subscriptions.end() - 1;
+        update_shared_filters();
+    }
+
+    for (const auto & member : it->members) {
+        if (member.client == &client) {
+            return member.id;
+        }
+    }
+
+    it->members.push_back(SharedSubscription::Member(client));
+    return it->members.back().id;
+}
+
+void Server::unsubscribe_shared(Client & client, const char * topic_filter) {
+    TRACE_FUNCTION
+    String group;
+    const char * filter = SharedSubscription::parse(topic_filter, group);
+    if (!filter) {
+        return;
+    }
+
+    for (auto it = shared_subscriptions.begin(); it != shared_subscriptions.end(); ++it) {
+        if ((it->group != group) || (it->topic_filter != filter)) {
+            continue;
+        }
+        auto & members = it->members;
+        members.erase(std::remove_if(members.begin(), members.end(),
+        [&client](const SharedSubscription::Member & member) { return member.client == &client; }), members.end());
+        if (members.empty()) {
+            shared_subscriptions.erase(it);
+            update_shared_filters();
+        }
+        return;
+    }
+}
+
+void Server::unsubscribe_shared(Client & client) {
+    TRACE_FUNCTION
+    bool changed = false;
+    for (auto it = shared_subscriptions.begin(); it != shared_subscriptions.end();) {
+        auto & members = it->members;
+        members.erase(std::remove_if(members.begin(), members.end(),
+        [&client](const SharedSubscription::Member & member) { return member.client == &client; }), members.end());
+        if (members.empty()) {
+            it = shared_subscriptions.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+    if (changed) {
+        update_shared_filters();
+    }
+}
+
+void Server::update_shared_filters() {
+    TRACE_FUNCTION
+    shared_filters.clear();
+    for (size_t i = 0; i < shared_subscriptions.size(); ++i) {
+        shared_filters.add(shared_subscriptions[i].topic_filter.c_str(), i);
+    }
+}
+
+void Server::add_shared_subscribers(const TopicTokens & topic, PrintMux & print_mux,
+                                    bool (*exclude)(const char * client_id)) {
+    TRACE_FUNCTION
+    if (shared_subscriptions.empty() || !shared_filters.match(topic, shared_bitmap)) {
+        return;
+    }
+
+    for (size_t word = 0; word < shared_bitmap.size(); ++word) {
+        for (uint32_t bits = shared_bitmap[word]; bits; bits &= bits - 1) {
+            SharedSubscription & subscription = shared_subscriptions[word * 32 + __builtin_ctz(bits)];
+            const size_t size = subscription.members.size();
+
+            // round-robin picks the first member after the last one used, least loaded the one with the most free
+            // space, ties are resolved in round-robin order
+            size_t selected = size;
+            int best = -1;
+            for (size_t i = 0; i < size; ++i) {
+                const size_t index = (subscription.next + i) % size;
+                Client & client = *subscription.members[index].client;
+                if (exclude && exclude(client.get_client_id())) {
+                    continue;
+                }
+                if (shared_subscription_policy != SHARED_LEAST_LOADED) {
+                    selected = index;
+                    break;
+                }
+                const int free_space = client.get_print().availableForWrite();
+                if (free_space > best) {
+                    best = free_space;
+                    selected = index;
+                }
+            }
+
+            if (selected == size) {
+                continue;
+            }
+            subscription.next = selected + 1;
+
+            SharedSubscription::Member & member = subscription.members[selected];
+            ++member.delivered;
+            print_mux.add(member.client->get_print());
+        }
+    }
+}
+
+void Server::route(const char * topic, IncomingPacket & packet, Publish & publish, std::vector<uint8_t> & buffer) {
+    TRACE_FUNCTION
+    const size_t payload_size = packet.get_remaining_size();
+
+    if (payload_size > max_buffered_payload_size) {
+        // stream the payload to subscribers while callbacks read it
+        {
+            IncomingPublish incoming_publish(packet, publish);
+            on_message(topic, incoming_publish);
+        }
+        publish.send();
+        return;
+    }
+
+    // the only copy of the payload
+    buffer.resize(payload_size + 1);
+    const int read_size = packet.read(buffer.data(), payload_size);
+    if (read_size != (int) payload_size) {
+        // connection error, like with streaming, subscribers get the message padded with zeros
+        if (read_size > 0) {
+            publish.write(buffer.data(), read_size);
+        }
+        publish.send();
+        return;
+    }
+    buffer[payload_size] = '\0';
+
+    publish.write(buffer.data(), payload_size);
+    publish.send();
+
+    // Local callbacks run after the message has been sent, so any messages they publish don't interleave with it
+    BufferedIncomingPacket buffered_packet(packet.get_type(), packet.get_flags(), buffer.data(), payload_size);
+    on_message(topic, buffered_packet);
+}
+
 Publisher::Publish Server::begin_publish(const char * topic, const size_t payload_size,
         uint8_t, bool, uint16_t) {
     TRACE_FUNCTION
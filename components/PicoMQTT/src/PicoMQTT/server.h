@@ -1,7 +1,11 @@
 #pragma once
 
+#include <functional>
 #include <list>
+#include <map>
 #include <set>
+#include <type_traits>
+#include <vector>
 
 #include <Arduino.h>
 
@@ -13,12 +17,17 @@
 #error "This board is not supported."
 #endif
 
+#include "acl.h"
+#include "async_queue.h"
 #include "debug.h"
 #include "incoming_packet.h"
 #include "connection.h"
+#include "memory_accounting.h"
 #include "publisher.h"
 #include "subscriber.h"
 #include "pico_interface.h"
+#include "timer_wheel.h"
+#include "topic_matcher.h"
 #include "utils.h"
 
 namespace PicoMQTT {
@@ -57,7 +66,7 @@ class ServerSocket: public ServerSocketInterface, public Server {
         }
 };
 
-template <typename Server>
+template <typename Server, typename Enable = void>
 class ServerSocketProxy: public ServerSocketInterface {
     public:
         Server & server;
@@ -82,6 +91,26 @@ class ServerSocketProxy: public ServerSocketInterface {
 
 };
 
+// Proxy of a ServerSocketInterface owned elsewhere, e.g. a TlsServer
+template <typename Server>
+class ServerSocketProxy<Server, typename std::enable_if<std::is_base_of<ServerSocketInterface, Server>::value>::type>:
+    public ServerSocketInterface {
+    public:
+        Server & server;
+
+        ServerSocketProxy(Server & server): server(server) {}
+
+        virtual ::Client * accept_client() override {
+            TRACE_FUNCTION
+            return server.accept_client();
+        };
+
+        virtual void begin() override {
+            TRACE_FUNCTION
+            server.begin();
+        }
+};
+
 class ServerSocketMux: public ServerSocketInterface {
     public:
         template <typename... Targs>
@@ -134,24 +163,96 @@ class Server: public PicoMQTTInterface, public Publisher, public SubscribedMessa
                 Print & get_print() { return Connection::client; }
                 const char * get_client_id() const { return client_id.c_str(); }
 
-                virtual void loop() override;
-
                 virtual const char * get_subscription_pattern(SubscriptionId id) const override;
                 virtual SubscriptionId get_subscription(const char * topic) const override;
+                SubscriptionId get_subscription(const TopicTokens & topic) const;
                 virtual SubscriptionId subscribe(const String & topic_filter) override;
                 virtual void unsubscribe(const String & topic_filter) override;
 
+                // Estimated heap usage of the connection, including Server::socket_memory_estimate
+                size_t get_memory_usage() const;
+                // highest value seen by Server::update_memory_usage()
+                size_t get_memory_high_water() const { return memory_high_water; }
+
+                bool is_compacted() const { return compacted; }
+
             protected:
+                friend class Server;
+
                 Server & server;
                 String client_id;
+                Acl::Policy acl_policy;
                 std::set<Subscription> subscriptions;
+                TopicFilterSet subscription_filters;
+                size_t memory_high_water;
+
+                // payload of the last message received, see Server::route()
+                std::vector<uint8_t> payload_buffer;
+
+                // Set once the CONNECT packet is handled.  Until then, the timer is the CONNECT deadline, afterwards
+                // the keep-alive deadline.
+                bool connect_received;
+                TimerWheel::Timer timeout_timer;
+
+                // Set if the CONNECT was accepted, only accepted clients are reported by on_connected() and
+                // on_disconnected()
+                bool accepted;
+
+                // Set while the subscriptions are stored only in subscription_filters, see compact()
+                bool compacted;
+
+                // Cleared if the client connected with a persistent session, see Server::sessions
+                bool clean_session;
 
+                void update_subscription_filters();
+                void check_timeout();
+
+                // Frees the subscriptions set, which is only needed to change subscriptions, and the payload buffer.
+                // Matching works on subscription_filters alone, which is shrunk to fit.
+                void compact();
+                // Rebuilds the subscriptions set, before they change
+                void rehydrate();
+
+                virtual void on_connect(IncomingPacket & packet);
                 virtual void on_subscribe(IncomingPacket & packet);
                 virtual void on_unsubscribe(IncomingPacket & packet);
 
                 virtual void handle_packet(IncomingPacket & packet) override;
         };
 
+        /*
+         * A shared subscription ($share/<group>/<topic filter>).  Each matching message is delivered to just one
+         * member of the group, selected according to shared_subscription_policy.
+         */
+        class SharedSubscription {
+            public:
+                struct Member {
+                    Member(Client & client): client(&client), id(AutoId().id), delivered(0) {}
+                    Client * client;
+                    AutoId::Id id;
+                    unsigned long delivered;
+                };
+
+                SharedSubscription(const String & group, const String & topic_filter)
+                    : group(group), topic_filter(topic_filter), next(0) {}
+
+                // Returns the topic filter part of a shared subscription or nullptr if topic_filter is not a (valid)
+                // shared subscription.  On success, group is set to the group name.
+                static const char * parse(const char * topic_filter, String & group);
+
+                String group;
+                String topic_filter;
+                std::vector<Member> members;
+                size_t next;
+        };
+
+        enum SharedSubscriptionPolicy {
+            // O(1) per group
+            SHARED_ROUND_ROBIN,
+            // pick the member with the most free space in the outgoing socket buffer, O(group size) per group
+            SHARED_LEAST_LOADED,
+        };
+
         class IncomingPublish: public IncomingPacket {
             public:
                 IncomingPublish(IncomingPacket & packet, Publish & publish);
@@ -191,8 +292,97 @@ class Server: public PicoMQTTInterface, public Publisher, public SubscribedMessa
                                       uint8_t qos = 0, bool retain = false, uint16_t message_id = 0) override;
 
         unsigned long keep_alive_tolerance_millis;
+        // Also the time new connections have to send the CONNECT packet
         unsigned long socket_timeout_millis;
 
+        // Payloads up to this size are read into a buffer of the sending connection once and both subscribed clients
+        // and local callbacks get them from there.  Bigger payloads are streamed from the socket.
+        size_t max_buffered_payload_size;
+
+        SharedSubscriptionPolicy shared_subscription_policy;
+
+        // Checked on every publish and subscribe.  Changes apply to clients which connect afterwards.
+        Acl acl;
+        const std::vector<SharedSubscription> & get_shared_subscriptions() const { return shared_subscriptions; }
+
+        // Admission control: new connections get CONNACK with CRC_SERVER_UNAVAILABLE when max_clients clients are
+        // connected already (0 means no limit) or when the free heap is below min_free_heap bytes.
+        size_t max_clients;
+        size_t min_free_heap;
+
+        size_t get_client_count() const { return clients.size(); }
+
+        // Connections which didn't send anything for this long release their per-connection buffers and keep
+        // their subscriptions in a packed read-only form until they subscribe or unsubscribe again.  0 disables it.
+        unsigned long idle_compaction_millis;
+
+        size_t get_compacted_client_count() const;
+
+        /*
+         * Persistent sessions.  The subscriptions of clients which connect with the clean session flag cleared are
+         * kept by client id and restored when the client connects again without the flag (the CONNACK then has
+         * session present set), until it connects with the flag.  At most max_sessions are kept, clients beyond that
+         * get a clean session.  Messages are not queued for disconnected clients, the broker only delivers with QoS 0.
+         *
+         * Sessions live in RAM.  To keep them across restarts, override on_session_changed() to store them and call
+         * restore_session() for each stored subscription before begin().
+         */
+        size_t max_sessions;
+        const std::map<String, std::set<String>> & get_sessions() const { return sessions; }
+        void restore_session(const char * client_id, const char * topic_filter);
+
+        // number of connections refused because of each limit
+        unsigned long rejected_max_clients = 0;
+        unsigned long rejected_low_memory = 0;
+
+        // Memory owned by the broker, in the "clients", "routing" and "async" accounts.  Applications can add their
+        // own.
+        MemoryAccounting memory;
+
+        // Memory held by each connection outside of the Client object (socket object, lwIP control blocks), which
+        // can't be measured, but counts towards the "clients" account.  Data queued in socket buffers is not included.
+        size_t socket_memory_estimate;
+
+        // Samples all memory accounts and updates the high-water marks
+        void update_memory_usage();
+
+        // Clients with the highest memory usage, largest first
+        std::vector<const Client *> get_top_memory_clients(size_t count) const;
+
+        // Lowest free heap seen (by the system on ESP32, sampled by the broker elsewhere)
+        size_t get_heap_low_water() const;
+
+        /*
+         * Publishing from other tasks.  publish_async() copies the message into a lock-free queue, which loop() drains
+         * first thing, publishing the messages in the order they were queued.  It's the only method of the server
+         * which may be called from another task than the one running loop().
+         *
+         * When the queue is full, publish_async() retries for up to async_wait_millis and then drops the message and
+         * returns false.  Messages longer than half of the queue are always dropped.  The queue is allocated by
+         * begin(), with async_queue_size rounded up to a power of two; 0 disables it.
+         */
+        bool publish_async(const char * topic, const void * payload, size_t payload_size);
+        bool publish_async(const char * topic, const char * payload) {
+            return publish_async(topic, payload, strlen(payload));
+        }
+        bool publish_async(const String & topic, const String & payload) {
+            return publish_async(topic.c_str(), payload.c_str(), payload.length());
+        }
+
+        size_t async_queue_size;
+        unsigned long async_wait_millis;
+
+        // Called after each successful publish_async() from the publishing task, e.g. to wake up the task running
+        // loop().  Set it before calling begin().
+        std::function<void()> async_wakeup;
+
+        AsyncQueue::Stats get_async_stats() const { return async_queue.get_stats(); }
+
+        // Broker statistics are published under $SYS/broker/ at this interval, 0 disables them
+        unsigned long sys_interval_millis;
+        // number of clients listed in $SYS/broker/memory/top_clients
+        size_t sys_top_clients;
+
     protected:
         Server(ServerSocketInterface * socket)
             : Server(std::unique_ptr<ServerSocketInterface>(socket)) {
@@ -202,16 +392,74 @@ class Server: public PicoMQTTInterface, public Publisher, public SubscribedMessa
         virtual void on_message(const char * topic, IncomingPacket & packet);
         virtual ConnectReturnCode auth(const char * client_id, const char * username, const char * password) { return CRC_ACCEPTED; }
 
+        // Called before a new connection is accepted, any other value than CRC_ACCEPTED refuses it
+        virtual ConnectReturnCode admit();
+
         virtual void on_connected(const char * client_id) {}
         virtual void on_disconnected(const char * client_id) {}
 
         virtual void on_subscribe(const char * client_id, const char * topic) {}
         virtual void on_unsubscribe(const char * client_id, const char * topic) {}
 
+        // Called after the subscriptions of a persistent session change, the session was created or it was removed
+        // (then it's no longer in get_sessions())
+        virtual void on_session_changed(const char * client_id) {}
+
         virtual PrintMux get_subscribed(const char * topic);
 
+        // Sends a message received from a connection with the already started publish and fires local callbacks
+        void route(const char * topic, IncomingPacket & packet, Publish & publish, std::vector<uint8_t> & buffer);
+
+        virtual void publish_sys();
+        size_t get_clients_memory_usage() const;
+        size_t get_routing_memory_usage() const;
+
+        Subscriber::SubscriptionId subscribe_shared(Client & client, const char * topic_filter);
+        void unsubscribe_shared(Client & client, const char * topic_filter);
+        void unsubscribe_shared(Client & client);
+        void update_shared_filters();
+        // Members for which exclude returns true (given their client id) are skipped, a group with no other members
+        // gets no copy
+        void add_shared_subscribers(const TopicTokens & topic, PrintMux & print_mux,
+                                    bool (*exclude)(const char * client_id) = nullptr);
+
+        // Refused connections wait here for the CONNECT packet, so that the CONNACK isn't lost when the socket is
+        // closed with unread data.  No Client object is created for them.
+        struct RejectedClient {
+            std::unique_ptr<::Client> client;
+            ConnectReturnCode crc;
+            unsigned long start_millis;
+        };
+
+        void reject(::Client * client, ConnectReturnCode crc);
+        void loop_rejected();
+        void loop_async();
+        void compact_idle_clients();
+
+        // Restores the subscriptions of the client's persistent session or creates one.  Removes the stored session if
+        // the client wants a clean one.  Returns true if a session was restored.
+        bool open_session(Client & client);
+        void update_session(Client & client, const char * topic_filter, bool subscribed);
+
+        AsyncQueue async_queue;
+
+        // keep-alive and CONNECT deadlines of clients, advanced by loop()
+        TimerWheel timers;
+        TimerWheel::Timer compaction_timer;
+
         std::unique_ptr<ServerSocketInterface> server;
         std::list<std::unique_ptr<Client>> clients;
+        std::list<RejectedClient> rejected_clients;
+
+        unsigned long last_sys_millis;
+        size_t heap_low_water;
+
+        // subscriptions of persistent sessions by client id
+        std::map<String, std::set<String>> sessions;
+
+        std::vector<SharedSubscription> shared_subscriptions;
+        TopicFilterSet shared_filters;
+        TopicFilterSet::Bitmap shared_bitmap;
 };
 
 class ServerLocalSubscribe: public Server {
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "subscriber.h"
 #include "incoming_packet.h"
 #include "debug.h"
@@ -79,12 +81,9 @@ const char * SubscribedMessageListener::get_subscription_pattern(SubscriptionId
 
 Subscriber::SubscriptionId SubscribedMessageListener::get_subscription(const char * topic) const {
     TRACE_FUNCTION
-    for (const auto & kv : subscriptions) {
-        if (topic_matches(kv.first.c_str(), topic)) {
-            return kv.first.id;
-        }
-    }
-    return 0;
+    const TopicTokens tokens(topic);
+    const int index = subscription_filters.find_first(tokens);
+    return index >= 0 ? subscription_filters.get_id(index) : 0;
 }
 
 Subscriber::SubscriptionId SubscribedMessageListener::subscribe(const String & topic_filter) {
@@ -95,67 +94,111 @@ Subscriber::SubscriptionId SubscribedMessageListener::subscribe(const String & t
 Subscriber::SubscriptionId SubscribedMessageListener::subscribe(const String & topic_filter, MessageCallback callback) {
     TRACE_FUNCTION
     unsubscribe(topic_filter);
-    auto pair = subscriptions.emplace(std::make_pair(Subscription(topic_filter), callback));
+    auto pair = subscriptions.emplace(Subscription(topic_filter), std::move(callback));
+    update_subscription_filters();
     return pair.first->first.id;
 }
 
 void SubscribedMessageListener::unsubscribe(const String & topic_filter) {
     TRACE_FUNCTION
     subscriptions.erase(topic_filter);
+    update_subscription_filters();
 }
 
-void SubscribedMessageListener::fire_message_callbacks(const char * topic, IncomingPacket & packet) {
+void SubscribedMessageListener::update_subscription_filters() {
     TRACE_FUNCTION
+    ++subscription_generation;
+
+    // subscription ids are increasing, sorting by them gives the subscription order
+    std::vector<const std::pair<const Subscription, MessageCallback> *> ordered;
+    ordered.reserve(subscriptions.size());
     for (const auto & kv : subscriptions) {
-        if (topic_matches(kv.first.c_str(), topic)) {
-            kv.second((char *) topic, packet);
-            return;
-        }
+        ordered.push_back(&kv);
     }
-    on_extra_message(topic, packet);
+    std::sort(ordered.begin(), ordered.end(), [](const std::pair<const Subscription, MessageCallback> * a,
+    const std::pair<const Subscription, MessageCallback> * b) {
+        return a->first.id < b->first.id;
+    });
+
+    subscription_filters.clear();
+    subscription_callbacks.clear();
+    subscription_callbacks.reserve(subscriptions.size());
+    for (const auto * kv : ordered) {
+        subscription_filters.add(kv->first.c_str(), kv->first.id);
+        subscription_callbacks.push_back(&kv->second);
+    }
+    subscription_index.build(subscription_filters);
 }
 
-Subscriber::SubscriptionId SubscribedMessageListener::subscribe(const String & topic_filter,
-        std::function<void(char *, void *, size_t)> callback, size_t max_size) {
+void SubscribedMessageListener::fire_message_callbacks(const char * topic, IncomingPacket & packet) {
     TRACE_FUNCTION
-    return subscribe(topic_filter, [this, callback, max_size](char * topic, IncomingPacket & packet) {
-        const size_t payload_size = packet.get_remaining_size();
-        if (payload_size >= max_size) {
-            on_message_too_big(topic, packet);
-            return;
+    const TopicTokens tokens(topic);
+
+    std::vector<uint32_t> matches;
+    matches.swap(match_buffer);
+    matches.clear();
+    subscription_index.match(tokens, matches);
+
+    if (matches.size() <= 1) {
+        if (matches.empty()) {
+            on_extra_message(topic, packet);
+        } else {
+            (*subscription_callbacks[matches[0]])((char *) topic, packet);
         }
-        char payload[payload_size + 1];
-        if (packet.read((uint8_t *) payload, payload_size) != (int) payload_size) {
-            // connection error, ignore
-            return;
-        }
-        payload[payload_size] = '\0';
-        callback(topic, payload, payload_size);
-    });
-}
+        matches.swap(match_buffer);
+        return;
+    }
 
-Subscriber::SubscriptionId SubscribedMessageListener::subscribe(const String & topic_filter,
-        std::function<void(char *, char *)> callback, size_t max_size) {
-    TRACE_FUNCTION
-    return subscribe(topic_filter, [callback](char * topic, void * payload, size_t payload_size) {
-        callback(topic, (char *) payload);
-    }, max_size);
-}
+    std::vector<uint8_t> buffer;
+    buffer.swap(payload_buffer);
 
-Subscriber::SubscriptionId SubscribedMessageListener::subscribe(const String & topic_filter,
-        std::function<void(char *)> callback, size_t max_size) {
-    TRACE_FUNCTION
-    return subscribe(topic_filter, [callback](char * topic, void * payload, size_t payload_size) {
-        callback((char *) payload);
-    }, max_size);
-}
+    const size_t payload_size = packet.get_remaining_size();
+    const uint8_t * payload = packet.get_buffered_data();
 
-Subscriber::SubscriptionId SubscribedMessageListener::subscribe(const String & topic_filter,
-        std::function<void(void *, size_t)> callback, size_t max_size) {
-    TRACE_FUNCTION
-    return subscribe(topic_filter, [callback](char * topic, void * payload, size_t payload_size) {
-        callback(payload, payload_size);
-    }, max_size);
+    if (!payload && (payload_size <= PICOMQTT_MAX_MESSAGE_SIZE)) {
+        buffer.resize(payload_size + 1);
+        if (packet.read(buffer.data(), payload_size) == (int) payload_size) {
+            buffer[payload_size] = '\0';
+            payload = buffer.data();
+        } else {
+            // connection error, ignore the message
+            matches.clear();
+        }
+    }
+
+    if (payload) {
+        // subscriptions made while dispatching don't get the message
+        const SubscriptionId last_id = subscription_filters.get_id(matches.back());
+        size_t next = 0;
+        while (next < matches.size()) {
+            const uint32_t index = matches[next++];
+            const SubscriptionId id = subscription_filters.get_id(index);
+            const unsigned int generation = subscription_generation;
+
+            BufferedIncomingPacket buffered_packet(packet.get_type(), packet.get_flags(), payload, payload_size);
+            (*subscription_callbacks[index])((char *) topic, buffered_packet);
+
+            if (generation != subscription_generation) {
+                // the callback changed the subscriptions and the indexes, match again and continue with the
+                // subscriptions following this one which are still there
+                matches.clear();
+                subscription_index.match(tokens, matches);
+                next = 0;
+                while ((next < matches.size()) && (subscription_filters.get_id(matches[next]) <= id)) {
+                    ++next;
+                }
+                while (!matches.empty() && (subscription_filters.get_id(matches.back()) > last_id)) {
+                    matches.pop_back();
+                }
+            }
+        }
+    } else if (!matches.empty()) {
+        // too big to keep in memory, only one callback can consume the stream
+        (*subscription_callbacks[matches[0]])((char *) topic, packet);
+    }
+
+    buffer.swap(payload_buffer);
+    matches.swap(match_buffer);
 }
 
 };
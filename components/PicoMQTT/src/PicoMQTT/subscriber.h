@@ -1,17 +1,19 @@
 #pragma once
 
-#include <functional>
 #include <map>
+#include <type_traits>
+#include <utility>
 
 #include <Arduino.h>
 
 #include "autoid.h"
 #include "config.h"
+#include "delegate.h"
+#include "incoming_packet.h"
+#include "topic_matcher.h"
 
 namespace PicoMQTT {
 
-class IncomingPacket;
-
 class Subscriber {
     public:
         typedef AutoId::Id SubscriptionId;
@@ -41,7 +43,7 @@ class SubscribedMessageListener: public Subscriber {
     public:
         // NOTE: None of the callback functions use const arguments for wider compatibility.  It's still OK (and
         // recommended) to use callbacks which take const arguments.  Similarly with Strings.
-        typedef std::function<void(char * topic, IncomingPacket & packet)> MessageCallback;
+        typedef Delegate<void(char * topic, IncomingPacket & packet), PICOMQTT_CALLBACK_INLINE_SIZE> MessageCallback;
 
         virtual const char * get_subscription_pattern(SubscriptionId id) const override;
         virtual SubscriptionId get_subscription(const char * topic) const override;
@@ -49,15 +51,51 @@ class SubscribedMessageListener: public Subscriber {
         virtual SubscriptionId subscribe(const String & topic_filter) override;
         virtual SubscriptionId subscribe(const String & topic_filter, MessageCallback callback);
 
-        SubscriptionId subscribe(const String & topic_filter, std::function<void(char *, void *, size_t)> callback,
-                                 size_t max_size = PICOMQTT_MAX_MESSAGE_SIZE);
-
-        SubscriptionId subscribe(const String & topic_filter, std::function<void(char *, char *)> callback,
-                                 size_t max_size = PICOMQTT_MAX_MESSAGE_SIZE);
-        SubscriptionId subscribe(const String & topic_filter, std::function<void(void *, size_t)> callback,
-                                 size_t max_size = PICOMQTT_MAX_MESSAGE_SIZE);
-        SubscriptionId subscribe(const String & topic_filter, std::function<void(char *)> callback,
-                                 size_t max_size = PICOMQTT_MAX_MESSAGE_SIZE);
+        // SubscriptionId if Callback can be called with Args, used to select the subscribe() overload
+        template <typename Callback, typename... Args>
+        using EnableIfCallable = typename std::enable_if<std::is_invocable<Callback &, Args...>::value,
+              SubscriptionId>::type;
+
+        // True if Callback takes the payload as const, so it can't modify a buffer shared with other callbacks
+        template <typename Callback, typename... Args>
+        using IsReadOnly = std::is_invocable<Callback &, Args...>;
+
+        // The overloads below accept any callable (lambda, function pointer, std::function) with a matching
+        // signature.  The callable is wrapped in a single MessageCallback, so a message is dispatched with one
+        // indirect call and small lambdas are stored without heap allocations.
+        template <typename Callback>
+        EnableIfCallable<Callback, char *, void *, size_t> subscribe(const String & topic_filter, Callback callback,
+                size_t max_size = PICOMQTT_MAX_MESSAGE_SIZE) {
+            return subscribe_payload<IsReadOnly<Callback, char *, const void *, size_t>::value>(
+                       topic_filter, std::move(callback), max_size);
+        }
+
+        template <typename Callback>
+        EnableIfCallable<Callback, char *, char *> subscribe(const String & topic_filter, Callback callback,
+                size_t max_size = PICOMQTT_MAX_MESSAGE_SIZE) {
+            return subscribe_payload<IsReadOnly<Callback, char *, const char *>::value>(
+            topic_filter, [callback](char * topic, void * payload, size_t payload_size) mutable {
+                callback(topic, (char *) payload);
+            }, max_size);
+        }
+
+        template <typename Callback>
+        EnableIfCallable<Callback, void *, size_t> subscribe(const String & topic_filter, Callback callback,
+                size_t max_size = PICOMQTT_MAX_MESSAGE_SIZE) {
+            return subscribe_payload<IsReadOnly<Callback, const void *, size_t>::value>(
+            topic_filter, [callback](char * topic, void * payload, size_t payload_size) mutable {
+                callback(payload, payload_size);
+            }, max_size);
+        }
+
+        template <typename Callback>
+        EnableIfCallable<Callback, char *> subscribe(const String & topic_filter, Callback callback,
+                size_t max_size = PICOMQTT_MAX_MESSAGE_SIZE) {
+            return subscribe_payload<IsReadOnly<Callback, const char *>::value>(
+            topic_filter, [callback](char * topic, void * payload, size_t payload_size) mutable {
+                callback((char *) payload);
+            }, max_size);
+        }
 
         virtual void unsubscribe(const String & topic_filter) override;
 
@@ -65,9 +103,71 @@ class SubscribedMessageListener: public Subscriber {
         virtual void on_message_too_big(const char * topic, IncomingPacket & packet) {}
 
     protected:
+        // Reads the payload into memory (unless it's already buffered) and passes it to the callback.  A buffered
+        // payload is shared by all callbacks of the message, callbacks which may modify it get a copy.
+        template <typename Callback, bool read_only>
+        class PayloadCallback {
+            public:
+                PayloadCallback(SubscribedMessageListener & listener, Callback && callback, size_t max_size)
+                    : listener(listener), max_size(max_size), callback(std::move(callback)) {}
+
+                void operator()(char * topic, IncomingPacket & packet) {
+                    const size_t payload_size = packet.get_remaining_size();
+                    if (payload_size >= max_size) {
+                        listener.on_message_too_big(topic, packet);
+                        return;
+                    }
+
+                    const uint8_t * buffered_payload = packet.get_buffered_data();
+                    if (buffered_payload && read_only) {
+                        // already in memory and zero terminated, no copy needed
+                        callback(topic, (void *) buffered_payload, payload_size);
+                        return;
+                    }
+
+                    char payload[payload_size + 1];
+                    if (buffered_payload) {
+                        memcpy(payload, buffered_payload, payload_size);
+                    } else if (packet.read((uint8_t *) payload, payload_size) != (int) payload_size) {
+                        // connection error, ignore
+                        return;
+                    }
+                    payload[payload_size] = '\0';
+                    callback(topic, payload, payload_size);
+                }
+
+            protected:
+                SubscribedMessageListener & listener;
+                size_t max_size;
+                Callback callback;
+        };
+
+        template <bool read_only, typename Callback>
+        SubscriptionId subscribe_payload(const String & topic_filter, Callback callback, size_t max_size) {
+            return subscribe(topic_filter, PayloadCallback<Callback, read_only>(*this, std::move(callback), max_size));
+        }
+
+        // Fires the callbacks of all subscriptions matching the topic, in the order in which they were subscribed.
+        // If there's more than one, the payload is read into memory once (unless it's already buffered or bigger
+        // than PICOMQTT_MAX_MESSAGE_SIZE, in which case only the first callback gets the message) and each callback
+        // gets a packet reading from the beginning of that copy.  If a callback subscribes or unsubscribes, the
+        // message still goes to the remaining matching subscriptions, except those made during the dispatch.
         void fire_message_callbacks(const char * topic, IncomingPacket & packet);
+        void update_subscription_filters();
 
         std::map<Subscription, MessageCallback> subscriptions;
+
+        // compiled copy of the keys of subscriptions (in subscription order) used for matching
+        TopicFilterSet subscription_filters;
+        TopicFilterIndex subscription_index;
+        std::vector<const MessageCallback *> subscription_callbacks;
+
+        // incremented on every change of subscriptions, so dispatching notices if a callback changes them
+        unsigned int subscription_generation = 0;
+
+        // reused between messages, taken out of the object while dispatching in case a callback fires callbacks
+        std::vector<uint32_t> match_buffer;
+        std::vector<uint8_t> payload_buffer;
 };
 
 }
@@ -0,0 +1,114 @@
+#include "timer_wheel.h"
+
+namespace PicoMQTT {
+
+void TimerWheel::Timer::cancel() {
+    if (!pprev) {
+        return;
+    }
+    *pprev = next;
+    if (next) {
+        next->pprev = pprev;
+    }
+    next = nullptr;
+    pprev = nullptr;
+    --wheel->count;
+    wheel = nullptr;
+}
+
+TimerWheel::TimerWheel(unsigned long now): overdue(nullptr), current(now), count(0) {
+    for (auto & level : slots) {
+        for (auto & slot : level) {
+            slot = nullptr;
+        }
+    }
+}
+
+void TimerWheel::schedule(Timer & timer, unsigned long deadline) {
+    timer.cancel();
+    timer.deadline = deadline;
+    timer.wheel = this;
+    insert(timer);
+    ++count;
+}
+
+void TimerWheel::link(Timer ** slot, Timer & timer) {
+    timer.next = *slot;
+    if (timer.next) {
+        timer.next->pprev = &timer.next;
+    }
+    timer.pprev = slot;
+    *slot = &timer;
+}
+
+void TimerWheel::insert(Timer & timer) {
+    const unsigned long delta = timer.deadline - current;
+
+    if ((long) delta < 0) {
+        link(&overdue, timer);
+        return;
+    }
+
+    for (unsigned int level = 0; level < LEVELS; ++level) {
+        if (delta < (1ul << (SLOT_BITS * (level + 1)))) {
+            link(&slots[level][(timer.deadline >> (SLOT_BITS * level)) & (SLOTS - 1)], timer);
+            return;
+        }
+    }
+
+    // out of range, park in the top level slot which is cascaded last
+    const unsigned int top = LEVELS - 1;
+    link(&slots[top][((current >> (SLOT_BITS * top)) + SLOTS - 1) & (SLOTS - 1)], timer);
+}
+
+void TimerWheel::cascade(unsigned int level) {
+    // re-insert the timers of the slot which becomes current, they all land in lower levels (or back in the top
+    // level if they're out of range)
+    Timer ** slot = &slots[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    Timer * timer = *slot;
+    *slot = nullptr;
+    while (timer) {
+        Timer * next = timer->next;
+        insert(*timer);
+        timer = next;
+    }
+}
+
+void TimerWheel::fire(Timer ** slot) {
+    // Detach the list first.  Callbacks may schedule and cancel any timer, including the expired ones which haven't
+    // fired yet, and timers scheduled in the past from a callback fire on the next advance().
+    Timer * expired = *slot;
+    *slot = nullptr;
+    if (expired) {
+        expired->pprev = &expired;
+    }
+
+    while (expired) {
+        Timer & timer = *expired;
+        timer.cancel();
+        if (timer.callback) {
+            timer.callback();
+        }
+    }
+}
+
+void TimerWheel::advance(unsigned long now) {
+    fire(&overdue);
+
+    while (count && ((long)(now - current) >= 0)) {
+        for (unsigned int level = 1; level < LEVELS; ++level) {
+            if (current & ((1ul << (SLOT_BITS * level)) - 1)) {
+                break;
+            }
+            cascade(level);
+        }
+        fire(&slots[0][current++ & (SLOTS - 1)]);
+    }
+
+    if (!count && ((long)(now - current) >= 0)) {
+        // nothing left to fire, skip ahead
+        current = now + 1;
+    }
+}
+
+}
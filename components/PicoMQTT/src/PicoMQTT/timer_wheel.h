@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+#include "delegate.h"
+
+namespace PicoMQTT {
+
+/*
+ * Hierarchical timer wheel with a resolution of 1 ms.
+ *
+ * Timers are kept in LEVELS levels of SLOTS slots each.  Level 0 holds timers due within the next SLOTS
+ * milliseconds, one slot per millisecond; each higher level covers SLOTS times the range of the level below and is
+ * moved down one slot at a time as the time advances (cascading).  Timers beyond the range of the top level (about
+ * 4.6 hours) wait in its last slot and are cascaded again until they're in range.  Scheduling and cancelling are
+ * O(1), advancing is O(1) per elapsed millisecond plus the cost of the expired timers, and every timer is cascaded at
+ * most LEVELS - 1 times, no matter how many timers are waiting.
+ *
+ * Timers are intrusive, the wheel doesn't allocate.  A timer is cancelled when it's destroyed.  Time is the value of
+ * millis() and may wrap around, deadlines must be less than half of its range away.
+ */
+class TimerWheel {
+    public:
+        typedef Delegate<void(), 2 * sizeof(void *)> Callback;
+
+        class Timer {
+            public:
+                Timer(Callback callback = nullptr): callback(std::move(callback)), next(nullptr), pprev(nullptr),
+                    deadline(0), wheel(nullptr) {}
+                ~Timer() { cancel(); }
+
+                Timer(const Timer &) = delete;
+                const Timer & operator=(const Timer &) = delete;
+
+                bool is_scheduled() const { return pprev != nullptr; }
+                unsigned long get_deadline() const { return deadline; }
+                void cancel();
+
+                // Called by TimerWheel::advance() once the deadline has passed.  The timer is no longer scheduled
+                // at that point, the callback may schedule it again.
+                Callback callback;
+
+            protected:
+                friend class TimerWheel;
+
+                // slot lists are singly linked from the slot, doubly linked between timers
+                Timer * next;
+                Timer ** pprev;
+                unsigned long deadline;
+                TimerWheel * wheel;         // set while scheduled
+        };
+
+        static const unsigned int LEVELS = 4;
+        static const unsigned int SLOT_BITS = 6;
+        static const unsigned int SLOTS = 1 << SLOT_BITS;
+
+        TimerWheel(unsigned long now = 0);
+
+        TimerWheel(const TimerWheel &) = delete;
+        const TimerWheel & operator=(const TimerWheel &) = delete;
+
+        // (Re)schedules the timer to fire at the given time.  Timers with deadlines which have passed already fire on
+        // the next call to advance().
+        void schedule(Timer & timer, unsigned long deadline);
+
+        // Fires all timers with deadlines up to now
+        void advance(unsigned long now);
+
+        size_t get_count() const { return count; }
+
+    protected:
+        static void link(Timer ** slot, Timer & timer);
+        void insert(Timer & timer);
+        void cascade(unsigned int level);
+        void fire(Timer ** slot);
+
+        Timer * slots[LEVELS][SLOTS];
+        Timer * overdue;            // deadlines before current
+        unsigned long current;      // the next millisecond to process
+        size_t count;
+};
+
+}
@@ -0,0 +1,171 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "timeseries.h"
+
+namespace {
+
+const uint32_t TEN_SECONDS_MILLIS = 10 * 1000;
+const uint32_t ONE_MINUTE_MILLIS = 60 * 1000;
+
+const char * const RESOLUTION_NAMES[] = {"raw", "10s", "1m"};
+
+}
+
+namespace PicoMQTT {
+
+void TimeSeriesStore::Accumulator::add(float min_value, float max_value, float sum_value, uint32_t samples) {
+    if (!count) {
+        min = min_value;
+        max = max_value;
+        sum = sum_value;
+    } else {
+        min = min_value < min ? min_value : min;
+        max = max_value > max ? max_value : max;
+        sum += sum_value;
+    }
+    count += samples;
+}
+
+TimeSeriesStore::Bucket TimeSeriesStore::Series::open_minute() const {
+    Accumulator minute = one_minute_open;
+    const uint32_t start = ten_seconds_open.start - ten_seconds_open.start % ONE_MINUTE_MILLIS;
+    if (ten_seconds_open.count && (!minute.count || minute.start == start)) {
+        minute.start = start;
+        minute.add(ten_seconds_open.min, ten_seconds_open.max, ten_seconds_open.sum, ten_seconds_open.count);
+    }
+    return minute.to_bucket();
+}
+
+void TimeSeriesStore::Series::add(float value, uint32_t now) {
+    push(raw_samples, raw_size, raw, Sample{now, value});
+
+    const uint32_t start = now - now % TEN_SECONDS_MILLIS;
+    if (ten_seconds_open.count && (ten_seconds_open.start != start)) {
+        // close the 10 s bucket and fold it into the minute
+        const Bucket closed = ten_seconds_open.to_bucket();
+        push(ten_seconds_buckets, ten_seconds_size, ten_seconds, closed);
+
+        const uint32_t minute_start = closed.time - closed.time % ONE_MINUTE_MILLIS;
+        if (one_minute_open.count && (one_minute_open.start != minute_start)) {
+            push(one_minute_buckets, one_minute_size, one_minute, one_minute_open.to_bucket());
+            one_minute_open.count = 0;
+        }
+        one_minute_open.start = minute_start;
+        one_minute_open.add(ten_seconds_open.min, ten_seconds_open.max, ten_seconds_open.sum, ten_seconds_open.count);
+        ten_seconds_open.count = 0;
+    }
+    ten_seconds_open.start = start;
+    ten_seconds_open.add(value, value, value, 1);
+}
+
+TimeSeriesStore::TimeSeriesStore(size_t topic_capacity): topic_capacity(topic_capacity) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+size_t TimeSeriesStore::add(size_t max_series, size_t raw_size, size_t ten_seconds_size, size_t one_minute_size) {
+    Group group;
+    group.max_series = max_series;
+    group.raw_size = raw_size;
+    group.ten_seconds_size = ten_seconds_size;
+    group.one_minute_size = one_minute_size;
+    group.used = 0;
+    groups.push_back(std::move(group));
+    return groups.size() - 1;
+}
+
+void TimeSeriesStore::begin() {
+    groups.shrink_to_fit();
+    for (auto & group : groups) {
+        group.used = 0;
+        group.series.assign(group.max_series, Series());
+        group.topics.assign(group.max_series * topic_capacity, '\0');
+        group.raw_samples.assign(group.max_series * group.raw_size, Sample());
+        group.buckets.assign(group.max_series * (group.ten_seconds_size + group.one_minute_size), Bucket());
+
+        for (size_t i = 0; i < group.max_series; ++i) {
+            Series & series = group.series[i];
+            memset(&series, 0, sizeof(series));
+            series.topic = group.topics.data() + i * topic_capacity;
+            series.raw_samples = group.raw_samples.data() + i * group.raw_size;
+            series.ten_seconds_buckets = group.buckets.data() + i * (group.ten_seconds_size + group.one_minute_size);
+            series.one_minute_buckets = series.ten_seconds_buckets + group.ten_seconds_size;
+            series.raw_size = group.raw_size;
+            series.ten_seconds_size = group.ten_seconds_size;
+            series.one_minute_size = group.one_minute_size;
+        }
+    }
+}
+
+bool TimeSeriesStore::ingest(size_t group_index, const char * topic, const char * payload, uint32_t now) {
+    char * end;
+    const float value = strtof(payload, &end);
+    if ((end == payload) || (*end && *end != ' ')) {
+        ++stats.not_numeric;
+        return false;
+    }
+    return ingest(group_index, topic, value, now);
+}
+
+bool TimeSeriesStore::ingest(size_t group_index, const char * topic, float value, uint32_t now) {
+    if (group_index >= groups.size()) {
+        ++stats.no_series;
+        return false;
+    }
+
+    Group & group = groups[group_index];
+    size_t i = 0;
+    while ((i < group.used) && strcmp(group.series[i].topic, topic)) {
+        ++i;
+    }
+
+    if (i == group.used) {
+        const size_t topic_size = strlen(topic);
+        if ((group.used == group.series.size()) || (topic_size >= topic_capacity)) {
+            ++stats.no_series;
+            return false;
+        }
+        memcpy(group.series[i].topic, topic, topic_size + 1);
+        ++group.used;
+    }
+
+    group.series[i].add(value, now);
+    ++stats.ingested;
+    return true;
+}
+
+const TimeSeriesStore::Series * TimeSeriesStore::find(const char * topic) const {
+    for (const auto & group : groups) {
+        for (size_t i = 0; i < group.used; ++i) {
+            if (!strcmp(group.series[i].topic, topic)) {
+                return &group.series[i];
+            }
+        }
+    }
+    return nullptr;
+}
+
+const char * TimeSeriesStore::get_resolution_name(Resolution resolution) {
+    return RESOLUTION_NAMES[resolution];
+}
+
+bool TimeSeriesStore::parse_resolution(const char * name, Resolution & resolution) {
+    for (size_t i = 0; i < sizeof(RESOLUTION_NAMES) / sizeof(RESOLUTION_NAMES[0]); ++i) {
+        if (!strcmp(name, RESOLUTION_NAMES[i])) {
+            resolution = (Resolution) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t TimeSeriesStore::get_memory_usage() const {
+    size_t ret = groups.capacity() * sizeof(Group);
+    for (const auto & group : groups) {
+        ret += group.series.capacity() * sizeof(Series) + group.topics.capacity()
+               + group.raw_samples.capacity() * sizeof(Sample) + group.buckets.capacity() * sizeof(Bucket);
+    }
+    return ret;
+}
+
+}
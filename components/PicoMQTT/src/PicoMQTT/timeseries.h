@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PicoMQTT {
+
+/*
+ * History of numeric topics in fixed-size rings.
+ *
+ * Series are grouped by the topic filter they were configured for: add() returns a group with room for up to
+ * max_series topics, each new matching topic takes the next free series until they're used up.  Each series keeps the
+ * last raw samples and two downsampled tiers, buckets of 10 s and of 1 min with the minimum, maximum and mean of the
+ * samples in them.  A sample is added to the raw ring and to the open 10 s bucket; a closed 10 s bucket goes to its
+ * ring and is folded into the open 1 min bucket.  Ingesting is O(1) apart from finding the series, which compares the
+ * topic with the series of the group.
+ *
+ * All memory is allocated by begin() from the configuration and nothing is allocated afterwards.  Payloads are
+ * parsed once, when they're ingested.  Time is the value of millis() and may wrap around, samples older than half of
+ * its range are not returned anymore.
+ */
+class TimeSeriesStore {
+    public:
+        enum Resolution {
+            RAW,
+            TEN_SECONDS,
+            ONE_MINUTE,
+        };
+
+        // a raw sample has min == max == mean
+        struct Bucket {
+            uint32_t time;          // of the sample or start of the bucket, millis()
+            float min;
+            float max;
+            float mean;
+        };
+
+        struct Stats {
+            unsigned long ingested;
+            unsigned long not_numeric;
+            unsigned long no_series;      // all series of the group taken or topic too long
+        };
+
+        TimeSeriesStore(size_t topic_capacity = 64);
+
+        TimeSeriesStore(const TimeSeriesStore &) = delete;
+        const TimeSeriesStore & operator=(const TimeSeriesStore &) = delete;
+
+        // Adds a group of series and returns its index.  Sizes are numbers of entries kept at each resolution.
+        size_t add(size_t max_series, size_t raw_size, size_t ten_seconds_size, size_t one_minute_size);
+
+        // Allocates the series of all groups
+        void begin();
+
+        // Parses the payload as a number and adds it to the series of the topic.  Returns false if the payload
+        // is not a number or there's no series for the topic.
+        bool ingest(size_t group, const char * topic, const char * payload, uint32_t now);
+        bool ingest(size_t group, const char * topic, float value, uint32_t now);
+
+        /*
+         * Passes the entries of the series of topic at the given resolution which are not older than since to
+         * callback(const Bucket &), oldest first.  The downsampled tiers end with the bucket still open.  Returns
+         * the number of entries passed, or -1 if there's no such series.
+         */
+        template <typename Callback>
+        int query(const char * topic, Resolution resolution, uint32_t since, Callback callback) const {
+            const Series * series = find(topic);
+            if (!series) {
+                return -1;
+            }
+
+            int count = 0;
+            auto visit = [&](const Bucket & bucket) {
+                if ((int32_t)(bucket.time - since) >= 0) {
+                    callback(bucket);
+                    ++count;
+                }
+            };
+
+            switch (resolution) {
+                case RAW:
+                    for (size_t i = 0; i < series->raw.count; ++i) {
+                        const Sample & sample = series->raw_entry(i);
+                        visit(Bucket{sample.time, sample.value, sample.value, sample.value});
+                    }
+                    break;
+
+                case TEN_SECONDS:
+                    for (size_t i = 0; i < series->ten_seconds.count; ++i) {
+                        visit(series->ten_seconds_entry(i));
+                    }
+                    if (series->ten_seconds_open.count) {
+                        visit(series->ten_seconds_open.to_bucket());
+                    }
+                    break;
+
+                case ONE_MINUTE:
+                    for (size_t i = 0; i < series->one_minute.count; ++i) {
+                        visit(series->one_minute_entry(i));
+                    }
+                    if (series->one_minute_open.count || series->ten_seconds_open.count) {
+                        visit(series->open_minute());
+                    }
+                    break;
+            }
+            return count;
+        }
+
+        // Topics of all series in use
+        template <typename Callback>
+        void for_each_topic(Callback callback) const {
+            for (const auto & group : groups) {
+                for (size_t i = 0; i < group.used; ++i) {
+                    callback(group.series[i].topic);
+                }
+            }
+        }
+
+        static const char * get_resolution_name(Resolution resolution);
+        static bool parse_resolution(const char * name, Resolution & resolution);
+
+        const Stats & get_stats() const { return stats; }
+        size_t get_memory_usage() const;
+
+    protected:
+        struct Sample {
+            uint32_t time;
+            float value;
+        };
+
+        struct Ring {
+            size_t next;
+            size_t count;
+        };
+
+        struct Accumulator {
+            uint32_t start;
+            uint32_t count;
+            float min;
+            float max;
+            float sum;
+
+            void add(float min_value, float max_value, float sum_value, uint32_t samples);
+            Bucket to_bucket() const { return Bucket{start, min, max, sum / count}; }
+        };
+
+        struct Series {
+            char * topic;
+            Sample * raw_samples;
+            Bucket * ten_seconds_buckets;
+            Bucket * one_minute_buckets;
+            size_t raw_size;
+            size_t ten_seconds_size;
+            size_t one_minute_size;
+
+            Ring raw;
+            Ring ten_seconds;
+            Ring one_minute;
+            Accumulator ten_seconds_open;
+            Accumulator one_minute_open;
+
+            // i-th oldest entry
+            const Sample & raw_entry(size_t i) const {
+                return raw_samples[(raw.next + raw_size - raw.count + i) % raw_size];
+            }
+            const Bucket & ten_seconds_entry(size_t i) const {
+                return ten_seconds_buckets[(ten_seconds.next + ten_seconds_size - ten_seconds.count + i)
+                                           % ten_seconds_size];
+            }
+            const Bucket & one_minute_entry(size_t i) const {
+                return one_minute_buckets[(one_minute.next + one_minute_size - one_minute.count + i)
+                                          % one_minute_size];
+            }
+
+            // the open minute including the open 10 s bucket
+            Bucket open_minute() const;
+
+            void add(float value, uint32_t now);
+        };
+
+        struct Group {
+            size_t max_series;
+            size_t raw_size;
+            size_t ten_seconds_size;
+            size_t one_minute_size;
+
+            std::vector<Series> series;
+            std::vector<char> topics;
+            std::vector<Sample> raw_samples;
+            std::vector<Bucket> buckets;
+            size_t used;
+        };
+
+        template <typename T>
+        static void push(T * entries, size_t size, Ring & ring, const T & entry) {
+            if (!size) {
+                return;
+            }
+            entries[ring.next] = entry;
+            ring.next = (ring.next + 1) % size;
+            if (ring.count < size) {
+                ++ring.count;
+            }
+        }
+
+        const Series * find(const char * topic) const;
+
+        const size_t topic_capacity;
+        std::vector<Group> groups;
+        Stats stats;
+};
+
+}
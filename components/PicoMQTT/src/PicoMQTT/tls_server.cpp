@@ -0,0 +1,442 @@
+#include "tls_server.h"
+
+#if PICOMQTT_TLS
+
+#include <algorithm>
+#include <cstring>
+
+#include <mbedtls/net_sockets.h>
+
+#include "debug.h"
+
+namespace PicoMQTT {
+
+TlsClient::TlsClient(TlsServer & server, const ::WiFiClient & client)
+    : server(server), client(client), record_size(server.record_size), peeked(-1), open(true), resumed(false),
+      waiting_for_data(false), accept_millis(millis()), handshake_micros(0) {
+    TRACE_FUNCTION
+    mbedtls_ssl_init(&ssl);
+    if (mbedtls_ssl_setup(&ssl, &server.config) != 0) {
+        close();
+        return;
+    }
+    mbedtls_ssl_set_bio(&ssl, &this->client, bio_send, bio_recv, nullptr);
+}
+
+TlsClient::~TlsClient() {
+    TRACE_FUNCTION
+    stop();
+    mbedtls_ssl_free(&ssl);
+}
+
+int TlsClient::bio_send(void * ctx, const unsigned char * buffer, size_t size) {
+    ::WiFiClient & client = *static_cast<::WiFiClient *>(ctx);
+    if (!client.connected()) {
+        return MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    const size_t ret = client.write(buffer, size);
+    return ret ? (int) ret : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+int TlsClient::bio_recv(void * ctx, unsigned char * buffer, size_t size) {
+    ::WiFiClient & client = *static_cast<::WiFiClient *>(ctx);
+    if (!client.available()) {
+        return client.connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    const int ret = client.read(buffer, size);
+    return ret > 0 ? ret : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+TlsClient::HandshakeResult TlsClient::handshake() {
+    TRACE_FUNCTION
+    if (!open) {
+        return HandshakeResult::FAILED;
+    }
+
+    int result;
+    if (waiting_for_data && client.connected() && !client.available()) {
+        // mbedTLS needs more data than it got in the previous call, don't spend time (counted as handshake time) on
+        // polling it
+        result = MBEDTLS_ERR_SSL_WANT_READ;
+    } else {
+        server.current = this;
+        const unsigned long start_micros = micros();
+        result = mbedtls_ssl_handshake(&ssl);
+        handshake_micros += micros() - start_micros;
+        server.current = nullptr;
+    }
+    waiting_for_data = (result == MBEDTLS_ERR_SSL_WANT_READ);
+
+    switch (result) {
+        case 0: {
+            const int max_payload = mbedtls_ssl_get_max_out_record_payload(&ssl);
+            if ((max_payload > 0) && (record_size > (size_t) max_payload)) {
+                record_size = max_payload;
+            }
+            buffer.reserve(record_size);
+            return HandshakeResult::DONE;
+        }
+
+        case MBEDTLS_ERR_SSL_WANT_READ:
+        case MBEDTLS_ERR_SSL_WANT_WRITE:
+            if (millis() - accept_millis > server.handshake_timeout_millis) {
+                close();
+                return HandshakeResult::FAILED;
+            }
+            return HandshakeResult::IN_PROGRESS;
+
+        default:
+            close();
+            return HandshakeResult::FAILED;
+    }
+}
+
+bool TlsClient::flush_buffer() {
+    TRACE_FUNCTION
+    size_t offset = 0;
+    const unsigned long start_millis = millis();
+
+    while (open && (offset < buffer.size())) {
+        const int result = mbedtls_ssl_write(&ssl, buffer.data() + offset, buffer.size() - offset);
+        if (result > 0) {
+            offset += result;
+        } else if (((result == MBEDTLS_ERR_SSL_WANT_WRITE) || (result == MBEDTLS_ERR_SSL_WANT_READ))
+                   && (millis() - start_millis < server.socket_timeout_millis)) {
+            yield();
+        } else {
+            close();
+        }
+    }
+
+    buffer.clear();
+    return open;
+}
+
+void TlsClient::close() {
+    TRACE_FUNCTION
+    open = false;
+    buffer.clear();
+    client.stop();
+}
+
+size_t TlsClient::write(const uint8_t * data, size_t size) {
+    TRACE_FUNCTION
+    size_t ret = 0;
+    while (open && (ret < size)) {
+        const size_t chunk_size = std::min(size - ret, record_size - buffer.size());
+        buffer.insert(buffer.end(), data + ret, data + ret + chunk_size);
+        ret += chunk_size;
+        if ((buffer.size() >= record_size) && !flush_buffer()) {
+            return 0;
+        }
+    }
+    return ret;
+}
+
+int TlsClient::available() {
+    TRACE_FUNCTION
+    flush_buffer();
+
+    if (peeked >= 0) {
+        return 1 + mbedtls_ssl_get_bytes_avail(&ssl);
+    }
+
+    const size_t ret = mbedtls_ssl_get_bytes_avail(&ssl);
+    if (ret || !open || !client.available()) {
+        return ret;
+    }
+
+    // no decrypted data, but there's something on the socket -- try to process the next record
+    return (peek() >= 0) ? 1 + mbedtls_ssl_get_bytes_avail(&ssl) : 0;
+}
+
+int TlsClient::read(uint8_t * data, size_t size) {
+    TRACE_FUNCTION
+    flush_buffer();
+
+    if (!size) {
+        return 0;
+    }
+
+    size_t ret = 0;
+    if (peeked >= 0) {
+        data[ret++] = peeked;
+        peeked = -1;
+    }
+
+    if ((!open && !mbedtls_ssl_get_bytes_avail(&ssl)) || (ret == size)) {
+        return ret ? (int) ret : -1;
+    }
+
+    const int result = mbedtls_ssl_read(&ssl, data + ret, size - ret);
+    if (result > 0) {
+        ret += result;
+    } else if ((result != MBEDTLS_ERR_SSL_WANT_READ) && (result != MBEDTLS_ERR_SSL_WANT_WRITE)) {
+        // error or close notify from the peer
+        close();
+    }
+
+    return ret ? (int) ret : -1;
+}
+
+int TlsClient::read() {
+    TRACE_FUNCTION
+    uint8_t value;
+    return (read(&value, 1) == 1) ? value : -1;
+}
+
+int TlsClient::peek() {
+    TRACE_FUNCTION
+    if (peeked < 0) {
+        uint8_t value;
+        if (read(&value, 1) == 1) {
+            peeked = value;
+        }
+    }
+    return peeked;
+}
+
+void TlsClient::flush() {
+    TRACE_FUNCTION
+    flush_buffer();
+}
+
+void TlsClient::stop() {
+    TRACE_FUNCTION
+    if (!open) {
+        return;
+    }
+    flush_buffer();
+    mbedtls_ssl_close_notify(&ssl);
+    close();
+}
+
+uint8_t TlsClient::connected() {
+    TRACE_FUNCTION
+    flush_buffer();
+    if (open && !client.connected()) {
+        // data which was already decrypted can still be read
+        close();
+    }
+    return open || (peeked >= 0) || mbedtls_ssl_get_bytes_avail(&ssl);
+}
+
+void TlsServer::HandshakeStats::add(unsigned long micros) {
+    ++count;
+    total_micros += micros;
+    if (micros > max_micros) {
+        max_micros = micros;
+    }
+}
+
+TlsServer::TlsServer(uint16_t port)
+    : record_size(PICOMQTT_TLS_RECORD_SIZE), handshake_timeout_millis(10 * 1000), max_handshakes(2),
+      session_tickets(true), session_cache(true), session_cache_size(8), session_lifetime_seconds(24 * 60 * 60),
+      socket_timeout_millis(5 * 1000), server(port), ciphersuites(nullptr), ready(false), current(nullptr) {
+    TRACE_FUNCTION
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&ctr_drbg);
+    mbedtls_ssl_config_init(&config);
+    mbedtls_x509_crt_init(&certificate);
+    mbedtls_pk_init(&key);
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_init(&cache);
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C)
+    mbedtls_ssl_ticket_init(&ticket);
+#endif
+}
+
+TlsServer::~TlsServer() {
+    TRACE_FUNCTION
+    handshakes.clear();
+#if defined(MBEDTLS_SSL_TICKET_C)
+    mbedtls_ssl_ticket_free(&ticket);
+#endif
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_free(&cache);
+#endif
+    mbedtls_pk_free(&key);
+    mbedtls_x509_crt_free(&certificate);
+    mbedtls_ssl_config_free(&config);
+    mbedtls_ctr_drbg_free(&ctr_drbg);
+    mbedtls_entropy_free(&entropy);
+}
+
+bool TlsServer::set_certificate(const char * cert, size_t cert_size, const char * key, size_t key_size,
+                                const char * key_password) {
+    TRACE_FUNCTION
+    if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, nullptr, 0) != 0) {
+        return false;
+    }
+
+    if (mbedtls_x509_crt_parse(&certificate, (const unsigned char *) cert, cert_size) != 0) {
+        return false;
+    }
+
+    const unsigned char * password = (const unsigned char *) key_password;
+    const size_t password_size = key_password ? strlen(key_password) : 0;
+#if MBEDTLS_VERSION_MAJOR >= 3
+    const int result = mbedtls_pk_parse_key(&this->key, (const unsigned char *) key, key_size,
+                                            password, password_size, mbedtls_ctr_drbg_random, &ctr_drbg);
+#else
+    const int result = mbedtls_pk_parse_key(&this->key, (const unsigned char *) key, key_size,
+                                            password, password_size);
+#endif
+    return result == 0;
+}
+
+bool TlsServer::set_certificate(const char * cert_pem, const char * key_pem, const char * key_password) {
+    TRACE_FUNCTION
+    // PEM input must include the terminating zero
+    return set_certificate(cert_pem, strlen(cert_pem) + 1, key_pem, strlen(key_pem) + 1, key_password);
+}
+
+void TlsServer::begin() {
+    TRACE_FUNCTION
+    ready = false;
+
+    if (mbedtls_ssl_config_defaults(&config, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        return;
+    }
+
+    mbedtls_ssl_conf_rng(&config, mbedtls_ctr_drbg_random, &ctr_drbg);
+
+    if (mbedtls_ssl_conf_own_cert(&config, &certificate, &key) != 0) {
+        return;
+    }
+
+    if (ciphersuites) {
+        mbedtls_ssl_conf_ciphersuites(&config, ciphersuites);
+    }
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+    if (session_cache) {
+        mbedtls_ssl_cache_set_max_entries(&cache, session_cache_size);
+        mbedtls_ssl_cache_set_timeout(&cache, session_lifetime_seconds);
+        mbedtls_ssl_conf_session_cache(&config, this, cache_get, cache_set);
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_TICKET_C)
+    if (session_tickets) {
+        if (mbedtls_ssl_ticket_setup(&ticket, mbedtls_ctr_drbg_random, &ctr_drbg, MBEDTLS_CIPHER_AES_128_GCM,
+                                     session_lifetime_seconds) != 0) {
+            return;
+        }
+        mbedtls_ssl_conf_session_tickets_cb(&config, ticket_write, ticket_parse, this);
+    }
+#endif
+
+    ready = true;
+    server.begin();
+}
+
+// The callbacks below wrap the mbedTLS implementations to find out if a handshake resumes a session.  Both get a
+// pointer to the TlsServer, so they have to pass the right context to the wrapped functions.
+
+void TlsServer::mark_resumed() {
+    if (current) {
+        current->resumed = true;
+    }
+}
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+
+#if MBEDTLS_VERSION_MAJOR >= 3
+int TlsServer::cache_get(void * data, unsigned char const * session_id, size_t session_id_size,
+                         mbedtls_ssl_session * session) {
+    TlsServer & server = *static_cast<TlsServer *>(data);
+    const int ret = mbedtls_ssl_cache_get(&server.cache, session_id, session_id_size, session);
+    if (ret == 0) {
+        server.mark_resumed();
+    }
+    return ret;
+}
+
+int TlsServer::cache_set(void * data, unsigned char const * session_id, size_t session_id_size,
+                         const mbedtls_ssl_session * session) {
+    TlsServer & server = *static_cast<TlsServer *>(data);
+    return mbedtls_ssl_cache_set(&server.cache, session_id, session_id_size, session);
+}
+#else
+int TlsServer::cache_get(void * data, mbedtls_ssl_session * session) {
+    TlsServer & server = *static_cast<TlsServer *>(data);
+    const int ret = mbedtls_ssl_cache_get(&server.cache, session);
+    if (ret == 0) {
+        server.mark_resumed();
+    }
+    return ret;
+}
+
+int TlsServer::cache_set(void * data, const mbedtls_ssl_session * session) {
+    TlsServer & server = *static_cast<TlsServer *>(data);
+    return mbedtls_ssl_cache_set(&server.cache, session);
+}
+#endif
+
+#endif
+
+#if defined(MBEDTLS_SSL_TICKET_C)
+
+int TlsServer::ticket_write(void * data, const mbedtls_ssl_session * session, unsigned char * start,
+                            const unsigned char * end, size_t * size, uint32_t * lifetime) {
+    TlsServer & server = *static_cast<TlsServer *>(data);
+    return mbedtls_ssl_ticket_write(&server.ticket, session, start, end, size, lifetime);
+}
+
+int TlsServer::ticket_parse(void * data, mbedtls_ssl_session * session, unsigned char * buffer, size_t size) {
+    TlsServer & server = *static_cast<TlsServer *>(data);
+    const int ret = mbedtls_ssl_ticket_parse(&server.ticket, session, buffer, size);
+    if (ret == 0) {
+        server.mark_resumed();
+    }
+    return ret;
+}
+
+#endif
+
+::Client * TlsServer::accept_client() {
+    TRACE_FUNCTION
+    if (!ready) {
+        return nullptr;
+    }
+
+    ::WiFiClient client = server.accept();
+    if (client) {
+        if (handshakes.size() < max_handshakes) {
+            handshakes.push_back(std::unique_ptr<TlsClient>(new TlsClient(*this, client)));
+        } else {
+            // each handshake in progress holds a full set of mbedTLS buffers
+            ++stats.rejected;
+            client.stop();
+        }
+    }
+
+    for (auto it = handshakes.begin(); it != handshakes.end();) {
+        switch ((*it)->handshake()) {
+            case TlsClient::HandshakeResult::IN_PROGRESS:
+                ++it;
+                break;
+
+            case TlsClient::HandshakeResult::FAILED:
+                ++stats.failed;
+                handshakes.erase(it++);
+                break;
+
+            case TlsClient::HandshakeResult::DONE: {
+                TlsClient * ret = it->release();
+                handshakes.erase(it);
+                (ret->resumed ? stats.resumed : stats.full).add(ret->handshake_micros);
+                return ret;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+}
+
+#endif
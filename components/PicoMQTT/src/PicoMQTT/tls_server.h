@@ -0,0 +1,220 @@
+#pragma once
+
+#include "config.h"
+
+#if PICOMQTT_TLS
+
+#if !__has_include(<mbedtls/ssl.h>)
+#error "TlsServer needs mbedTLS: add it to the build (REQUIRES mbedtls in ESP-IDF) or define PICOMQTT_TLS as 0"
+#endif
+
+#include <list>
+#include <memory>
+#include <vector>
+
+#include <Arduino.h>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/version.h>
+#include <mbedtls/x509_crt.h>
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+#include <mbedtls/ssl_cache.h>
+#endif
+
+#if defined(MBEDTLS_SSL_TICKET_C)
+#include <mbedtls/ssl_ticket.h>
+#endif
+
+#include "server.h"
+
+namespace PicoMQTT {
+
+class TlsServer;
+
+/*
+ * A TLS connection accepted by TlsServer.
+ *
+ * Writes are collected in a plaintext buffer of record_size bytes and encrypted when it fills up, when flush() is
+ * called or when the connection is polled (available(), connected(), read()), so a packet written in small chunks
+ * becomes a single TLS record instead of many tiny ones.
+ */
+class TlsClient: public ::Client {
+    public:
+        TlsClient(TlsServer & server, const ::WiFiClient & client);
+        virtual ~TlsClient();
+
+        TlsClient(const TlsClient &) = delete;
+        const TlsClient & operator=(const TlsClient &) = delete;
+
+        virtual int connect(IPAddress ip, uint16_t port) override { return 0; }
+        virtual int connect(const char * host, uint16_t port) override { return 0; }
+#ifdef PICOMQTT_EXTRA_CONNECT_METHODS
+        virtual int connect(IPAddress ip, uint16_t port, int32_t timeout) override { return 0; }
+        virtual int connect(const char * host, uint16_t port, int32_t timeout) override { return 0; }
+#endif
+
+        virtual size_t write(const uint8_t * buffer, size_t size) override;
+        virtual size_t write(uint8_t value) override { return write(&value, 1); }
+        virtual int available() override;
+        virtual int read(uint8_t * buffer, size_t size) override;
+        virtual int read() override;
+        virtual int peek() override;
+        virtual void flush() override;
+        virtual void stop() override;
+        virtual uint8_t connected() override;
+        virtual operator bool() override { return connected(); }
+
+        bool is_resumed() const { return resumed; }
+        unsigned long get_handshake_micros() const { return handshake_micros; }
+
+    protected:
+        friend class TlsServer;
+
+        enum class HandshakeResult { IN_PROGRESS, DONE, FAILED };
+        HandshakeResult handshake();
+
+        bool flush_buffer();
+        void close();
+
+        static int bio_send(void * ctx, const unsigned char * buffer, size_t size);
+        static int bio_recv(void * ctx, unsigned char * buffer, size_t size);
+
+        TlsServer & server;
+        ::WiFiClient client;
+        mbedtls_ssl_context ssl;
+        std::vector<uint8_t> buffer;
+        size_t record_size;
+        int peeked;
+        bool open;
+        bool resumed;
+        // the last handshake step returned MBEDTLS_ERR_SSL_WANT_READ
+        bool waiting_for_data;
+
+        const unsigned long accept_millis;
+        unsigned long handshake_micros;
+};
+
+/*
+ * TLS listener for Server, using mbedTLS.
+ *
+ * Handshakes are performed incrementally in accept_client(), without blocking the broker loop.  A connection is
+ * handed to the broker only after its handshake has completed.
+ *
+ * To let reconnecting clients skip the expensive part of the handshake (the public key operations), the server
+ * supports both session resumption mechanisms of TLS 1.2: session tickets (the session state is encrypted with a
+ * server key and kept by the client, costs no server RAM) and a session cache (the state is kept on the server,
+ * for clients which don't support tickets).
+ *
+ * The TlsServer object must outlive the Server which uses it.
+ */
+class TlsServer: public ServerSocketInterface {
+    public:
+        struct HandshakeStats {
+            unsigned long count = 0;
+            // time spent in mbedTLS (CPU time on a single core device)
+            unsigned long long total_micros = 0;
+            unsigned long max_micros = 0;
+
+            unsigned long get_average_micros() const { return count ? total_micros / count : 0; }
+            void add(unsigned long micros);
+        };
+
+        struct Stats {
+            HandshakeStats full;
+            HandshakeStats resumed;
+            unsigned long failed = 0;
+            unsigned long rejected = 0;
+        };
+
+        TlsServer(uint16_t port = 8883);
+        virtual ~TlsServer();
+
+        // PEM (zero terminated) or DER certificate chain and private key.  Must be called before begin().
+        bool set_certificate(const char * cert, size_t cert_size, const char * key, size_t key_size,
+                             const char * key_password = nullptr);
+        bool set_certificate(const char * cert_pem, const char * key_pem, const char * key_password = nullptr);
+
+        // Zero terminated list of MBEDTLS_TLS_* cipher suite ids, in order of preference.  The array is not copied.
+        // By default all suites enabled in the mbedTLS configuration are allowed.
+        void set_ciphersuites(const int * ciphersuites) { this->ciphersuites = ciphersuites; }
+
+        virtual void begin() override;
+        virtual ::Client * accept_client() override;
+
+        const Stats & get_stats() const { return stats; }
+        size_t get_handshake_count() const { return handshakes.size(); }
+
+        // Size of the plaintext buffer of each connection, limited by the maximum record payload that mbedTLS can
+        // send.  Smaller values save RAM per client, larger ones produce fewer records (less overhead) when
+        // publishing big messages.  Note that the mbedTLS record buffers are sized by MBEDTLS_SSL_IN_CONTENT_LEN and
+        // MBEDTLS_SSL_OUT_CONTENT_LEN, unless MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH (CONFIG_MBEDTLS_DYNAMIC_BUFFER in
+        // ESP-IDF) is enabled.
+        size_t record_size;
+
+        // Handshakes which take longer are aborted
+        unsigned long handshake_timeout_millis;
+        // Incoming connections are refused while this many handshakes are in progress
+        size_t max_handshakes;
+
+        bool session_tickets;
+        bool session_cache;
+        size_t session_cache_size;
+        unsigned long session_lifetime_seconds;
+
+        // timeout of writes of a single record
+        unsigned long socket_timeout_millis;
+
+    protected:
+#if defined(MBEDTLS_SSL_CACHE_C)
+#if MBEDTLS_VERSION_MAJOR >= 3
+        static int cache_get(void * data, unsigned char const * session_id, size_t session_id_size,
+                             mbedtls_ssl_session * session);
+        static int cache_set(void * data, unsigned char const * session_id, size_t session_id_size,
+                             const mbedtls_ssl_session * session);
+#else
+        static int cache_get(void * data, mbedtls_ssl_session * session);
+        static int cache_set(void * data, const mbedtls_ssl_session * session);
+#endif
+#endif
+
+#if defined(MBEDTLS_SSL_TICKET_C)
+        static int ticket_write(void * data, const mbedtls_ssl_session * session, unsigned char * start,
+                                const unsigned char * end, size_t * size, uint32_t * lifetime);
+        static int ticket_parse(void * data, mbedtls_ssl_session * session, unsigned char * buffer, size_t size);
+#endif
+
+        void mark_resumed();
+
+        ::WiFiServer server;
+        std::list<std::unique_ptr<TlsClient>> handshakes;
+        Stats stats;
+
+        const int * ciphersuites;
+
+        mbedtls_entropy_context entropy;
+        mbedtls_ctr_drbg_context ctr_drbg;
+        mbedtls_ssl_config config;
+        mbedtls_x509_crt certificate;
+        mbedtls_pk_context key;
+#if defined(MBEDTLS_SSL_CACHE_C)
+        mbedtls_ssl_cache_context cache;
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C)
+        mbedtls_ssl_ticket_context ticket;
+#endif
+
+        bool ready;
+
+        // connection whose handshake is being processed, used by the resumption callbacks
+        TlsClient * current;
+
+        friend class TlsClient;
+};
+
+}
+
+#endif
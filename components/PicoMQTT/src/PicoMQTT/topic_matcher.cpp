@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+
+#include "topic_matcher.h"
+
+namespace {
+
+typedef uintptr_t Word;
+
+constexpr Word repeat(uint8_t value) {
+    return (~Word(0) / 0xff) * value;
+}
+
+constexpr Word SLASHES = repeat('/');
+constexpr Word LOW_BITS = repeat(0x7f);
+
+// Returns a word with the high bit set in every byte of word which equals '/' and all other bits cleared.  Unlike the
+// classic "has zero byte" trick, this has no false positives, so every set bit is a real separator.
+inline Word find_slashes(Word word) {
+    const Word x = word ^ SLASHES;
+    return ~(((x & LOW_BITS) + LOW_BITS) | x | LOW_BITS);
+}
+
+inline unsigned int first_byte_index(Word mask) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    return __builtin_clzl(mask) / 8;
+#else
+    return __builtin_ctzl(mask) / 8;
+#endif
+}
+
+inline Word clear_first_byte(Word mask) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    return mask & ~(Word(0x80) << ((sizeof(Word) - 1 - first_byte_index(mask)) * 8));
+#else
+    return mask & (mask - 1);
+#endif
+}
+
+struct IndexBuildNode {
+    IndexBuildNode(): single_level_wildcard(0) {}
+
+    std::map<std::string, size_t> children;
+    size_t single_level_wildcard;   // 0 if there's none, the root is never a child
+    std::vector<uint32_t> exact;
+    std::vector<uint32_t> multi_level;
+};
+
+}
+
+namespace PicoMQTT {
+
+uint32_t TopicTokens::get_head_key(const char * data, size_t size) {
+    uint32_t key = 0;
+    memcpy(&key, data, size < sizeof(key) ? size : sizeof(key));
+    return key;
+}
+
+uint32_t TopicTokens::get_tail_key(const char * data, size_t size) {
+    if (size <= sizeof(uint32_t)) {
+        return get_head_key(data, size);
+    }
+    return get_head_key(data + size - sizeof(uint32_t), sizeof(uint32_t));
+}
+
+TopicTokens::TopicTokens(const char * topic): TopicTokens(topic, strlen(topic)) {
+}
+
+TopicTokens::TopicTokens(const char * topic, size_t length)
+    : topic(topic), length(length), count(0), levels(inline_levels) {
+
+    size_t level_begin = 0;
+    size_t pos = 0;
+
+    // scan whole words
+    for (; pos + sizeof(Word) <= length; pos += sizeof(Word)) {
+        Word word;
+        memcpy(&word, topic + pos, sizeof(word));
+        for (Word mask = find_slashes(word); mask; mask = clear_first_byte(mask)) {
+            const size_t slash = pos + first_byte_index(mask);
+            add_level(level_begin, slash);
+            level_begin = slash + 1;
+        }
+    }
+
+    // scan the tail, padded with zeros
+    if (pos < length) {
+        Word word = 0;
+        memcpy(&word, topic + pos, length - pos);
+        for (Word mask = find_slashes(word); mask; mask = clear_first_byte(mask)) {
+            const size_t slash = pos + first_byte_index(mask);
+            add_level(level_begin, slash);
+            level_begin = slash + 1;
+        }
+    }
+
+    add_level(level_begin, length);
+}
+
+void TopicTokens::add_level(size_t begin, size_t end) {
+    const size_t size = end - begin;
+    const Level level = {(uint16_t) begin, (uint16_t) size,
+                         get_head_key(topic + begin, size), get_tail_key(topic + begin, size)
+                        };
+
+    if (count < sizeof(inline_levels) / sizeof(inline_levels[0])) {
+        inline_levels[count++] = level;
+        return;
+    }
+
+    // rare case: deep topic, move to the heap
+    if (extra_levels.empty()) {
+        extra_levels.assign(inline_levels, inline_levels + count);
+    }
+    extra_levels.push_back(level);
+    levels = extra_levels.data();
+    ++count;
+}
+
+void TopicFilterSet::add(const char * topic_filter, Id id) {
+    const size_t filter_size = strlen(topic_filter);
+
+    Filter filter;
+    filter.first_level = levels.size();
+    filter.level_count = 0;
+    filter.multi_level = false;
+    filter.pool_offset = pool.size();
+    filter.id = id;
+
+    pool.insert(pool.end(), topic_filter, topic_filter + filter_size + 1);
+    const char * stored = pool.data() + filter.pool_offset;
+
+    size_t begin = 0;
+    while (true) {
+        const char * end_ptr = (const char *) memchr(stored + begin, '/', filter_size - begin);
+        const size_t end = end_ptr ? (size_t)(end_ptr - stored) : filter_size;
+        const size_t size = end - begin;
+
+        if (!end_ptr && size == 1 && stored[begin] == '#') {
+            filter.multi_level = true;
+            break;
+        }
+
+        Level level;
+        level.head = TopicTokens::get_head_key(stored + begin, size);
+        level.tail = TopicTokens::get_tail_key(stored + begin, size);
+        level.offset = filter.pool_offset + begin;
+        level.size = size;
+        level.type = (size == 1 && stored[begin] == '+') ? SINGLE_LEVEL_WILDCARD : LITERAL;
+        levels.push_back(level);
+        ++filter.level_count;
+
+        if (!end_ptr) {
+            break;
+        }
+        begin = end + 1;
+    }
+
+    filters.push_back(filter);
+}
+
+void TopicFilterSet::clear() {
+    pool.clear();
+    levels.clear();
+    filters.clear();
+}
+
+void TopicFilterSet::reserve(size_t filter_count, size_t total_size) {
+    filters.reserve(filter_count);
+    pool.reserve(total_size + filter_count);
+}
+
+void TopicFilterSet::shrink_to_fit() {
+    pool.shrink_to_fit();
+    levels.shrink_to_fit();
+    filters.shrink_to_fit();
+}
+
+size_t TopicFilterSet::get_memory_usage() const {
+    return pool.capacity() * sizeof(pool[0])
+           + levels.capacity() * sizeof(levels[0])
+           + filters.capacity() * sizeof(filters[0]);
+}
+
+bool TopicFilterSet::matches(size_t index, const TopicTokens & topic) const {
+    const Filter & filter = filters[index];
+    const size_t topic_levels = topic.get_level_count();
+
+    if (filter.multi_level) {
+        // The '#' needs a non-empty remainder of the topic
+        if (topic_levels <= filter.level_count) {
+            return false;
+        }
+        if ((topic_levels == filter.level_count + 1u) && !topic.get_level(filter.level_count).size) {
+            return false;
+        }
+    } else if (topic_levels != filter.level_count) {
+        return false;
+    }
+
+    // Compare the last levels first -- topics sharing a filter set usually differ at the end rather than at the
+    // beginning (e.g. device/+/temperature vs device/+/humidity).
+    const Level * level = levels.data() + filter.first_level + filter.level_count;
+    for (size_t i = filter.level_count; i--; ) {
+        --level;
+        if (level->type == SINGLE_LEVEL_WILDCARD) {
+            continue;
+        }
+        const TopicTokens::Level & topic_level = topic.get_level(i);
+        if ((topic_level.size != level->size) || (topic_level.head != level->head) || (topic_level.tail != level->tail)) {
+            return false;
+        }
+        if ((level->size > 2 * sizeof(level->head))
+                && memcmp(pool.data() + level->offset + sizeof(level->head),
+                          topic.get_topic() + topic_level.offset + sizeof(level->head),
+                          level->size - 2 * sizeof(level->head))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t TopicFilterSet::match(const TopicTokens & topic, Bitmap & bitmap) const {
+    bitmap.assign((filters.size() + 31) / 32, 0);
+    size_t ret = 0;
+    for (size_t i = 0; i < filters.size(); ++i) {
+        if (matches(i, topic)) {
+            bitmap[i / 32] |= uint32_t(1) << (i % 32);
+            ++ret;
+        }
+    }
+    return ret;
+}
+
+int TopicFilterSet::find_first(const TopicTokens & topic) const {
+    for (size_t i = 0; i < filters.size(); ++i) {
+        if (matches(i, topic)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void TopicFilterIndex::build(const TopicFilterSet & filters) {
+    clear();
+
+    // build a pointer based trie first
+    std::vector<IndexBuildNode> tree(1);
+
+    for (size_t index = 0; index < filters.size(); ++index) {
+        const char * begin = filters.get_filter(index);
+        size_t node = 0;
+        while (true) {
+            const char * end = strchr(begin, '/');
+            if (!end) {
+                end = begin + strlen(begin);
+            }
+            const std::string level(begin, end);
+
+            if (!*end && (level == "#")) {
+                tree[node].multi_level.push_back(index);
+                break;
+            }
+
+            size_t child;
+            if (level == "+") {
+                child = tree[node].single_level_wildcard;
+                if (!child) {
+                    child = tree.size();
+                    tree.emplace_back();
+                    tree[node].single_level_wildcard = child;
+                }
+            } else {
+                auto it = tree[node].children.find(level);
+                if (it == tree[node].children.end()) {
+                    child = tree.size();
+                    tree.emplace_back();
+                    tree[node].children[level] = child;
+                } else {
+                    child = it->second;
+                }
+            }
+            node = child;
+
+            if (!*end) {
+                tree[node].exact.push_back(index);
+                break;
+            }
+            begin = end + 1;
+        }
+    }
+
+    // flatten it breadth first, so that the edges of each node are contiguous and sorted
+    std::vector<uint32_t> flat_index(tree.size());
+    std::deque<size_t> queue = {0};
+    nodes.resize(tree.size());
+    uint32_t next_index = 1;
+
+    while (!queue.empty()) {
+        const IndexBuildNode & source = tree[queue.front()];
+        Node & target = nodes[flat_index[queue.front()]];
+        queue.pop_front();
+
+        target.first_value = values.size();
+        target.exact_count = source.exact.size();
+        target.multi_level_count = source.multi_level.size();
+        values.insert(values.end(), source.exact.begin(), source.exact.end());
+        values.insert(values.end(), source.multi_level.begin(), source.multi_level.end());
+
+        target.single_level_wildcard = -1;
+        if (source.single_level_wildcard) {
+            flat_index[source.single_level_wildcard] = next_index;
+            target.single_level_wildcard = next_index++;
+            queue.push_back(source.single_level_wildcard);
+        }
+
+        target.first_edge = edges.size();
+        target.edge_count = source.children.size();
+        for (const auto & kv : source.children) {
+            flat_index[kv.second] = next_index;
+            Edge edge;
+            edge.size = kv.first.size();
+            edge.head = TopicTokens::get_head_key(kv.first.data(), kv.first.size());
+            edge.tail = TopicTokens::get_tail_key(kv.first.data(), kv.first.size());
+            edge.offset = pool.size();
+            edge.node = next_index++;
+            pool.insert(pool.end(), kv.first.begin(), kv.first.end());
+            edges.push_back(edge);
+            queue.push_back(kv.second);
+        }
+
+        std::sort(edges.begin() + target.first_edge, edges.end(), [](const Edge & a, const Edge & b) {
+            if (a.size != b.size) {
+                return a.size < b.size;
+            }
+            if (a.head != b.head) {
+                return a.head < b.head;
+            }
+            return a.tail < b.tail;
+        });
+    }
+}
+
+void TopicFilterIndex::clear() {
+    nodes.clear();
+    edges.clear();
+    values.clear();
+    pool.clear();
+}
+
+size_t TopicFilterIndex::get_memory_usage() const {
+    return nodes.capacity() * sizeof(nodes[0]) + edges.capacity() * sizeof(edges[0])
+           + values.capacity() * sizeof(values[0]) + pool.capacity();
+}
+
+int32_t TopicFilterIndex::find_edge(const Node & node, const TopicTokens & topic, size_t level) const {
+    const TopicTokens::Level & key = topic.get_level(level);
+    const Edge * begin = edges.data() + node.first_edge;
+    const Edge * end = begin + node.edge_count;
+
+    const Edge * edge = std::lower_bound(begin, end, key, [](const Edge & edge, const TopicTokens::Level & key) {
+        if (edge.size != key.size) {
+            return edge.size < key.size;
+        }
+        if (edge.head != key.head) {
+            return edge.head < key.head;
+        }
+        return edge.tail < key.tail;
+    });
+
+    // levels longer than 8 bytes may have equal keys
+    for (; (edge != end) && (edge->size == key.size) && (edge->head == key.head) && (edge->tail == key.tail); ++edge) {
+        if ((key.size <= 2 * sizeof(key.head))
+                || !memcmp(pool.data() + edge->offset + sizeof(key.head),
+                           topic.get_level_data(level) + sizeof(key.head),
+                           key.size - 2 * sizeof(key.head))) {
+            return edge->node;
+        }
+    }
+
+    return -1;
+}
+
+void TopicFilterIndex::match(uint32_t index, const TopicTokens & topic, size_t level,
+                             std::vector<uint32_t> & matches) const {
+    const Node & node = nodes[index];
+    const size_t count = topic.get_level_count();
+    const uint32_t * node_values = values.data() + node.first_value;
+
+    // '#' needs a non-empty remainder of the topic
+    if (node.multi_level_count && (level < count) && ((level + 1 < count) || topic.get_level(level).size)) {
+        matches.insert(matches.end(), node_values + node.exact_count,
+                       node_values + node.exact_count + node.multi_level_count);
+    }
+
+    if (level == count) {
+        matches.insert(matches.end(), node_values, node_values + node.exact_count);
+        return;
+    }
+
+    const int32_t child = find_edge(node, topic, level);
+    if (child >= 0) {
+        match(child, topic, level + 1, matches);
+    }
+
+    if (node.single_level_wildcard >= 0) {
+        match(node.single_level_wildcard, topic, level + 1, matches);
+    }
+}
+
+size_t TopicFilterIndex::match(const TopicTokens & topic, std::vector<uint32_t> & matches) const {
+    const size_t begin = matches.size();
+    if (!nodes.empty()) {
+        match(0, topic, 0, matches);
+    }
+    std::sort(matches.begin() + begin, matches.end());
+    return matches.size() - begin;
+}
+
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PicoMQTT {
+
+/*
+ * A topic split into levels.  Level boundaries are found by scanning for '/' one machine word at a time, so
+ * tokenizing costs roughly length / sizeof(word) steps.  The topic string must outlive the object.
+ */
+class TopicTokens {
+    public:
+        // The head and tail keys are the first and last (up to) 4 bytes of the level.  Levels of equal size up to
+        // 8 bytes long are equal if and only if their keys are equal.
+        struct Level {
+            uint16_t offset;
+            uint16_t size;
+            uint32_t head;
+            uint32_t tail;
+        };
+
+        TopicTokens(const char * topic);
+        TopicTokens(const char * topic, size_t length);
+
+        TopicTokens(const TopicTokens &) = delete;
+        const TopicTokens & operator=(const TopicTokens &) = delete;
+
+        const char * get_topic() const { return topic; }
+        size_t get_length() const { return length; }
+        size_t get_level_count() const { return count; }
+        const Level & get_level(size_t index) const { return levels[index]; }
+        const char * get_level_data(size_t index) const { return topic + levels[index].offset; }
+
+        static uint32_t get_head_key(const char * data, size_t size);
+        static uint32_t get_tail_key(const char * data, size_t size);
+
+    protected:
+        void add_level(size_t begin, size_t end);
+
+        const char * topic;
+        size_t length;
+        size_t count;
+        Level * levels;
+
+        Level inline_levels[16];
+        std::vector<Level> extra_levels;
+};
+
+/*
+ * A contiguous set of compiled topic filters.  A topic is tokenized once and then evaluated against all filters in
+ * a single pass.
+ *
+ * The matching rules are the same as in Subscriber::topic_matches() for valid filters: '+' matches exactly one
+ * (possibly empty) level, '#' must be the last level and matches the remainder of the topic, if it's not empty.
+ * Wildcard characters which don't occupy a whole level are treated as literals.
+ */
+class TopicFilterSet {
+    public:
+        typedef unsigned int Id;
+        typedef std::vector<uint32_t> Bitmap;
+
+        TopicFilterSet() {}
+
+        void add(const char * topic_filter, Id id = 0);
+        void clear();
+        void reserve(size_t filter_count, size_t total_size);
+        // Releases unused capacity
+        void shrink_to_fit();
+
+        size_t size() const { return filters.size(); }
+        bool empty() const { return filters.empty(); }
+        size_t get_memory_usage() const;
+
+        const char * get_filter(size_t index) const { return pool.data() + filters[index].pool_offset; }
+        Id get_id(size_t index) const { return filters[index].id; }
+
+        bool matches(size_t index, const TopicTokens & topic) const;
+
+        // Sets bit i of the bitmap (bitmap[i / 32] & (1 << (i % 32))) for every filter i matching the topic.
+        // Returns the number of matching filters.
+        size_t match(const TopicTokens & topic, Bitmap & bitmap) const;
+
+        // Returns the index of the first matching filter or -1 if there's no match.
+        int find_first(const TopicTokens & topic) const;
+
+    protected:
+        enum LevelType : uint8_t {
+            LITERAL,
+            SINGLE_LEVEL_WILDCARD,
+        };
+
+        struct Level {
+            uint32_t head;
+            uint32_t tail;
+            uint32_t offset;
+            uint16_t size;
+            LevelType type;
+        };
+
+        struct Filter {
+            uint32_t first_level;
+            uint16_t level_count;       // not including the trailing '#'
+            bool multi_level;           // ends with '#'
+            uint32_t pool_offset;
+            Id id;
+        };
+
+        std::vector<char> pool;
+        std::vector<Level> levels;
+        std::vector<Filter> filters;
+};
+
+/*
+ * A trie built from the filters of a TopicFilterSet, which finds all filters matching a topic in time proportional
+ * to the number of topic levels (and wildcard branches taken) instead of the number of filters.  Uses the same
+ * matching rules as TopicFilterSet.  The index doesn't refer to the set, it has to be rebuilt when the set changes.
+ */
+class TopicFilterIndex {
+    public:
+        TopicFilterIndex() {}
+
+        void build(const TopicFilterSet & filters);
+        void clear();
+        size_t get_memory_usage() const;
+
+        // Appends the indices (in the TopicFilterSet) of all filters matching the topic to matches, in ascending
+        // order.  Returns the number of matching filters.
+        size_t match(const TopicTokens & topic, std::vector<uint32_t> & matches) const;
+
+    protected:
+        struct Node {
+            uint32_t first_edge;
+            uint32_t first_value;
+            int32_t single_level_wildcard;  // -1 if there's none
+            uint16_t edge_count;
+            uint16_t exact_count;           // filters ending at this node
+            uint16_t multi_level_count;     // filters ending with '#' at this node, stored after the exact ones
+        };
+
+        struct Edge {
+            uint32_t head;
+            uint32_t tail;
+            uint32_t offset;
+            uint32_t node;
+            uint16_t size;
+        };
+
+        int32_t find_edge(const Node & node, const TopicTokens & topic, size_t level) const;
+        void match(uint32_t index, const TopicTokens & topic, size_t level, std::vector<uint32_t> & matches) const;
+
+        std::vector<Node> nodes;
+        std::vector<Edge> edges;
+        std::vector<uint32_t> values;
+        std::vector<char> pool;
+};
+
+}
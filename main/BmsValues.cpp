@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "BmsValues.h"
+
+// CBOR major types
+#define CBOR_UNSIGNED       0
+#define CBOR_NEGATIVE       1
+#define CBOR_BYTES          2
+#define CBOR_TEXT           3
+#define CBOR_ARRAY          4
+#define CBOR_MAP            5
+#define CBOR_TAG            6
+#define CBOR_SIMPLE         7
+
+// Nesting of skipped values
+#define CBOR_MAX_DEPTH      4
+
+static const char* _MetricNames[BmsValues::MetricCount] =
+{
+    "socofpack",
+    "voltageofpack",
+    "currentofpack",
+    "cellvmax",
+    "celltmax",
+    "cellvmin",
+    "celltmin",
+    "bmschstate",
+    "bmsdschstate"
+};
+
+static float _HalfToFloat(uint16_t half)
+{
+    const int exponent = (half >> 10) & 0x1f;
+    const int mantissa = half & 0x3ff;
+    float value;
+    if (exponent == 0)
+        value = ldexpf(mantissa, -24);
+    else if (exponent == 0x1f)
+        value = mantissa ? NAN : INFINITY;
+    else
+        value = ldexpf(mantissa + 1024, exponent - 25);
+    return (half & 0x8000) ? -value : value;
+}
+
+const char* BmsValues::GetName(Metric metric)
+{
+    return _MetricNames[metric];
+}
+
+bool BmsValues::IsPackedTopic(const char* topic)
+{
+    const size_t topicSize = strlen(topic);
+    const size_t prefixSize = topicSize - (sizeof(BMS_PACKED_TOPIC_NAME) - 1);
+    return topicSize >= sizeof(BMS_PACKED_TOPIC_NAME) && topic[prefixSize - 1] == '/'
+        && strcmp(topic + prefixSize, BMS_PACKED_TOPIC_NAME) == 0;
+}
+
+void BmsValues::GetMetricTopic(const char* packedTopic, Metric metric, char* buffer, size_t size)
+{
+    const size_t prefixSize = strlen(packedTopic) - (sizeof(BMS_PACKED_TOPIC_NAME) - 1);
+    snprintf(buffer, size, "%.*s%s", (int)prefixSize, packedTopic, _MetricNames[metric]);
+}
+
+void BmsValues::Set(Metric metric, float value)
+{
+    _Values[metric] = value;
+    _Present |= 1 << metric;
+}
+
+bool BmsValues::_ReadHead(Stream& stream, uint8_t& major, uint8_t& info, uint64_t& argument)
+{
+    const int initial = stream.read();
+    if (initial < 0)
+        return false;
+
+    major = initial >> 5;
+    info = initial & 0x1f;
+    if (info < 24)
+    {
+        argument = info;
+        return true;
+    }
+    if (info > 27)
+        return false;   // indefinite lengths are not supported
+
+    argument = 0;
+    for (int i = 0; i < (1 << (info - 24)); ++i)
+    {
+        const int value = stream.read();
+        if (value < 0)
+            return false;
+        argument = (argument << 8) | value;
+    }
+    return true;
+}
+
+bool BmsValues::_SkipBytes(Stream& stream, uint64_t size)
+{
+    for (; size > 0; --size)
+    {
+        if (stream.read() < 0)
+            return false;
+    }
+    return true;
+}
+
+bool BmsValues::_Skip(Stream& stream, uint8_t major, uint8_t info, uint64_t argument, int depth)
+{
+    switch (major)
+    {
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+        return _SkipBytes(stream, argument);
+
+    case CBOR_ARRAY:
+    case CBOR_MAP:
+    case CBOR_TAG:
+    {
+        if (depth >= CBOR_MAX_DEPTH)
+            return false;
+        const uint64_t items = major == CBOR_MAP ? argument * 2 : major == CBOR_ARRAY ? argument : 1;
+        for (uint64_t i = 0; i < items; ++i)
+        {
+            uint8_t itemMajor, itemInfo;
+            uint64_t itemArgument;
+            if (!_ReadHead(stream, itemMajor, itemInfo, itemArgument)
+                || !_Skip(stream, itemMajor, itemInfo, itemArgument, depth + 1))
+                return false;
+        }
+        return true;
+    }
+
+    default:
+        // the argument was the whole item
+        return true;
+    }
+}
+
+bool BmsValues::_ReadNumber(Stream& stream, float& value, bool& isNumber)
+{
+    uint8_t major, info;
+    uint64_t argument;
+    if (!_ReadHead(stream, major, info, argument))
+        return false;
+
+    isNumber = true;
+    switch (major)
+    {
+    case CBOR_UNSIGNED:
+        value = (float)argument;
+        return true;
+
+    case CBOR_NEGATIVE:
+        value = -1.0f - (float)argument;
+        return true;
+
+    case CBOR_SIMPLE:
+        if (info == 25)
+        {
+            value = _HalfToFloat((uint16_t)argument);
+            return true;
+        }
+        if (info == 26)
+        {
+            const uint32_t bits = (uint32_t)argument;
+            memcpy(&value, &bits, sizeof(value));
+            return true;
+        }
+        if (info == 27)
+        {
+            double doubleValue;
+            memcpy(&doubleValue, &argument, sizeof(doubleValue));
+            value = (float)doubleValue;
+            return true;
+        }
+        if (info == 20 || info == 21)
+        {
+            // false, true
+            value = info - 20;
+            return true;
+        }
+        break;
+    }
+
+    isNumber = false;
+    return _Skip(stream, major, info, argument, 0);
+}
+
+bool BmsValues::Decode(Stream& stream)
+{
+    uint8_t major, info;
+    uint64_t count;
+    if (!_ReadHead(stream, major, info, count))
+        return false;
+
+    if (major == CBOR_ARRAY)
+    {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            float value;
+            bool isNumber;
+            if (!_ReadNumber(stream, value, isNumber))
+                return false;
+            if (isNumber && i < MetricCount)
+                Set((Metric)i, value);
+        }
+        return true;
+    }
+
+    if (major != CBOR_MAP)
+        return false;
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint8_t keyMajor, keyInfo;
+        uint64_t key;
+        if (!_ReadHead(stream, keyMajor, keyInfo, key))
+            return false;
+
+        int metric = -1;
+        if (keyMajor == CBOR_UNSIGNED)
+        {
+            metric = key < MetricCount ? (int)key : -1;
+        }
+        else if (keyMajor == CBOR_TEXT)
+        {
+            // names are short, longer keys can't match
+            char name[16];
+            if (key < sizeof(name))
+            {
+                for (size_t c = 0; c < key; ++c)
+                {
+                    const int value = stream.read();
+                    if (value < 0)
+                        return false;
+                    name[c] = value;
+                }
+                name[key] = '\0';
+                for (int m = 0; m < MetricCount && metric < 0; ++m)
+                {
+                    if (strcmp(name, _MetricNames[m]) == 0)
+                        metric = m;
+                }
+            }
+            else if (!_SkipBytes(stream, key))
+            {
+                return false;
+            }
+        }
+        else if (!_Skip(stream, keyMajor, keyInfo, key, 0))
+        {
+            return false;
+        }
+
+        float value;
+        bool isNumber;
+        if (!_ReadNumber(stream, value, isNumber))
+            return false;
+        if (isNumber && metric >= 0)
+            Set((Metric)metric, value);
+    }
+    return true;
+}
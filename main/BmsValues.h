@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <Arduino.h>
+
+// Topic with all metrics of a pack in one message, next to the per-metric topics emkit/<...>/<metric name>
+#define BMS_PACKED_TOPIC_NAME       "bms"
+
+// Metrics of one BMS cycle of a pack.
+//
+// Publishers can send all of them in one message to emkit/<...>/bms instead of one message per metric.  The payload
+// is CBOR, either a map from metric names (or their indices in Metric) to numbers, e.g.
+// {"socofpack": 87, "voltageofpack": 53.2, ...}, or an array of numbers in the order of Metric.  Missing metrics are
+// left unset, unknown keys and values which are not numbers are skipped.
+class BmsValues
+{
+public:
+    enum Metric : uint8_t
+    {
+        SocOfPack,
+        VoltageOfPack,
+        CurrentOfPack,
+        CellVMax,
+        CellTMax,
+        CellVMin,
+        CellTMin,
+        ChargeState,
+        DischargeState,
+        MetricCount
+    };
+
+    BmsValues() : _Present(0) {}
+
+    // Name of the per-metric topic, e.g. "socofpack"
+    static const char* GetName(Metric metric);
+
+    // True for emkit/<...>/bms
+    static bool IsPackedTopic(const char* topic);
+    // Per-metric topic next to the packed one, e.g. emkit/1/2/socofpack for emkit/1/2/bms
+    static void GetMetricTopic(const char* packedTopic, Metric metric, char* buffer, size_t size);
+
+    bool Has(Metric metric) const { return _Present & (1 << metric); }
+    float Get(Metric metric) const { return _Values[metric]; }
+    void Set(Metric metric, float value);
+
+    // Decodes the CBOR payload in a single pass over the stream, without allocating.  Returns false if it's not
+    // valid CBOR (values decoded up to the error stay set).
+    bool Decode(Stream& stream);
+
+private:
+    float _Values[MetricCount];
+    uint16_t _Present;
+
+    static bool _ReadHead(Stream& stream, uint8_t& major, uint8_t& info, uint64_t& argument);
+    static bool _ReadNumber(Stream& stream, float& value, bool& isNumber);
+    static bool _Skip(Stream& stream, uint8_t major, uint8_t info, uint64_t argument, int depth);
+    static bool _SkipBytes(Stream& stream, uint64_t size);
+};
@@ -0,0 +1,52 @@
+#include "esp_log.h"
+#include "FlashPartitionStorage.h"
+
+static const char *TAG = "FlashPartitionStorage";
+
+FlashPartitionStorage::FlashPartitionStorage(const char* label)
+    : _Label(label), _Partition(NULL)
+{
+}
+
+bool FlashPartitionStorage::Begin()
+{
+    // Found by label only, the subtype in partitions.csv doesn't matter
+    _Partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, _Label);
+    if (_Partition == NULL)
+    {
+        ESP_LOGE(TAG, "Partition '%s' not found", _Label);
+        return false;
+    }
+    return true;
+}
+
+size_t FlashPartitionStorage::get_size() const
+{
+    return _Partition != NULL ? _Partition->size : 0;
+}
+
+size_t FlashPartitionStorage::get_sector_size() const
+{
+    return _Partition != NULL ? _Partition->erase_size : 0;
+}
+
+bool FlashPartitionStorage::read(size_t offset, void* buffer, size_t size)
+{
+    return esp_partition_read(_Partition, offset, buffer, size) == ESP_OK;
+}
+
+bool FlashPartitionStorage::write(size_t offset, const void* data, size_t size)
+{
+    auto ret = esp_partition_write(_Partition, offset, data, size);
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "Write of %u bytes at 0x%x failed: %s", (unsigned)size, (unsigned)offset, esp_err_to_name(ret));
+    return ret == ESP_OK;
+}
+
+bool FlashPartitionStorage::erase_sector(size_t offset)
+{
+    auto ret = esp_partition_erase_range(_Partition, offset, _Partition->erase_size);
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "Erase at 0x%x failed: %s", (unsigned)offset, esp_err_to_name(ret));
+    return ret == ESP_OK;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "esp_partition.h"
+
+#include "PicoMQTT/journal.h"
+
+// Journal storage on a data partition of the SPI flash, found by its label
+class FlashPartitionStorage : public PicoMQTT::Journal::Storage
+{
+public:
+    FlashPartitionStorage(const char* label);
+
+    // Finds the partition, the other methods may be called only if it's found
+    bool Begin();
+
+    virtual size_t get_size() const override;
+    virtual size_t get_sector_size() const override;
+    virtual bool read(size_t offset, void* buffer, size_t size) override;
+    virtual bool write(size_t offset, const void* data, size_t size) override;
+    virtual bool erase_sector(size_t offset) override;
+
+private:
+    const char* _Label;
+    const esp_partition_t* _Partition;
+};
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include "esp_log.h"
+#include "MqttAggregation.h"
+
+static const char *TAG = "MqttAggregation";
+
+MqttAggregation::MqttAggregation(PicoMQTT::Server& broker)
+    : _Broker(broker), _Aggregator(MQTT_AGGREGATION_MAX_KEYS)
+{
+    _Aggregator.publish_callback = [this](const char* topic, float value)
+    {
+        char payload[16];
+        snprintf(payload, sizeof(payload), "%g", value);
+        _Broker.publish(topic, payload);
+    };
+}
+
+bool MqttAggregation::Add(const char* expression)
+{
+    if (!_Aggregator.add(expression))
+    {
+        ESP_LOGE(TAG, "Invalid rule '%s'", expression);
+        return false;
+    }
+    return true;
+}
+
+void MqttAggregation::OnMessage(const char* topic, const char* payload)
+{
+    if (_Aggregator.get_rule_count() > 0)
+        _Aggregator.ingest(topic, payload, millis());
+}
+
+void MqttAggregation::OnValue(const char* topic, float value)
+{
+    if (_Aggregator.get_rule_count() > 0)
+        _Aggregator.ingest(topic, value, millis());
+}
+
+void MqttAggregation::Loop()
+{
+    _Aggregator.loop(millis());
+}
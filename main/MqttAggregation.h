@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <Arduino.h>
+#include "PicoMQTT.h"
+#include "PicoMQTT/aggregator.h"
+
+// Max keys (e.g. packs) aggregated separately per rule
+#define MQTT_AGGREGATION_MAX_KEYS       8
+
+// Windowed aggregates computed by the broker (see PicoMQTT::Aggregator), so consumers which only need e.g. the 10 s
+// average of a metric subscribe to "<topic>/avg/10s" instead of the raw stream.
+//
+// All methods run in the broker task.
+class MqttAggregation
+{
+public:
+    MqttAggregation(PicoMQTT::Server& broker);
+
+    // Rule like "avg(emkit/+/+/currentofpack, 10s)"
+    bool Add(const char* expression);
+
+    // Called by the broker for every message with the payload in memory
+    void OnMessage(const char* topic, const char* payload);
+    // Called by the broker for every metric of a packed message, see BmsValues
+    void OnValue(const char* topic, float value);
+    // Called by the main loop, publishes the windows which ended
+    void Loop();
+
+    const PicoMQTT::Aggregator::Stats& GetStats() const { return _Aggregator.get_stats(); }
+    size_t GetMemoryUsage() const { return _Aggregator.get_memory_usage(); }
+
+private:
+    PicoMQTT::Server& _Broker;
+    PicoMQTT::Aggregator _Aggregator;
+};
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include "esp_log.h"
+#include "MqttAlarms.h"
+
+static const char *TAG = "MqttAlarms";
+
+MqttAlarms::MqttAlarms(PicoMQTT::Server& broker)
+    : _Broker(broker), _Engine(MQTT_ALARMS_MAX_KEYS)
+{
+    _Engine.event_callback = [this](const char* name, const char* topic, bool active, float value)
+    {
+        if (active)
+            ESP_LOGW(TAG, "%s: %s = %g", name, topic, value);
+        else
+            ESP_LOGI(TAG, "%s cleared: %s = %g", name, topic, value);
+
+        char eventTopic[sizeof(MQTT_ALARMS_TOPIC) + PICOMQTT_MAX_TOPIC_SIZE];
+        snprintf(eventTopic, sizeof(eventTopic), MQTT_ALARMS_TOPIC "%s/%s", name, topic);
+        char payload[24];
+        snprintf(payload, sizeof(payload), "%s %g", active ? "alarm" : "clear", value);
+        _Broker.publish(eventTopic, payload);
+    };
+}
+
+bool MqttAlarms::Add(const MqttAlarmRule& rule)
+{
+    if (!_Engine.add(rule.Name, rule.TopicFilter, rule.Condition))
+    {
+        ESP_LOGE(TAG, "Invalid rule %s: '%s'", rule.Name, rule.Condition);
+        return false;
+    }
+    return true;
+}
+
+void MqttAlarms::OnMessage(const char* topic, const char* payload)
+{
+    if (_Engine.get_rule_count() > 0)
+        _Engine.ingest(topic, payload, millis());
+}
+
+void MqttAlarms::OnValue(const char* topic, float value)
+{
+    if (_Engine.get_rule_count() > 0)
+        _Engine.ingest(topic, value, millis());
+}
+
+void MqttAlarms::Loop()
+{
+    _Engine.loop(millis());
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <Arduino.h>
+#include "PicoMQTT.h"
+#include "PicoMQTT/rule_engine.h"
+
+// Events are published to MQTT_ALARMS_TOPIC<rule name>/<topic of the message>
+#define MQTT_ALARMS_TOPIC               "alarms/"
+
+// Max keys (e.g. packs) per topic filter
+#define MQTT_ALARMS_MAX_KEYS            8
+
+struct MqttAlarmRule
+{
+    const char* Name;
+    const char* TopicFilter;
+    const char* Condition;      // e.g. "value > 3.65" or "value == 6 for 5s", see PicoMQTT::RuleEngine
+};
+
+// Alarms evaluated by the broker on every matching message, so they work without a dashboard connected.  When a
+// rule's condition becomes true, "alarm <value>" is published to alarms/<rule name>/<topic>, when it becomes false
+// again, "clear <value>".
+//
+// All methods run in the broker task.
+class MqttAlarms
+{
+public:
+    MqttAlarms(PicoMQTT::Server& broker);
+
+    bool Add(const MqttAlarmRule& rule);
+
+    // Called by the broker for every message with the payload in memory
+    void OnMessage(const char* topic, const char* payload);
+    // Called by the broker for every metric of a packed message, see BmsValues
+    void OnValue(const char* topic, float value);
+    // Called by the main loop, raises alarms whose hold time expired
+    void Loop();
+
+    size_t GetRuleCount() const { return _Engine.get_rule_count(); }
+    const PicoMQTT::RuleEngine::Stats& GetStats() const { return _Engine.get_stats(); }
+    size_t GetMemoryUsage() const { return _Engine.get_memory_usage(); }
+
+private:
+    PicoMQTT::Server& _Broker;
+    PicoMQTT::RuleEngine _Engine;
+};
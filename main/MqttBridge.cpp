@@ -0,0 +1,340 @@
+#include <string.h>
+#include "esp_log.h"
+#include "MqttBridge.h"
+
+static const char *TAG = "MqttBridge";
+
+MqttBridge::Uplink::Uplink(MqttBridge& bridge)
+    : PicoMQTT::Client(), _Bridge(bridge)
+{
+}
+
+bool MqttBridge::Uplink::SendQos1(const uint8_t* record, size_t size, uint16_t messageId, bool dup)
+{
+    if (!connected())
+        return false;
+
+    const size_t topicSize = (record[0] << 8) | record[1];
+    const char* topic = (const char*)record + 2;
+    const uint8_t* payload = record + 2 + topicSize;
+    const size_t payloadSize = size - 2 - topicSize;
+
+    // Publish directly on the socket, on_publish_complete() does not wait for the PUBACK
+    Publish publish(*this, client, topic, topicSize, payloadSize, 1, false, dup, messageId);
+    publish.write(payload, payloadSize);
+    return publish.send();
+}
+
+void MqttBridge::Uplink::handle_packet(PicoMQTT::IncomingPacket& packet)
+{
+    if (packet.get_type() == PicoMQTT::Packet::PUBACK)
+    {
+        _Bridge._OnAck(packet.read_u16());
+        return;
+    }
+    PicoMQTT::Client::handle_packet(packet);
+}
+
+MqttBridge::MqttBridge()
+    : _Port(1883), _Uplink(*this), _ParseState(ParseState::Idle), _Remaining(0), _LengthShift(0), _StagedSize(0),
+      _Head(0), _Tail(0), _InFlightCount(0), _SendCursor(0), _WasConnected(false)
+{
+}
+
+bool MqttBridge::Configure(const char* settings)
+{
+    _Host = "";
+    _Port = 1883;
+    _Filters.clear();
+
+    if (settings == NULL || settings[0] == 0)
+        return false;
+
+    const char* filters = strchr(settings, ';');
+    const size_t addressSize = filters ? (size_t)(filters - settings) : strlen(settings);
+    const char* colon = (const char*)memchr(settings, ':', addressSize);
+
+    _Host.concat(settings, colon ? (size_t)(colon - settings) : addressSize);
+    if (colon)
+        _Port = atoi(colon + 1);
+
+    if (filters)
+    {
+        char filter[PICOMQTT_MAX_TOPIC_SIZE + 1];
+        const char* begin = filters + 1;
+        while (*begin && _Filters.size() < MQTT_BRIDGE_MAX_FILTERS)
+        {
+            const char* end = strchr(begin, ',');
+            const size_t size = end ? (size_t)(end - begin) : strlen(begin);
+            if (size && size < sizeof(filter))
+            {
+                memcpy(filter, begin, size);
+                filter[size] = 0;
+                _Filters.add(filter);
+            }
+            if (!end)
+                break;
+            begin = end + 1;
+        }
+    }
+
+    if (_Filters.empty())
+        _Filters.add(MQTT_BRIDGE_DEFAULT_FILTER);
+
+    ESP_LOGI(TAG, "Uplink %s:%u, %u filters", _Host.c_str(), _Port, (unsigned)_Filters.size());
+
+    _Uplink.host = _Host;
+    _Uplink.port = _Port;
+    _Uplink.client_id = "bridge-";
+    _Uplink.client_id += String((uint32_t)ESP.getEfuseMac(), HEX);
+    return _Host.length() > 0;
+}
+
+void MqttBridge::Start(UBaseType_t priority, uint32_t stackSize)
+{
+    if (!IsConfigured())
+    {
+        ESP_LOGI(TAG, "Not configured");
+        return;
+    }
+
+    xTaskCreate([](void* arg) { ((MqttBridge*)arg)->_Task(); }, "mqtt_bridge", stackSize, this, priority, NULL);
+}
+
+bool MqttBridge::Matches(const PicoMQTT::TopicTokens& topic) const
+{
+    return IsConfigured() && _Filters.find_first(topic) >= 0;
+}
+
+void MqttBridge::BeginMessage()
+{
+    _ParseState = ParseState::Head;
+}
+
+size_t MqttBridge::write(uint8_t value)
+{
+    return write(&value, 1);
+}
+
+size_t MqttBridge::write(const uint8_t* buffer, size_t size)
+{
+    // Parses the PUBLISH packet the broker writes to all subscribers: fixed header, remaining length, body
+    for (size_t i = 0; i < size; )
+    {
+        switch (_ParseState)
+        {
+        case ParseState::Idle:
+            return size;
+
+        case ParseState::Head:
+            _Remaining = 0;
+            _LengthShift = 0;
+            _StagedSize = 0;
+            _ParseState = ParseState::Length;
+            ++i;
+            break;
+
+        case ParseState::Length:
+            _Remaining |= (size_t)(buffer[i] & 0x7f) << _LengthShift;
+            _LengthShift += 7;
+            if (!(buffer[i++] & 0x80))
+            {
+                if (_Remaining > sizeof(_Staging))
+                {
+                    _Stats.Oversized++;
+                    _ParseState = ParseState::Skip;
+                }
+                else
+                {
+                    _ParseState = ParseState::Body;
+                }
+            }
+            break;
+
+        case ParseState::Body:
+        {
+            const size_t chunk = size - i < _Remaining ? size - i : _Remaining;
+            memcpy(_Staging + _StagedSize, buffer + i, chunk);
+            _StagedSize += chunk;
+            _Remaining -= chunk;
+            i += chunk;
+            if (!_Remaining)
+            {
+                _Push();
+                _ParseState = ParseState::Idle;
+            }
+            break;
+        }
+
+        case ParseState::Skip:
+        {
+            const size_t chunk = size - i < _Remaining ? size - i : _Remaining;
+            _Remaining -= chunk;
+            i += chunk;
+            if (!_Remaining)
+                _ParseState = ParseState::Idle;
+            break;
+        }
+        }
+    }
+    return size;
+}
+
+bool MqttBridge::_Push()
+{
+    const size_t head = _Head.load(std::memory_order_acquire);
+    const size_t tail = _Tail.load(std::memory_order_relaxed);
+
+    if (_StagedSize + 2 > sizeof(_Queue) - (tail - head))
+    {
+        // keep the backlog, drop the newest message
+        _Stats.Dropped++;
+        return false;
+    }
+
+    uint8_t header[2] = { (uint8_t)(_StagedSize >> 8), (uint8_t)(_StagedSize & 0xff) };
+    for (size_t i = 0; i < 2; ++i)
+        _Queue[(tail + i) % sizeof(_Queue)] = header[i];
+
+    const size_t start = (tail + 2) % sizeof(_Queue);
+    const size_t first = _StagedSize < sizeof(_Queue) - start ? _StagedSize : sizeof(_Queue) - start;
+    memcpy(_Queue + start, _Staging, first);
+    memcpy(_Queue, _Staging + first, _StagedSize - first);
+
+    _Tail.store(tail + 2 + _StagedSize, std::memory_order_release);
+    _Stats.Enqueued++;
+    return true;
+}
+
+void MqttBridge::_ReadQueue(size_t offset, uint8_t* buffer, size_t size) const
+{
+    const size_t start = offset % sizeof(_Queue);
+    const size_t first = size < sizeof(_Queue) - start ? size : sizeof(_Queue) - start;
+    memcpy(buffer, _Queue + start, first);
+    memcpy(buffer + first, _Queue, size - first);
+}
+
+size_t MqttBridge::ReadRecord(size_t offset, uint8_t* buffer) const
+{
+    uint8_t header[2];
+    _ReadQueue(offset, header, 2);
+    const size_t size = (header[0] << 8) | header[1];
+    _ReadQueue(offset + 2, buffer, size);
+    return size;
+}
+
+bool MqttBridge::Restore(size_t offset, const uint8_t* record, size_t size)
+{
+    if (size > sizeof(_Staging))
+        return false;
+
+    // Records lost from the journal leave no gap, later ones move up
+    if (_Head.load() == _Tail.load())
+    {
+        _Head.store(offset);
+        _Tail.store(offset);
+        _SendCursor = offset;
+    }
+
+    memcpy(_Staging, record, size);
+    _StagedSize = size;
+    return _Push();
+}
+
+void MqttBridge::_OnAck(uint16_t messageId)
+{
+    for (size_t i = 0; i < _InFlightCount; ++i)
+    {
+        if (_InFlight[i].MessageId == messageId)
+        {
+            _InFlight[i].Acked = true;
+            break;
+        }
+    }
+
+    // PUBACKs normally arrive in order, release all acknowledged records at the head of the queue
+    size_t released = 0;
+    while (released < _InFlightCount && _InFlight[released].Acked)
+    {
+        _Head.store(_InFlight[released].Offset + 2 + _InFlight[released].Size, std::memory_order_release);
+        _Stats.Acked++;
+        released++;
+    }
+    if (released)
+    {
+        memmove(_InFlight, _InFlight + released, (_InFlightCount - released) * sizeof(_InFlight[0]));
+        _InFlightCount -= released;
+    }
+}
+
+void MqttBridge::_Flush()
+{
+    if (!_Uplink.connected())
+    {
+        _WasConnected = false;
+        return;
+    }
+
+    if (!_WasConnected)
+    {
+        // resend everything which was not acknowledged before the connection was lost
+        _WasConnected = true;
+        _Stats.Reconnects++;
+        _SendCursor = _Head.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < _InFlightCount; ++i)
+        {
+            _ReadQueue(_InFlight[i].Offset + 2, _SendBuffer, _InFlight[i].Size);
+            if (!_Uplink.SendQos1(_SendBuffer, _InFlight[i].Size, _InFlight[i].MessageId, true))
+                return;
+            _Stats.Resent++;
+            _SendCursor = _InFlight[i].Offset + 2 + _InFlight[i].Size;
+        }
+    }
+
+    // pipeline new records up to the window size
+    while (_InFlightCount < MQTT_BRIDGE_WINDOW && _SendCursor != _Tail.load(std::memory_order_acquire))
+    {
+        uint8_t header[2];
+        _ReadQueue(_SendCursor, header, 2);
+        const uint16_t size = (header[0] << 8) | header[1];
+        _ReadQueue(_SendCursor + 2, _SendBuffer, size);
+
+        InFlight& inFlight = _InFlight[_InFlightCount];
+        inFlight.Offset = _SendCursor;
+        inFlight.Size = size;
+        inFlight.MessageId = _Uplink.NextMessageId();
+        inFlight.Acked = false;
+
+        if (!_Uplink.SendQos1(_SendBuffer, size, inFlight.MessageId, false))
+            return;
+
+        _InFlightCount++;
+        _SendCursor += 2 + size;
+        _Stats.Sent++;
+    }
+}
+
+void MqttBridge::_Task()
+{
+    ESP_LOGI(TAG, "Bridge task started");
+    while (1)
+    {
+        // reconnects when needed and handles PUBACKs
+        _Uplink.loop();
+        _Flush();
+        vTaskDelay(pdMS_TO_TICKS(_Uplink.connected() ? 1 : 100));
+    }
+}
+
+MqttBridge::Stats MqttBridge::GetStats() const
+{
+    Stats ret;
+    ret.Enqueued = _Stats.Enqueued.load(std::memory_order_relaxed);
+    ret.Dropped = _Stats.Dropped.load(std::memory_order_relaxed);
+    ret.Oversized = _Stats.Oversized.load(std::memory_order_relaxed);
+    ret.Sent = _Stats.Sent.load(std::memory_order_relaxed);
+    ret.Resent = _Stats.Resent.load(std::memory_order_relaxed);
+    ret.Acked = _Stats.Acked.load(std::memory_order_relaxed);
+    ret.Reconnects = _Stats.Reconnects.load(std::memory_order_relaxed);
+    return ret;
+}
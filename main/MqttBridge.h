@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <Arduino.h>
+#include "PicoMQTT.h"
+
+// Bytes reserved for messages waiting for the uplink
+#ifndef MQTT_BRIDGE_QUEUE_SIZE
+#define MQTT_BRIDGE_QUEUE_SIZE          (16 * 1024)
+#endif
+
+// Max QoS 1 messages sent to the uplink without PUBACK
+#ifndef MQTT_BRIDGE_WINDOW
+#define MQTT_BRIDGE_WINDOW              8
+#endif
+
+#define MQTT_BRIDGE_MAX_FILTERS         8
+#define MQTT_BRIDGE_DEFAULT_FILTER      "emkit/#"
+#define MQTT_BRIDGE_MAX_RECORD_SIZE     (2 + PICOMQTT_MAX_TOPIC_SIZE + PICOMQTT_MAX_MESSAGE_SIZE)
+
+// Forwards selected topics of the local broker to an upstream broker.
+//
+// The bridge is a Print sink which the broker adds to the fan-out of matching messages (see MqttBroker), so it
+// receives the encoded PUBLISH packets just like a connected client.  Messages are stored in a bounded RAM ring
+// (single producer: the broker task, single consumer: the bridge task), so local delivery never waits for the
+// uplink.  The bridge task sends the backlog as pipelined QoS 1 publishes with at most MQTT_BRIDGE_WINDOW of them
+// waiting for PUBACK, and resends the unacknowledged ones after a reconnect.
+class MqttBridge : public Print
+{
+public:
+    struct Stats
+    {
+        uint32_t Enqueued;
+        uint32_t Dropped;       // queue full
+        uint32_t Oversized;     // message bigger than MQTT_BRIDGE_MAX_RECORD_SIZE
+        uint32_t Sent;
+        uint32_t Resent;
+        uint32_t Acked;
+        uint32_t Reconnects;
+    };
+
+    MqttBridge();
+
+    // Settings format: host[:port][;filter[,filter...]], e.g. "192.168.4.2:1883;emkit/#"
+    bool Configure(const char* settings);
+    bool IsConfigured() const { return _Host.length() > 0; }
+
+    void Start(UBaseType_t priority = 1, uint32_t stackSize = 6144);
+
+    // Called by the broker task
+    bool Matches(const PicoMQTT::TopicTokens& topic) const;
+    void BeginMessage();
+    virtual size_t write(uint8_t value) override;
+    virtual size_t write(const uint8_t* buffer, size_t size) override;
+
+    // Also called by the broker task, for MqttJournal.  Records in [head, tail) stay in place until the broker task
+    // queues more, the bridge task only moves the head when they are acknowledged.
+    size_t GetHeadOffset() const { return _Head.load(std::memory_order_acquire); }
+    size_t GetTailOffset() const { return _Tail.load(std::memory_order_relaxed); }
+    // Copies the record at the queue offset, returns its size: [topic size u16][topic][payload]
+    size_t ReadRecord(size_t offset, uint8_t* buffer) const;
+    // Queues a record saved before a restart at its previous offset, before Start()
+    bool Restore(size_t offset, const uint8_t* record, size_t size);
+
+    Stats GetStats() const;
+    size_t GetQueuedBytes() const { return _Tail.load() - _Head.load(); }
+    const char* GetHost() const { return _Host.c_str(); }
+    uint16_t GetPort() const { return _Port; }
+
+private:
+    class Uplink : public PicoMQTT::Client
+    {
+        MqttBridge& _Bridge;
+    public:
+        Uplink(MqttBridge& bridge);
+        bool SendQos1(const uint8_t* record, size_t size, uint16_t messageId, bool dup);
+        uint16_t NextMessageId() { return message_id_generator.generate(); }
+    protected:
+        virtual void handle_packet(PicoMQTT::IncomingPacket& packet) override;
+        virtual bool on_publish_complete(const Publish& publish) override { return true; }
+    };
+
+    enum class ParseState { Idle, Head, Length, Body, Skip };
+
+    struct InFlight
+    {
+        size_t Offset;
+        uint16_t Size;
+        uint16_t MessageId;
+        bool Acked;
+    };
+
+    String _Host;
+    uint16_t _Port;
+    PicoMQTT::TopicFilterSet _Filters;
+    Uplink _Uplink;
+
+    // encoded message being received from the broker
+    ParseState _ParseState;
+    size_t _Remaining;
+    uint8_t _LengthShift;
+    size_t _StagedSize;
+    uint8_t _Staging[MQTT_BRIDGE_MAX_RECORD_SIZE];
+
+    // ring of records: [size u16][topic size u16][topic][payload]
+    uint8_t _Queue[MQTT_BRIDGE_QUEUE_SIZE];
+    std::atomic<size_t> _Head;
+    std::atomic<size_t> _Tail;
+
+    // bridge task state
+    InFlight _InFlight[MQTT_BRIDGE_WINDOW];
+    size_t _InFlightCount;
+    size_t _SendCursor;
+    bool _WasConnected;
+    uint8_t _SendBuffer[MQTT_BRIDGE_MAX_RECORD_SIZE];
+
+    // Stats, counted by both tasks
+    struct Counters
+    {
+        std::atomic<uint32_t> Enqueued{0};
+        std::atomic<uint32_t> Dropped{0};
+        std::atomic<uint32_t> Oversized{0};
+        std::atomic<uint32_t> Sent{0};
+        std::atomic<uint32_t> Resent{0};
+        std::atomic<uint32_t> Acked{0};
+        std::atomic<uint32_t> Reconnects{0};
+    };
+    Counters _Stats;
+
+    // Queues the staged record, returns false if the queue is full
+    bool _Push();
+    void _ReadQueue(size_t offset, uint8_t* buffer, size_t size) const;
+    void _Flush();
+    void _OnAck(uint16_t messageId);
+    void _Task();
+};
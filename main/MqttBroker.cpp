@@ -0,0 +1,68 @@
+#include "BmsValues.h"
+#include "MqttBroker.h"
+
+PicoMQTT::PrintMux MqttBroker::get_subscribed(const char* topic)
+{
+    PicoMQTT::PrintMux ret = PicoMQTT::Server::get_subscribed(topic);
+    if (_Bridge != NULL && _Bridge->Matches(PicoMQTT::TopicTokens(topic)))
+    {
+        _Bridge->BeginMessage();
+        ret.add(*_Bridge);
+    }
+    return ret;
+}
+
+void MqttBroker::on_session_changed(const char* client_id)
+{
+    if (_Journal != NULL)
+        _Journal->OnSessionChanged(client_id);
+}
+
+void MqttBroker::on_message(const char* topic, PicoMQTT::IncomingPacket& packet)
+{
+    // Payloads up to max_buffered_payload_size are in memory and zero terminated, bigger ones are streamed and
+    // not numbers anyway
+    const uint8_t* payload = packet.get_buffered_data();
+    if (_TimeSeries != NULL && payload != NULL)
+        _TimeSeries->OnMessage(topic, (const char*)payload);
+    if (_Aggregation != NULL && payload != NULL)
+        _Aggregation->OnMessage(topic, (const char*)payload);
+    if (_Alarms != NULL && payload != NULL)
+        _Alarms->OnMessage(topic, (const char*)payload);
+    if (payload != NULL)
+        _OnPackedMessage(topic, payload, packet.get_remaining_size());
+
+    PicoMQTT::Server::on_message(topic, packet);
+}
+
+void MqttBroker::_OnPackedMessage(const char* topic, const uint8_t* payload, size_t size)
+{
+    if (_TimeSeries == NULL && _Aggregation == NULL && _Alarms == NULL)
+        return;
+
+    if (!BmsValues::IsPackedTopic(topic))
+        return;
+
+    // Decoded from a copy of the stream, the original one is still read by the subscribers
+    PicoMQTT::BufferedIncomingPacket stream(PicoMQTT::Packet::PUBLISH, 0, payload, size);
+    BmsValues values;
+    values.Decode(stream);
+
+    // Each metric is passed on as if it was published to its own topic, so rules and series don't depend on the
+    // format the pack uses
+    char metricTopic[PICOMQTT_MAX_TOPIC_SIZE + 1];
+    for (int m = 0; m < BmsValues::MetricCount; ++m)
+    {
+        const BmsValues::Metric metric = (BmsValues::Metric)m;
+        if (!values.Has(metric))
+            continue;
+
+        BmsValues::GetMetricTopic(topic, metric, metricTopic, sizeof(metricTopic));
+        if (_TimeSeries != NULL)
+            _TimeSeries->OnValue(metricTopic, values.Get(metric));
+        if (_Aggregation != NULL)
+            _Aggregation->OnValue(metricTopic, values.Get(metric));
+        if (_Alarms != NULL)
+            _Alarms->OnValue(metricTopic, values.Get(metric));
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+#include "PicoMQTT.h"
+
+#include "MqttAggregation.h"
+#include "MqttAlarms.h"
+#include "MqttBridge.h"
+#include "MqttJournal.h"
+#include "MqttTimeSeries.h"
+
+// The local broker.  Adds the bridge to the fan-out of messages matching its topic filters, saves persistent
+// sessions to the journal and passes messages to the time series, aggregates and alarms (the metrics of packed BMS
+// messages one by one, see BmsValues).
+class MqttBroker : public PicoMQTT::Server
+{
+public:
+    void SetBridge(MqttBridge* bridge) { _Bridge = bridge; }
+    void SetJournal(MqttJournal* journal) { _Journal = journal; }
+    void SetTimeSeries(MqttTimeSeries* timeSeries) { _TimeSeries = timeSeries; }
+    void SetAggregation(MqttAggregation* aggregation) { _Aggregation = aggregation; }
+    void SetAlarms(MqttAlarms* alarms) { _Alarms = alarms; }
+
+protected:
+    virtual PicoMQTT::PrintMux get_subscribed(const char* topic) override;
+    virtual void on_session_changed(const char* client_id) override;
+    virtual void on_message(const char* topic, PicoMQTT::IncomingPacket& packet) override;
+
+private:
+    // Passes the metrics of a packed BMS message to the time series, aggregates and alarms
+    void _OnPackedMessage(const char* topic, const uint8_t* payload, size_t size);
+
+    MqttBridge* _Bridge = NULL;
+    MqttJournal* _Journal = NULL;
+    MqttTimeSeries* _TimeSeries = NULL;
+    MqttAggregation* _Aggregation = NULL;
+    MqttAlarms* _Alarms = NULL;
+};
@@ -0,0 +1,202 @@
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "esp_log.h"
+#include "MqttJournal.h"
+#include "MqttBroker.h"
+
+static const char *TAG = "MqttJournal";
+
+static void _WriteU32(uint8_t* buffer, uint32_t value)
+{
+    for (size_t i = 0; i < 4; ++i)
+        buffer[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint32_t _ReadU32(const uint8_t* buffer)
+{
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+MqttJournal::MqttJournal(MqttBroker& broker, MqttBridge& bridge)
+    : _Broker(broker), _Bridge(bridge), _Storage(MQTT_JOURNAL_PARTITION), _Journal(_Storage, MQTT_JOURNAL_BUFFER_SIZE),
+      _Started(false), _JournaledTail(0), _JournaledHead(0), _LastCommitMillis(0)
+{
+}
+
+bool MqttJournal::Begin()
+{
+    if (!_Storage.Begin())
+        return false;
+
+    // The replayed state is applied once the whole journal is read
+    struct ReplayState
+    {
+        std::map<uint32_t, std::vector<uint8_t>> Messages;
+        uint32_t Acked = 0;
+        std::map<std::string, std::vector<std::string>> Sessions;
+    } state;
+
+    const unsigned long start = millis();
+    const bool ok = _Journal.begin([&state](uint8_t type, const uint8_t* data, size_t size)
+    {
+        switch (type)
+        {
+        case Message:
+        {
+            if (size < 4 + 2)
+                break;
+            const uint32_t offset = _ReadU32(data);
+            if (offset >= state.Acked)
+                state.Messages[offset].assign(data + 4, data + size);
+            break;
+        }
+
+        case Ack:
+            // Normally increasing, but a checkpoint after a restart may start the queue over at a lower offset.
+            // Checkpoints write it before the messages.
+            if (size == 4)
+            {
+                state.Acked = _ReadU32(data);
+                state.Messages.erase(state.Messages.begin(), state.Messages.lower_bound(state.Acked));
+            }
+            break;
+
+        case Session:
+        {
+            const char* begin = (const char*)data;
+            const char* end = begin + size;
+            const size_t idSize = strnlen(begin, size);
+            std::vector<std::string>& filters = state.Sessions[std::string(begin, idSize)];
+            filters.clear();
+            for (const char* filter = begin + idSize + 1; filter < end; )
+            {
+                const size_t filterSize = strnlen(filter, end - filter);
+                filters.emplace_back(filter, filterSize);
+                filter += filterSize + 1;
+            }
+            break;
+        }
+
+        case SessionRemoved:
+            state.Sessions.erase(std::string((const char*)data, size));
+            break;
+        }
+    });
+
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Partition '%s' can't hold the journal", MQTT_JOURNAL_PARTITION);
+        return false;
+    }
+
+    // Messages for the uplink are only kept while the bridge is configured
+    size_t restored = 0;
+    if (_Bridge.IsConfigured())
+    {
+        for (const auto& kv : state.Messages)
+            restored += _Bridge.Restore(kv.first, kv.second.data(), kv.second.size()) ? 1 : 0;
+    }
+
+    for (const auto& kv : state.Sessions)
+    {
+        _Broker.restore_session(kv.first.c_str(), NULL);
+        for (const auto& filter : kv.second)
+            _Broker.restore_session(kv.first.c_str(), filter.c_str());
+    }
+
+    // Start over from the restored state, records of messages which couldn't be restored or moved up don't apply
+    // anymore
+    _JournaledHead = _Bridge.GetHeadOffset();
+    _JournaledTail = _Bridge.GetTailOffset();
+    _Journal.checkpoint_callback = [this]() { _WriteCheckpoint(); };
+    _Journal.checkpoint();
+    _Started = true;
+    _LastCommitMillis = millis();
+
+    ESP_LOGI(TAG, "Replayed %lu records in %lu ms: %u queued messages, %u sessions, %u/%u sectors used",
+        _Journal.get_stats().replayed, millis() - start, (unsigned)restored, (unsigned)state.Sessions.size(),
+        (unsigned)_Journal.get_used_sectors(), (unsigned)_Journal.get_sector_count());
+    return true;
+}
+
+void MqttJournal::Loop()
+{
+    if (!_Started)
+        return;
+
+    if (millis() - _LastCommitMillis >= MQTT_JOURNAL_COMMIT_MS)
+    {
+        _LastCommitMillis = millis();
+
+        // Messages acknowledged since the last commit don't need to be journaled
+        const size_t head = _Bridge.GetHeadOffset();
+        const size_t tail = _Bridge.GetTailOffset();
+        _AppendMessages((long)(head - _JournaledTail) > 0 ? head : _JournaledTail, tail);
+        if (head != _JournaledHead)
+            _AppendAck(head);
+
+        _Journal.commit();
+    }
+
+    _Journal.loop();
+}
+
+void MqttJournal::OnSessionChanged(const char* clientId)
+{
+    if (_Started)
+        _AppendSession(clientId);
+}
+
+void MqttJournal::_AppendMessages(size_t from, size_t to)
+{
+    while (from != to)
+    {
+        const size_t size = _Bridge.ReadRecord(from, _Record + 4);
+        _WriteU32(_Record, from);
+        _Journal.append(Message, _Record, 4 + size);
+        from += 2 + size;
+    }
+    _JournaledTail = to;
+}
+
+void MqttJournal::_AppendAck(size_t head)
+{
+    uint8_t record[4];
+    _WriteU32(record, head);
+    _Journal.append(Ack, record, sizeof(record));
+    _JournaledHead = head;
+}
+
+void MqttJournal::_AppendSession(const char* clientId)
+{
+    auto it = _Broker.get_sessions().find(clientId);
+    if (it == _Broker.get_sessions().end())
+    {
+        _Journal.append(SessionRemoved, clientId, strlen(clientId));
+        return;
+    }
+
+    std::string record(clientId);
+    record += '\0';
+    for (const auto& filter : it->second)
+    {
+        record += filter.c_str();
+        record += '\0';
+    }
+
+    if (!_Journal.append(Session, record.data(), record.size()))
+        ESP_LOGW(TAG, "Session of %s not saved (%u bytes)", clientId, (unsigned)record.size());
+}
+
+void MqttJournal::_WriteCheckpoint()
+{
+    const size_t head = _Bridge.GetHeadOffset();
+    const size_t tail = _Bridge.GetTailOffset();
+
+    _AppendAck(head);
+    for (const auto& kv : _Broker.get_sessions())
+        _AppendSession(kv.first.c_str());
+    _AppendMessages(head, tail);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <Arduino.h>
+#include "PicoMQTT.h"
+#include "PicoMQTT/journal.h"
+
+#include "FlashPartitionStorage.h"
+#include "MqttBridge.h"
+
+class MqttBroker;
+
+// Data partition holding the journal
+#define MQTT_JOURNAL_PARTITION          "espflash"
+
+// Group commit: queued messages, acknowledgements and session changes are written at most this often.  Messages
+// acknowledged by the uplink within the interval never reach the flash.
+#ifndef MQTT_JOURNAL_COMMIT_MS
+#define MQTT_JOURNAL_COMMIT_MS          200
+#endif
+
+#define MQTT_JOURNAL_BUFFER_SIZE        1024
+
+// Keeps the messages queued for the uplink and the persistent sessions of the broker across restarts, in an
+// append-only journal on the MQTT_JOURNAL_PARTITION partition (see PicoMQTT::Journal).
+//
+// All methods run in the broker task.  The bridge queue is read between its head, which the bridge task moves on
+// PUBACK, and its tail, which only the broker task moves, so the records read don't change.  Records:
+//   Message:        [queue offset u32][topic size u16][topic][payload]
+//   Ack:            [queue offset u32], all messages before the offset were acknowledged
+//   Session:        [client id]\0[topic filter]\0...
+//   SessionRemoved: [client id]
+class MqttJournal
+{
+public:
+    MqttJournal(MqttBroker& broker, MqttBridge& bridge);
+
+    // Replays the journal into the broker's sessions and the bridge queue, before either starts
+    bool Begin();
+    // Called by the main loop: journals and commits changes, writes checkpoints and erases obsolete sectors
+    void Loop();
+
+    // Called by the broker
+    void OnSessionChanged(const char* clientId);
+
+    bool IsStarted() const { return _Started; }
+    const PicoMQTT::Journal::Stats& GetStats() const { return _Journal.get_stats(); }
+    size_t GetUsedSectors() const { return _Journal.get_used_sectors(); }
+    size_t GetSectorCount() const { return _Journal.get_sector_count(); }
+
+private:
+    enum RecordType : uint8_t
+    {
+        Message = 1,
+        Ack = 2,
+        Session = 3,
+        SessionRemoved = 4
+    };
+
+    MqttBroker& _Broker;
+    MqttBridge& _Bridge;
+    FlashPartitionStorage _Storage;
+    PicoMQTT::Journal _Journal;
+    bool _Started;
+
+    // bridge queue offsets journaled so far
+    size_t _JournaledTail;
+    size_t _JournaledHead;
+    unsigned long _LastCommitMillis;
+
+    uint8_t _Record[4 + MQTT_BRIDGE_MAX_RECORD_SIZE];
+
+    void _AppendMessages(size_t from, size_t to);
+    void _AppendAck(size_t head);
+    void _AppendSession(const char* clientId);
+    void _WriteCheckpoint();
+};
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "MqttTimeSeries.h"
+
+static const char *TAG = "MqttTimeSeries";
+
+MqttTimeSeries::MqttTimeSeries(PicoMQTT::Server& broker)
+    : _Broker(broker), _Store(MQTT_TIMESERIES_MAX_TOPIC_SIZE)
+{
+}
+
+void MqttTimeSeries::Add(const char* topicFilter, size_t maxSeries, size_t rawSize, size_t tenSecondsSize, size_t oneMinuteSize)
+{
+    _Filters.add(topicFilter);
+    _Store.add(maxSeries, rawSize, tenSecondsSize, oneMinuteSize);
+}
+
+void MqttTimeSeries::Begin()
+{
+    if (_Filters.empty())
+        return;
+
+    _Filters.shrink_to_fit();
+    _Store.begin();
+
+    _Broker.subscribe(MQTT_TIMESERIES_QUERY_TOPIC "+", [this](const char* topic, const char* payload)
+    {
+        _OnQuery(topic, payload);
+    });
+
+    ESP_LOGI(TAG, "%u filters, %u bytes", _Filters.size(), _Store.get_memory_usage());
+}
+
+void MqttTimeSeries::OnMessage(const char* topic, const char* payload)
+{
+    if (_Filters.empty())
+        return;
+
+    const int group = _Filters.find_first(PicoMQTT::TopicTokens(topic));
+    if (group >= 0)
+        _Store.ingest(group, topic, payload, millis());
+}
+
+void MqttTimeSeries::OnValue(const char* topic, float value)
+{
+    if (_Filters.empty())
+        return;
+
+    const int group = _Filters.find_first(PicoMQTT::TopicTokens(topic));
+    if (group >= 0)
+        _Store.ingest(group, topic, value, millis());
+}
+
+void MqttTimeSeries::_OnQuery(const char* topic, const char* payload)
+{
+    char resultTopic[sizeof(MQTT_TIMESERIES_RESULT_TOPIC) + PICOMQTT_MAX_TOPIC_SIZE];
+    snprintf(resultTopic, sizeof(resultTopic), MQTT_TIMESERIES_RESULT_TOPIC "%s", topic + strlen(MQTT_TIMESERIES_QUERY_TOPIC));
+
+    // <topic> [<seconds>] [<resolution>]
+    char request[MQTT_TIMESERIES_MAX_TOPIC_SIZE + 32];
+    strncpy(request, payload, sizeof(request) - 1);
+    request[sizeof(request) - 1] = '\0';
+
+    char* context = NULL;
+    const char* series = strtok_r(request, " ", &context);
+    const char* seconds = strtok_r(NULL, " ", &context);
+    const char* resolutionName = strtok_r(NULL, " ", &context);
+
+    PicoMQTT::TimeSeriesStore::Resolution resolution = PicoMQTT::TimeSeriesStore::RAW;
+    if (resolutionName != NULL && !PicoMQTT::TimeSeriesStore::parse_resolution(resolutionName, resolution))
+        series = NULL;
+
+    const uint32_t now = millis();
+    const unsigned long maxAge = seconds != NULL ? strtoul(seconds, NULL, 10) * 1000 : 0;
+    const uint32_t since = now - (maxAge > 0 && maxAge < 0x7fffffff ? maxAge : 0x7fffffff);
+
+    // The result is streamed to the subscribers: the entries are formatted once to get the size of the payload
+    // and again while it's sent
+    char line[64];
+    auto format = [&line, now, resolution](const PicoMQTT::TimeSeriesStore::Bucket& bucket)
+    {
+        if (resolution == PicoMQTT::TimeSeriesStore::RAW)
+            return snprintf(line, sizeof(line), "%lu,%g\n", (unsigned long)(now - bucket.time), bucket.mean);
+        return snprintf(line, sizeof(line), "%lu,%g,%g,%g\n", (unsigned long)(now - bucket.time),
+            bucket.min, bucket.max, bucket.mean);
+    };
+
+    size_t size = 0;
+    const int count = series == NULL ? -1 : _Store.query(series, resolution, since,
+        [&size, &format](const PicoMQTT::TimeSeriesStore::Bucket& bucket) { size += format(bucket); });
+
+    if (count < 0)
+    {
+        _Broker.publish(resultTopic, "");
+        return;
+    }
+
+    const int headerSize = snprintf(line, sizeof(line), " %s %d\n",
+        PicoMQTT::TimeSeriesStore::get_resolution_name(resolution), count);
+    size += strlen(series) + headerSize;
+
+    auto publish = _Broker.begin_publish(resultTopic, size);
+    publish.write((const uint8_t*)series, strlen(series));
+    publish.write((const uint8_t*)line, headerSize);
+    _Store.query(series, resolution, since, [&publish, &line, &format](const PicoMQTT::TimeSeriesStore::Bucket& bucket)
+    {
+        publish.write((const uint8_t*)line, format(bucket));
+    });
+    publish.send();
+}
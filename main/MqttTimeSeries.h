@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <Arduino.h>
+#include "PicoMQTT.h"
+#include "PicoMQTT/timeseries.h"
+
+// Queries are published to MQTT_TIMESERIES_QUERY_TOPIC<id>, the result goes to MQTT_TIMESERIES_RESULT_TOPIC<id>
+#define MQTT_TIMESERIES_QUERY_TOPIC     "timeseries/query/"
+#define MQTT_TIMESERIES_RESULT_TOPIC    "timeseries/result/"
+
+#define MQTT_TIMESERIES_MAX_TOPIC_SIZE  64
+
+// History of numeric topics kept by the broker (see PicoMQTT::TimeSeriesStore), with raw samples and 10 s and 1 min
+// min/max/mean buckets.  The memory is allocated by Begin() and doesn't grow afterwards.
+//
+// A query is published to timeseries/query/<id> with the payload "<topic> [<seconds>] [raw|10s|1m]", by default
+// all raw samples.  The result is published to timeseries/result/<id> as a line "<topic> <resolution> <count>" and
+// a line per entry, oldest first: "<age ms>,<value>" for raw samples, "<age ms>,<min>,<max>,<mean>" for buckets,
+// where the age of a bucket is that of its start.  Unknown series get an empty result.
+//
+// All methods run in the broker task.
+class MqttTimeSeries
+{
+public:
+    MqttTimeSeries(PicoMQTT::Server& broker);
+
+    // Keeps the history of topics matching the filter, for up to maxSeries different topics
+    void Add(const char* topicFilter, size_t maxSeries, size_t rawSize, size_t tenSecondsSize, size_t oneMinuteSize);
+    void Begin();
+
+    // Called by the broker for every message with the payload in memory
+    void OnMessage(const char* topic, const char* payload);
+    // Called by the broker for every metric of a packed message, see BmsValues
+    void OnValue(const char* topic, float value);
+
+    bool IsEmpty() const { return _Filters.empty(); }
+    const PicoMQTT::TimeSeriesStore::Stats& GetStats() const { return _Store.get_stats(); }
+    size_t GetMemoryUsage() const { return _Store.get_memory_usage() + _Filters.get_memory_usage(); }
+
+private:
+    PicoMQTT::Server& _Broker;
+    PicoMQTT::TimeSeriesStore _Store;
+    // filters in the order of the store's groups
+    PicoMQTT::TopicFilterSet _Filters;
+
+    void _OnQuery(const char* topic, const char* payload);
+};
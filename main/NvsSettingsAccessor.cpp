@@ -252,3 +252,15 @@ bool NvsSettingsAccessor::SetMqtt(const char* mqtt)
     return _SetStr("Settings.Mqtt", mqtt);
 }
 
+char _NvsSettingsAccessorUiLayoutBuff[1024];
+
+const char* NvsSettingsAccessor::GetUiLayout()
+{
+    return _GetStr("Settings.Ui", _NvsSettingsAccessorUiLayoutBuff, sizeof(_NvsSettingsAccessorUiLayoutBuff));
+}
+
+bool NvsSettingsAccessor::SetUiLayout(const char* layout)
+{
+    return _SetStr("Settings.Ui", layout);
+}
+
@@ -43,6 +43,9 @@ public:
     static const char* GetMqtt();
     static bool SetMqtt(const char*);
 
+    static const char* GetUiLayout();
+    static bool SetUiLayout(const char*);
+
     static int GetBootCounter();
     static int IncBootCounter();
 
@@ -0,0 +1,136 @@
+#include <math.h>
+#include <string.h>
+#include "Sparkline.h"
+
+Sparkline::Sparkline()
+{
+    _Width = 0;
+    _Height = 0;
+    _Color = 0;
+    _Background = 0;
+    _AutoRange = true;
+    _Min = 0;
+    _Max = 0;
+    _SinceFit = 0;
+    _Head = 0;
+    _Count = 0;
+    _LastY = -1;
+    memset(&_Stats, 0, sizeof(_Stats));
+}
+
+bool Sparkline::Init(uint8_t width, uint8_t height, uint16_t color, uint16_t background, float min, float max)
+{
+    if (width < 2 || width > SPARKLINE_MAX_WIDTH || height < 2 || height > SPARKLINE_MAX_HEIGHT)
+        return false;
+
+    _Width = width;
+    _Height = height;
+    _Color = color;
+    _Background = background;
+    _AutoRange = !(min < max);
+    _Min = min;
+    _Max = max;
+    _Head = 0;
+    _Count = 0;
+    _Redraw();
+    return true;
+}
+
+int Sparkline::_GetY(float value) const
+{
+    if (!(_Max > _Min))
+        return _Height / 2;
+
+    // the top row is y = 0
+    const int y = (_Height - 1) - lroundf((value - _Min) * (_Height - 1) / (_Max - _Min));
+    return y < 0 ? 0 : y >= _Height ? _Height - 1 : y;
+}
+
+void Sparkline::_Scroll()
+{
+    for (int y = 0; y < _Height; ++y)
+    {
+        uint16_t* row = _Pixels + y * _Width;
+        memmove(row, row + 1, (_Width - 1) * sizeof(uint16_t));
+        row[_Width - 1] = _Background;
+    }
+}
+
+void Sparkline::_DrawSegment(int x, int fromY, int toY)
+{
+    if (fromY < 0)
+        fromY = toY;
+    if (fromY > toY)
+    {
+        const int y = fromY;
+        fromY = toY;
+        toY = y;
+    }
+    for (int y = fromY; y <= toY; ++y)
+        _Pixels[y * _Width + x] = _Color;
+}
+
+void Sparkline::_FitRange()
+{
+    _SinceFit = 0;
+    if (!_AutoRange || _Count == 0)
+        return;
+
+    float min = _Samples[_Head];
+    float max = min;
+    for (int i = 1; i < _Count; ++i)
+    {
+        const float value = _Samples[(_Head + i) % _Width];
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+    }
+    _Min = min;
+    _Max = max;
+}
+
+void Sparkline::_Redraw()
+{
+    ++_Stats.Redraws;
+    for (size_t i = 0; i < (size_t)_Width * _Height; ++i)
+        _Pixels[i] = _Background;
+
+    // the newest sample is in the last column
+    _LastY = -1;
+    for (int i = 0; i < _Count; ++i)
+    {
+        const int y = _GetY(_Samples[(_Head + i) % _Width]);
+        _DrawSegment(_Width - _Count + i, _LastY, y);
+        _LastY = y;
+    }
+}
+
+void Sparkline::Add(float value)
+{
+    if (_Width == 0 || isnan(value))
+        return;
+    ++_Stats.Samples;
+
+    if (_Count < _Width)
+    {
+        _Samples[(_Head + _Count) % _Width] = value;
+        ++_Count;
+    }
+    else
+    {
+        _Samples[_Head] = value;
+        _Head = (_Head + 1) % _Width;
+    }
+
+    ++_SinceFit;
+    if (_AutoRange && (value < _Min || value > _Max || _Count == 1 || _SinceFit >= _Width))
+    {
+        _FitRange();
+        _Redraw();
+        return;
+    }
+
+    _Scroll();
+    const int y = _GetY(value);
+    _DrawSegment(_Width - 1, _LastY, y);
+    _LastY = y;
+}
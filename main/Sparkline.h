@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Largest trend, the pixels of each Sparkline are preallocated for it
+#define SPARKLINE_MAX_WIDTH         64
+#define SPARKLINE_MAX_HEIGHT        32
+
+// Trend of a value as a line of one column per sample, drawn into an RGB565 pixel buffer (e.g. of an LVGL canvas).
+//
+// The last width samples are kept in a ring.  A new sample scrolls the pixels left by a column and draws only the
+// segment from the previous sample to the new one into the last column, so the cost per sample doesn't depend on the
+// history shown.  The whole line is redrawn from the ring only when the scale changes: with an automatic range, when
+// a sample falls outside of it and when the samples which set it have scrolled out.
+//
+// Doesn't depend on LVGL, the owner shows the pixels and decides when to invalidate them.
+class Sparkline
+{
+public:
+    struct Stats
+    {
+        unsigned long Samples;
+        unsigned long Redraws;      // of the whole line
+    };
+
+    Sparkline();
+
+    // The range is fixed if min < max, otherwise it follows the samples
+    bool Init(uint8_t width, uint8_t height, uint16_t color, uint16_t background, float min, float max);
+
+    void Add(float value);
+
+    uint16_t* GetPixels() { return _Pixels; }
+    uint8_t GetWidth() const { return _Width; }
+    uint8_t GetHeight() const { return _Height; }
+    const Stats& GetStats() const { return _Stats; }
+
+private:
+    int _GetY(float value) const;
+    void _Scroll();
+    void _DrawSegment(int x, int fromY, int toY);
+    void _FitRange();
+    void _Redraw();
+
+    uint8_t _Width;
+    uint8_t _Height;
+    uint16_t _Color;
+    uint16_t _Background;
+    bool _AutoRange;
+    float _Min;
+    float _Max;
+    // samples shown since the range was fitted, it's fitted again when they fill the width
+    uint16_t _SinceFit;
+
+    float _Samples[SPARKLINE_MAX_WIDTH];
+    uint8_t _Head;                  // index of the oldest sample
+    uint8_t _Count;
+    int _LastY;                     // of the newest sample
+
+    uint16_t _Pixels[SPARKLINE_MAX_WIDTH * SPARKLINE_MAX_HEIGHT];
+    Stats _Stats;
+};
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <drivers\display\st7789\lv_st7789.h>
 #include "esp_log.h"
 #include "esp_check.h"
@@ -8,8 +9,7 @@ static const char *TAG = "smld";
 void lv_lcd_send_cmd_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, const uint8_t * param, size_t param_size);
 void lv_lcd_send_color_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, uint8_t * param, size_t param_size);
 
-
-static SpiMipiLvglDisplayDriver *_ActiveSpiMipiLvglDisplayDriver = NULL;
+// The transfers are in SpiMipiLvglDisplayDriverFlush.cpp, which also builds on a PC
 
 SpiMipiLvglDisplayDriver::SpiMipiLvglDisplayDriver(spi_host_device_t hostId, gpio_num_t gpioCs, gpio_num_t gpioDc, gpio_num_t gpioRst, uint32_t clockSpeedHz, gpio_num_t gpioBacklight)
 {
@@ -18,7 +18,10 @@ SpiMipiLvglDisplayDriver::SpiMipiLvglDisplayDriver(spi_host_device_t hostId, gpi
     _GpioDc = gpioDc;
     _GpioRst = gpioRst;
     _GpioBackLight = gpioBacklight;
-    _SpiHandle = NULL;
+    _Bus = NULL;
+    _OwnsBus = false;
+    memset(&_ColorTransaction, 0, sizeof(_ColorTransaction));
+    _ColorTransactionQueued = false;
 
     ESP_LOGI(TAG, "->SpiMipiLvglDisplayDriver %x:%x:%x", hostId, lv_lcd_send_cmd_cb, lv_lcd_send_color_cb);
 
@@ -27,6 +30,7 @@ SpiMipiLvglDisplayDriver::SpiMipiLvglDisplayDriver(spi_host_device_t hostId, gpi
         .clock_speed_hz = (int)clockSpeedHz,
         .spics_io_num = gpioCs,
         .queue_size = 4, 
+        .post_cb = _SpiPostTransferCallback,
     };
 
     if (gpioRst != GPIO_NUM_NC)
@@ -50,11 +54,14 @@ SpiMipiLvglDisplayDriver::SpiMipiLvglDisplayDriver(spi_host_device_t hostId, gpi
         gpio_set_level(_GpioDc, 1);
     }
 
-    auto ret = spi_bus_add_device(hostId, &devcfg, &_SpiHandle);
+    spi_device_handle_t spiHandle;
+    auto ret = spi_bus_add_device(hostId, &devcfg, &spiHandle);
     if (ret != ESP_OK) {
         ESP_LOGD(TAG, "spi_bus_add_device failed with rc=0x%x", ret);
         return;
     }
+    _Bus = new SpiDeviceBus(spiHandle);
+    _OwnsBus = true;
 
     if (_GpioRst != GPIO_NUM_NC)
     {
@@ -74,7 +81,7 @@ SpiMipiLvglDisplayDriver::SpiMipiLvglDisplayDriver(spi_host_device_t hostId, gpi
     lv_tick_set_cb([]() { return (uint32_t)(esp_timer_get_time() / 1000); });
     lv_tick_inc(0); 
     
-    _ActiveSpiMipiLvglDisplayDriver = this;
+    _Active = this;
 
 //TODO:  LV_USE_ST7735 | LV_USE_ST7789 | LV_USE_ST7796 | LV_USE_ILI9341   
 #ifdef LV_USE_ST7789
@@ -106,8 +113,11 @@ SpiMipiLvglDisplayDriver::SpiMipiLvglDisplayDriver(spi_host_device_t hostId, gpi
     lv_lcd_generic_mipi_set_invert(_Display, true);
     lv_display_set_rotation(_Display, LV_DISPLAY_ROTATION_0);
 
-    static uint8_t buf[hRes * vRes / 10 * 2]; /* x2 because of 16-bit color depth */
-    lv_display_set_buffers(_Display, buf, NULL, sizeof(buf), LV_DISPLAY_RENDER_MODE_PARTIAL);    
+    // LVGL renders into one buffer while the other is sent
+    static uint8_t buf1[hRes * vRes / LVGL_BUFFER_DIVIDER * 2] __attribute__((aligned(4))); /* x2 because of 16-bit color depth */
+    static uint8_t buf2[hRes * vRes / LVGL_BUFFER_DIVIDER * 2] __attribute__((aligned(4)));
+    lv_display_set_buffers(_Display, buf1, buf2, sizeof(buf1), LV_DISPLAY_RENDER_MODE_PARTIAL);    
+    lv_display_set_flush_wait_cb(_Display, _FlushWaitCallback);
 
     lv_display_set_user_data(_Display, this);
 
@@ -160,92 +170,22 @@ void SpiMipiLvglDisplayDriver::SetBackLight(uint8_t value)
     ledc_update_duty(_LedcChannel.speed_mode, _LedcChannel.channel);
 }
 
-SpiMipiLvglDisplayDriver::~SpiMipiLvglDisplayDriver()
+SpiDeviceBus::~SpiDeviceBus()
 {
-    if (_Display)
-    {
-        //lv_st7789_delete(_Display);
-        _Display = NULL;
-    };
-     
-    if (_SpiHandle)
-    {
-        spi_bus_remove_device(_SpiHandle);
-        _SpiHandle = NULL;
-    }
+    spi_bus_remove_device(_Handle);
 }
 
-lv_display_t* SpiMipiLvglDisplayDriver::operator &()
+esp_err_t SpiDeviceBus::Transmit(spi_transaction_t* transaction)
 {
-    return _Display;
+    return spi_device_transmit(_Handle, transaction);
 }
 
-void SpiMipiLvglDisplayDriver::_lv_lcd_send_cmd_cb(const uint8_t *cmd, size_t cmd_size, const uint8_t *param, size_t param_size)
+esp_err_t SpiDeviceBus::QueueTrans(spi_transaction_t* transaction, TickType_t ticksToWait)
 {
-    spi_transaction_t trConfig = 
-    {
-        .flags = 0,
-        .cmd = 0,
-        .addr = 0,
-        .length = 0,
-        .rxlength = 0,
-        .user = 0,
-        .tx_buffer = 0,
-        .rx_buffer = 0
-    };
-
-    if (cmd_size)
-    {
-        trConfig.length = cmd_size*8;
-        trConfig.tx_buffer = (void*)cmd;
-
-        if (_GpioDc != GPIO_NUM_NC)
-            gpio_set_level(_GpioDc, 0);
-
-        auto ret = spi_device_transmit(_SpiHandle, &trConfig);
-        if (ret != ESP_OK) {
-            ESP_LOGD(TAG, "spi_device_transmit failed with rc=0x%x", ret);
-        }
-
-        if (_GpioDc != GPIO_NUM_NC)
-            gpio_set_level(_GpioDc, 1);
-    }
-
-    if (param_size)
-    {
-        trConfig.length = param_size*8;
-        trConfig.tx_buffer = (void*)param;
-
-        auto ret = spi_device_transmit(_SpiHandle, &trConfig);
-        if (ret != ESP_OK) {    
-            ESP_LOGD(TAG, "spi_device_transmit failed with rc=0x%x", ret);
-        }       
-    }
-
-}
-
-void SpiMipiLvglDisplayDriver::_lv_lcd_send_color_cb(const uint8_t *cmd, size_t cmd_size, uint8_t *param, size_t param_size)
-{
-    _lv_lcd_send_cmd_cb(cmd, cmd_size, param, param_size);
-    //vTaskDelay(pdMS_TO_TICKS(10));
-    lv_display_flush_ready(_Display);
-}
-
-void lv_lcd_send_cmd_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, const uint8_t * param, size_t param_size)
-{
-    //ESP_LOGI(TAG, "%s:%i:%i", __FUNCTION__, cmd_size, param_size);
-    SpiMipiLvglDisplayDriver* drv = (SpiMipiLvglDisplayDriver*)lv_display_get_user_data(disp);
-    if (drv == NULL)
-        drv = _ActiveSpiMipiLvglDisplayDriver;
-    drv->_lv_lcd_send_cmd_cb(cmd, cmd_size, param, param_size);
+    return spi_device_queue_trans(_Handle, transaction, ticksToWait);
 }
 
-void lv_lcd_send_color_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, uint8_t * param, size_t param_size)
+esp_err_t SpiDeviceBus::GetTransResult(spi_transaction_t** transaction, TickType_t ticksToWait)
 {
-    //ESP_LOGI(TAG, "%s:%i:%i", __FUNCTION__, cmd_size, param_size);
-    SpiMipiLvglDisplayDriver* drv = (SpiMipiLvglDisplayDriver*)lv_display_get_user_data(disp);
-    if (drv == NULL)
-        drv = _ActiveSpiMipiLvglDisplayDriver;
-    drv->_lv_lcd_send_color_cb(cmd, cmd_size, param, param_size);
+    return spi_device_get_trans_result(_Handle, transaction, ticksToWait);
 }
-
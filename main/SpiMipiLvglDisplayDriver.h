@@ -14,6 +14,9 @@
 #define ST7789_LCD_H_RES              240
 #define ST7789_LCD_V_RES              320
 
+// Each of the two render buffers holds 1/LVGL_BUFFER_DIVIDER of the screen
+#define LVGL_BUFFER_DIVIDER           10
+
 #define LEDC_HS_TIMER          LEDC_TIMER_0
 #define LEDC_LS_MODE           LEDC_LOW_SPEED_MODE
 #define LEDC_HS_CH0_CHANNEL    LEDC_CHANNEL_0
@@ -21,6 +24,33 @@
 #define LEDC_ResolutionRatio   LEDC_TIMER_13_BIT
 #define LEDC_MAX_Duty          ((1 << LEDC_ResolutionRatio) - 1)
 
+// The SPI transfers of the driver, so the flush can also run against a stand-in on a PC (see
+// benchmark/display_flush_bench.cpp).  A queued transaction ends with the post transfer callback of the driver, see
+// SpiMipiLvglDisplayDriver::GetPostTransferCallback().
+class SpiMipiBus
+{
+public:
+    virtual ~SpiMipiBus() {}
+
+    virtual esp_err_t Transmit(spi_transaction_t* transaction) = 0;
+    virtual esp_err_t QueueTrans(spi_transaction_t* transaction, TickType_t ticksToWait) = 0;
+    virtual esp_err_t GetTransResult(spi_transaction_t** transaction, TickType_t ticksToWait) = 0;
+};
+
+// SpiMipiBus of an ESP-IDF SPI device, removes the device from the bus when deleted
+class SpiDeviceBus : public SpiMipiBus
+{
+    spi_device_handle_t _Handle;
+
+public:
+    SpiDeviceBus(spi_device_handle_t handle) : _Handle(handle) {}
+    ~SpiDeviceBus() override;
+
+    esp_err_t Transmit(spi_transaction_t* transaction) override;
+    esp_err_t QueueTrans(spi_transaction_t* transaction, TickType_t ticksToWait) override;
+    esp_err_t GetTransResult(spi_transaction_t** transaction, TickType_t ticksToWait) override;
+};
+
 class SpiMipiLvglDisplayDriver
 {
     friend void lv_lcd_send_cmd_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, const uint8_t * param, size_t param_size);
@@ -33,10 +63,22 @@ class SpiMipiLvglDisplayDriver
     gpio_num_t _GpioRst;
     gpio_num_t _GpioBackLight;
     
-    spi_device_handle_t _SpiHandle;    
+    SpiMipiBus* _Bus;
+    bool _OwnsBus;
+
+    // Pixels are sent by a queued DMA transaction, LVGL renders the next band into the other buffer meanwhile
+    spi_transaction_t _ColorTransaction;
+    bool _ColorTransactionQueued;
 
     void _lv_lcd_send_cmd_cb(const uint8_t * cmd, size_t cmd_size, const uint8_t * param, size_t param_size);
     void _lv_lcd_send_color_cb(const uint8_t * cmd, size_t cmd_size, uint8_t * param, size_t param_size);
+    void _WaitColorTransaction();
+
+    static void _SpiPostTransferCallback(spi_transaction_t* transaction);
+    static void _FlushWaitCallback(lv_display_t* display);
+
+    // Used by the callbacks of displays without user data
+    static SpiMipiLvglDisplayDriver* _Active;
 
     ledc_channel_config_t _LedcChannel;    
     void _BackLightInit();
@@ -44,8 +86,13 @@ class SpiMipiLvglDisplayDriver
 
 public:
     SpiMipiLvglDisplayDriver(spi_host_device_t hostId, gpio_num_t gpioCs, gpio_num_t gpioDc, gpio_num_t gpioRst, uint32_t clockSpeedHz, gpio_num_t gpioBacklight);
+    // Drives an existing LVGL display through the given bus, without initializing the hardware or LVGL
+    SpiMipiLvglDisplayDriver(SpiMipiBus& bus, gpio_num_t gpioDc, lv_display_t* display);
     ~SpiMipiLvglDisplayDriver();
 
+    // The post transfer callback the SPI device must call, it marks the flush as ready
+    static transaction_cb_t GetPostTransferCallback() { return _SpiPostTransferCallback; }
+
     lv_display_t* operator &();
 
     lv_display_t* GetDisplay() { return _Display; };
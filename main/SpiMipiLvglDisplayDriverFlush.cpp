@@ -0,0 +1,171 @@
+#include <string.h>
+#include <display/lv_display_private.h>
+#include "esp_log.h"
+#include "SpiMipiLvglDisplayDriver.h"
+
+static const char *TAG = "smld";
+
+SpiMipiLvglDisplayDriver* SpiMipiLvglDisplayDriver::_Active = NULL;
+
+SpiMipiLvglDisplayDriver::SpiMipiLvglDisplayDriver(SpiMipiBus& bus, gpio_num_t gpioDc, lv_display_t* display)
+{
+    _Display = display;
+    _HostId = (spi_host_device_t)0;
+    _GpioCs = GPIO_NUM_NC;
+    _GpioDc = gpioDc;
+    _GpioRst = GPIO_NUM_NC;
+    _GpioBackLight = GPIO_NUM_NC;
+    _Bus = &bus;
+    _OwnsBus = false;
+    memset(&_ColorTransaction, 0, sizeof(_ColorTransaction));
+    _ColorTransactionQueued = false;
+    memset(&_LedcChannel, 0, sizeof(_LedcChannel));
+
+    _Active = this;
+    lv_display_set_flush_wait_cb(_Display, _FlushWaitCallback);
+    lv_display_set_user_data(_Display, this);
+}
+
+SpiMipiLvglDisplayDriver::~SpiMipiLvglDisplayDriver()
+{
+    if (_Display)
+    {
+        //lv_st7789_delete(_Display);
+        _Display = NULL;
+    };
+     
+    if (_Bus)
+    {
+        _WaitColorTransaction();
+        if (_OwnsBus)
+            delete _Bus;
+        _Bus = NULL;
+    }
+}
+
+lv_display_t* SpiMipiLvglDisplayDriver::operator &()
+{
+    return _Display;
+}
+
+void SpiMipiLvglDisplayDriver::_lv_lcd_send_cmd_cb(const uint8_t *cmd, size_t cmd_size, const uint8_t *param, size_t param_size)
+{
+    // The pixels of the previous flush must be on the wire before DC changes, and spi_device_transmit() can't be
+    // mixed with unfinished queued transactions
+    _WaitColorTransaction();
+
+    spi_transaction_t trConfig = 
+    {
+        .flags = 0,
+        .cmd = 0,
+        .addr = 0,
+        .length = 0,
+        .rxlength = 0,
+        .user = 0,
+        .tx_buffer = 0,
+        .rx_buffer = 0
+    };
+
+    if (cmd_size)
+    {
+        trConfig.length = cmd_size*8;
+        trConfig.tx_buffer = (void*)cmd;
+
+        if (_GpioDc != GPIO_NUM_NC)
+            gpio_set_level(_GpioDc, 0);
+
+        auto ret = _Bus->Transmit(&trConfig);
+        if (ret != ESP_OK) {
+            ESP_LOGD(TAG, "spi_device_transmit failed with rc=0x%x", ret);
+        }
+
+        if (_GpioDc != GPIO_NUM_NC)
+            gpio_set_level(_GpioDc, 1);
+    }
+
+    if (param_size)
+    {
+        trConfig.length = param_size*8;
+        trConfig.tx_buffer = (void*)param;
+
+        auto ret = _Bus->Transmit(&trConfig);
+        if (ret != ESP_OK) {    
+            ESP_LOGD(TAG, "spi_device_transmit failed with rc=0x%x", ret);
+        }       
+    }
+
+}
+
+void SpiMipiLvglDisplayDriver::_lv_lcd_send_color_cb(const uint8_t *cmd, size_t cmd_size, uint8_t *param, size_t param_size)
+{
+    // The memory write command is a single byte, only the pixels are worth sending in the background
+    _lv_lcd_send_cmd_cb(cmd, cmd_size, NULL, 0);
+
+    memset(&_ColorTransaction, 0, sizeof(_ColorTransaction));
+    _ColorTransaction.length = param_size*8;
+    _ColorTransaction.tx_buffer = param;
+    _ColorTransaction.user = _Display;
+
+    auto ret = _Bus->QueueTrans(&_ColorTransaction, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        ESP_LOGD(TAG, "spi_device_queue_trans failed with rc=0x%x", ret);
+        lv_display_flush_ready(_Display);
+        return;
+    }
+    _ColorTransactionQueued = true;
+    // flush ready is signalled by _SpiPostTransferCallback
+}
+
+void SpiMipiLvglDisplayDriver::_WaitColorTransaction()
+{
+    if (!_ColorTransactionQueued)
+        return;
+
+    spi_transaction_t* transaction;
+    auto ret = _Bus->GetTransResult(&transaction, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        ESP_LOGD(TAG, "spi_device_get_trans_result failed with rc=0x%x", ret);
+    }
+    _ColorTransactionQueued = false;
+}
+
+// Runs in the SPI interrupt.  With CONFIG_SPI_MASTER_ISR_IN_IRAM it runs even while the cache is disabled by flash
+// writes (NVS, journal), so instead of calling lv_display_flush_ready() from flash it clears the same flags itself.
+void IRAM_ATTR SpiMipiLvglDisplayDriver::_SpiPostTransferCallback(spi_transaction_t* transaction)
+{
+    lv_display_t* display = (lv_display_t*)transaction->user;
+    if (display != NULL)
+    {
+        display->flushing = 0;
+        display->flushing_last = 0;
+    }
+}
+
+// Called by LVGL when it needs a buffer which is still being sent.  Blocks on the transaction instead of spinning
+// on the flag, so the WiFi and MQTT tasks get the CPU meanwhile.
+void SpiMipiLvglDisplayDriver::_FlushWaitCallback(lv_display_t* display)
+{
+    SpiMipiLvglDisplayDriver* drv = (SpiMipiLvglDisplayDriver*)lv_display_get_user_data(display);
+    if (drv == NULL)
+        drv = _Active;
+    drv->_WaitColorTransaction();
+}
+
+void lv_lcd_send_cmd_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, const uint8_t * param, size_t param_size)
+{
+    //ESP_LOGI(TAG, "%s:%i:%i", __FUNCTION__, cmd_size, param_size);
+    SpiMipiLvglDisplayDriver* drv = (SpiMipiLvglDisplayDriver*)lv_display_get_user_data(disp);
+    if (drv == NULL)
+        drv = SpiMipiLvglDisplayDriver::_Active;
+    drv->_lv_lcd_send_cmd_cb(cmd, cmd_size, param, param_size);
+}
+
+void lv_lcd_send_color_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, uint8_t * param, size_t param_size)
+{
+    //ESP_LOGI(TAG, "%s:%i:%i", __FUNCTION__, cmd_size, param_size);
+    SpiMipiLvglDisplayDriver* drv = (SpiMipiLvglDisplayDriver*)lv_display_get_user_data(disp);
+    if (drv == NULL)
+        drv = SpiMipiLvglDisplayDriver::_Active;
+    drv->_lv_lcd_send_color_cb(cmd, cmd_size, param, param_size);
+}
+
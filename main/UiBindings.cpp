@@ -0,0 +1,172 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Arduino.h>
+#include "UiBindings.h"
+
+// True if the whole text is a number, surrounding white space allowed
+static bool _ParseNumber(const char* text, float& number)
+{
+    char* end;
+    number = strtof(text, &end);
+    if (end == text)
+        return false;
+    while (isspace((unsigned char)*end))
+        ++end;
+    return *end == '\0';
+}
+
+UiBindings::UiBindings()
+{
+    _SlotCount = 0;
+    _LastUpdate = 0;
+    memset(&_Stats, 0, sizeof(_Stats));
+}
+
+int UiBindings::Add(lv_obj_t* label, const char* unit)
+{
+    if (_SlotCount >= UI_MAX_SLOTS)
+        return -1;
+
+    Slot& slot = _Slots[_SlotCount];
+    memset(&slot, 0, sizeof(slot));
+    slot.Label = label;
+    slot.Unit = unit;
+    return _SlotCount++;
+}
+
+int UiBindings::Add(lv_obj_t* label, const UiEnumEntry* entries, size_t count)
+{
+    if (count == 0 || count > UINT8_MAX)
+        return -1;
+
+    const int ret = Add(label, NULL);
+    if (ret >= 0)
+    {
+        _Slots[ret].Entries = entries;
+        _Slots[ret].EntryCount = count;
+    }
+    return ret;
+}
+
+int UiBindings::AddTrend(lv_obj_t* canvas, Sparkline* trend)
+{
+    const int ret = Add(canvas, NULL);
+    if (ret >= 0)
+        _Slots[ret].Trend = trend;
+    return ret;
+}
+
+void UiBindings::SetValue(int slot, const char* value)
+{
+    if (slot < 0 || slot >= _SlotCount)
+        return;
+
+    Slot& s = _Slots[slot];
+    if (s.Trend != NULL)
+    {
+        char* end;
+        const float number = strtof(value, &end);
+        if (end != value)
+            SetValue(slot, number);
+        return;
+    }
+
+    ++_Stats.values;
+    if (s.Dirty)
+        ++_Stats.coalesced;
+
+    strncpy(s.Value, value, sizeof(s.Value) - 1);
+    s.Value[sizeof(s.Value) - 1] = '\0';
+    s.Dirty = true;
+}
+
+void UiBindings::SetValue(int slot, float value)
+{
+    if (slot >= 0 && slot < _SlotCount && _Slots[slot].Trend != NULL)
+    {
+        // each value is a column, none is coalesced
+        ++_Stats.values;
+        _Slots[slot].Trend->Add(value);
+        _Slots[slot].Dirty = true;
+        return;
+    }
+
+    char text[UI_VALUE_SIZE];
+    snprintf(text, sizeof(text), "%g", value);
+    SetValue(slot, text);
+}
+
+void UiBindings::Loop()
+{
+    const uint32_t now = millis();
+    if (now - _LastUpdate < UI_UPDATE_PERIOD_MS)
+        return;
+    _LastUpdate = now;
+
+    for (int i = 0; i < _SlotCount; ++i)
+    {
+        if (_Slots[i].Dirty)
+            _Apply(_Slots[i]);
+    }
+}
+
+void UiBindings::_Apply(Slot& slot)
+{
+    slot.Dirty = false;
+
+    if (slot.Trend != NULL)
+    {
+        // the new columns are drawn already
+        lv_obj_invalidate(slot.Label);
+        ++_Stats.applied;
+        return;
+    }
+
+    if (slot.Entries != NULL)
+    {
+        // Numbers match by value, so "2.0" or "2\n" select the entry of "2", other values by text
+        float number;
+        const bool isNumber = _ParseNumber(slot.Value, number);
+
+        const UiEnumEntry* entry = &slot.Entries[slot.EntryCount - 1];
+        for (int i = 0; i < slot.EntryCount - 1; ++i)
+        {
+            float entryNumber;
+            const bool matches = isNumber && _ParseNumber(slot.Entries[i].Value, entryNumber)
+                ? number == entryNumber
+                : strcmp(slot.Value, slot.Entries[i].Value) == 0;
+            if (matches)
+            {
+                entry = &slot.Entries[i];
+                break;
+            }
+        }
+
+        if (entry == slot.Entry)
+        {
+            ++_Stats.unchanged;
+            return;
+        }
+        slot.Entry = entry;
+        if (entry->HasColor)
+            lv_obj_set_style_text_color(slot.Label, entry->Color, LV_PART_MAIN | LV_STATE_DEFAULT);
+        lv_label_set_text_static(slot.Label, entry->Text);
+        ++_Stats.applied;
+        return;
+    }
+
+    char text[UI_TEXT_SIZE];
+    snprintf(text, sizeof(text), "%s%s", slot.Value, slot.Unit != NULL ? slot.Unit : "");
+    if (strcmp(text, slot.Text) == 0)
+    {
+        ++_Stats.unchanged;
+        return;
+    }
+
+    // The label points to the text of the slot, setting it again re-layouts the label
+    memcpy(slot.Text, text, sizeof(slot.Text));
+    lv_label_set_text_static(slot.Label, slot.Text);
+    ++_Stats.applied;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lvgl.h"
+
+#include "Sparkline.h"
+
+// Max labels bound to values
+#define UI_MAX_SLOTS                16
+// Latest value of a slot as received, e.g. "53.2", longer values are truncated
+#define UI_VALUE_SIZE               16
+// Text shown by a label, value and unit
+#define UI_TEXT_SIZE                24
+// Labels are updated at most this often, whatever the message rate
+#define UI_UPDATE_PERIOD_MS         100
+
+// Text and colour shown for one value of an enumeration, e.g. "2" -> "Charging" in blue
+struct UiEnumEntry
+{
+    const char* Value;
+    const char* Text;
+    lv_color_t Color;
+    bool HasColor;              // otherwise the colour of the label is left as it is
+};
+
+// Latest values of the dashboard, applied to the labels at a fixed rate.
+//
+// MQTT callbacks only copy the value into the preallocated slot of a label and mark it dirty.  Loop() runs every
+// UI_UPDATE_PERIOD_MS, formats the dirty slots and touches a label only if its text changed, so a burst of messages
+// costs one re-layout and invalidation per label and frame, and messages repeating the shown value cost none.  The
+// text is kept in the slot and set with lv_label_set_text_static(), nothing is allocated after Add().  Trends take
+// every value as it comes, since each is a column, but are invalidated at the same rate.
+//
+// Not thread safe, values are set by the callbacks of the broker, which run in the main loop like LVGL.
+class UiBindings
+{
+public:
+    struct Stats
+    {
+        unsigned long values;           // set by callbacks
+        unsigned long coalesced;        // overwritten before they were shown
+        unsigned long unchanged;        // formatted to the text already shown
+        unsigned long applied;          // label updates
+    };
+
+    UiBindings();
+
+    // Shows the value followed by the unit (may be NULL), returns the slot or -1 if there are UI_MAX_SLOTS already
+    int Add(lv_obj_t* label, const char* unit);
+    // Shows the text of the entry matching the value, or of the last entry (the default) if none does
+    int Add(lv_obj_t* label, const UiEnumEntry* entries, size_t count);
+    // Adds every value to the trend, which draws into the buffer of the canvas, the canvas is invalidated once per
+    // frame
+    int AddTrend(lv_obj_t* canvas, Sparkline* trend);
+
+    void SetValue(int slot, const char* value);
+    void SetValue(int slot, float value);
+
+    // Called by the main loop, applies the changed values at most every UI_UPDATE_PERIOD_MS
+    void Loop();
+
+    const Stats& GetStats() const { return _Stats; }
+
+private:
+    struct Slot
+    {
+        lv_obj_t* Label;                // or canvas of the trend
+        Sparkline* Trend;
+        const char* Unit;
+        const UiEnumEntry* Entries;
+        uint8_t EntryCount;
+        bool Dirty;
+        char Value[UI_VALUE_SIZE];
+        char Text[UI_TEXT_SIZE];
+        const UiEnumEntry* Entry;       // shown, NULL before the first value
+    };
+
+    void _Apply(Slot& slot);
+
+    Slot _Slots[UI_MAX_SLOTS];
+    int _SlotCount;
+    uint32_t _LastUpdate;
+    Stats _Stats;
+};
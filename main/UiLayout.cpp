@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "UiLayout.h"
+
+static const char *TAG = "UiLayout";
+
+#define UI_LAYOUT_SEPARATORS    " \t\r"
+
+static const char* _DefaultTable =
+    "label 0 40 L emkit/+/+/socofpack %\n"
+    "label 0 -40 L emkit/+/+/voltageofpack V\n"
+    "label 0 0 L emkit/+/+/currentofpack A\n"
+    "label 0 -140 M emkit/+/+/cellvmax V\n"
+    "label 0 -110 M emkit/+/+/celltmax °\n"
+    "label 0 140 M emkit/+/+/cellvmin V\n"
+    "label 0 110 M emkit/+/+/celltmin °\n"
+    "label 0 -80 M emkit/+/+/bmschstate - 0=Disable:00ff00,1=Waiting:00ff00,2=Charging:0000ff,3=Ballancing:00ff00,"
+        "4=Charged:00ff00,5=OverCool:00ff00,6=OverHeat:00ff00,*=Unknown:00ff00\n"
+    "label 0 77 M emkit/+/+/bmsdschstate - 0=Disable:00ff00,1=Waiting:00ff00,2=Discharging:0000ff,3=Stopped:00ff00,"
+        "4=Discharged:00ff00,5=OverCool:00ff00,6=OverHeat:00ff00,*=Unknown:00ff00\n"
+    "trend 94 -40 44x28 emkit/+/+/voltageofpack - 0000ff\n"
+    "trend 94 0 44x28 emkit/+/+/currentofpack - 0000ff\n"
+    "trend 94 40 44x28 emkit/+/+/socofpack 0:100 0000ff\n";
+
+static const lv_font_t* _GetFont(char font)
+{
+    switch (font)
+    {
+    case 'S':
+        return &lv_font_montserrat_14;
+    case 'M':
+        return &lv_font_montserrat_28;
+    default:
+        return &lv_font_montserrat_40;
+    }
+}
+
+UiLayout::UiLayout(UiBindings& bindings)
+    : _Bindings(bindings)
+{
+    _Table[0] = '\0';
+    _WidgetCount = 0;
+    _EntryCount = 0;
+    _TrendCount = 0;
+}
+
+const char* UiLayout::GetDefaultTable()
+{
+    return _DefaultTable;
+}
+
+int UiLayout::Load(const char* table)
+{
+    _WidgetCount = 0;
+    _EntryCount = 0;
+    _TrendCount = 0;
+    _Filters.clear();
+
+    if (strlen(table) >= sizeof(_Table))
+        ESP_LOGW(TAG, "The table is longer than %d bytes, the rest is ignored", UI_LAYOUT_MAX_SIZE - 1);
+    strncpy(_Table, table, sizeof(_Table) - 1);
+    _Table[sizeof(_Table) - 1] = '\0';
+
+    // The fields are terminated in place, the widgets point into _Table
+    int lineNumber = 0;
+    for (char* line = _Table; line != NULL; )
+    {
+        char* next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        ++lineNumber;
+
+        if (!_ParseLine(line))
+            ESP_LOGE(TAG, "Invalid widget at line %d", lineNumber);
+        line = next;
+    }
+
+    _Index.build(_Filters);
+    _Matches.reserve(_Filters.size());
+    ESP_LOGI(TAG, "%d widgets, %u topic filters", _WidgetCount, (unsigned)_Filters.size());
+    return _WidgetCount;
+}
+
+bool UiLayout::_ParseLine(char* line)
+{
+    char* save;
+    const char* type = strtok_r(line, UI_LAYOUT_SEPARATORS, &save);
+    if (type == NULL || type[0] == '#')
+        return true;    // empty line or comment
+
+    if (_WidgetCount >= UI_MAX_SLOTS)
+        return false;
+
+    Widget& widget = _Widgets[_WidgetCount];
+    memset(&widget, 0, sizeof(widget));
+    if (strcmp(type, "label") == 0)
+        widget.Type = Label;
+    else if (strcmp(type, "trend") == 0)
+        widget.Type = Trend;
+    else
+        return false;
+
+    const char* x = strtok_r(NULL, UI_LAYOUT_SEPARATORS, &save);
+    const char* y = strtok_r(NULL, UI_LAYOUT_SEPARATORS, &save);
+    const char* font = strtok_r(NULL, UI_LAYOUT_SEPARATORS, &save);      // or size of a trend
+    const char* filter = strtok_r(NULL, UI_LAYOUT_SEPARATORS, &save);
+    if (filter == NULL)
+        return false;
+
+    char* end;
+    widget.X = strtol(x, &end, 10);
+    if (*end != '\0')
+        return false;
+    widget.Y = strtol(y, &end, 10);
+    if (*end != '\0')
+        return false;
+
+    if (widget.Type == Trend)
+    {
+        if (!_ParseTrend(font, &save, widget))
+            return false;
+
+        const int filterIndex = _AddFilter(filter);
+        if (filterIndex < 0)
+            return false;
+        widget.Filter = filterIndex;
+
+        widget.Trend = _TrendCount++;
+        ++_WidgetCount;
+        return true;
+    }
+
+    if (strlen(font) != 1 || strchr("SML", font[0]) == NULL)
+        return false;
+    widget.Font = font[0];
+
+    const char* unit = strtok_r(NULL, UI_LAYOUT_SEPARATORS, &save);
+    if (unit != NULL && strcmp(unit, "-") != 0)
+        widget.Unit = unit;
+
+    // Entries of a line which turns out to be invalid are dropped with it
+    const int entryCount = _EntryCount;
+    char* map = strtok_r(NULL, UI_LAYOUT_SEPARATORS, &save);
+    if ((map != NULL && !_ParseEntries(map, widget)) || strtok_r(NULL, UI_LAYOUT_SEPARATORS, &save) != NULL)
+    {
+        _EntryCount = entryCount;
+        return false;
+    }
+
+    const int filterIndex = _AddFilter(filter);
+    if (filterIndex < 0)
+    {
+        _EntryCount = entryCount;
+        return false;
+    }
+    widget.Filter = filterIndex;
+
+    ++_WidgetCount;
+    return true;
+}
+
+bool UiLayout::_ParseEntries(char* map, Widget& widget)
+{
+    const int first = _EntryCount;
+    bool hasDefault = false;
+
+    char* save;
+    for (char* value = strtok_r(map, ",", &save); value != NULL; value = strtok_r(NULL, ",", &save))
+    {
+        // the default must be the last one
+        if (hasDefault || _EntryCount >= UI_LAYOUT_MAX_ENUM_ENTRIES)
+            return false;
+
+        char* text = strchr(value, '=');
+        if (text == NULL || text == value)
+            return false;
+        *text++ = '\0';
+
+        UiEnumEntry& entry = _Entries[_EntryCount++];
+        entry.Value = value;
+        entry.Text = text;
+        entry.HasColor = false;
+
+        char* color = strchr(text, ':');
+        if (color != NULL)
+        {
+            *color++ = '\0';
+            char* end;
+            const unsigned long rgb = strtoul(color, &end, 16);
+            if (*end != '\0' || end - color != 6)
+                return false;
+            entry.Color = lv_color_hex(rgb);
+            entry.HasColor = true;
+        }
+
+        hasDefault = strcmp(value, "*") == 0;
+    }
+
+    if (!hasDefault)
+    {
+        if (_EntryCount >= UI_LAYOUT_MAX_ENUM_ENTRIES)
+            return false;
+        UiEnumEntry& entry = _Entries[_EntryCount++];
+        entry.Value = "*";
+        entry.Text = "?";
+        entry.HasColor = false;
+    }
+
+    widget.Entries = &_Entries[first];
+    widget.EntryCount = _EntryCount - first;
+    return true;
+}
+
+bool UiLayout::_ParseTrend(const char* size, char** save, Widget& widget)
+{
+    if (_TrendCount >= UI_LAYOUT_MAX_TRENDS)
+        return false;
+
+    char* end;
+    const long width = strtol(size, &end, 10);
+    if (*end != 'x' || width < 2 || width > SPARKLINE_MAX_WIDTH)
+        return false;
+    const long height = strtol(end + 1, &end, 10);
+    if (*end != '\0' || height < 2 || height > SPARKLINE_MAX_HEIGHT)
+        return false;
+    widget.Width = width;
+    widget.Height = height;
+
+    // min >= max selects the automatic range
+    const char* range = strtok_r(NULL, UI_LAYOUT_SEPARATORS, save);
+    if (range != NULL && strcmp(range, "-") != 0)
+    {
+        widget.Min = strtof(range, &end);
+        if (end == range || *end != ':')
+            return false;
+        const char* max = end + 1;
+        widget.Max = strtof(max, &end);
+        if (end == max || *end != '\0' || widget.Min >= widget.Max)
+            return false;
+    }
+
+    widget.Color = UI_LAYOUT_TREND_COLOR;
+    const char* color = strtok_r(NULL, UI_LAYOUT_SEPARATORS, save);
+    if (color != NULL)
+    {
+        widget.Color = strtoul(color, &end, 16);
+        if (*end != '\0' || end - color != 6)
+            return false;
+    }
+
+    return strtok_r(NULL, UI_LAYOUT_SEPARATORS, save) == NULL;
+}
+
+int UiLayout::_AddFilter(const char* filter)
+{
+    for (size_t i = 0; i < _Filters.size(); ++i)
+    {
+        if (strcmp(_Filters.get_filter(i), filter) == 0)
+            return i;
+    }
+
+    _Filters.add(filter);
+    return _Filters.size() - 1;
+}
+
+void UiLayout::Create(PicoMQTT::Server& broker)
+{
+    // Trends are drawn on the background of the screen
+    const uint16_t background = lv_color_to_u16(lv_obj_get_style_bg_color(lv_screen_active(), LV_PART_MAIN));
+
+    for (int i = 0; i < _WidgetCount; ++i)
+    {
+        Widget& widget = _Widgets[i];
+
+        if (widget.Type == Trend)
+        {
+            Sparkline& trend = _Trends[widget.Trend];
+            trend.Init(widget.Width, widget.Height, lv_color_to_u16(lv_color_hex(widget.Color)), background,
+                widget.Min, widget.Max);
+
+            lv_obj_t* canvas = lv_canvas_create(lv_screen_active());
+            lv_canvas_set_buffer(canvas, trend.GetPixels(), widget.Width, widget.Height, LV_COLOR_FORMAT_RGB565);
+            lv_obj_align(canvas, LV_ALIGN_CENTER, widget.X, widget.Y);
+
+            widget.Slot = _Bindings.AddTrend(canvas, &trend);
+            continue;
+        }
+
+        lv_obj_t* label = lv_label_create(lv_screen_active());
+        lv_obj_set_style_text_font(label, _GetFont(widget.Font), 0);
+        // Until the first message large labels show dashes and the others are blank, as on the original screen
+        lv_label_set_text(label, widget.Font == 'L' ? "---" : "     ");
+        lv_obj_align(label, LV_ALIGN_CENTER, widget.X, widget.Y);
+
+        if (widget.Entries != NULL)
+            widget.Slot = _Bindings.Add(label, widget.Entries, widget.EntryCount);
+        else
+            widget.Slot = _Bindings.Add(label, widget.Unit);
+    }
+
+    // Widgets with the same filter share the subscription, so each gets a message once even if filters overlap
+    for (size_t filter = 0; filter < _Filters.size(); ++filter)
+    {
+        broker.subscribe(_Filters.get_filter(filter), [this, filter](const char* topic, const char* payload)
+        {
+            _Dispatch(filter, payload);
+        });
+    }
+}
+
+void UiLayout::OnValue(const char* topic, float value)
+{
+    _Matches.clear();
+    _Index.match(PicoMQTT::TopicTokens(topic), _Matches);
+    for (const uint32_t filter : _Matches)
+        _Dispatch(filter, value);
+}
+
+void UiLayout::_Dispatch(int filter, const char* value)
+{
+    for (int i = 0; i < _WidgetCount; ++i)
+    {
+        if (_Widgets[i].Filter == filter)
+            _Bindings.SetValue(_Widgets[i].Slot, value);
+    }
+}
+
+void UiLayout::_Dispatch(int filter, float value)
+{
+    for (int i = 0; i < _WidgetCount; ++i)
+    {
+        if (_Widgets[i].Filter == filter)
+            _Bindings.SetValue(_Widgets[i].Slot, value);
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "lvgl.h"
+#include "PicoMQTT.h"
+
+#include "Sparkline.h"
+#include "UiBindings.h"
+
+// Max size of the layout table, as saved in NVS
+#define UI_LAYOUT_MAX_SIZE          1024
+// Max entries of all enumeration maps together
+#define UI_LAYOUT_MAX_ENUM_ENTRIES  48
+// Max trends, each has its pixels preallocated (see Sparkline)
+#define UI_LAYOUT_MAX_TRENDS        4
+// Colour of trends without one
+#define UI_LAYOUT_TREND_COLOR       0x0000ff
+
+// Dashboard built from a table of widgets bound to topics, so the layout can be changed without reflashing.
+//
+// Each line of the table describes a widget, the fields are separated by spaces:
+//
+//     label <x> <y> <font> <topic filter> [<unit>|-] [<value>=<text>[:<rrggbb>],...[,*=<text>[:<rrggbb>]]]
+//     trend <x> <y> <width>x<height> <topic filter> [<min>:<max>|-] [<rrggbb>]
+//
+// The position is relative to the centre of the screen, the font is S, M or L.  A label shows the payload of the last
+// message matching the filter followed by the unit, or, with an enumeration map, the text (and colour) of the
+// matching value, numbers match by value (so "2.0" matches 2) and "*" matches the other values.  Before the first
+// message, L labels show "---" and the others are blank.  A trend draws a column per message, see Sparkline, in the
+// given range or one following the values.
+//
+// Load() parses the table once at boot into fixed size structs pointing into its own copy of the text.  Create()
+// makes the widgets and subscribes to each distinct filter once, messages go through a single dispatch to the slots
+// of UiBindings, which updates the labels at a fixed rate, so nothing is allocated per message.
+class UiLayout
+{
+public:
+    UiLayout(UiBindings& bindings);
+
+    // Parses the table, lines which are not valid are logged and skipped.  Returns the number of widgets.
+    int Load(const char* table);
+
+    // Creates the widgets on the active screen and subscribes to their topics
+    void Create(PicoMQTT::Server& broker);
+
+    // For values which don't come in a message of their own, e.g. the metrics of a packed BMS message
+    void OnValue(const char* topic, float value);
+
+    int GetWidgetCount() const { return _WidgetCount; }
+
+    // The built in layout, used if none is saved
+    static const char* GetDefaultTable();
+
+private:
+    enum WidgetType : uint8_t
+    {
+        Label,
+        Trend,
+    };
+
+    struct Widget
+    {
+        WidgetType Type;
+        char Font;
+        uint8_t Filter;             // index in _Filters, widgets with the same filter share it
+        uint8_t EntryCount;
+        int16_t X;
+        int16_t Y;
+        int16_t Slot;
+        const char* Unit;
+        const UiEnumEntry* Entries;
+        // trend
+        uint8_t Width;
+        uint8_t Height;
+        uint8_t Trend;              // index in _Trends
+        uint32_t Color;
+        float Min;
+        float Max;
+    };
+
+    bool _ParseLine(char* line);
+    bool _ParseEntries(char* map, Widget& widget);
+    bool _ParseTrend(const char* size, char** save, Widget& widget);
+    int _AddFilter(const char* filter);
+
+    void _Dispatch(int filter, const char* value);
+    void _Dispatch(int filter, float value);
+
+    UiBindings& _Bindings;
+    char _Table[UI_LAYOUT_MAX_SIZE];
+    Widget _Widgets[UI_MAX_SLOTS];
+    int _WidgetCount;
+    UiEnumEntry _Entries[UI_LAYOUT_MAX_ENUM_ENTRIES];
+    int _EntryCount;
+    Sparkline _Trends[UI_LAYOUT_MAX_TRENDS];
+    int _TrendCount;
+
+    // Distinct topic filters, indexed for OnValue()
+    PicoMQTT::TopicFilterSet _Filters;
+    PicoMQTT::TopicFilterIndex _Index;
+    std::vector<uint32_t> _Matches;
+};
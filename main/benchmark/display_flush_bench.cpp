@@ -0,0 +1,313 @@
+/*
+ * Host benchmark of the display flush of SpiMipiLvglDisplayDriver, blocking vs. queued DMA transfers.
+ *
+ * The flush code of the driver (SpiMipiLvglDisplayDriverFlush.cpp) runs as is, built with the minimal ESP-IDF and
+ * LVGL headers in host/.  Its SPI calls go through SpiMipiBus, implemented here by SpiStandIn: like the DMA, the wire
+ * doesn't need the CPU, each transaction is scheduled when it's queued, to start when the previous one ends and to
+ * take the time its bits need at the clock of the display, and a thread completes it at that time and calls the post
+ * transfer callback of the driver.  It records when each transfer was queued, started and finished, and how long the
+ * CPU waited for the SPI.
+ *
+ * A frame is rendered in bands of 1/10 of the screen like LVGL does in partial mode, each band costs a fixed CPU time
+ * and is flushed like lv_lcd_generic_mipi does, with CASET and RASET through the command callback of the driver and
+ * RAMWR with the pixels through its color callback:
+ *   - blocking: one buffer and a stand-in which completes each transaction before returning, i.e. the flush is ready
+ *     when the color callback returns (the previous driver),
+ *   - queued: two buffers, the pixels are queued, the post transfer callback clears the flushing flag and LVGL only
+ *     waits (in the flush wait callback of the driver) when it needs the buffer which is still on the wire.
+ * For each mode, the frame time, the time the CPU spent waiting for the SPI and the utilization of the wire are
+ * printed, and the transfers of the last frame with -v.
+ *
+ * Build:
+ *   g++ -O2 -std=gnu++17 -pthread -Ihost -I.. -o display_flush_bench display_flush_bench.cpp \
+ *       ../SpiMipiLvglDisplayDriverFlush.cpp
+ * Run:
+ *   ./display_flush_bench [render us per band] [SPI clock Hz] [-v]
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SpiMipiLvglDisplayDriver.h"
+
+// The callbacks the driver gives to lv_lcd_generic_mipi
+void lv_lcd_send_cmd_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, const uint8_t * param, size_t param_size);
+void lv_lcd_send_color_cb(lv_display_t * disp, const uint8_t * cmd, size_t cmd_size, uint8_t * param, size_t param_size);
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Same resolution and buffer as the driver
+const size_t HRes = 240;
+const size_t VRes = 320;
+const size_t BufferDivider = 10;
+const size_t BandSize = HRes * VRes / BufferDivider * 2;
+
+struct SpiTransferRecord
+{
+    size_t Bytes;
+    double Queued;          // us since the start of the recording
+    double Started;
+    double Finished;
+};
+
+class SpiStandIn : public SpiMipiBus
+{
+public:
+    // A blocking stand-in completes each transaction before QueueTrans() returns
+    SpiStandIn(unsigned long clockSpeedHz, bool blocking)
+        : _ClockSpeedHz(clockSpeedHz), _Blocking(blocking), _PostCallback(SpiMipiLvglDisplayDriver::GetPostTransferCallback()),
+          _Stop(false), _Start(Clock::now()), _WireFree(_Start), _WaitTime(0), _Wire([this]() { _Run(); })
+    {
+    }
+
+    ~SpiStandIn()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+            _Stop = true;
+        }
+        _Changed.notify_all();
+        _Wire.join();
+    }
+
+    esp_err_t QueueTrans(spi_transaction_t* transaction, TickType_t) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+            const Clock::time_point now = Clock::now();
+            const Clock::time_point start = now > _WireFree ? now : _WireFree;
+            _WireFree = start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>((double)transaction->length / _ClockSpeedHz));
+            _Records.push_back({transaction->length / 8, _Since(now), _Since(start), _Since(_WireFree)});
+            _Queued.push_back({transaction, _WireFree});
+        }
+        _Changed.notify_all();
+
+        if (_Blocking)
+            _WaitUntilFinished(transaction);
+        return ESP_OK;
+    }
+
+    esp_err_t GetTransResult(spi_transaction_t** transaction, TickType_t) override
+    {
+        const auto start = Clock::now();
+        std::unique_lock<std::mutex> lock(_Mutex);
+        _Changed.wait(lock, [this]() { return !_Done.empty(); });
+        *transaction = _Done.front();
+        _Done.pop_front();
+        _WaitTime += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        return ESP_OK;
+    }
+
+    esp_err_t Transmit(spi_transaction_t* transaction) override
+    {
+        // polled like spi_device_transmit(), without the post callback of queued transactions
+        spi_transaction_t polled = *transaction;
+        polled.user = NULL;
+        QueueTrans(&polled, portMAX_DELAY);
+        spi_transaction_t* done;
+        return GetTransResult(&done, portMAX_DELAY);
+    }
+
+    void StartRecording()
+    {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        _Records.clear();
+        _Start = Clock::now();
+        _WaitTime = 0;
+    }
+
+    std::vector<SpiTransferRecord> GetRecords()
+    {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        return _Records;
+    }
+
+    // Time the CPU was blocked by the SPI since StartRecording(), in us
+    double GetWaitTime()
+    {
+        std::lock_guard<std::mutex> lock(_Mutex);
+        return _WaitTime;
+    }
+
+private:
+    struct Item
+    {
+        spi_transaction_t* Transaction;
+        Clock::time_point Finished;
+    };
+
+    double _Since(Clock::time_point time) const
+    {
+        return std::chrono::duration<double, std::micro>(time - _Start).count();
+    }
+
+    void _WaitUntilFinished(spi_transaction_t* transaction)
+    {
+        const auto start = Clock::now();
+        std::unique_lock<std::mutex> lock(_Mutex);
+        _Changed.wait(lock, [this, transaction]()
+        {
+            for (const Item& item : _Queued)
+            {
+                if (item.Transaction == transaction)
+                    return false;
+            }
+            return _Current != transaction;
+        });
+        _WaitTime += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+
+    void _Run()
+    {
+        std::unique_lock<std::mutex> lock(_Mutex);
+        while (true)
+        {
+            _Changed.wait(lock, [this]() { return _Stop || !_Queued.empty(); });
+            if (_Stop)
+                return;
+
+            const Item item = _Queued.front();
+            _Queued.pop_front();
+            _Current = item.Transaction;
+
+            lock.unlock();
+            std::this_thread::sleep_until(item.Finished);
+            if (item.Transaction->user != NULL)
+                _PostCallback(item.Transaction);
+            lock.lock();
+
+            _Current = NULL;
+            _Done.push_back(item.Transaction);
+            _Changed.notify_all();
+        }
+    }
+
+    const unsigned long _ClockSpeedHz;
+    const bool _Blocking;
+    const transaction_cb_t _PostCallback;
+    std::mutex _Mutex;
+    std::condition_variable _Changed;
+    std::deque<Item> _Queued;
+    spi_transaction_t* _Current = NULL;
+    std::deque<spi_transaction_t*> _Done;
+    std::vector<SpiTransferRecord> _Records;
+    bool _Stop;
+    Clock::time_point _Start;
+    Clock::time_point _WireFree;
+    double _WaitTime;
+    std::thread _Wire;
+};
+
+// wait_for_flushing() of LVGL
+void WaitForFlushing(lv_display_t* display)
+{
+    if (display->flush_wait_cb != NULL)
+    {
+        if (display->flushing)
+            display->flush_wait_cb(display);
+        display->flushing = 0;
+    }
+    while (display->flushing)
+        ;
+    display->flushing_last = 0;
+}
+
+// The flush callback of lv_lcd_generic_mipi
+void Flush(lv_display_t* display, uint8_t* pixels, size_t size)
+{
+    static const uint8_t caset[] = {0x2a};
+    static const uint8_t raset[] = {0x2b};
+    static const uint8_t ramwr[] = {0x2c};
+    static const uint8_t window[] = {0, 0, 0, 0};
+
+    lv_lcd_send_cmd_cb(display, caset, sizeof(caset), window, sizeof(window));
+    lv_lcd_send_cmd_cb(display, raset, sizeof(raset), window, sizeof(window));
+    lv_lcd_send_color_cb(display, ramwr, sizeof(ramwr), pixels, size);
+}
+
+void Render(uint8_t* buffer, double microseconds)
+{
+    // busy, like the CPU drawing the band
+    const auto end = Clock::now() + std::chrono::duration<double, std::micro>(microseconds);
+    uint8_t value = 0;
+    while (Clock::now() < end)
+    {
+        for (size_t i = 0; i < BandSize; i += 64)
+            buffer[i] = value++;
+    }
+}
+
+void Measure(const char* name, bool queued, double renderUs, unsigned long clockSpeedHz, bool verbose)
+{
+    static uint8_t buffers[2][BandSize];
+    const int frames = 5;
+
+    lv_display_t display = {};
+    SpiStandIn spi(clockSpeedHz, !queued);
+    SpiMipiLvglDisplayDriver driver(spi, GPIO_NUM_NC, &display);
+
+    double frameUs = 0;
+    double waitUs = 0;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        spi.StartRecording();
+        const auto start = Clock::now();
+        for (size_t band = 0; band < BufferDivider; ++band)
+        {
+            uint8_t* buffer = buffers[queued ? band % 2 : 0];
+            // with one buffer LVGL waits before rendering into it again
+            if (!queued)
+                WaitForFlushing(&display);
+            Render(buffer, renderUs);
+            // draw_buf_flush(): waits for the previous flush, then flushes the band
+            WaitForFlushing(&display);
+            display.flushing = 1;
+            display.flushing_last = band == BufferDivider - 1;
+            Flush(&display, buffer, BandSize);
+        }
+        WaitForFlushing(&display);
+        frameUs += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        waitUs += spi.GetWaitTime();
+    }
+
+    const std::vector<SpiTransferRecord> records = spi.GetRecords();
+    double wireUs = 0;
+    for (const auto& record : records)
+        wireUs += record.Finished - record.Started;
+
+    frameUs /= frames;
+    printf("%-9s frame %8.0f us, CPU waiting for SPI %8.0f us/frame, wire busy %5.1f%%\n", name, frameUs,
+           waitUs / frames, 100 * wireUs / frameUs);
+
+    if (verbose)
+    {
+        printf("  %8s %10s %10s %10s\n", "bytes", "queued", "started", "finished");
+        for (const auto& record : records)
+            printf("  %8zu %10.0f %10.0f %10.0f\n", record.Bytes, record.Queued, record.Started, record.Finished);
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const double renderUs = argc > 1 ? atof(argv[1]) : 5000;
+    const unsigned long clockSpeedHz = argc > 2 ? atol(argv[2]) : 12 * 1000 * 1000;
+    const bool verbose = argc > 3 && !strcmp(argv[3], "-v");
+
+    printf("%zu bands of %zu bytes, render %.0f us per band, SPI clock %lu Hz (%.0f us per band)\n", BufferDivider,
+           BandSize, renderUs, clockSpeedHz, BandSize * 8 * 1e6 / clockSpeedHz);
+    Measure("blocking", false, renderUs, clockSpeedHz, verbose);
+    Measure("queued", true, renderUs, clockSpeedHz, verbose);
+    return 0;
+}
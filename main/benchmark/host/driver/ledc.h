@@ -0,0 +1,6 @@
+#pragma once
+
+typedef struct
+{
+    int channel;
+} ledc_channel_config_t;
@@ -0,0 +1,27 @@
+#pragma once
+
+// Minimal ESP-IDF and LVGL headers for building SpiMipiLvglDisplayDriverFlush.cpp on a PC, see display_flush_bench.cpp
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct _lv_display_t lv_display_t;
+typedef void (*lv_display_flush_wait_cb_t)(lv_display_t* display);
+
+// The fields of lv_display_t used by the flush, with the same semantics
+struct _lv_display_t
+{
+    volatile int flushing;
+    volatile int flushing_last;
+    lv_display_flush_wait_cb_t flush_wait_cb;
+    void* user_data;
+};
+
+inline void lv_display_set_flush_wait_cb(lv_display_t* display, lv_display_flush_wait_cb_t callback) { display->flush_wait_cb = callback; }
+inline void lv_display_set_user_data(lv_display_t* display, void* userData) { display->user_data = userData; }
+inline void* lv_display_get_user_data(lv_display_t* display) { return display->user_data; }
+
+inline void lv_display_flush_ready(lv_display_t* display)
+{
+    display->flushing = 0;
+    display->flushing_last = 0;
+}
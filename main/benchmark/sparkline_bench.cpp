@@ -0,0 +1,171 @@
+/*
+ * Host benchmark of Sparkline, the trend widget of the dashboard.
+ *
+ * First, the incremental drawing (scroll by a column, draw the new segment) is checked against a reference which
+ * redraws the whole line from the samples, after every sample of a random walk with a fixed range, and the automatic
+ * range is checked to show a column for every sample.
+ *
+ * Then the cost per sample is measured for the sizes of the default layout and the largest one: the incremental
+ * drawing vs. redrawing the whole line, as a chart widget does on every new point.  Both invalidate the whole widget,
+ * so the SPI cost is the same and is computed for the clock of the display: the bytes of the area, sent once per
+ * frame of UiBindings however many samples arrived, plus the window commands.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I.. -o sparkline_bench sparkline_bench.cpp ../Sparkline.cpp
+ * Run:
+ *   ./sparkline_bench [samples] [SPI clock Hz]
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "Sparkline.h"
+
+namespace {
+
+const uint16_t Color = 0x001f;
+const uint16_t Background = 0xffff;
+
+// The whole line from the last samples, like a chart does
+void DrawReference(const std::vector<float>& samples, int width, int height, float min, float max, uint16_t* pixels)
+{
+    for (int i = 0; i < width * height; ++i)
+        pixels[i] = Background;
+
+    // the first column joins the sample before it, which scrolled out
+    const size_t count = samples.size() < (size_t)width ? samples.size() : width;
+    int lastY = -1;
+    for (size_t i = samples.size() > count ? 0 : 1; i <= count; ++i)
+    {
+        const float value = samples[samples.size() - count + i - 1];
+        int y = (height - 1) - lroundf((value - min) * (height - 1) / (max - min));
+        y = y < 0 ? 0 : y >= height ? height - 1 : y;
+        if (i > 0)
+        {
+            const int x = width - count + i - 1;
+            const int from = lastY < 0 ? y : lastY;
+            for (int row = from < y ? from : y; row <= (from < y ? y : from); ++row)
+                pixels[row * width + x] = Color;
+        }
+        lastY = y;
+    }
+}
+
+bool Check()
+{
+    const int width = 48;
+    const int height = 28;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> step(-2, 2);
+
+    Sparkline sparkline;
+    sparkline.Init(width, height, Color, Background, 40, 60);
+    std::vector<float> samples;
+    std::vector<uint16_t> reference(width * height);
+    float value = 50;
+    for (int i = 0; i < 500; ++i)
+    {
+        // also beyond the range, clamped to the edges
+        value += step(random);
+        samples.push_back(value);
+        sparkline.Add(value);
+        DrawReference(samples, width, height, 40, 60, reference.data());
+        if (memcmp(reference.data(), sparkline.GetPixels(), reference.size() * sizeof(uint16_t)) != 0)
+        {
+            printf("FAILED: fixed range differs from the reference after %d samples\n", i + 1);
+            return false;
+        }
+    }
+
+    Sparkline automatic;
+    automatic.Init(width, height, Color, Background, 0, 0);
+    for (int i = 0; i < 500; ++i)
+    {
+        value += step(random) * 10;
+        automatic.Add(value);
+
+        // every sample shown has a pixel in its column, clamped or not
+        int columns = 0;
+        for (int x = 0; x < width; ++x)
+        {
+            for (int y = 0; y < height; ++y)
+            {
+                if (automatic.GetPixels()[y * width + x] == Color)
+                {
+                    ++columns;
+                    break;
+                }
+            }
+        }
+        if (columns != (i < width ? i + 1 : width))
+        {
+            printf("FAILED: automatic range shows %d columns after %d samples\n", columns, i + 1);
+            return false;
+        }
+    }
+    printf("automatic range: %lu samples, %lu full redraws\n", automatic.GetStats().Samples,
+           automatic.GetStats().Redraws);
+    return true;
+}
+
+void Measure(int width, int height, unsigned long samples, unsigned long clockSpeedHz)
+{
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> distribution(40, 60);
+    std::vector<float> values(4096);
+    for (float& value : values)
+        value = distribution(random);
+
+    Sparkline sparkline;
+    sparkline.Init(width, height, Color, Background, 40, 60);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < samples; ++i)
+        sparkline.Add(values[i % values.size()]);
+    const double incrementalNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+        .count() / samples;
+
+    std::vector<float> history;
+    std::vector<uint16_t> pixels(width * height);
+    const unsigned long redraws = samples / 10;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < redraws; ++i)
+    {
+        if (history.size() == (size_t)width)
+            history.erase(history.begin());
+        history.push_back(values[i % values.size()]);
+        DrawReference(history, width, height, 40, 60, pixels.data());
+    }
+    const double redrawNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+        .count() / redraws;
+
+    // CASET, RASET and RAMWR with their parameters, then the pixels
+    const size_t bytes = width * height * 2 + 11;
+    const double spiUs = bytes * 8 * 1e6 / clockSpeedHz;
+    printf("%2dx%-2d incremental %7.1f ns/sample, full redraw %8.1f ns/sample, SPI %5zu bytes %7.1f us/frame"
+           " (%.2f%% of the wire for a sample per second)\n", width, height, incrementalNs, redrawNs, bytes, spiUs,
+           spiUs / 1e4);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned long samples = argc > 1 ? atol(argv[1]) : 1000000;
+    const unsigned long clockSpeedHz = argc > 2 ? atol(argv[2]) : 12 * 1000 * 1000;
+
+    if (!Check())
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    Measure(44, 28, samples, clockSpeedHz);
+    Measure(SPARKLINE_MAX_WIDTH, SPARKLINE_MAX_HEIGHT, samples, clockSpeedHz);
+    printf("OK\n");
+    return 0;
+}
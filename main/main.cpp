@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <atomic>
 #include <lvgl.h>
 #include <font/lv_font.h>
 #include "freertos/FreeRTOS.h"
@@ -15,7 +16,16 @@
 #include "PicoMQTT.h"
 
 #include "SpiMipiLvglDisplayDriver.h"
+#include "BmsValues.h"
+#include "UiBindings.h"
+#include "UiLayout.h"
 #include "NvsSettingsAccessor.h"
+#include "MqttAggregation.h"
+#include "MqttAlarms.h"
+#include "MqttBroker.h"
+#include "MqttBridge.h"
+#include "MqttJournal.h"
+#include "MqttTimeSeries.h"
 
 #include "esp_console.h"
 #include "esp_system.h"
@@ -25,6 +35,47 @@ static const char *TAG = "MAIN";
 #define DEFAULT_WIFI_SSID       "TestWiFi"
 #define DEFAULT_WIFI_PWD        "12345678"
 
+// Admission control of the broker: beyond these, new clients get "server unavailable"
+#define MQTT_MAX_CLIENTS        16
+#define MQTT_MIN_FREE_HEAP      (32 * 1024)
+
+// Interval of broker statistics published under $SYS/broker/
+#define MQTT_SYS_INTERVAL_MS    30000
+
+// Persistent sessions kept by the broker (and saved in the journal)
+#define MQTT_MAX_SESSIONS       16
+
+// Queue of messages published from other tasks (console, bridge) until the main loop sends them
+#define MQTT_ASYNC_QUEUE_SIZE   4096
+#define MQTT_ASYNC_WAIT_MS      20
+
+// History of the pack voltage, current and SOC, per pack: 60 raw samples, 30 min of 10 s buckets, 4 h of 1 min buckets
+#define MQTT_TIMESERIES_PACKS           1
+#define MQTT_TIMESERIES_RAW_SIZE        60
+#define MQTT_TIMESERIES_10S_SIZE        180
+#define MQTT_TIMESERIES_1M_SIZE         240
+
+// Aggregates published by the broker to <topic>/<function>/<window>, see MqttAggregation
+static const char* _AggregationRules[] =
+{
+    "avg(emkit/+/+/currentofpack, 10s)",
+    "avg(emkit/+/+/voltageofpack, 10s)",
+    "max(emkit/+/+/cellvmax, 1m)",
+    "min(emkit/+/+/cellvmin, 1m)",
+};
+
+// Alarms published by the broker to alarms/<name>/<topic>, see MqttAlarms
+static const MqttAlarmRule _AlarmRules[] =
+{
+    { "cell_overvoltage", "emkit/+/+/cellvmax", "value > 3.65" },
+    { "cell_undervoltage", "emkit/+/+/cellvmin", "value < 2.8" },
+    { "cell_overtemp", "emkit/+/+/celltmax", "value > 55" },
+    { "cell_undertemp", "emkit/+/+/celltmin", "value < 0" },
+    { "charge_overheat", "emkit/+/+/bmschstate", "value == 6 for 5s" },
+    { "discharge_overheat", "emkit/+/+/bmsdschstate", "value == 6 for 5s" },
+    { "low_soc", "emkit/+/+/socofpack", "value < 10 for 30s" },
+};
+
 #define ELMB_LCD_HOST  SPI2_HOST
 #define ELMB_LCD_PIXEL_CLOCK_HZ     (12 * 1000 * 1000)
 #define ELMB_PIN_NUM_SCLK           GPIO_NUM_7
@@ -42,8 +93,25 @@ void _StartMqttBrocker();
 void _StartWiFi();
 void _CreateUI();
 void _LoadSettings();
+void _PrintMemoryReport();
 
-PicoMQTT::Server _Mqtt;
+MqttBroker _Mqtt;
+MqttBridge _MqttBridge;
+MqttJournal _MqttJournal(_Mqtt, _MqttBridge);
+MqttTimeSeries _MqttTimeSeries(_Mqtt);
+MqttAggregation _MqttAggregation(_Mqtt);
+MqttAlarms _MqttAlarms(_Mqtt);
+
+// Values shown by the dashboard, applied to the labels by the main loop at a fixed rate
+UiBindings _UiBindings;
+// Widgets of the dashboard and their topics, from NVS or the default table
+UiLayout _UiLayout(_UiBindings);
+
+// Set by the console task, the report is printed by the main loop which owns the broker
+std::atomic<bool> _MemoryReportRequested(false);
+
+// Task running the main loop, notified when messages are published from other tasks
+TaskHandle_t _MainTask = NULL;
 
 const char* _SsIdName = DEFAULT_WIFI_SSID;
 const char* _SsIdPwd = DEFAULT_WIFI_PWD;
@@ -53,6 +121,8 @@ extern "C" void app_main()
 {
     ESP_LOGI(TAG, "->main");
 
+    _MainTask = xTaskGetCurrentTaskHandle();
+
     _LoadSettings(); 
 
     //Init SPI common driver for LVGL and SD card if used
@@ -76,10 +146,18 @@ extern "C" void app_main()
 
     ESP_LOGI(TAG, "->while");
     while (1) {
-        vTaskDelay(pdMS_TO_TICKS(1));
+        // Woken up early by messages published from other tasks
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1));
 
+        _UiBindings.Loop();
         lv_timer_handler();
         _Mqtt.loop();
+        _MqttJournal.Loop();
+        _MqttAggregation.Loop();
+        _MqttAlarms.Loop();
+
+        if (_MemoryReportRequested.exchange(false))
+            _PrintMemoryReport();
 
         //if (random(1000) == 0)
         //    _Mqtt.publish("picomqtt/welcome", "Hello from PicoMQTT!");
@@ -111,6 +189,9 @@ void _LoadSettings()
         _SsIdPwd = NvsSettingsAccessor::GetPwd();
         _SsIdMode = NvsSettingsAccessor::GetConnectionMode();
     }
+    _MqttBridge.Configure(NvsSettingsAccessor::GetMqtt());
+    const char* uiLayout = NvsSettingsAccessor::GetUiLayout();
+    _UiLayout.Load(uiLayout != NULL && *uiLayout ? uiLayout : UiLayout::GetDefaultTable());
     NvsSettingsAccessor::DeInit();
 }
 
@@ -156,6 +237,161 @@ int OnSetSSID(int argc, char **argv)
     return 0;
 }
 
+int OnSetMqtt(int argc, char **argv)
+{
+    if (argc < 2) {
+
+        printf("Broker clients %u/%u, rejected: max clients %lu, low memory %lu, free heap %lu\n",
+            (unsigned)_Mqtt.get_client_count(), (unsigned)_Mqtt.max_clients, _Mqtt.rejected_max_clients, _Mqtt.rejected_low_memory,
+            (unsigned long)ESP.getFreeHeap());
+
+        auto asyncStats = _Mqtt.get_async_stats();
+        printf("Async publish: enqueued %lu, dropped full %lu, too big %lu, high water %u/%u\n",
+            asyncStats.enqueued, asyncStats.dropped_full, asyncStats.dropped_too_big,
+            (unsigned)asyncStats.high_water, (unsigned)MQTT_ASYNC_QUEUE_SIZE);
+
+        if (_MqttJournal.IsStarted())
+        {
+            auto journalStats = _MqttJournal.GetStats();
+            printf("Journal: sessions %u, sectors %u/%u, appended %lu, dropped %lu, commits %lu, written %lu, erased %lu, checkpoints %lu\n",
+                (unsigned)_Mqtt.get_sessions().size(), (unsigned)_MqttJournal.GetUsedSectors(), (unsigned)_MqttJournal.GetSectorCount(),
+                journalStats.appended, journalStats.dropped, journalStats.commits, journalStats.bytes_written,
+                journalStats.sectors_erased, journalStats.checkpoints);
+        }
+
+        auto alarmStats = _MqttAlarms.GetStats();
+        printf("Alarms: rules %u, raised %lu, cleared %lu, messages %lu\n",
+            (unsigned)_MqttAlarms.GetRuleCount(), alarmStats.raised, alarmStats.cleared, alarmStats.messages);
+
+        if (_MqttBridge.IsConfigured())
+        {
+            auto stats = _MqttBridge.GetStats();
+            printf("MQTT=%s:%u; QUEUED=%u\n", _MqttBridge.GetHost(), _MqttBridge.GetPort(), _MqttBridge.GetQueuedBytes());
+            printf("Enqueued %lu, dropped %lu, oversized %lu, sent %lu, resent %lu, acked %lu, reconnects %lu\n",
+                stats.Enqueued, stats.Dropped, stats.Oversized, stats.Sent, stats.Resent, stats.Acked, stats.Reconnects);
+        }
+        else
+        {
+            printf("MQTT bridge is not configured\n");
+        }
+
+        printf("Usage: MQTT <HOST[:PORT][;FILTER,...]>\n");
+        printf("\tDefault filter: %s, \"-\" disables the bridge\n", MQTT_BRIDGE_DEFAULT_FILTER);
+        return 1;
+    }
+
+    const char *mqtt = strcmp(argv[1], "-") == 0 ? "" : argv[1];
+    printf("Setting MQTT bridge to '%s'\n", mqtt);
+
+    NvsSettingsAccessor::Init4Write();        
+
+    NvsSettingsAccessor::SetMqtt(mqtt);
+
+    NvsSettingsAccessor::DeInit();
+
+    printf("Restart device for apply changes\n");
+
+    return 0;
+}
+
+int OnUi(int argc, char **argv)
+{
+    if (argc < 2) {
+
+        NvsSettingsAccessor::Init4Read();        
+
+        auto layout = NvsSettingsAccessor::GetUiLayout();
+        const bool saved = layout != NULL && *layout;
+
+        printf("%s layout, %d widgets:\n%s\n", saved ? "Saved" : "Default", _UiLayout.GetWidgetCount(), saved ? layout : UiLayout::GetDefaultTable());
+
+        NvsSettingsAccessor::DeInit();
+
+        printf("Usage: UI ADD <WIDGET>\n");
+        printf("\t<WIDGET>: label <X> <Y> <S|M|L> <TOPIC FILTER> [<UNIT>|-] [<VALUE>=<TEXT>[:<RRGGBB>],...]\n");
+        printf("\t          trend <X> <Y> <W>x<H> <TOPIC FILTER> [<MIN>:<MAX>|-] [<RRGGBB>]\n");
+        printf("\tThe first widget added replaces the default layout, UI - restores it\n");
+        return 1;
+    }
+
+    NvsSettingsAccessor::Init4Write();        
+
+    if (strcmp(argv[1], "-") == 0)
+    {
+        printf("Restoring the default layout\n");
+        NvsSettingsAccessor::SetUiLayout("");
+    }
+    else if (strcmp(argv[1], "ADD") == 0 && argc > 2)
+    {
+        // The saved layout and the new widget, the fields joined with spaces again
+        static char layout[UI_LAYOUT_MAX_SIZE];
+        auto saved = NvsSettingsAccessor::GetUiLayout();
+        size_t size = snprintf(layout, sizeof(layout), "%s%s", saved != NULL ? saved : "", saved != NULL && *saved ? "\n" : "");
+        const size_t widget = size;
+        for (int i = 2; i < argc && size < sizeof(layout); ++i)
+            size += snprintf(layout + size, sizeof(layout) - size, i > 2 ? " %s" : "%s", argv[i]);
+
+        if (size >= sizeof(layout))
+        {
+            printf("The layout would be longer than %d bytes\n", UI_LAYOUT_MAX_SIZE - 1);
+            NvsSettingsAccessor::DeInit();
+            return 1;
+        }
+        printf("Adding '%s'\n", layout + widget);
+        NvsSettingsAccessor::SetUiLayout(layout);
+    }
+    else
+    {
+        printf("Unknown UI command '%s'\n", argv[1]);
+        NvsSettingsAccessor::DeInit();
+        return 1;
+    }
+
+    NvsSettingsAccessor::DeInit();
+
+    printf("Restart device for apply changes\n");
+
+    return 0;
+}
+
+int OnPub(int argc, char **argv)
+{
+    if (argc < 3) {
+        printf("Usage: PUB <TOPIC> <PAYLOAD>\n");
+        return 1;
+    }
+
+    // The console runs in its own task, the message is sent by the main loop
+    if (!_Mqtt.publish_async(argv[1], argv[2]))
+    {
+        printf("Message dropped, the publish queue is full\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int OnMem(int argc, char **argv)
+{
+    _MemoryReportRequested = true;
+    return 0;
+}
+
+void _PrintMemoryReport()
+{
+    _Mqtt.update_memory_usage();
+
+    printf("Free heap %lu, low water %lu\n", (unsigned long)ESP.getFreeHeap(), (unsigned long)_Mqtt.get_heap_low_water());
+    printf("Clients %u, compacted %u\n", (unsigned)_Mqtt.get_client_count(), (unsigned)_Mqtt.get_compacted_client_count());
+    for (const auto& account : _Mqtt.memory.get_accounts())
+        printf("%-10s %8u bytes, high water %8u\n", account.name, (unsigned)account.current, (unsigned)account.high_water);
+    printf("%-10s %8u bytes, high water %8u\n", "total", (unsigned)_Mqtt.memory.get_total(), (unsigned)_Mqtt.memory.get_total_high_water());
+
+    printf("Top clients:\n");
+    for (const auto* client : _Mqtt.get_top_memory_clients(5))
+        printf("  %-24s %6u bytes, high water %6u\n", client->get_client_id(), (unsigned)client->get_memory_usage(), (unsigned)client->get_memory_high_water());
+}
+
 void _CreateConsoleCommands()
 {
     esp_console_repl_t *repl = NULL;
@@ -174,9 +410,45 @@ void _CreateConsoleCommands()
         .argtable = NULL
     };
 
+    static esp_console_cmd_t mqttCmd = {
+        .command = "MQTT",
+        .help = "Set upstream MQTT broker for the bridge",
+        .hint = NULL,
+        .func = OnSetMqtt,
+        .argtable = NULL
+    };
+
+    static esp_console_cmd_t memCmd = {
+        .command = "MEM",
+        .help = "Show memory usage of the broker, bridge queue and UI",
+        .hint = NULL,
+        .func = OnMem,
+        .argtable = NULL
+    };
+
+    static esp_console_cmd_t uiCmd = {
+        .command = "UI",
+        .help = "Show or change the layout of the dashboard",
+        .hint = NULL,
+        .func = OnUi,
+        .argtable = NULL
+    };
+
+    static esp_console_cmd_t pubCmd = {
+        .command = "PUB",
+        .help = "Publish a message to the local broker",
+        .hint = NULL,
+        .func = OnPub,
+        .argtable = NULL
+    };
+
     /* Register commands */
     esp_console_register_help_command();
     esp_console_cmd_register(&cmd);
+    esp_console_cmd_register(&mqttCmd);
+    esp_console_cmd_register(&memCmd);
+    esp_console_cmd_register(&pubCmd);
+    esp_console_cmd_register(&uiCmd);
     //register_system_common();
 
     esp_console_dev_usb_serial_jtag_config_t hw_config = ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
@@ -234,170 +506,75 @@ void _StartMqttBrocker()
 
     _Mqtt.keep_alive_tolerance_millis = 20000;
     _Mqtt.socket_timeout_millis = 15000;
+    _Mqtt.max_clients = MQTT_MAX_CLIENTS;
+    _Mqtt.max_sessions = MQTT_MAX_SESSIONS;
+    _Mqtt.min_free_heap = MQTT_MIN_FREE_HEAP;
+    _Mqtt.sys_interval_millis = MQTT_SYS_INTERVAL_MS;
+    _Mqtt.async_queue_size = MQTT_ASYNC_QUEUE_SIZE;
+    _Mqtt.async_wait_millis = MQTT_ASYNC_WAIT_MS;
+    _Mqtt.async_wakeup = []() { xTaskNotifyGive(_MainTask); };
+
+    // Other subsystems are reported together with the broker's own "clients" and "routing" accounts
+    _Mqtt.memory.add("queues", []() { return _MqttBridge.GetQueuedBytes(); });
+    _Mqtt.memory.add("timeseries", []() { return _MqttTimeSeries.GetMemoryUsage(); });
+    _Mqtt.memory.add("aggregates", []() { return _MqttAggregation.GetMemoryUsage(); });
+    _Mqtt.memory.add("alarms", []() { return _MqttAlarms.GetMemoryUsage(); });
+    _Mqtt.memory.add("ui", []()
+    {
+        lv_mem_monitor_t monitor;
+        lv_mem_monitor(&monitor);
+        return (size_t)(monitor.total_size - monitor.free_size);
+    });
+
+    _Mqtt.SetBridge(&_MqttBridge);
+
+    // Queried over timeseries/query/<id>, see MqttTimeSeries
+    _MqttTimeSeries.Add("emkit/+/+/voltageofpack", MQTT_TIMESERIES_PACKS, MQTT_TIMESERIES_RAW_SIZE, MQTT_TIMESERIES_10S_SIZE, MQTT_TIMESERIES_1M_SIZE);
+    _MqttTimeSeries.Add("emkit/+/+/currentofpack", MQTT_TIMESERIES_PACKS, MQTT_TIMESERIES_RAW_SIZE, MQTT_TIMESERIES_10S_SIZE, MQTT_TIMESERIES_1M_SIZE);
+    _MqttTimeSeries.Add("emkit/+/+/socofpack", MQTT_TIMESERIES_PACKS, MQTT_TIMESERIES_RAW_SIZE, MQTT_TIMESERIES_10S_SIZE, MQTT_TIMESERIES_1M_SIZE);
+    _MqttTimeSeries.Begin();
+    _Mqtt.SetTimeSeries(&_MqttTimeSeries);
+
+    for (const char* rule : _AggregationRules)
+        _MqttAggregation.Add(rule);
+    _Mqtt.SetAggregation(&_MqttAggregation);
+
+    for (const MqttAlarmRule& rule : _AlarmRules)
+        _MqttAlarms.Add(rule);
+    _Mqtt.SetAlarms(&_MqttAlarms);
+
+    // Restores persistent sessions and messages which were waiting for the uplink before the restart
+    if (_MqttJournal.Begin())
+        _Mqtt.SetJournal(&_MqttJournal);
 
     _Mqtt.begin();
 
+    // Forwards matching messages to the upstream broker in its own task
+    _MqttBridge.Start();
+
 
     ESP_LOGI(TAG, "MQTT broker started.");
 }
 
 void _CreateUI()
 {
-    static lv_font_t _LargeFont = lv_font_montserrat_40;
-    static lv_font_t _MidFont = lv_font_montserrat_28;
-    static lv_font_t _SmallFont = lv_font_montserrat_14;
-
-    static lv_obj_t * labelSoc = lv_label_create(lv_screen_active());
-    lv_obj_set_style_text_font(labelSoc, &_LargeFont, 0);    
-    lv_label_set_text(labelSoc, "---");
-    lv_obj_align(labelSoc, LV_ALIGN_CENTER, 0, 40);
-    _Mqtt.subscribe("emkit/+/+/socofpack", [](const char * topic, const char * payload) {
-            std::string payloadStr(payload);
-            payloadStr+="%";
-            lv_label_set_text(labelSoc, payloadStr.c_str());
-        });    
-
-    static lv_obj_t * labelBatVoltage = lv_label_create(lv_screen_active());
-    lv_obj_set_style_text_font(labelBatVoltage, &_LargeFont, 0);    
-    lv_label_set_text(labelBatVoltage, "---");
-    lv_obj_align(labelBatVoltage, LV_ALIGN_CENTER, 0, -40);
-    _Mqtt.subscribe("emkit/+/+/voltageofpack", [](const char * topic, const char * payload) {
-            std::string payloadStr(payload);
-            payloadStr+="V";
-            lv_label_set_text(labelBatVoltage, payloadStr.c_str());
-        });    
-
-    static lv_obj_t * labelBatCurrent = lv_label_create(lv_screen_active());
-    lv_obj_set_style_text_font(labelBatCurrent, &_LargeFont, 0);    
-    lv_label_set_text(labelBatCurrent, "---");
-    lv_obj_align(labelBatCurrent, LV_ALIGN_CENTER, 0, 0);
-    _Mqtt.subscribe("emkit/+/+/currentofpack", [](const char * topic, const char * payload) {
-            std::string payloadStr(payload);
-            payloadStr+="A";
-            lv_label_set_text(labelBatCurrent, payloadStr.c_str());
-        });    
-
-    static lv_obj_t * labelMaxCellVoltage = lv_label_create(lv_screen_active());
-    lv_obj_set_style_text_font(labelMaxCellVoltage, &_MidFont, 0);    
-    lv_label_set_text(labelMaxCellVoltage, "     ");
-    lv_obj_align(labelMaxCellVoltage, LV_ALIGN_CENTER, 0, -140);
-    _Mqtt.subscribe("emkit/+/+/cellvmax", [](const char * topic, const char * payload) {
-            std::string payloadStr(payload);
-            payloadStr+="V";
-            lv_label_set_text(labelMaxCellVoltage, payloadStr.c_str());
-        });    
-
-    static lv_obj_t * labelMaxCellTemp = lv_label_create(lv_screen_active());
-    lv_obj_set_style_text_font(labelMaxCellTemp, &_MidFont, 0);    
-    lv_label_set_text(labelMaxCellTemp, "     ");
-    lv_obj_align(labelMaxCellTemp, LV_ALIGN_CENTER, 0, -110);
-    _Mqtt.subscribe("emkit/+/+/celltmax", [](const char * topic, const char * payload) {
-            std::string payloadStr(payload);
-            payloadStr+="°";
-            lv_label_set_text(labelMaxCellTemp, payloadStr.c_str());
-        });    
-
-
-    static lv_obj_t * labelMinCellVoltage = lv_label_create(lv_screen_active());
-    lv_obj_set_style_text_font(labelMinCellVoltage, &_MidFont, 0);    
-    lv_label_set_text(labelMinCellVoltage, "     ");
-    lv_obj_align(labelMinCellVoltage, LV_ALIGN_CENTER, 0, 140);
-    _Mqtt.subscribe("emkit/+/+/cellvmin", [](const char * topic, const char * payload) {
-            std::string payloadStr(payload);
-            payloadStr+="V";
-            lv_label_set_text(labelMinCellVoltage, payloadStr.c_str());
-        });    
-
-    static lv_obj_t * labelMinCellTemp = lv_label_create(lv_screen_active());
-    lv_obj_set_style_text_font(labelMinCellTemp, &_MidFont, 0);    
-    lv_label_set_text(labelMinCellTemp, "     ");
-    lv_obj_align(labelMinCellTemp, LV_ALIGN_CENTER, 0, 110);
-    _Mqtt.subscribe("emkit/+/+/celltmin", [](const char * topic, const char * payload) {
-            std::string payloadStr(payload);
-            payloadStr+="°";
-            lv_label_set_text(labelMinCellTemp, payloadStr.c_str());
-        });            
-
-    static lv_obj_t * labelChargeState = lv_label_create(lv_screen_active());
-    static int _LastrChargeState = -1;
-    lv_obj_set_style_text_font(labelChargeState, &_MidFont, 0);    
-    lv_label_set_text(labelChargeState, "     ");
-    lv_obj_align(labelChargeState, LV_ALIGN_CENTER, 0, -80);
-    _Mqtt.subscribe("emkit/+/+/bmschstate", [](const char * topic, const char * payload) {
-            if (_LastrChargeState != payload[0])
-            {
-                _LastrChargeState = payload[0];
-                lv_obj_set_style_text_color(labelChargeState, lv_color_make(0, 255, 0), LV_PART_MAIN | LV_STATE_DEFAULT);
-                switch (payload[0])
-                {
-                case '0':
-                    lv_label_set_text(labelChargeState, "Disable");
-                    break;
-                case '1':
-                    lv_label_set_text(labelChargeState, "Waiting");
-                    break;
-                case '2':
-                    lv_obj_set_style_text_color(labelChargeState, lv_color_make(0, 0, 255), LV_PART_MAIN | LV_STATE_DEFAULT);
-                    lv_label_set_text(labelChargeState, "Charging");
-                    break;
-                case '3':
-                    lv_label_set_text(labelChargeState, "Ballancing");
-                    break;
-                case '4':
-                    lv_label_set_text(labelChargeState, "Charged");
-                    break;
-                case '5':
-                    lv_label_set_text(labelChargeState, "OverCool");
-                    break;
-                case '6':
-                    lv_label_set_text(labelChargeState, "OverHeat");
-                    break;
-                default:
-                    lv_label_set_text(labelChargeState, "Unknown");
-                    break;
-                }
-            }
-        });            
-
-    static lv_obj_t * labelDischargeState = lv_label_create(lv_screen_active());
-    static int _LastrDischargeState = -1;
-    lv_obj_set_style_text_font(labelDischargeState, &_MidFont, 0);    
-    lv_label_set_text(labelDischargeState, "     ");
-    lv_obj_align(labelDischargeState, LV_ALIGN_CENTER, 0, 77);
-    _Mqtt.subscribe("emkit/+/+/bmsdschstate", [](const char * topic, const char * payload) {
-            if (_LastrDischargeState != payload[0])
+    // Widgets of the layout table, bound to the per-metric topics
+    _UiLayout.Create(_Mqtt);
+
+    // One message per BMS cycle with all metrics, decoded straight from the packet and shown as if each metric came
+    // on its own topic
+    _Mqtt.subscribe("emkit/+/+/" BMS_PACKED_TOPIC_NAME, [](char * topic, PicoMQTT::IncomingPacket & packet) {
+            BmsValues values;
+            values.Decode(packet);
+
+            char metricTopic[PICOMQTT_MAX_TOPIC_SIZE + 1];
+            for (int m = 0; m < BmsValues::MetricCount; ++m)
             {
-                lv_obj_set_style_text_color(labelDischargeState, lv_color_make(0, 255, 0), LV_PART_MAIN | LV_STATE_DEFAULT);
-                _LastrDischargeState = payload[0];
-                switch (payload[0])
-                {
-                case '0':
-                    lv_label_set_text(labelDischargeState, "Disable");
-                    break;
-                case '1':
-                    lv_label_set_text(labelDischargeState, "Waiting");
-                    break;
-                case '2':
-                    lv_obj_set_style_text_color(labelDischargeState, lv_color_make(0, 0, 255), LV_PART_MAIN | LV_STATE_DEFAULT);
-                    lv_label_set_text(labelDischargeState, "Discharging");
-                    break;
-                case '3':
-                    lv_label_set_text(labelDischargeState, "Stopped");
-                    break;
-                case '4':
-                    lv_label_set_text(labelDischargeState, "Discharged");
-                    break;
-                case '5':
-                    lv_label_set_text(labelDischargeState, "OverCool");
-                    break;
-                case '6':
-                    lv_label_set_text(labelDischargeState, "OverHeat");
-                    break;
-                default:
-                    lv_label_set_text(labelDischargeState, "Unknown");
-                    break;
-                }
+                const BmsValues::Metric metric = (BmsValues::Metric)m;
+                if (!values.Has(metric))
+                    continue;
+                BmsValues::GetMetricTopic(topic, metric, metricTopic, sizeof(metricTopic));
+                _UiLayout.OnValue(metricTopic, values.Get(metric));
             }
-        });            
-
+        });
 }